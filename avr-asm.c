@@ -0,0 +1,1150 @@
+/*
+ *  AVR specific functions for TCC assembler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tcc.h"
+
+/* The syntax is the one of avr-as: registers r0..r31, pointers X, Y
+   and Z, '.+k' for relative jumps, ';' comments and the lo8(), hi8(),
+   hh8(), hhi8() and pm() modifiers of the immediates */
+
+/* operand formats */
+enum {
+    OPF_NONE,       /* no operand */
+    OPF_RD,         /* Rd */
+    OPF_RD_DUP,     /* Rd, encoded as Rd, Rd */
+    OPF_RD_RR,      /* Rd, Rr */
+    OPF_RD16,       /* Rd (r16-r31) */
+    OPF_RD16_K,     /* Rd (r16-r31), K */
+    OPF_RD16_NK,    /* Rd (r16-r31), K, encoded with ~K */
+    OPF_RD16_RR16,  /* Rd, Rr (r16-r31) */
+    OPF_RD16_RR23,  /* Rd, Rr (r16-r23) */
+    OPF_MOVW,       /* Rd+1:Rd, Rr+1:Rr */
+    OPF_ADIW,       /* Rd (r24, r26, r28 or r30), K (0-63) */
+    OPF_BRANCH,     /* k (-64..63 words) */
+    OPF_BRBX,       /* s, k (-64..63 words) */
+    OPF_RJMP,       /* k (-2048..2047 words) */
+    OPF_JMP,        /* k (22 bits word address) */
+    OPF_S,          /* s */
+    OPF_RD_B,       /* Rd, b */
+    OPF_A_B,        /* A (0-31), b */
+    OPF_IN,         /* Rd, A (0-63) */
+    OPF_OUT,        /* A (0-63), Rr */
+    OPF_LDS,        /* Rd, k */
+    OPF_STS,        /* k, Rr */
+    OPF_LD,         /* Rd, X|X+|-X|Y|Y+|-Y|Z|Z+|-Z */
+    OPF_ST,         /* X|X+|-X|Y|Y+|-Y|Z|Z+|-Z, Rr */
+    OPF_LDD,        /* Rd, Y+q|Z+q */
+    OPF_STD,        /* Y+q|Z+q, Rr */
+    OPF_LPM,        /* [Rd, Z|Z+] */
+    OPF_SPM,        /* [Z+] */
+    OPF_Z_RD,       /* Z, Rd */
+    OPF_K4,         /* K (0-15) */
+};
+
+typedef struct ASMInstr {
+    uint16_t sym;
+    uint16_t opcode;
+    uint16_t format;
+    uint16_t flags; /* AVR_HAVE_xxx needed by the instruction */
+} ASMInstr;
+
+static const ASMInstr asm_instrs[] = {
+    /* arithmetic and logic */
+    { TOK_ASM_add, 0x0C00, OPF_RD_RR, 0 },
+    { TOK_ASM_adc, 0x1C00, OPF_RD_RR, 0 },
+    { TOK_ASM_adiw, 0x9600, OPF_ADIW, 0 },
+    { TOK_ASM_sub, 0x1800, OPF_RD_RR, 0 },
+    { TOK_ASM_subi, 0x5000, OPF_RD16_K, 0 },
+    { TOK_ASM_sbc, 0x0800, OPF_RD_RR, 0 },
+    { TOK_ASM_sbci, 0x4000, OPF_RD16_K, 0 },
+    { TOK_ASM_sbiw, 0x9700, OPF_ADIW, 0 },
+    { TOK_ASM_and, 0x2000, OPF_RD_RR, 0 },
+    { TOK_ASM_andi, 0x7000, OPF_RD16_K, 0 },
+    { TOK_ASM_or, 0x2800, OPF_RD_RR, 0 },
+    { TOK_ASM_ori, 0x6000, OPF_RD16_K, 0 },
+    { TOK_ASM_eor, 0x2400, OPF_RD_RR, 0 },
+    { TOK_ASM_com, 0x9400, OPF_RD, 0 },
+    { TOK_ASM_neg, 0x9401, OPF_RD, 0 },
+    { TOK_ASM_sbr, 0x6000, OPF_RD16_K, 0 },
+    { TOK_ASM_cbr, 0x7000, OPF_RD16_NK, 0 },
+    { TOK_ASM_inc, 0x9403, OPF_RD, 0 },
+    { TOK_ASM_dec, 0x940A, OPF_RD, 0 },
+    { TOK_ASM_tst, 0x2000, OPF_RD_DUP, 0 },
+    { TOK_ASM_clr, 0x2400, OPF_RD_DUP, 0 },
+    { TOK_ASM_ser, 0xEF0F, OPF_RD16, 0 },
+    { TOK_ASM_mul, 0x9C00, OPF_RD_RR, AVR_HAVE_MUL },
+    { TOK_ASM_muls, 0x0200, OPF_RD16_RR16, AVR_HAVE_MUL },
+    { TOK_ASM_mulsu, 0x0300, OPF_RD16_RR23, AVR_HAVE_MUL },
+    { TOK_ASM_fmul, 0x0308, OPF_RD16_RR23, AVR_HAVE_MUL },
+    { TOK_ASM_fmuls, 0x0380, OPF_RD16_RR23, AVR_HAVE_MUL },
+    { TOK_ASM_fmulsu, 0x0388, OPF_RD16_RR23, AVR_HAVE_MUL },
+    { TOK_ASM_des, 0x940B, OPF_K4, AVR_HAVE_XMEGA },
+
+    /* branches */
+    { TOK_ASM_rjmp, 0xC000, OPF_RJMP, 0 },
+    { TOK_ASM_ijmp, 0x9409, OPF_NONE, 0 },
+    { TOK_ASM_eijmp, 0x9419, OPF_NONE, AVR_HAVE_EIJMP_EICALL },
+    { TOK_ASM_jmp, 0x940C, OPF_JMP, AVR_HAVE_JMP_CALL },
+    { TOK_ASM_rcall, 0xD000, OPF_RJMP, 0 },
+    { TOK_ASM_icall, 0x9509, OPF_NONE, 0 },
+    { TOK_ASM_eicall, 0x9519, OPF_NONE, AVR_HAVE_EIJMP_EICALL },
+    { TOK_ASM_call, 0x940E, OPF_JMP, AVR_HAVE_JMP_CALL },
+    { TOK_ASM_ret, 0x9508, OPF_NONE, 0 },
+    { TOK_ASM_reti, 0x9518, OPF_NONE, 0 },
+    { TOK_ASM_cpse, 0x1000, OPF_RD_RR, 0 },
+    { TOK_ASM_cp, 0x1400, OPF_RD_RR, 0 },
+    { TOK_ASM_cpc, 0x0400, OPF_RD_RR, 0 },
+    { TOK_ASM_cpi, 0x3000, OPF_RD16_K, 0 },
+    { TOK_ASM_sbrc, 0xFC00, OPF_RD_B, 0 },
+    { TOK_ASM_sbrs, 0xFE00, OPF_RD_B, 0 },
+    { TOK_ASM_sbic, 0x9900, OPF_A_B, 0 },
+    { TOK_ASM_sbis, 0x9B00, OPF_A_B, 0 },
+    { TOK_ASM_brbs, 0xF000, OPF_BRBX, 0 },
+    { TOK_ASM_brbc, 0xF400, OPF_BRBX, 0 },
+    { TOK_ASM_breq, 0xF001, OPF_BRANCH, 0 },
+    { TOK_ASM_brne, 0xF401, OPF_BRANCH, 0 },
+    { TOK_ASM_brcs, 0xF000, OPF_BRANCH, 0 },
+    { TOK_ASM_brcc, 0xF400, OPF_BRANCH, 0 },
+    { TOK_ASM_brsh, 0xF400, OPF_BRANCH, 0 },
+    { TOK_ASM_brlo, 0xF000, OPF_BRANCH, 0 },
+    { TOK_ASM_brmi, 0xF002, OPF_BRANCH, 0 },
+    { TOK_ASM_brpl, 0xF402, OPF_BRANCH, 0 },
+    { TOK_ASM_brge, 0xF404, OPF_BRANCH, 0 },
+    { TOK_ASM_brlt, 0xF004, OPF_BRANCH, 0 },
+    { TOK_ASM_brhs, 0xF005, OPF_BRANCH, 0 },
+    { TOK_ASM_brhc, 0xF405, OPF_BRANCH, 0 },
+    { TOK_ASM_brts, 0xF006, OPF_BRANCH, 0 },
+    { TOK_ASM_brtc, 0xF406, OPF_BRANCH, 0 },
+    { TOK_ASM_brvs, 0xF003, OPF_BRANCH, 0 },
+    { TOK_ASM_brvc, 0xF403, OPF_BRANCH, 0 },
+    { TOK_ASM_brie, 0xF007, OPF_BRANCH, 0 },
+    { TOK_ASM_brid, 0xF407, OPF_BRANCH, 0 },
+
+    /* data transfer */
+    { TOK_ASM_mov, 0x2C00, OPF_RD_RR, 0 },
+    { TOK_ASM_movw, 0x0100, OPF_MOVW, AVR_HAVE_MOVW },
+    { TOK_ASM_ldi, 0xE000, OPF_RD16_K, 0 },
+    { TOK_ASM_ld, 0x0000, OPF_LD, 0 },
+    { TOK_ASM_ldd, 0x8000, OPF_LDD, 0 },
+    { TOK_ASM_lds, 0x9000, OPF_LDS, 0 },
+    { TOK_ASM_st, 0x0200, OPF_ST, 0 },
+    { TOK_ASM_std, 0x8200, OPF_STD, 0 },
+    { TOK_ASM_sts, 0x9200, OPF_STS, 0 },
+    { TOK_ASM_lpm, 0x95C8, OPF_LPM, 0 },
+    { TOK_ASM_elpm, 0x95D8, OPF_LPM, AVR_HAVE_ELPM },
+    { TOK_ASM_spm, 0x95E8, OPF_SPM, 0 },
+    { TOK_ASM_in, 0xB000, OPF_IN, 0 },
+    { TOK_ASM_out, 0xB800, OPF_OUT, 0 },
+    { TOK_ASM_push, 0x920F, OPF_RD, 0 },
+    { TOK_ASM_pop, 0x900F, OPF_RD, 0 },
+    { TOK_ASM_xch, 0x9204, OPF_Z_RD, AVR_HAVE_XMEGA },
+    { TOK_ASM_las, 0x9205, OPF_Z_RD, AVR_HAVE_XMEGA },
+    { TOK_ASM_lac, 0x9206, OPF_Z_RD, AVR_HAVE_XMEGA },
+    { TOK_ASM_lat, 0x9207, OPF_Z_RD, AVR_HAVE_XMEGA },
+
+    /* bit and bit-test */
+    { TOK_ASM_lsl, 0x0C00, OPF_RD_DUP, 0 },
+    { TOK_ASM_lsr, 0x9406, OPF_RD, 0 },
+    { TOK_ASM_rol, 0x1C00, OPF_RD_DUP, 0 },
+    { TOK_ASM_ror, 0x9407, OPF_RD, 0 },
+    { TOK_ASM_asr, 0x9405, OPF_RD, 0 },
+    { TOK_ASM_swap, 0x9402, OPF_RD, 0 },
+    { TOK_ASM_bset, 0x9408, OPF_S, 0 },
+    { TOK_ASM_bclr, 0x9488, OPF_S, 0 },
+    { TOK_ASM_sbi, 0x9A00, OPF_A_B, 0 },
+    { TOK_ASM_cbi, 0x9800, OPF_A_B, 0 },
+    { TOK_ASM_bst, 0xFA00, OPF_RD_B, 0 },
+    { TOK_ASM_bld, 0xF800, OPF_RD_B, 0 },
+    { TOK_ASM_sec, 0x9408, OPF_NONE, 0 },
+    { TOK_ASM_clc, 0x9488, OPF_NONE, 0 },
+    { TOK_ASM_sez, 0x9418, OPF_NONE, 0 },
+    { TOK_ASM_clz, 0x9498, OPF_NONE, 0 },
+    { TOK_ASM_sen, 0x9428, OPF_NONE, 0 },
+    { TOK_ASM_cln, 0x94A8, OPF_NONE, 0 },
+    { TOK_ASM_sev, 0x9438, OPF_NONE, 0 },
+    { TOK_ASM_clv, 0x94B8, OPF_NONE, 0 },
+    { TOK_ASM_ses, 0x9448, OPF_NONE, 0 },
+    { TOK_ASM_cls, 0x94C8, OPF_NONE, 0 },
+    { TOK_ASM_seh, 0x9458, OPF_NONE, 0 },
+    { TOK_ASM_clh, 0x94D8, OPF_NONE, 0 },
+    { TOK_ASM_set, 0x9468, OPF_NONE, 0 },
+    { TOK_ASM_clt, 0x94E8, OPF_NONE, 0 },
+    { TOK_ASM_sei, 0x9478, OPF_NONE, 0 },
+    { TOK_ASM_cli, 0x94F8, OPF_NONE, 0 },
+
+    /* MCU control */
+    { TOK_ASM_nop, 0x0000, OPF_NONE, 0 },
+    { TOK_ASM_sleep, 0x9588, OPF_NONE, 0 },
+    { TOK_ASM_wdr, 0x95A8, OPF_NONE, 0 },
+    { TOK_BREAK, 0x9598, OPF_NONE, 0 },
+    { 0, },
+};
+
+/* modifiers of the immediates, see asm_parse_imm() */
+#define MOD_LO8  1
+#define MOD_HI8  2
+#define MOD_HH8  3
+#define MOD_HHI8 4
+#define MOD_PM   8 /* word address of program memory */
+
+/* relocations of 'ldi' and the other Rd, K instructions by modifier */
+static const uint8_t ldi_relocs[16] = {
+    R_AVR_LDI, R_AVR_LO8_LDI, R_AVR_HI8_LDI, R_AVR_HH8_LDI, R_AVR_MS8_LDI,
+    0, 0, 0,
+    0, R_AVR_LO8_LDI_PM, R_AVR_HI8_LDI_PM, R_AVR_HH8_LDI_PM, 0,
+};
+
+static int asm_parse_reg(void)
+{
+    int reg;
+
+    if (tok >= TOK_ASM_r0 && tok <= TOK_ASM_r31)
+        reg = tok - TOK_ASM_r0;
+    else if (tok == TOK_ASM_tmp_reg)
+        reg = TMP_REG;
+    else if (tok == TOK_ASM_zero_reg)
+        reg = ZERO_REG;
+    else
+        expect("register");
+    next();
+    return reg;
+}
+
+/* parse a register in [min, max] */
+static int asm_parse_reg_range(int min, int max)
+{
+    int reg;
+
+    reg = asm_parse_reg();
+    if (reg < min || reg > max)
+        tcc_error("register r%d-r%d expected", min, max);
+    return reg;
+}
+
+/* parse an expression with its modifier: lo8(e), hi8(e), hh8(e) or
+   hlo8(e), hhi8(e), pm(e) or gs(e) and their combinations. The
+   modifier is applied to the constants, 0 being returned for them */
+static int asm_parse_imm(TCCState *s1, ExprValue *pe)
+{
+    int mod;
+
+    switch(tok) {
+    case TOK_ASM_lo8:
+        mod = MOD_LO8;
+        break;
+    case TOK_ASM_hi8:
+        mod = MOD_HI8;
+        break;
+    case TOK_ASM_hlo8:
+    case TOK_ASM_hh8:
+        mod = MOD_HH8;
+        break;
+    case TOK_ASM_hhi8:
+        mod = MOD_HHI8;
+        break;
+    case TOK_ASM_pm_lo8:
+        mod = MOD_PM | MOD_LO8;
+        break;
+    case TOK_ASM_pm_hi8:
+        mod = MOD_PM | MOD_HI8;
+        break;
+    case TOK_ASM_pm_hh8:
+        mod = MOD_PM | MOD_HH8;
+        break;
+    case TOK_ASM_pm:
+    case TOK_ASM_gs:
+        mod = MOD_PM;
+        break;
+    /* I/O addresses of avr-libc */
+    case TOK_ASM_SREG:
+        pe->v = IO_SREG;
+        goto io;
+    case TOK_ASM_SP_H:
+        pe->v = IO_SPH;
+        goto io;
+    case TOK_ASM_SP_L:
+        pe->v = IO_SPL;
+        goto io;
+    case TOK_ASM_RAMPZ:
+        pe->v = 0x3B;
+    io:
+        pe->sym = NULL;
+        next();
+        return 0;
+    default:
+        asm_expr(s1, pe);
+        return 0;
+    }
+    next();
+    skip('(');
+    if (!(mod & MOD_PM) && (tok == TOK_ASM_pm || tok == TOK_ASM_gs)) {
+        next();
+        skip('(');
+        asm_expr(s1, pe);
+        skip(')');
+        mod |= MOD_PM;
+    } else {
+        asm_expr(s1, pe);
+    }
+    skip(')');
+    if (pe->sym)
+        return mod;
+    if (mod & MOD_PM)
+        pe->v >>= 1;
+    switch(mod & ~MOD_PM) {
+    case MOD_LO8:
+        pe->v &= 0xFF;
+        break;
+    case MOD_HI8:
+        pe->v = (pe->v >> 8) & 0xFF;
+        break;
+    case MOD_HH8:
+        pe->v = (pe->v >> 16) & 0xFF;
+        break;
+    case MOD_HHI8:
+        pe->v = (pe->v >> 24) & 0xFF;
+        break;
+    }
+    return 0;
+}
+
+/* parse an immediate in [min, max]. A symbol is relocated at 'offset'
+   of the instruction with 'type', R_AVR_LDI selecting the relocation
+   of the modifier */
+static int asm_parse_field(TCCState *s1, int min, int max, int type,
+                           int offset)
+{
+    ExprValue e;
+    int mod;
+
+    mod = asm_parse_imm(s1, &e);
+    if (e.sym) {
+        if (type == R_AVR_LDI)
+            type = ldi_relocs[mod];
+        else if (mod)
+            type = 0;
+        if (!type)
+            tcc_error("invalid relocation of '%s'",
+                      get_tok_str(e.sym->v, NULL));
+        greloca(e.sym, ind + offset, type, e.v);
+        return 0;
+    }
+    if ((int)e.v < min || (int)e.v > max)
+        tcc_error("operand %d out of range [%d, %d]", (int)e.v, min, max);
+    return e.v;
+}
+
+/* parse the target of a relative jump. Return the displacement in
+   bytes from the next instruction or emit the relocation 'type' */
+static int asm_parse_rel(TCCState *s1, int type)
+{
+    ExprValue e;
+    Sym *sym;
+
+    if (tok == '.') {
+        /* '.+k' of avr-gcc and avr-objdump: 'brne .+2' skips a word,
+           'rjmp .-2' loops forever */
+        next();
+        e.v = 0;
+        if (tok == '+' || tok == '-')
+            e.v = asm_int_expr(s1);
+        return e.v;
+    }
+    asm_expr(s1, &e);
+    sym = e.sym;
+    if (!sym)
+        tcc_error("jump to an absolute address, use '.+k'");
+    if (sym->r == cur_text_section->sh_num) {
+        /* label already defined in this section */
+        return sym->jnext + e.v - ind - 2;
+    }
+    if (sym->type.t == VT_VOID) {
+        sym->type.t = VT_FUNC;
+        sym->type.ref = NULL;
+    }
+    greloca(sym, ind, type, e.v);
+    return 0;
+}
+
+/* parse X, X+, -X, Y, Y+, -Y, Z, Z+ or -Z: return the encoding of ld
+   and st */
+static int asm_parse_ptr(void)
+{
+    int pre, code;
+
+    pre = 0;
+    if (tok == '-') {
+        next();
+        pre = 1;
+    }
+    if (tok == TOK_ASM_X || tok == TOK_ASM_x)
+        code = 0x900C;
+    else if (tok == TOK_ASM_Y || tok == TOK_ASM_y)
+        code = 0x8008;
+    else if (tok == TOK_ASM_Z || tok == TOK_ASM_z)
+        code = 0x8000;
+    else
+        expect("X, Y or Z");
+    next();
+    if (pre) {
+        code = (code | 0x1000) + 2;
+    } else if (tok == '+') {
+        next();
+        code = (code | 0x1000) + 1;
+    }
+    return code;
+}
+
+/* parse Y+q or Z+q: return the encoding of ldd and std */
+static int asm_parse_disp(TCCState *s1)
+{
+    int code, q;
+
+    if (tok == TOK_ASM_Y || tok == TOK_ASM_y)
+        code = 0x0008;
+    else if (tok == TOK_ASM_Z || tok == TOK_ASM_z)
+        code = 0x0000;
+    else
+        expect("Y or Z");
+    next();
+    q = 0;
+    if (tok == '+') {
+        next();
+        q = asm_parse_field(s1, 0, 63, R_AVR_6, 0);
+    }
+    return code | ((q & 0x20) << 8) | ((q & 0x18) << 7) | (q & 7);
+}
+
+/* parse Z or Z+: return 1 for Z+ */
+static int asm_parse_z(void)
+{
+    if (tok != TOK_ASM_Z && tok != TOK_ASM_z)
+        expect("Z");
+    next();
+    if (tok == '+') {
+        next();
+        return 1;
+    }
+    return 0;
+}
+
+ST_FUNC void gen_expr32(ExprValue *pe)
+{
+    if (pe->sym) {
+        greloca(pe->sym, ind, R_AVR_32, pe->v);
+        gen_le32(0);
+    } else {
+        gen_le32(pe->v);
+    }
+}
+
+/* .word: a 16 bit address, pm() or gs() giving the word address of the
+   program memory */
+ST_FUNC void asm_word(TCCState *s1, Section *sec)
+{
+    ExprValue e;
+    int mod;
+
+    mod = asm_parse_imm(s1, &e);
+    if (sec->sh_type == SHT_NOBITS) {
+        ind += 2;
+        return;
+    }
+    if (e.sym) {
+        if (mod & ~MOD_PM)
+            tcc_error("invalid relocation of '%s'",
+                      get_tok_str(e.sym->v, NULL));
+        greloca(e.sym, ind, mod ? R_AVR_16_PM : R_AVR_16, e.v);
+        e.v = 0;
+    }
+    gen_le16(e.v);
+}
+
+ST_FUNC void asm_opcode(TCCState *s1, int opcode)
+{
+    const ASMInstr *pa;
+    int d, r, k, code, w2;
+
+    for(pa = asm_instrs; pa->sym != opcode; pa++) {
+        if (pa->sym == 0)
+            tcc_error("unknown opcode '%s'", get_tok_str(opcode, NULL));
+    }
+    if (pa->flags & ~s1->avr_device->flags)
+        tcc_error("'%s' is not supported by %s",
+                  get_tok_str(opcode, NULL), s1->avr_device->name);
+    code = pa->opcode;
+    w2 = -1; /* second word of lds, sts, jmp and call */
+    switch(pa->format) {
+    case OPF_NONE:
+        break;
+    case OPF_RD:
+        code |= asm_parse_reg() << 4;
+        break;
+    case OPF_RD_DUP:
+        d = asm_parse_reg();
+        code |= ((d & 0x10) << 5) | (d << 4) | (d & 0xF);
+        break;
+    case OPF_RD_RR:
+        d = asm_parse_reg();
+        skip(',');
+        r = asm_parse_reg();
+        code |= ((r & 0x10) << 5) | (d << 4) | (r & 0xF);
+        break;
+    case OPF_RD16:
+        code |= (asm_parse_reg_range(16, 31) - 16) << 4;
+        break;
+    case OPF_RD16_K:
+    case OPF_RD16_NK:
+        d = asm_parse_reg_range(16, 31);
+        skip(',');
+        k = asm_parse_field(s1, -128, 255,
+                            pa->format == OPF_RD16_K ? R_AVR_LDI : 0, 0);
+        if (pa->format == OPF_RD16_NK)
+            k = ~k;
+        code |= ((k & 0xF0) << 4) | ((d - 16) << 4) | (k & 0xF);
+        break;
+    case OPF_RD16_RR16:
+    case OPF_RD16_RR23:
+        k = pa->format == OPF_RD16_RR16 ? 31 : 23;
+        d = asm_parse_reg_range(16, k);
+        skip(',');
+        r = asm_parse_reg_range(16, k);
+        code |= ((d - 16) << 4) | (r - 16);
+        break;
+    case OPF_MOVW:
+        d = asm_parse_reg();
+        skip(',');
+        r = asm_parse_reg();
+        if ((d | r) & 1)
+            tcc_error("even registers expected");
+        code |= ((d >> 1) << 4) | (r >> 1);
+        break;
+    case OPF_ADIW:
+        d = asm_parse_reg_range(24, 31);
+        if (d & 1)
+            tcc_error("r24, r26, r28 or r30 expected");
+        skip(',');
+        k = asm_parse_field(s1, 0, 63, R_AVR_6_ADIW, 0);
+        code |= ((k & 0x30) << 2) | (((d - 24) >> 1) << 4) | (k & 0xF);
+        break;
+    case OPF_BRBX:
+        code |= asm_parse_field(s1, 0, 7, 0, 0);
+        skip(',');
+        /* fall through */
+    case OPF_BRANCH:
+        k = asm_parse_rel(s1, R_AVR_7_PCREL);
+        if ((k & 1) || k < -128 || k > 126)
+            tcc_error("branch out of range");
+        code |= ((k >> 1) & 0x7F) << 3;
+        break;
+    case OPF_RJMP:
+        k = asm_parse_rel(s1, R_AVR_13_PCREL);
+        if ((k & 1) || k < -4096 || k > 4094)
+            tcc_error("relative jump out of range");
+        code |= (k >> 1) & 0xFFF;
+        break;
+    case OPF_JMP:
+        k = asm_parse_field(s1, 0, 0x7FFFFE, R_AVR_CALL, 0);
+        if (k & 1)
+            tcc_error("odd jump address");
+        k >>= 1;
+        code |= ((k >> 13) & 0x1F0) | ((k >> 16) & 1);
+        w2 = k & 0xFFFF;
+        break;
+    case OPF_S:
+        code |= asm_parse_field(s1, 0, 7, 0, 0) << 4;
+        break;
+    case OPF_RD_B:
+        code |= asm_parse_reg() << 4;
+        skip(',');
+        code |= asm_parse_field(s1, 0, 7, 0, 0);
+        break;
+    case OPF_A_B:
+        code |= asm_parse_field(s1, 0, 31, R_AVR_PORT5, 0) << 3;
+        skip(',');
+        code |= asm_parse_field(s1, 0, 7, 0, 0);
+        break;
+    case OPF_IN:
+        code |= asm_parse_reg() << 4;
+        skip(',');
+        k = asm_parse_field(s1, 0, 63, R_AVR_PORT6, 0);
+        code |= ((k & 0x30) << 5) | (k & 0xF);
+        break;
+    case OPF_OUT:
+        k = asm_parse_field(s1, 0, 63, R_AVR_PORT6, 0);
+        code |= ((k & 0x30) << 5) | (k & 0xF);
+        skip(',');
+        code |= asm_parse_reg() << 4;
+        break;
+    case OPF_LDS:
+        code |= asm_parse_reg() << 4;
+        skip(',');
+        w2 = asm_parse_field(s1, -0x8000, 0xFFFF, R_AVR_16, 2) & 0xFFFF;
+        break;
+    case OPF_STS:
+        w2 = asm_parse_field(s1, -0x8000, 0xFFFF, R_AVR_16, 2) & 0xFFFF;
+        skip(',');
+        code |= asm_parse_reg() << 4;
+        break;
+    case OPF_LD:
+        d = asm_parse_reg();
+        skip(',');
+        code |= asm_parse_ptr() | (d << 4);
+        break;
+    case OPF_ST:
+        code |= asm_parse_ptr();
+        skip(',');
+        code |= asm_parse_reg() << 4;
+        break;
+    case OPF_LDD:
+        d = asm_parse_reg();
+        skip(',');
+        code |= asm_parse_disp(s1) | (d << 4);
+        break;
+    case OPF_STD:
+        code |= asm_parse_disp(s1);
+        skip(',');
+        code |= asm_parse_reg() << 4;
+        break;
+    case OPF_LPM:
+        if (tok == TOK_LINEFEED || tok == TOK_EOF)
+            break;
+        /* lpm Rd, Z(+) and elpm Rd, Z(+) */
+        k = opcode == TOK_ASM_lpm ? AVR_HAVE_LPMX : AVR_HAVE_ELPMX;
+        if (!(s1->avr_device->flags & k))
+            tcc_error("'%s Rd, Z' is not supported by %s",
+                      get_tok_str(opcode, NULL), s1->avr_device->name);
+        d = asm_parse_reg();
+        skip(',');
+        code = (opcode == TOK_ASM_lpm ? 0x9004 : 0x9006) | (d << 4) |
+            asm_parse_z();
+        break;
+    case OPF_SPM:
+        if (tok != TOK_LINEFEED && tok != TOK_EOF) {
+            if (!asm_parse_z())
+                expect("Z+");
+            code |= 0x0010;
+        }
+        break;
+    case OPF_Z_RD:
+        if (asm_parse_z())
+            expect("Z");
+        skip(',');
+        code |= asm_parse_reg() << 4;
+        break;
+    case OPF_K4:
+        code |= asm_parse_field(s1, 0, 15, 0, 0) << 4;
+        break;
+    }
+    gen_le16(code);
+    if (w2 >= 0)
+        gen_le16(w2);
+}
+
+/********************************************************/
+/* GCC inline asm support */
+
+/* registers of the constraints, bit n for rn: r0, r1 and the frame
+   pointer r29:r28 are never given */
+#define ASM_REGS_r 0xCFFFFFFCu /* r2-r27, r30, r31 */
+#define ASM_REGS_l 0x0000FFFCu /* r2-r15 */
+#define ASM_REGS_d 0xCFFF0000u /* r16-r27, r30, r31 */
+#define ASM_REGS_a 0x00FF0000u /* r16-r23 */
+#define ASM_REGS_w 0xCF000000u /* r25:r24, X, Z */
+#define ASM_REGS_e 0xCC000000u /* X, Z */
+#define ASM_REGS_x 0x0C000000u /* X */
+#define ASM_REGS_z 0xC0000000u /* Z (and 'b', Y being the frame pointer) */
+
+#define REG_OUT_MASK 0x01
+#define REG_IN_MASK  0x02
+
+/* size in bytes of the value of an operand */
+static int asm_value_size(SValue *sv)
+{
+    int align;
+
+    if ((sv->type.t & VT_ARRAY) || (sv->type.t & VT_BTYPE) == VT_FUNC)
+        return PTR_SIZE;
+    return type_size(&sv->type, &align);
+}
+
+/* return the TCC register of the hardware register 'hw' */
+static int asm_treg(int hw)
+{
+    int r;
+
+    for(r = 0; reg_idx[r] != hw; r++);
+    return r;
+}
+
+/* return the first hardware register of 'size' consecutive registers
+   of 'regs' free in 'reg_mask', from an even one if 'size' > 1, or -1.
+   They are tried in the order of the code generator */
+static int asm_find_regs(uint8_t *regs_allocated, int reg_mask,
+                         unsigned regs, int size)
+{
+    int i, hw, k;
+
+    for(i = 0; i < NB_REGS; i++) {
+        hw = reg_idx[i];
+        if ((size > 1 && (hw & 1)) || hw + size > NB_ASM_REGS)
+            continue;
+        for(k = 0; k < size; k++) {
+            if (!(regs & (1u << (hw + k))) ||
+                (regs_allocated[hw + k] & reg_mask))
+                break;
+        }
+        if (k == size)
+            return hw;
+    }
+    return -1;
+}
+
+/* return the constraint priority (we allocate first the lowest
+   numbered constraints) */
+static inline int constraint_priority(const char *str)
+{
+    int priority, c, pr;
+
+    /* we take the lowest priority */
+    priority = 0;
+    for(;;) {
+        c = *str;
+        if (c == '\0')
+            break;
+        str++;
+        switch(c) {
+        case 'w':
+        case 'e':
+        case 'b':
+        case 'x':
+        case 'y':
+        case 'z':
+            pr = 1;
+            break;
+        case 'a':
+        case 'd':
+        case 'l':
+            pr = 2;
+            break;
+        case 'r':
+            pr = 3;
+            break;
+        case 'I':
+        case 'J':
+        case 'K':
+        case 'L':
+        case 'M':
+        case 'N':
+        case 'O':
+        case 'P':
+        case 'R':
+        case 'i':
+        case 'n':
+        case 's':
+        case 'm':
+        case 'g':
+            pr = 4;
+            break;
+        default:
+            tcc_error("unknown constraint '%c'", c);
+            pr = 0;
+        }
+        if (pr > priority)
+            priority = pr;
+    }
+    return priority;
+}
+
+static const char *skip_constraint_modifiers(const char *p)
+{
+    while (*p == '=' || *p == '&' || *p == '+' || *p == '%')
+        p++;
+    return p;
+}
+
+/* the operand registers are those of the code generator: op->reg is
+   the TCC register of the first byte, the others following it in the
+   hardware registers. The clobbered registers are hardware ones */
+ST_FUNC void asm_compute_constraints(ASMOperand *operands,
+                                    int nb_operands, int nb_outputs,
+                                    const uint8_t *clobber_regs,
+                                    int *pout_reg)
+{
+    ASMOperand *op;
+    int sorted_op[MAX_ASM_OPERANDS];
+    int i, j, k, p1, p2, tmp, hw, c, reg_mask, size, v;
+    unsigned regs;
+    const char *str;
+    uint8_t regs_allocated[NB_ASM_REGS];
+
+    /* init fields */
+    for(i=0;i<nb_operands;i++) {
+        op = &operands[i];
+        op->input_index = -1;
+        op->ref_index = -1;
+        op->reg = -1;
+        op->is_memory = 0;
+        op->is_rw = 0;
+        op->is_llong = 0;
+    }
+    /* compute constraint priority and evaluate references to output
+       constraints if input constraints */
+    for(i=0;i<nb_operands;i++) {
+        op = &operands[i];
+        str = op->constraint;
+        str = skip_constraint_modifiers(str);
+        if (isnum(*str) || *str == '[') {
+            /* this is a reference to another constraint */
+            k = find_constraint(operands, nb_operands, str, NULL);
+            if ((unsigned)k >= i || i < nb_outputs)
+                tcc_error("invalid reference in constraint %d ('%s')",
+                      i, str);
+            op->ref_index = k;
+            if (operands[k].input_index >= 0)
+                tcc_error("cannot reference twice the same operand");
+            operands[k].input_index = i;
+            op->priority = 5;
+        } else {
+            op->priority = constraint_priority(str);
+        }
+    }
+
+    /* sort operands according to their priority */
+    for(i=0;i<nb_operands;i++)
+        sorted_op[i] = i;
+    for(i=0;i<nb_operands - 1;i++) {
+        for(j=i+1;j<nb_operands;j++) {
+            p1 = operands[sorted_op[i]].priority;
+            p2 = operands[sorted_op[j]].priority;
+            if (p2 < p1) {
+                tmp = sorted_op[i];
+                sorted_op[i] = sorted_op[j];
+                sorted_op[j] = tmp;
+            }
+        }
+    }
+
+    for(i = 0;i < NB_ASM_REGS; i++) {
+        if (clobber_regs[i] || (avr_global_regs & (1u << i)))
+            regs_allocated[i] = REG_IN_MASK | REG_OUT_MASK;
+        else
+            regs_allocated[i] = 0;
+    }
+
+    /* allocate registers */
+    for(i=0;i<nb_operands;i++) {
+        j = sorted_op[i];
+        op = &operands[j];
+        str = op->constraint;
+        /* no need to allocate references */
+        if (op->ref_index >= 0)
+            continue;
+        /* select if register is used for output, input or both */
+        if (op->input_index >= 0) {
+            reg_mask = REG_IN_MASK | REG_OUT_MASK;
+        } else if (j < nb_outputs) {
+            reg_mask = REG_OUT_MASK;
+        } else {
+            reg_mask = REG_IN_MASK;
+        }
+        size = asm_value_size(op->vt);
+        v = op->vt->r & (VT_VALMASK | VT_LVAL | VT_SYM);
+    try_next:
+        c = *str++;
+        switch(c) {
+        case '=':
+            goto try_next;
+        case '+':
+            op->is_rw = 1;
+            /* FALL THRU */
+        case '&':
+            if (j >= nb_outputs)
+                tcc_error("'%c' modifier can only be applied to outputs", c);
+            reg_mask = REG_IN_MASK | REG_OUT_MASK;
+            goto try_next;
+        case 'r':
+            regs = ASM_REGS_r;
+            goto alloc_reg;
+        case 'l':
+            regs = ASM_REGS_l;
+            goto alloc_reg;
+        case 'd':
+            regs = ASM_REGS_d;
+            goto alloc_reg;
+        case 'a':
+            regs = ASM_REGS_a;
+            goto alloc_reg;
+        case 'w':
+            regs = ASM_REGS_w;
+            goto alloc_reg;
+        case 'e':
+            regs = ASM_REGS_e;
+            goto alloc_reg;
+        case 'x':
+            regs = ASM_REGS_x;
+            goto alloc_reg;
+        case 'b':
+        case 'z':
+            regs = ASM_REGS_z;
+        alloc_reg:
+            if (size > 8)
+                goto try_next;
+            hw = asm_find_regs(regs_allocated, reg_mask, regs, size);
+            if (hw < 0)
+                goto try_next;
+            op->reg = asm_treg(hw);
+            for(k = 0; k < size; k++)
+                regs_allocated[hw + k] |= reg_mask;
+            break;
+        case 'y':
+            /* Y is the frame pointer */
+            goto try_next;
+        case 'I':
+        case 'J':
+        case 'K':
+        case 'L':
+        case 'M':
+        case 'N':
+        case 'O':
+        case 'P':
+        case 'R':
+            if (v != VT_CONST)
+                goto try_next;
+            k = op->vt->c.i;
+            if ((c == 'I' && (k < 0 || k > 63)) ||
+                (c == 'J' && (k < -63 || k > 0)) ||
+                (c == 'K' && k != 2) ||
+                (c == 'L' && k != 0) ||
+                (c == 'M' && (k < 0 || k > 255)) ||
+                (c == 'N' && k != -1) ||
+                (c == 'O' && k != 8 && k != 16 && k != 24) ||
+                (c == 'P' && k != 1) ||
+                (c == 'R' && (k < -6 || k > 5)))
+                goto try_next;
+            break;
+        case 'n':
+            if (v != VT_CONST)
+                goto try_next;
+            break;
+        case 'i':
+            if ((v & ~VT_SYM) != VT_CONST)
+                goto try_next;
+            break;
+        case 's':
+            if (v != (VT_CONST | VT_SYM))
+                goto try_next;
+            break;
+        case 'g':
+            if ((v & ~VT_SYM) == VT_CONST)
+                break;
+            /* FALL THRU */
+        case 'm':
+            /* only the static variables have an address known to the
+               assembler, the frame offsets being patched later */
+            if ((v & ~VT_SYM) != (VT_CONST | VT_LVAL) ||
+                ((v & VT_SYM) && SYM_GLOBAL_REG(op->vt->sym)))
+                goto try_next;
+            break;
+        default:
+            tcc_error("asm constraint %d ('%s') could not be satisfied",
+                  j, op->constraint);
+            break;
+        }
+        /* if a reference is present for that operand, we assign it too */
+        if (op->input_index >= 0)
+            operands[op->input_index].reg = op->reg;
+    }
+
+    /* the outputs stored through pointers use Z, saved on the stack */
+    *pout_reg = -1;
+
+#ifdef ASM_DEBUG
+    for(i=0;i<nb_operands;i++) {
+        j = sorted_op[i];
+        op = &operands[j];
+        printf("%%%d [%s]: \"%s\" r=0x%04x reg=%d\n",
+               j,
+               op->id ? get_tok_str(op->id, NULL) : "",
+               op->constraint,
+               op->vt->r,
+               op->reg);
+    }
+#endif
+}
+
+ST_FUNC void subst_asm_operand(CString *add_str,
+                              SValue *sv, int modifier)
+{
+    int r, reg, val, i;
+    char buf[64];
+
+    i = 0;
+    if (modifier >= 'A' && modifier <= 'D') {
+        i = modifier - 'A';
+        if (i >= asm_value_size(sv))
+            tcc_error("invalid operand byte '%%%c'", modifier);
+    }
+    r = sv->r;
+    if ((r & VT_VALMASK) == VT_CONST) {
+        val = sv->c.i;
+        if (r & VT_SYM) {
+            if (modifier == 'n' || modifier == 'i' || (i && !(r & VT_LVAL)))
+                tcc_error("invalid modifier '%c' of a symbol", modifier);
+            cstr_cat(add_str, get_tok_str(sv->sym->v, NULL));
+            val += i;
+            if (val == 0)
+                return;
+            cstr_ccat(add_str, '+');
+        } else if (r & VT_LVAL) {
+            val += i;
+        } else if (modifier == 'n') {
+            val = -val;
+        } else if (modifier == 'i') {
+            /* I/O address of a memory mapped register */
+            val -= 0x20;
+        } else if (modifier >= 'A' && modifier <= 'D') {
+            val = (val >> (8 * i)) & 0xFF;
+        }
+        snprintf(buf, sizeof(buf), "%d", val);
+        cstr_cat(add_str, buf);
+    } else if ((r & VT_LVAL) || (r & VT_VALMASK) >= VT_CONST) {
+        tcc_error("internal compiler error");
+    } else {
+        /* register case */
+        reg = reg_idx[r & VT_VALMASK] + i;
+        if (modifier == 'a') {
+            if (reg != 26 && reg != 28 && reg != 30)
+                tcc_error("pointer register expected");
+            snprintf(buf, sizeof(buf), "%c", 'X' + (reg - 26) / 2);
+        } else if (modifier == 'r') {
+            snprintf(buf, sizeof(buf), "%d", reg);
+        } else {
+            snprintf(buf, sizeof(buf), "r%d", reg);
+        }
+        cstr_cat(add_str, buf);
+    }
+}
+
+/* ldd 'd', Z+'q' and std Z+'q', 'd' through the pointer saved at the
+   frame offset 'c', Z being preserved */
+static void asm_llocal(int d, int c, int q, int is_store)
+{
+    int code;
+
+    _PUSH(30);
+    _PUSH(31);
+    gldd_y(30, c);
+    gldd_y(31, c + 1);
+    code = (is_store ? 0x8200 : 0x8000) | (d << 4) |
+        ((q & 0x20) << 8) | ((q & 0x18) << 7) | (q & 7);
+    gen_le16(code);
+    _POP(31);
+    _POP(30);
+}
+
+/* generate prolog and epilog code for asm statment */
+ST_FUNC void asm_gen_code(ASMOperand *operands, int nb_operands,
+                         int nb_outputs, int is_output,
+                         uint8_t *clobber_regs,
+                         int out_reg)
+{
+    ASMOperand *op;
+    SValue sv;
+    int i, k, hw, size, v;
+
+    func_has_asm = 1;
+    if (!is_output) {
+        /* generate load code */
+        for(i = 0; i < nb_operands; i++) {
+            op = &operands[i];
+            if (op->reg < 0 || (i < nb_outputs && !op->is_rw))
+                continue;
+            hw = reg_idx[op->reg];
+            size = asm_value_size(op->vt);
+            v = op->vt->r & VT_VALMASK;
+            if (v == VT_LOCAL && !(op->vt->r & VT_LVAL)) {
+                /* address of a local */
+                gen_local_addr(op->reg, asm_treg(hw + 1), op->vt->c.i);
+                continue;
+            }
+            for(k = 0; k < size; k++) {
+                if (v == VT_CONST && !(op->vt->r & VT_LVAL)) {
+                    if (op->vt->r & VT_SYM)
+                        gloadsym(asm_treg(hw + k), op->vt->sym,
+                                 op->vt->c.i, k);
+                    else
+                        gloadi(asm_treg(hw + k), op->vt->c.i >> (8 * k));
+                } else if (v == VT_LLOCAL) {
+                    asm_llocal(TMP_REG, op->vt->c.i, k, 0);
+                    _MOV(hw + k, TMP_REG);
+                } else {
+                    sv = *op->vt;
+                    sv.c.i += k;
+                    load(asm_treg(hw + k), &sv);
+                }
+            }
+        }
+    } else {
+        /* __zero_reg__ is cleared again as after 'mul' */
+        if (clobber_regs[ZERO_REG])
+            _EOR(ZERO_REG, ZERO_REG);
+        /* generate save code */
+        for(i = 0 ; i < nb_outputs; i++) {
+            op = &operands[i];
+            if (op->reg < 0)
+                continue;
+            hw = reg_idx[op->reg];
+            size = asm_value_size(op->vt);
+            for(k = 0; k < size; k++) {
+                if ((op->vt->r & VT_VALMASK) == VT_LLOCAL) {
+                    _MOV(TMP_REG, hw + k);
+                    asm_llocal(TMP_REG, op->vt->c.i, k, 1);
+                } else {
+                    sv = *op->vt;
+                    sv.c.i += k;
+                    store(asm_treg(hw + k), &sv);
+                }
+            }
+        }
+    }
+}
+
+ST_FUNC void asm_clobber(uint8_t *clobber_regs, const char *str)
+{
+    int reg;
+    TokenSym *ts;
+
+    if (!strcmp(str, "memory") ||
+        !strcmp(str, "cc"))
+        return;
+    ts = tok_alloc(str, strlen(str));
+    reg = ts->tok;
+    if (reg >= TOK_ASM_r0 && reg <= TOK_ASM_r31) {
+        reg -= TOK_ASM_r0;
+    } else if (reg == TOK_ASM_tmp_reg) {
+        reg = TMP_REG;
+    } else if (reg == TOK_ASM_zero_reg) {
+        reg = ZERO_REG;
+    } else {
+        tcc_error("invalid clobber register '%s'", str);
+    }
+    if (reg == 28 || reg == 29)
+        tcc_error("the frame pointer r%d cannot be clobbered", reg);
+    clobber_regs[reg] = 1;
+}
@@ -25,6 +25,7 @@
 
 /* number of available registers */
 #define NB_REGS            32
+#define NB_ASM_REGS        32
 
 /* a register can belong to several classes. The classes must be
    sorted from more general to more precise (see gv2() code which does
@@ -34,23 +35,26 @@
 #define RC_FLOAT   0x0004	/* generic float register */
 #define RC_LONG    RC_FLOAT
 #define RC_LLONG   0x0008
-/* Return registers */
-#define RC_R24     0x0010
-#define RC_R25     0x0020
-#define RC_R23     0x0040
-#define RC_R22     0x0080
-#define RC_R21     0x0100
-#define RC_R20     0x0200
-#define RC_R19     0x0400
-#define RC_R18     0x0800
-
-#define RC_ADIW    0x0010   /* can be used in adiw instruction */
+/* Fixed registers r8-r25, in ascending order: a value wanted in class
+   RC_R(n) is loaded in rn, rn+1... (see gv()) */
+#define RC_R(n)    (0x0010 << ((n) - 8))
+#define RC_R18     RC_R(18)
+#define RC_R19     RC_R(19)
+#define RC_R20     RC_R(20)
+#define RC_R21     RC_R(21)
+#define RC_R22     RC_R(22)
+#define RC_R23     RC_R(23)
+#define RC_R24     RC_R(24)
+#define RC_R25     RC_R(25)
+
+#define RC_LDI     0x400000 /* r16-r31: accepts immediate operands */
+#define RC_FMUL    0x800000 /* r16-r23: operands of fmul, fmuls, fmulsu */
 
 #define RC_BRET    RC_R24	/* function return: byte register */
-#define RC_IRET    RC_R25	/* function return: second integer register */
-#define RC_LRET    RC_R22	/* function return: second integer register */
-#define RC_LLRET   RC_R18	/* function return: second integer register */
-#define RC_FRET    RC_LRET	/* function return: float register */
+#define RC_IRET    RC_R24	/* function return: integer in r25:r24 */
+#define RC_LRET    RC_R22	/* function return: long in r25..r22 */
+#define RC_LLRET   RC_R18	/* function return: long long in r25..r18 */
+#define RC_FRET    RC_LRET	/* function return: float in r25..r22 */
 
 /* pretty names for the registers */
 enum {
@@ -84,6 +88,9 @@ enum {
     TREG_R17,
     TREG_R30,
     TREG_R31,
+    /* never allocated, see reg_classes[] */
+    TREG_R0,
+    TREG_R1,
 };
 
 static int reg_idx[] =  {
@@ -117,6 +124,8 @@ static int reg_idx[] =  {
     17,
     30,
     31,
+    0,
+    1,
 };
 
 static char *reg_names[] =  {
@@ -150,13 +159,15 @@ static char *reg_names[] =  {
     "r17",
     "r30",
     "r31",
+    "r0",
+    "r1",
 };
 
 /* return registers for function */
 #define REG_BRET TREG_R24	/* single word byte return register */
 #define REG_IRET TREG_R25	/* single word int return register */
 #define REG_LRET TREG_R26	/* second word return register (for long long) */
-#define REG_FRET TREG_R24	/* float return register */
+#define REG_FRET TREG_R22	/* float return register, up to r25 */
 
 /* defined if function parameters must be evaluated in reverse order */
 #define INVERT_FUNC_PARAMS
@@ -181,51 +192,276 @@ static char *reg_names[] =  {
 
 /* relocation type for 32 bit data relocation */
 #define R_DATA_32   R_AVR_32
-#define R_DATA_PTR  R_AVR_32
+#define R_DATA_PTR  R_AVR_16
 #define R_JMP_SLOT  R_C60_JMP_SLOT
 #define R_COPY      R_C60_COPY
 
-#define ELF_START_ADDR 0x00000400
-#define ELF_PAGE_SIZE  0x1000
+/* flash starts at 0 and sections need only be word aligned. The data
+   segment runs at AVR_DATA_VMA + the SRAM start of the device: the
+   address space of avr-gcc, where 0x800000 tags the data space and
+   0x810000 the EEPROM */
+#define ELF_START_ADDR 0x00000000
+#define ELF_PAGE_SIZE  2
+#define AVR_DATA_VMA   0x800000
+#define AVR_EEPROM_VMA 0x810000
+
+/******************************************************/
+/* devices, selected with -mmcu= */
+
+/* core features */
+#define AVR_HAVE_MUL          0x0001 /* mul, muls, mulsu, fmul... */
+#define AVR_HAVE_MOVW         0x0002
+#define AVR_HAVE_LPMX         0x0004 /* lpm Rd, Z(+) */
+#define AVR_HAVE_JMP_CALL     0x0008
+#define AVR_HAVE_ELPM         0x0010 /* and RAMPZ */
+#define AVR_HAVE_ELPMX        0x0020
+#define AVR_HAVE_EIJMP_EICALL 0x0040 /* and a 3 bytes PC */
+#define AVR_HAVE_8BIT_SP      0x0080 /* no SPH */
+#define AVR_HAVE_XMEGA        0x0100 /* des, xch, las, lac, lat */
+
+typedef struct AVRDevice {
+    const char *name;    /* -mmcu= name */
+    const char *macro;   /* __AVR_<macro>__, NULL for the architectures */
+    int arch;            /* avr-gcc architecture: 2, 25, 3, 31... */
+    int flags;           /* AVR_HAVE_xxx */
+    unsigned flash_size; /* in bytes */
+    unsigned ram_start;  /* first SRAM address */
+    unsigned ram_size;   /* in bytes */
+    unsigned eeprom_size; /* in bytes */
+    unsigned page_size;  /* flash page written by the self programming */
+} AVRDevice;
+
+/* the device used without -mmcu, avr5 being the core the code
+   generator was written for */
+#define AVR_DEFAULT_DEVICE "avr5"
 
 /******************************************************/
 #else /* ! TARGET_DEFS_ONLY */
 /******************************************************/
 #include "tcc.h"
 
-ST_DATA const int reg_classes[NB_REGS] = {
-    /* R24 */ RC_BYTE | RC_R24,
-    /* R25 */ RC_BYTE | RC_R25,
-    /* R18 */ RC_BYTE | RC_R18,
-    /* R19 */ RC_BYTE | RC_R19,
-    /* R20 */ RC_BYTE | RC_R20,
-    /* R21 */ RC_BYTE | RC_R21,
-    /* R22 */ RC_BYTE | RC_R22,
-    /* R23 */ RC_BYTE | RC_R23,
-    /* R26 */ RC_BYTE,
-    /* R27 */ RC_BYTE,
-    /* R28 */ RC_BYTE,
-    /* R29 */ RC_BYTE,
+/* r0 is the scratch register clobbered by 'mul', r1 always holds 0
+   (__zero_reg__, cleared again after each 'mul') and r29:r28 is the
+   frame pointer Y: none of them is allocated. As with avr-gcc, r2 to
+   r17 are call-saved: a function saves those it uses (see
+   gsave_regs()) */
+static const int avr_reg_classes[NB_REGS] = {
+    /* R24 */ RC_BYTE | RC_LDI | RC_R24,
+    /* R25 */ RC_BYTE | RC_LDI | RC_R25,
+    /* R18 */ RC_BYTE | RC_LDI | RC_FMUL | RC_R18,
+    /* R19 */ RC_BYTE | RC_LDI | RC_FMUL | RC_R19,
+    /* R20 */ RC_BYTE | RC_LDI | RC_FMUL | RC_R20,
+    /* R21 */ RC_BYTE | RC_LDI | RC_FMUL | RC_R21,
+    /* R22 */ RC_BYTE | RC_LDI | RC_FMUL | RC_R22,
+    /* R23 */ RC_BYTE | RC_LDI | RC_FMUL | RC_R23,
+    /* R26 */ RC_BYTE | RC_LDI,
+    /* R27 */ RC_BYTE | RC_LDI,
+    /* R28 */ 0,
+    /* R29 */ 0,
     /* R2  */ RC_BYTE,
     /* R3  */ RC_BYTE,
     /* R4  */ RC_BYTE,
     /* R5  */ RC_BYTE,
     /* R6  */ RC_BYTE,
     /* R7  */ RC_BYTE,
-    /* R8  */ RC_BYTE,
-    /* R9  */ RC_BYTE,
-    /* R10 */ RC_BYTE,
-    /* R11 */ RC_BYTE,
-    /* R12 */ RC_BYTE,
-    /* R13 */ RC_BYTE,
-    /* R14 */ RC_BYTE,
-    /* R15 */ RC_BYTE,
-    /* R16 */ RC_BYTE,
-    /* R17 */ RC_BYTE,
-    /* R30 */ RC_BYTE,
-    /* R31 */ RC_BYTE,
+    /* R8  */ RC_BYTE | RC_R(8),
+    /* R9  */ RC_BYTE | RC_R(9),
+    /* R10 */ RC_BYTE | RC_R(10),
+    /* R11 */ RC_BYTE | RC_R(11),
+    /* R12 */ RC_BYTE | RC_R(12),
+    /* R13 */ RC_BYTE | RC_R(13),
+    /* R14 */ RC_BYTE | RC_R(14),
+    /* R15 */ RC_BYTE | RC_R(15),
+    /* R16 */ RC_BYTE | RC_R(16) | RC_LDI | RC_FMUL,
+    /* R17 */ RC_BYTE | RC_R(17) | RC_LDI | RC_FMUL,
+    /* R30 */ RC_BYTE | RC_LDI,
+    /* R31 */ RC_BYTE | RC_LDI,
+    /* R0  */ 0,
+    /* R1  */ 0,
+};
+
+/* the classes of the translation unit, without the registers of the
+   global register variables */
+ST_DATA int reg_classes[NB_REGS];
+/* the registers of the global register variables, bit n for rn */
+ST_DATA unsigned avr_global_regs;
+
+/* give back all the registers, before a translation unit */
+ST_FUNC void avr_regs_init(void)
+{
+    memcpy(reg_classes, avr_reg_classes, sizeof(reg_classes));
+    avr_global_regs = 0;
+}
+
+/* the call-saved registers written by the current function, bit n for
+   rn */
+static unsigned func_saved_regs;
+
+/* record that the function uses the register 'r' */
+ST_FUNC void avr_use_reg(int r)
+{
+    int d = reg_idx[r];
+    if (d >= 2 && d <= 17)
+        func_saved_regs |= 1 << d;
+}
+
+/* declare at file scope 'register type v asm(name)': the variable is
+   kept in the call-saved registers from 'name' on, which are no longer
+   allocated. As with avr-gcc, the other translation units must not use
+   them either. Its symbol is a static lvalue without storage, load()
+   and store() moving it instead */
+ST_FUNC void avr_global_reg(CType *type, int v, char *name)
+{
+    Sym *sym;
+    char *end;
+    int hw, size, align, i, r;
+    unsigned mask;
+
+    hw = -1;
+    if (name[0] == 'r' && name[1] >= '0' && name[1] <= '9') {
+        hw = strtol(name + 1, &end, 10);
+        if (*end)
+            hw = -1;
+    }
+    if (hw < 0)
+        tcc_error("invalid register name '%s' for '%s'",
+                  name, get_tok_str(v, NULL));
+    if ((type->t & (VT_ARRAY | VT_VLA)) ||
+        (type->t & VT_BTYPE) == VT_STRUCT || (type->t & VT_BTYPE) == VT_FUNC)
+        tcc_error("global register variable '%s' must be a scalar",
+                  get_tok_str(v, NULL));
+    size = type_size(type, &align);
+    if (hw < 2 || hw + size > 18)
+        tcc_error("global register variable '%s' must be in r2 to r17",
+                  get_tok_str(v, NULL));
+    mask = ((1u << size) - 1) << hw;
+
+    sym = sym_find(v);
+    if (sym) {
+        /* a redeclaration */
+        if (SYM_GLOBAL_REG(sym) != hw ||
+            !is_compatible_types(&sym->type, type))
+            tcc_error("incompatible redefinition of '%s'",
+                      get_tok_str(v, NULL));
+        tcc_free(name);
+        return;
+    }
+    if (avr_global_regs & mask)
+        tcc_error("register '%s' of '%s' is already used",
+                  name, get_tok_str(v, NULL));
+    avr_global_regs |= mask;
+    for (r = 0; r < NB_REGS; r++) {
+        for (i = 0; i < size; i++)
+            if (reg_idx[r] == hw + i)
+                reg_classes[r] = 0;
+    }
+    sym = sym_push(v, type, VT_CONST | VT_SYM | lvalue_type(type->t) |
+                   (hw << 16), 0);
+    sym->asm_label = name;
+}
+
+#define TMP_REG  0  /* __tmp_reg__ */
+#define ZERO_REG 1  /* __zero_reg__ */
+
+/******************************************************/
+
+/* core features of the avr-gcc architectures */
+#define AVR2  0
+#define AVR25 (AVR_HAVE_MOVW | AVR_HAVE_LPMX)
+#define AVR3  AVR_HAVE_JMP_CALL
+#define AVR31 (AVR3 | AVR_HAVE_ELPM)
+#define AVR35 (AVR3 | AVR25)
+#define AVR4  (AVR25 | AVR_HAVE_MUL)
+#define AVR5  (AVR4 | AVR_HAVE_JMP_CALL)
+#define AVR51 (AVR5 | AVR_HAVE_ELPM | AVR_HAVE_ELPMX)
+#define AVR6  (AVR51 | AVR_HAVE_EIJMP_EICALL)
+
+static const AVRDevice avr_devices[] = {
+    /* architectures, with the smallest memories and pages of their
+       devices */
+    { "avr2", NULL, 2, AVR2, 0x800, 0x60, 128, 128, 32 },
+    { "avr25", NULL, 25, AVR25, 0x800, 0x60, 128, 64, 32 },
+    { "avr3", NULL, 3, AVR3, 0x4000, 0x60, 256, 512, 128 },
+    { "avr31", NULL, 31, AVR31, 0x10000, 0x60, 1024, 4096, 256 },
+    { "avr35", NULL, 35, AVR35, 0x2000, 0x100, 512, 512, 128 },
+    { "avr4", NULL, 4, AVR4, 0x2000, 0x60, 512, 512, 64 },
+    { "avr5", NULL, 5, AVR5, 0x4000, 0x60, 1024, 512, 128 },
+    { "avr51", NULL, 51, AVR51, 0x20000, 0x100, 4096, 4096, 256 },
+    { "avr6", NULL, 6, AVR6, 0x40000, 0x200, 8192, 4096, 256 },
+    /* devices */
+    { "attiny13", "ATtiny13", 25, AVR25 | AVR_HAVE_8BIT_SP, 0x400, 0x60, 64, 64, 32 },
+    { "attiny2313", "ATtiny2313", 25, AVR25 | AVR_HAVE_8BIT_SP, 0x800, 0x60, 128, 128, 32 },
+    { "attiny85", "ATtiny85", 25, AVR25, 0x2000, 0x60, 512, 512, 64 },
+    { "atmega8", "ATmega8", 4, AVR4, 0x2000, 0x60, 1024, 512, 64 },
+    { "atmega88", "ATmega88", 4, AVR4, 0x2000, 0x100, 1024, 512, 64 },
+    { "atmega16", "ATmega16", 5, AVR5, 0x4000, 0x60, 1024, 512, 128 },
+    { "atmega168", "ATmega168", 5, AVR5, 0x4000, 0x100, 1024, 512, 128 },
+    { "atmega32", "ATmega32", 5, AVR5, 0x8000, 0x60, 2048, 1024, 128 },
+    { "atmega328p", "ATmega328P", 5, AVR5, 0x8000, 0x100, 2048, 1024, 128 },
+    { "atmega32u4", "ATmega32U4", 5, AVR5, 0x8000, 0x100, 2560, 1024, 128 },
+    { "atmega644p", "ATmega644P", 5, AVR5, 0x10000, 0x100, 4096, 2048, 256 },
+    { "atmega128", "ATmega128", 51, AVR51, 0x20000, 0x100, 4096, 4096, 256 },
+    { "atmega1280", "ATmega1280", 51, AVR51, 0x20000, 0x200, 8192, 4096, 256 },
+    { "atmega1284p", "ATmega1284P", 51, AVR51, 0x20000, 0x100, 16384, 4096, 256 },
+    { "atmega2560", "ATmega2560", 6, AVR6, 0x40000, 0x200, 8192, 4096, 256 },
 };
 
+#define avr_have(f) (tcc_state->avr_device->flags & (f))
+
+/* return the device named 'name', NULL if unknown */
+ST_FUNC const AVRDevice *avr_find_device(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(avr_devices) / sizeof(avr_devices[0]); i++)
+        if (!strcmp(avr_devices[i].name, name))
+            return &avr_devices[i];
+    return NULL;
+}
+
+/* define the avr-gcc macros describing the device */
+ST_FUNC void avr_define_device(TCCState *s)
+{
+    const AVRDevice *d = s->avr_device;
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "%d", d->arch);
+    tcc_define_symbol(s, "__AVR_ARCH__", buf);
+    if (d->macro) {
+        snprintf(buf, sizeof(buf), "__AVR_%s__", d->macro);
+        tcc_define_symbol(s, buf, NULL);
+        tcc_define_symbol(s, "__AVR_DEVICE_NAME__", d->name);
+    }
+    if (d->flags & AVR_HAVE_MUL) {
+        tcc_define_symbol(s, "__AVR_HAVE_MUL__", NULL);
+        tcc_define_symbol(s, "__AVR_ENHANCED__", NULL);
+    }
+    if (d->flags & AVR_HAVE_MOVW)
+        tcc_define_symbol(s, "__AVR_HAVE_MOVW__", NULL);
+    if (d->flags & AVR_HAVE_LPMX)
+        tcc_define_symbol(s, "__AVR_HAVE_LPMX__", NULL);
+    if (d->flags & AVR_HAVE_JMP_CALL) {
+        tcc_define_symbol(s, "__AVR_HAVE_JMP_CALL__", NULL);
+        tcc_define_symbol(s, "__AVR_MEGA__", NULL);
+    }
+    if (d->flags & AVR_HAVE_ELPM) {
+        tcc_define_symbol(s, "__AVR_HAVE_ELPM__", NULL);
+        tcc_define_symbol(s, "__AVR_HAVE_RAMPZ__", NULL);
+    }
+    if (d->flags & AVR_HAVE_ELPMX)
+        tcc_define_symbol(s, "__AVR_HAVE_ELPMX__", NULL);
+    if (d->flags & AVR_HAVE_EIJMP_EICALL) {
+        tcc_define_symbol(s, "__AVR_HAVE_EIJMP_EICALL__", NULL);
+        tcc_define_symbol(s, "__AVR_3_BYTE_PC__", NULL);
+    } else {
+        tcc_define_symbol(s, "__AVR_2_BYTE_PC__", NULL);
+    }
+    if (d->flags & AVR_HAVE_8BIT_SP)
+        tcc_define_symbol(s, "__AVR_HAVE_8BIT_SP__", NULL);
+    else
+        tcc_define_symbol(s, "__AVR_HAVE_16BIT_SP__", NULL);
+}
+
 /******************************************************/
 
 void g(int c)
@@ -252,6 +488,20 @@ void o4(unsigned char c1, unsigned char c2, unsigned char c3, unsigned char c4)
     g((c1 << 4) | c2);
 }
 
+ST_FUNC void gen_le16(int c)
+{
+    g(c);
+    g(c >> 8);
+}
+
+ST_FUNC void gen_le32(int c)
+{
+    g(c);
+    g(c >> 8);
+    g(c >> 16);
+    g(c >> 24);
+}
+
 /*****************************************************/
 
 /* AVR instruction emitters */
@@ -263,9 +513,41 @@ void o4(unsigned char c1, unsigned char c2, unsigned char c3, unsigned char c4)
 /* Add without Carry */ 
 #define _ADD(d, r) o4(0x0, 0xC | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
 /* Add Immediate to Word */
-#define _ADIW(d, k) o4(0x9, 0x6, (((k) >> 4) & 0xC) | ((d) & 0x3), (k) & 0xF)
+#define _ADIW(d, k) o4(0x9, 0x6, (((k) >> 2) & 0xC) | ((((d) - 24) >> 1) & 0x3), (k) & 0xF)
 /* Logical AND */
 #define _AND(d, r) o4(0x2, (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
+/* Logical AND with Immediate */
+#define _ANDI(d, k) o4(0x7, ((k) >> 4) & 0xF, (d) & 0xF, (k) & 0xF)
+/* Arithmetic Shift Right */
+#define _ASR(d) o4(0x9, 0x4 | ((d) >> 4), (d) & 0xF, 0x5)
+/* One's Complement */
+#define _COM(d) o4(0x9, 0x4 | ((d) >> 4), (d) & 0xF, 0x0)
+/* Compare */
+#define _CP(d, r) o4(0x1, 0x4 | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
+/* Compare with Carry */
+#define _CPC(d, r) o4(0x0, 0x4 | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
+/* Decrement */
+#define _DEC(d) o4(0x9, 0x4 | ((d) >> 4), (d) & 0xF, 0xA)
+/* Exclusive OR */
+#define _EOR(d, r) o4(0x2, 0x4 | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
+/* Increment */
+#define _INC(d) o4(0x9, 0x4 | ((d) >> 4), (d) & 0xF, 0x3)
+/* Logical Shift Right */
+#define _LSR(d) o4(0x9, 0x4 | ((d) >> 4), (d) & 0xF, 0x6)
+/* Multiply Unsigned */
+#define _MUL(d, r) o4(0x9, 0xC | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
+/* Fractional Multiply Unsigned */
+#define _FMUL(d, r) o4(0x0, 0x3, (d) & 0x7, 0x8 | ((r) & 0x7))
+/* Fractional Multiply Signed */
+#define _FMULS(d, r) o4(0x0, 0x3, 0x8 | ((d) & 0x7), (r) & 0x7)
+/* Fractional Multiply Signed with Unsigned */
+#define _FMULSU(d, r) o4(0x0, 0x3, 0x8 | ((d) & 0x7), 0x8 | ((r) & 0x7))
+/* Logical OR with Immediate */
+#define _ORI(d, k) o4(0x6, ((k) >> 4) & 0xF, (d) & 0xF, (k) & 0xF)
+/* Rotate Right through Carry */
+#define _ROR(d) o4(0x9, 0x4 | ((d) >> 4), (d) & 0xF, 0x7)
+/* Logical OR */
+#define _OR(d, r) o4(0x2, 0x8 | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
 /* Subtract with Carry */
 #define _SBC(d, r) o4(0x0, 0x8 | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
 /* Subtract without Carry */
@@ -274,6 +556,8 @@ void o4(unsigned char c1, unsigned char c2, unsigned char c3, unsigned char c4)
 #define _SBCI(d, k) o4(0x4, ((k) >> 4) & 0xF, (d), (k) & 0xF)
 /* Subtract Immediate */
 #define _SUBI(d, k) o4(0x5, ((k) >> 4) & 0xF, (d), (k) & 0xF)
+/* Subtract Immediate from Word */
+#define _SBIW(d, k) o4(0x9, 0x7, (((k) >> 2) & 0xC) | ((((d) - 24) >> 1) & 0x3), (k) & 0xF)
 
 /*
  *  Branch instructions
@@ -284,28 +568,67 @@ void o4(unsigned char c1, unsigned char c2, unsigned char c3, unsigned char c4)
 #define _BRBC(s, k) o4(0xF, (0x4) | (((k) >> 5) & 0x3), ((k) >> 1) & 0xF, (((k) << 3) & 0x8) | ((s) & 0x7))
 /* Branch if Equal */
 #define _BREQ(k) _BRBS(0x1, k)
+/* Branch if Not Equal */
+#define _BRNE(k) _BRBC(0x1, k)
+/* Branch if Plus */
+#define _BRPL(k) _BRBC(0x2, k)
+/* Branch if Minus */
+#define _BRMI(k) _BRBS(0x2, k)
+/* Branch if Carry Cleared */
+#define _BRCC(k) _BRBC(0x0, k)
+/* Branch if Overflow Cleared */
+#define _BRVC(k) _BRBC(0x3, k)
 /* Branch if Greater or Equal (Signed) */
 #define _BRGE(k) _BRBC(0x4, k)
 /* Branch if Less Than */
 #define _BRLT(k) _BRBS(0x4, k)
 /* Compare with Immediate */
-#define _CPI(r, k) o4(0x3, (k) >> 4, (r), (k) & 0xFF);
+#define _CPI(r, k) o4(0x3, ((k) >> 4) & 0xF, (r) & 0xF, (k) & 0xF)
 /* Relative Call to Subroutine */
 #define _RCALL(k) o((0xD << 12) | ((k) & 0xFFF))
+/* Long Call to a Subroutine, 'k' in words */
+#define _CALL(k) (o4(0x9, 0x4 | (((k) >> 21) & 1), ((k) >> 17) & 0xF, 0xE | (((k) >> 16) & 1)), \
+                  o4(((k) >> 12) & 0xF, ((k) >> 8) & 0xF, ((k) >> 4) & 0xF, (k) & 0xF))
+/* Jump, 'k' in words */
+#define _JMP(k) (o4(0x9, 0x4 | (((k) >> 21) & 1), ((k) >> 17) & 0xF, 0xC | (((k) >> 16) & 1)), \
+                 o4(((k) >> 12) & 0xF, ((k) >> 8) & 0xF, ((k) >> 4) & 0xF, (k) & 0xF))
 /* Relative Jump */
 #define _RJMP(k) o((0xC << 12) | ((k) & 0xFFF))
+/* Indirect Call/Jump to Z, Extended with EIND */
+#define _ICALL() o(0x9509)
+#define _EICALL() o(0x9519)
+#define _IJMP() o(0x9409)
+#define _EIJMP() o(0x9419)
 /* Return from Subroutine*/
 #define _RET() o(0x9508)
+/* Push/Pop Register on Stack */
+#define _PUSH(r) o4(0x9, 0x2 | ((r) >> 4), (r) & 0xF, 0xF)
+#define _POP(d) o4(0x9, 0x0 | ((d) >> 4), (d) & 0xF, 0xF)
+/* Load/Store I/O Location */
+#define _IN(d, a) o4(0xB, (((a) >> 3) & 0x6) | ((d) >> 4), (d) & 0xF, (a) & 0xF)
+#define _OUT(a, r) o4(0xB, 0x8 | (((a) >> 3) & 0x6) | ((r) >> 4), (r) & 0xF, (a) & 0xF)
+/* Global Interrupt Disable */
+#define _CLI() o(0x94F8)
 
 /*
  *  Data Transfer instructions
  */
 /* Load Immediate */
 #define _LDI(d, k) o4(0xE, ((k) >> 4) & 0xF, (d) - 0x10, (k) & 0xF);
+/* Load Direct from Data Space */
+#define _LDS(d, k) (o4(0x9, (d) >> 4, (d) & 0xF, 0x0), \
+                    o4(((k) >> 12) & 0xF, ((k) >> 8) & 0xF, ((k) >> 4) & 0xF, (k) & 0xF))
 /* Load Indirect from Data Space to Register using Index Y */
 #define _LDDYq(d, q) o4(0x8 | (((q) >> 4) & 0x2), (0xC & ((q) >> 1)) | ((d) >> 4), (d) & 0xF, 0x8 | ((q) & 0x7))
+/* Load Indirect from Data Space to Register using Index Z */
+#define _LDZ(d) o4(0x8, ((d) >> 4) & 1, (d) & 0xF, 0)
 /* Copy Register */
-#define _MOV(d, r) o4(0x2, 0xC | (((d) >> 3) & 0x2) | (((r) >> 4) & 1), (d) & 0xF, (r) & 0xF)
+#define _MOV(d, r) o4(0x2, 0xC | (((r) >> 3) & 0x2) | ((d) >> 4), (d) & 0xF, (r) & 0xF)
+/* Copy Register Word */
+#define _MOVW(d, r) o4(0x0, 0x1, (d) >> 1, (r) >> 1)
+/* Store Direct to Data Space */
+#define _STS(k, r) (o4(0x9, 0x2 | ((r) >> 4), (r) & 0xF, 0x0), \
+                    o4(((k) >> 12) & 0xF, ((k) >> 8) & 0xF, ((k) >> 4) & 0xF, (k) & 0xF))
 /* Store Indirect From Register to Data Space using Index Y */
 #define _STDYq(r, q) o4(0x8 | (((q) >> 4) & 0x2), 0x2 | (((q) >> 1) & 0xC) | (((r) >> 4) & 1), (r) & 0xF, 0x8 | (q) & 0x7)
 /* Store Indirect From Register to Data Space using Index Z */
@@ -313,16 +636,83 @@ void o4(unsigned char c1, unsigned char c2, unsigned char c3, unsigned char c4)
 
 /*****************************************************/
 
+/* Jumps are chained through the 12 bit offset field of the 'rjmp'
+   instructions waiting to be patched: the field holds the distance in
+   words to the next pending jump of the list, 0 ending the list.
+   Conditional jumps are emitted as a reversed branch over an 'rjmp' so
+   that only 'rjmp's appear in the lists. */
+
+static unsigned read16(int a)
+{
+    unsigned char *p = cur_text_section->data + a;
+    return p[0] | (p[1] << 8);
+}
+
+static void write16(int a, unsigned w)
+{
+    unsigned char *p = cur_text_section->data + a;
+    p[0] = w;
+    p[1] = w >> 8;
+}
+
+/* next jump in the list after the jump at 't' */
+static int gjmp_next(int t)
+{
+    int n = read16(t) & 0xFFF;
+    if (n == 0)
+        return 0;
+    n = (n ^ 0x800) - 0x800; /* sign extend */
+    return t - (n << 1);
+}
+
+/* make the jump at 't' point to the next jump 'n' of its list */
+static void gjmp_link(int t, int n)
+{
+    int d = n ? (t - n) >> 1 : 0;
+    if (d < -2048 || d > 2047)
+        tcc_error("jump list out of range");
+    write16(t, 0xC000 | (d & 0xFFF));
+}
+
+/* status bit 's' is 'set' when the comparison 'op' is true, the flags
+   having been set by gen_opi(). It only generates the comparisons
+   TOK_EQ, TOK_NE, TOK_LT, TOK_GE and their unsigned variants */
+static void gcond(int op, int *s, int *set)
+{
+    switch (op) {
+    case TOK_EQ:  *s = 1; *set = 1; break;
+    case TOK_NE:  *s = 1; *set = 0; break;
+    case TOK_LT:  *s = 4; *set = 1; break;
+    case TOK_GE:  *s = 4; *set = 0; break;
+    case TOK_ULT: *s = 0; *set = 1; break;
+    case TOK_UGE: *s = 0; *set = 0; break;
+    default:
+        tcc_error("unsupported comparison");
+    }
+}
+
+/* emit a conditional branch over one instruction, taken when the
+   status bit 's' is 'set' */
+static void gskip(int s, int set)
+{
+    AVR_DEBUG("%s %d, .+2\n", set ? "brbs" : "brbc", s);
+    if (set)
+        _BRBS(s, 1);
+    else
+        _BRBC(s, 1);
+}
+
 /* output a symbol and patch all calls to it */
 ST_FUNC void gsym_addr(int t, int a)
 {
     AVR_DEBUG("# gsym_addr(t=%d, a=%d)\n", t, a);
-    unsigned short n, *ptr;
+    int n, k;
     while (t) {
-        ptr = (unsigned short *)(cur_text_section->data + t);
-        n = (*ptr >> 3) & 0x7F; /* next value */
-        AVR_DEBUG("n = %X\n", n);
-        *ptr |= ((a - t - 2) >> 1) << 3;    /* XXX?!! */
+        n = gjmp_next(t);
+        k = (a - t - 2) >> 1;
+        if (k < -2048 || k > 2047)
+            tcc_error("jump out of range");
+        write16(t, 0xC000 | (k & 0xFFF));
         t = n;
     }
 }
@@ -333,6 +723,229 @@ ST_FUNC void gsym(int t)
     gsym_addr(t, ind);
 }
 
+/* Frame layout: Y points below the locals, which are followed by the
+   saved arguments:
+       Y+1 ... Y+F     locals (frame offsets 'loc' to -1)
+       Y+F+1 ...       arguments (frame offsets 0 and above)
+   F being only known at the end of the function, the displacements
+   are recorded and patched by gfunc_epilog(), those beyond the 63
+   bytes of 'ldd' and 'std' by gfar_y() */
+
+#define IO_SPL  0x3D
+#define IO_SPH  0x3E
+#define IO_SREG 0x3F
+
+static int func_sub_sp_offset; /* 'subi r28' of the prolog */
+static int func_frame_end; /* end of the frame setup of the prolog */
+static int func_helpers; /* the prolog and epilog use the frame helpers */
+static int func_args_size;
+static int *yfixes; /* pairs of (position, frame offset), the position
+                       being odd for a 'subi' taking a local address */
+static int nb_yfixes, yfixes_allocated;
+static int func_frame_size; /* locals and saved arguments */
+static Sym **func_calls; /* callees for -fstack-usage, NULL if indirect */
+static int nb_func_calls, func_calls_allocated;
+static int *loop_bounds; /* triples (header, min, max) of gloop_bound() */
+static int nb_loop_bounds, loop_bounds_allocated;
+static int *cold_blocks; /* pairs (start, end) of gcold() */
+static int nb_cold_blocks, cold_blocks_allocated;
+static int func_has_asm; /* inline asm, which gen_layout() cannot move */
+
+/* record that the instruction about to be emitted addresses the frame
+   offset 'c', or subtracts its displacement if 'addr' is set */
+static void gfix_y(int c, int addr)
+{
+    if (nb_yfixes + 2 > yfixes_allocated) {
+        yfixes_allocated = yfixes_allocated ? yfixes_allocated * 2 : 64;
+        yfixes = tcc_realloc(yfixes, yfixes_allocated * sizeof(int));
+    }
+    yfixes[nb_yfixes++] = ind | addr;
+    yfixes[nb_yfixes++] = c;
+}
+
+/* ldd r, Y+c */
+static void gldd_y(int r, int c)
+{
+    AVR_DEBUG("ldd r%d, Y@%d\n", r, c);
+    gfix_y(c, 0);
+    _LDDYq(r, 0);
+}
+
+/* std Y+c, r */
+static void gstd_y(int r, int c)
+{
+    AVR_DEBUG("std Y@%d, r%d\n", c, r);
+    gfix_y(c, 0);
+    _STDYq(r, 0);
+}
+
+/* patch 'subi' and 'sbci' at 'a' to subtract 'k' */
+static void gpatch_subi(int a, int k)
+{
+    write16(a, (read16(a) & 0xF0F0) | ((k & 0xF0) << 4) | (k & 0xF));
+    k >>= 8;
+    write16(a + 2, (read16(a + 2) & 0xF0F0) | ((k & 0xF0) << 4) | (k & 0xF));
+}
+
+/* copy 's'+1:'s' to 'd2':'d', with movw when the device has it and both
+   are register pairs */
+static void gmovw(int d, int d2, int s)
+{
+    if (avr_have(AVR_HAVE_MOVW) && !(d & 1) && d2 == d + 1 && !(s & 1)) {
+        AVR_DEBUG("movw r%d, r%d\n", d, s);
+        _MOVW(d, s);
+    } else {
+        AVR_DEBUG("mov r%d, r%d\nmov r%d, r%d\n", d, s, d2, s + 1);
+        _MOV(d, s);
+        _MOV(d2, s + 1);
+    }
+}
+
+/* set 'r':'r2' to the address of the frame offset 'c'. Both registers
+   must accept immediate operands */
+ST_FUNC void gen_local_addr(int r, int r2, int c)
+{
+    AVR_DEBUG("# gen_local_addr(r=%d, r2=%d, c=%d)\n", r, r2, c);
+    r = reg_idx[r];
+    r2 = reg_idx[r2];
+    if (r < 16 || r2 < 16)
+        tcc_error("XXX: local address in r%d:r%d unsupported", r2, r);
+    gmovw(r, r2, 28);
+    /* subtract the negated displacement, as for the frame offsets */
+    AVR_DEBUG("subi/sbci r%d, -(Y@%d)\n", r, c);
+    gfix_y(c, 1);
+    _SUBI(r, 0);
+    _SBCI(r2, 0);
+}
+
+/* load the constant byte 'k' in register 'r' */
+static void gloadi(int r, int k)
+{
+    k &= 0xFF;
+    if (reg_idx[r] >= 16) {
+        AVR_DEBUG("ldi %s, %d\n", reg_names[r], k);
+        _LDI(reg_idx[r], k);
+    } else if (k == 0 || k == 1) {
+        AVR_DEBUG("mov %s, r1\n", reg_names[r]);
+        _MOV(reg_idx[r], ZERO_REG);
+        if (k) {
+            AVR_DEBUG("inc %s\n", reg_names[r]);
+            _INC(reg_idx[r]);
+        }
+    } else {
+        /* through r31, which is saved */
+        AVR_DEBUG("push r31\nldi r31, %d\nmov %s, r31\npop r31\n",
+                  k, reg_names[r]);
+        _PUSH(31);
+        _LDI(31, k);
+        _MOV(reg_idx[r], 31);
+        _POP(31);
+    }
+}
+
+/* relocation of 'type' at 'offset' of the code to 'sym' + 'addend' */
+static void greloca(Sym *sym, int offset, int type, int addend)
+{
+    ElfW_Rel *rel;
+
+    greloc(cur_text_section, sym, offset, type);
+    rel = (ElfW_Rel *)(cur_text_section->reloc->data +
+                       cur_text_section->reloc->data_offset) - 1;
+    rel->r_addend = addend;
+}
+
+/* load in register 'r' the byte 'i' of the address of 'sym' + 'addend',
+   a word address for the functions */
+static void gloadsym(int r, Sym *sym, int addend, int i)
+{
+    int d, type;
+
+    if (i >= PTR_SIZE) {
+        gloadi(r, 0);
+        return;
+    }
+    if ((sym->type.t & VT_BTYPE) == VT_FUNC)
+        type = i ? R_AVR_HI8_LDI_PM : R_AVR_LO8_LDI_PM;
+    else
+        type = i ? R_AVR_HI8_LDI : R_AVR_LO8_LDI;
+    d = reg_idx[r];
+    if (d < 16) {
+        /* through r31, which is saved */
+        AVR_DEBUG("push r31\n");
+        _PUSH(31);
+    }
+    AVR_DEBUG("ldi r%d, %s(%s%+d)\n", d < 16 ? 31 : d,
+              type == R_AVR_LO8_LDI ? "lo8" : type == R_AVR_HI8_LDI ? "hi8" :
+              type == R_AVR_LO8_LDI_PM ? "pm_lo8" : "pm_hi8",
+              get_tok_str(sym->v, NULL), addend);
+    greloca(sym, ind, type, addend);
+    _LDI(d < 16 ? 31 : d, 0);
+    if (d < 16) {
+        AVR_DEBUG("mov r%d, r31\npop r31\n", d);
+        _MOV(d, 31);
+        _POP(31);
+    }
+}
+
+/* return true if a value of the value stack uses r30 or r31 */
+static int gz_used(void)
+{
+    SValue *p;
+    int i, r;
+
+    for (p = vstack; p <= vtop; p++) {
+        for (i = 0; i < 8; i++) {
+            r = (&p->r)[i] & VT_VALMASK;
+            if (r == TREG_R30 || r == TREG_R31)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* point Z at the address held in the registers of the lvalue 'sv', or
+   saved on the stack by save_reg() (VT_LLOCAL). Z is pushed first when it
+   is in use, the return value telling to pop it */
+static int gload_z(SValue *sv)
+{
+    int v, lo, hi, saved;
+
+    v = sv->r & VT_VALMASK;
+    lo = v < VT_CONST ? reg_idx[v] : -1;
+    hi = (sv->r2 & VT_VALMASK) < VT_CONST ? reg_idx[sv->r2 & VT_VALMASK]
+                                          : ZERO_REG;
+    if (lo == 30 && hi == 31)
+        return 0;
+    saved = gz_used();
+    if (saved) {
+        AVR_DEBUG("push r30\npush r31\n");
+        _PUSH(30);
+        _PUSH(31);
+    }
+    if (v == VT_LLOCAL) {
+        gldd_y(30, sv->c.ul);
+        gldd_y(31, sv->c.ul + 1);
+    } else {
+        if (lo == 31) {
+            AVR_DEBUG("mov r0, r31\n");
+            _MOV(TMP_REG, 31);
+            lo = TMP_REG;
+        }
+        AVR_DEBUG("mov r31, r%d\nmov r30, r%d\n", hi, lo);
+        _MOV(31, hi);
+        _MOV(30, lo);
+    }
+    return saved;
+}
+
+/* restore Z pushed by gload_z() */
+static void gpop_z(void)
+{
+    AVR_DEBUG("pop r31\npop r30\n");
+    _POP(31);
+    _POP(30);
+}
+
 /* load 'r' from value 'sv' */
 ST_FUNC void load(int r, SValue *sv)
 {
@@ -351,28 +964,60 @@ ST_FUNC void load(int r, SValue *sv)
 
     if ((fr & VT_LVAL) && (v == VT_LOCAL)) {
         /* Load lvalue from stack */
-        fc = fc < 0? -fc : fc; /* XXX */
-        AVR_DEBUG("ldd %s, Y%+d\n", reg_names[r], fc);
-        _LDDYq(reg_idx[r], fc);
+        gldd_y(reg_idx[r], fc);
+    } else if ((fr & (VT_LVAL | VT_SYM)) == (VT_LVAL | VT_SYM) &&
+               v == VT_CONST && SYM_GLOBAL_REG(sv->sym)) {
+        /* global register variable */
+        fc += SYM_GLOBAL_REG(sv->sym);
+        AVR_DEBUG("mov %s, r%d\n", reg_names[r], fc);
+        _MOV(reg_idx[r], fc);
+    } else if ((fr & VT_LVAL) && v == VT_CONST) {
+        /* global or absolute address */
+        AVR_DEBUG("lds %s, %s%+d\n", reg_names[r],
+                  fr & VT_SYM ? get_tok_str(sv->sym->v, NULL) : "", fc);
+        if (fr & VT_SYM) {
+            greloca(sv->sym, ind + 2, R_AVR_16, fc);
+            fc = 0;
+        }
+        _LDS(reg_idx[r], fc);
+    } else if ((fr & VT_LVAL) && (v < VT_CONST || v == VT_LLOCAL)) {
+        /* through a pointer */
+        if (gload_z(sv)) {
+            AVR_DEBUG("ld r0, Z\nmov %s, r0\n", reg_names[r]);
+            _LDZ(TMP_REG);
+            gpop_z();
+            _MOV(reg_idx[r], TMP_REG);
+        } else {
+            AVR_DEBUG("ld %s, Z\n", reg_names[r]);
+            _LDZ(reg_idx[r]);
+        }
     } else if (v == VT_CONST) {
-        /* Load immediate */
+        /* Load immediate, the byte number of a symbol address being in
+           r2 (see gv_bytes()) */
+        if (fr & VT_SYM)
+            gloadsym(r, sv->sym, fc, sv->r2);
+        else
+            gloadi(r, fc);
+    } else if (v == VT_CMP) {
+        int s, set;
+        /* clearing does not touch the flags */
+        gloadi(r, 0);
+        gcond(fc, &s, &set);
+        gskip(s, !set);
         if (reg_idx[r] >= 16) {
-            AVR_DEBUG("ldi %s, %d\n", reg_names[r], fc);
-            _LDI(reg_idx[r], fc);
+            AVR_DEBUG("ldi %s, 1\n", reg_names[r]);
+            _LDI(reg_idx[r], 1);
         } else {
-            tcc_error("Unsupported\n");
+            AVR_DEBUG("inc %s\n", reg_names[r]);
+            _INC(reg_idx[r]);
         }
-    } else if (v == VT_CMP) {
-        //oad(0xb8 + r, 0); /* mov $0, r */
-        //o(0x0f); /* setxx %br */
-        //o(fc);
-        //o(0xc0 + r);
     } else if (v == VT_JMP || v == VT_JMPI) {
-        //t = v & 1;
-        //oad(0xb8 + r, t); /* mov $1, r */
-        //o(0x05eb); /* jmp after */
-        //gsym(fc);
-        //oad(0xb8 + r, t ^ 1); /* mov $0, r */
+        t = v & 1;
+        gloadi(r, t);
+        v = gjmp(0);
+        gsym(fc);
+        gloadi(r, t ^ 1);
+        gsym(v);
     } else if (v != r) {
         AVR_DEBUG("mov %s, %s\n", reg_names[r], reg_names[v]);
         _MOV(reg_idx[r], reg_idx[v]);
@@ -385,7 +1030,7 @@ ST_FUNC void store(int r, SValue * v)
 {
     AVR_DEBUG("# store(r=%d, v=%p)\n", r, v);
 
-    int fr, bt, ft, fc;
+    int fr, bt, ft, fc, s, saved;
 
     ft = v->type.t;
     fc = v->c.ul;
@@ -393,166 +1038,227 @@ ST_FUNC void store(int r, SValue * v)
     bt = ft & VT_BTYPE;
     printf("ft = %x, fc = %x, fr = %x, bt = %x\n", ft, fc, v->r, bt);
 
-    if (fr == VT_CONST) {   /* Constant memory reference */
+    if (fr == VT_CONST && (v->r & VT_SYM) && SYM_GLOBAL_REG(v->sym)) {
+        /* global register variable */
+        fc += SYM_GLOBAL_REG(v->sym);
+        AVR_DEBUG("mov r%d, %s\n", fc, reg_names[r]);
+        _MOV(fc, reg_idx[r]);
+    } else if (fr == VT_CONST) {   /* Constant memory reference */
+        AVR_DEBUG("sts %s%+d, %s\n",
+                  v->r & VT_SYM ? get_tok_str(v->sym->v, NULL) : "", fc,
+                  reg_names[r]);
         if (v->r & VT_SYM) {
-            AVR_DEBUG("Relocation\n");
+            greloca(v->sym, ind + 2, R_AVR_16, fc);
+            fc = 0;
         }
-        AVR_DEBUG("ldi r30, %x\n", fc & 0xFF);
-        _LDI(30, fc & 0xFF);
-
-        fc >>= 8;
-        AVR_DEBUG("ldi r31, %x\n", fc & 0xFF);
-        _LDI(31, fc & 0xFF);
-
-        AVR_DEBUG("st Z, %s\n", reg_names[r]);
-        _STZ(reg_idx[r]);
+        _STS(fc & 0xFFFF, reg_idx[r]);
     } else if (fr == VT_LOCAL) {    /* Offset on stack */
-        fc = fc < 0? -fc : fc; /* XXX */
-        AVR_DEBUG("std Y%+d, %s\n", fc, reg_names[r]);
-        _STDYq(reg_idx[r], fc);
+        gstd_y(reg_idx[r], fc);
     } else if (v->r & VT_LVAL) {
-        if (v->r & VT_LVAL_BYTE) {
-            fc = -fc;
-
-            AVR_DEBUG("mov r31, %s\n", reg_names[fr & VT_VALMASK]);
-            _MOV(31, reg_idx[fr & VT_VALMASK]);
-
-            AVR_DEBUG("mov r30, %s\n", reg_names[v->r2]);
-            _MOV(30, reg_idx[v->r2]);
-
-            AVR_DEBUG("st Z, %s\n", reg_names[r]);
-            _STZ(reg_idx[r]);
-        } else {
-            if ((fr & VT_VALMASK) == VT_LOCAL) {
-                AVR_DEBUG("std Y%+d, %s\n", -fc, reg_names[r]);
-                _STDYq(reg_idx[r], -fc);
-            }
+        /* through a pointer, 'r' may be r30 or r31 */
+        s = reg_idx[r];
+        if (s >= 30) {
+            AVR_DEBUG("mov r0, r%d\n", s);
+            _MOV(TMP_REG, s);
+            s = TMP_REG;
         }
+        saved = gload_z(v);
+        AVR_DEBUG("st Z, r%d\n", s);
+        _STZ(s);
+        if (saved)
+            gpop_z();
     } else if (fr != r) {
         AVR_DEBUG("mov %s, %s\n", reg_names[fr], reg_names[r]);
         _MOV(reg_idx[fr], reg_idx[r]);
     }
 }
 
+/* record a call for -fstack-usage */
+static void gstack_call(Sym *sym)
+{
+    if (nb_func_calls >= func_calls_allocated) {
+        func_calls_allocated = func_calls_allocated ? func_calls_allocated * 2 : 16;
+        func_calls = tcc_realloc(func_calls, func_calls_allocated * sizeof(Sym *));
+    }
+    func_calls[nb_func_calls++] = sym;
+}
+
+/* load in Z the function address on vtop, which gfunc_call() saved if
+   it was in registers: the other registers hold the arguments */
+static void gload_call_z(void)
+{
+    SValue sv;
+    int i, lo, hi;
+
+    if ((vtop->r & (VT_VALMASK | VT_LVAL)) < VT_CONST) {
+        lo = reg_idx[vtop->r & VT_VALMASK];
+        hi = reg_idx[vtop->r2 & VT_VALMASK];
+        AVR_DEBUG("mov r0, r%d\nmov r30, r%d\nmov r31, r0\n", hi, lo);
+        _MOV(TMP_REG, hi);
+        _MOV(30, lo);
+        _MOV(31, TMP_REG);
+        return;
+    }
+    if ((vtop->r & VT_LVAL) && (vtop->r & VT_VALMASK) != VT_LOCAL &&
+        (vtop->r & VT_VALMASK) != VT_CONST)
+        tcc_error("XXX: indirect call through this address unsupported");
+    for (i = 0; i < PTR_SIZE; i++) {
+        sv = *vtop;
+        sv.type.t = VT_BYTE;
+        if (sv.r & VT_LVAL)
+            sv.c.ul += i;
+        else if (sv.r & VT_SYM)
+            sv.r2 = i; /* byte number, see gv_bytes() */
+        else
+            sv.c.ul = (vtop->c.ul >> (i * 8)) & 0xFF;
+        load(TREG_R30 + i, &sv);
+    }
+}
+
 /* 'is_jmp' is '1' if it is a jump */
 ST_FUNC void gcall_or_jmp(int is_jmp)
 {
     AVR_DEBUG("# gcall_or_jmp(is_jmp=%d)\n", is_jmp);
-    int r;
-    if ((vtop->r & (VT_VALMASK | VT_LVAL)) == VT_CONST) {
-        /* constant case */
-        if (vtop->r & VT_SYM) {
-            /* relocation case */
-            greloc(cur_text_section, vtop->sym,
-                   ind, R_AVR_13_PCREL);
+    if (tcc_state->stack_usage)
+        gstack_call((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) ==
+                    (VT_CONST | VT_SYM) ? vtop->sym : NULL);
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == (VT_CONST | VT_SYM)) {
+        /* relocation case: 'rcall' and 'rjmp' reach 4K bytes, the
+           devices with more flash have 'call' and 'jmp' */
+        greloca(vtop->sym, ind,
+                avr_have(AVR_HAVE_JMP_CALL) ? R_AVR_CALL : R_AVR_13_PCREL,
+                vtop->c.ul);
+        AVR_DEBUG("%s %s\n", is_jmp ? "jmp" : "call",
+                  get_tok_str(vtop->sym->v, NULL));
+        if (avr_have(AVR_HAVE_JMP_CALL)) {
+            if (is_jmp)
+                _JMP(0);
+            else
+                _CALL(0);
         } else {
-            AVR_DEBUG("reolcation PC\n");
-            /* put an empty PC32 relocation */
-            /*put_elf_reloc(symtab_section, cur_text_section,
-                          ind + 1, R_X86_64_PC32, 0);*/
+            if (is_jmp)
+                _RJMP(0);
+            else
+                _RCALL(0);
         }
-        //oad(0xe8 + is_jmp, vtop->c.ul - 4); /* call/jmp im */
-        if (is_jmp) {
-
+    } else {
+        /* indirect call, also for an absolute address */
+        gload_call_z();
+        AVR_DEBUG("%s%s\n", avr_have(AVR_HAVE_EIJMP_EICALL) ? "ei" : "i",
+                  is_jmp ? "jmp" : "call");
+        if (avr_have(AVR_HAVE_EIJMP_EICALL)) {
+            if (is_jmp)
+                _EIJMP();
+            else
+                _EICALL();
         } else {
-            AVR_DEBUG("rcall .%s\n", get_tok_str(vtop->sym->v, NULL));
-            _RCALL(vtop->c.ul);
+            if (is_jmp)
+                _IJMP();
+            else
+                _ICALL();
         }
+    }
+}
+
+/* copy Y to the stack pointer, interrupts being disabled while SPH and
+   SPL do not match ('out SPL' is done with interrupts still masked) */
+static void gset_sp(void)
+{
+    if (avr_have(AVR_HAVE_8BIT_SP)) {
+        AVR_DEBUG("out SPL, r28\n");
+        _OUT(IO_SPL, 28);
+        return;
+    }
+    AVR_DEBUG("in r0, SREG\ncli\nout SPH, r29\nout SREG, r0\nout SPL, r28\n");
+    _IN(TMP_REG, IO_SREG);
+    _CLI();
+    _OUT(IO_SPH, 29);
+    _OUT(IO_SREG, TMP_REG);
+    _OUT(IO_SPL, 28);
+}
+
+/* -mcall-prologues: the frame is set up and torn down by the shared
+   helpers of lib/avr-prologue.S, which also save and restore r(18-n)
+   to r17, n being given by the entry point. For a function saving m
+   registers, they save 2m+7 words but cost 11 cycles and more per
+   call, so they are only used from AVR_HELPER_MIN_REGS saved registers
+   on. They return with ijmp and need SPH */
+#define AVR_HELPER_MIN_REGS 4
+
+static int avr_call_prologues(void)
+{
+    return tcc_state->avr_call_prologues &&
+           !avr_have(AVR_HAVE_8BIT_SP) && !avr_have(AVR_HAVE_EIJMP_EICALL);
+}
+
+/* jump to the helper 'v', at its instruction 'k' */
+static void gjmp_helper(int v, int k)
+{
+    Sym *sym;
+
+    sym = external_global_sym(v, &func_old_type, 0);
+    AVR_DEBUG("%s %s+%d\n", avr_have(AVR_HAVE_JMP_CALL) ? "jmp" : "rjmp",
+              get_tok_str(v, NULL), 2 * k);
+    if (avr_have(AVR_HAVE_JMP_CALL)) {
+        greloca(sym, ind, R_AVR_CALL, 2 * k);
+        _JMP(0);
     } else {
-        AVR_DEBUG("indirect\n");
-        /* otherwise, indirect call */
-        //r = TREG_R11;
-        //load(r, vtop);
-        //o(0x41); /* REX */
-        //o(0xff); /* call/jmp *r */
-        //o(0xd0 + REG_VALUE(r) + (is_jmp << 4));
+        greloca(sym, ind, R_AVR_13_PCREL, 2 * k);
+        _RJMP(0);
     }
 }
 
-#define NB_ARG_REGS 18
-static int arg_regs[] = {
-    TREG_R25,
-    TREG_R24,
-    TREG_R23,
-    TREG_R22,
-    TREG_R21,
-    TREG_R20,
-    TREG_R19,
-    TREG_R18,
-    TREG_R17,
-    TREG_R16,
-    TREG_R15,
-    TREG_R14,
-    TREG_R13,
-    TREG_R12,
-    TREG_R11,
-    TREG_R10,
-    TREG_R9,
-    TREG_R8,
-};
+/* first register of each of the 'nb_args' arguments of types 'types'.
+   As with avr-gcc, arguments are allocated from r25 down to r8, each
+   one starting at an even register */
+static void gfunc_arg_regs(int *regs, CType **types, int nb_args)
+{
+    int i, size, align, reg;
 
-static int arg_regs_class[] = {
-    RC_R25,
-    RC_R24,
-    RC_R23,
-    RC_R22,
-    RC_R21,
-    RC_R20,
-    RC_R19,
-    RC_R18,
-    //TREG_R17,
-    //TREG_R16,
-    //TREG_R15,
-    //TREG_R14,
-    //TREG_R13,
-    //TREG_R12,
-    //TREG_R11,
-    //TREG_R10,
-    //TREG_R9,
-    //TREG_R8,
-};
+    reg = 26;
+    for (i = 0; i < nb_args; i++) {
+        if ((types[i]->t & VT_BTYPE) == VT_STRUCT)
+            tcc_error("Struct arguments are not yet supported");
+        /* an array is passed by address */
+        if (types[i]->t & VT_ARRAY)
+            size = PTR_SIZE;
+        else
+            size = type_size(types[i], &align);
+        reg -= (size + 1) & ~1;
+        if (reg < 8)
+            tcc_error("arguments passed by stack is not yet supported");
+        if (avr_global_regs & (((1u << size) - 1) << reg))
+            tcc_error("argument %d would be passed in r%d, taken by a "
+                      "global register variable", i + 1, reg);
+        regs[i] = reg;
+    }
+}
 
 /* generate function call with address in (vtop->t, vtop->c) and free function
    context. Stack entry is popped */
 ST_FUNC void gfunc_call(int nb_args)
 {
     AVR_DEBUG("# gfunc_call(nb_args=%d)\n", nb_args);
-    int size, type, align, args_size, i;
-    int reg_index = 0;
-
-    for (i = 0; i < nb_args; i++) {
-        type = vtop->type.t & VT_BTYPE;
-        if (type == VT_STRUCT ||
-            type == VT_LDOUBLE) {
-            tcc_error("Struct and long double arguments are not yet supported");
-        //} else if (is_sse_float(vtop->type.t)) {
-            //int j = --sse_reg;
-            //if (j < 8) {
-            //    gv(RC_FLOAT); /* only one float register */
-            //    /* movaps %xmm0, %xmmN */
-            //    o(0x280f);
-            //    o(0xc0 + (sse_reg << 3));
-            //}
-        } else {
-            if (reg_index < NB_ARG_REGS) {
-                size = type_size(vtop, &align);
-                switch (size) {
-                case 8:
-                    tcc_error("64-bit argument size is not yet supported");
-                case 4:
-                    tcc_error("32-bit argument size is not yet supported");
-                case 2: /* Choose the odd valued register */
-                    gv(arg_regs_class[reg_index]);
-                case 1: /* Choose the even-valued register */
-                    gv(arg_regs_class[reg_index+1]);
-                }
-                reg_index += size;
-            } else {
-                tcc_error("arguments passed by stack is not yet supported");
-            }
-        }
-        vtop--;
+    int i, regs[9];
+    CType *types[9];
+
+    if (nb_args > 9)
+        tcc_error("arguments passed by stack is not yet supported");
+    /* the last argument is on top of the stack */
+    for (i = 0; i < nb_args; i++)
+        types[i] = &vtop[i + 1 - nb_args].type;
+    gfunc_arg_regs(regs, types, nb_args);
+
+    /* every register is clobbered by the call */
+    save_regs(nb_args);
+
+    /* load the arguments from the last one, keeping them on the stack
+       so that their registers are not reused */
+    for (i = nb_args - 1; i >= 0; i--) {
+        gv(RC_R(regs[i]));
+        vrott(nb_args);
     }
+    vtop -= nb_args;
 
     gcall_or_jmp(0);
     vtop--;
@@ -565,294 +1271,2117 @@ ST_FUNC void gfunc_prolog(CType *func_type)
     AVR_DEBUG("# gfunc_prolog(func_type=%p)\n", func_type);
 
     Sym *sym;
-    int n, addr, size, align;
+    int n, addr, size, align, i, regs[9];
+    CType *types[9];
 
     sym = func_type->ref;
     func_vt = sym->type;
 
-    int reg_index = 0;
-
-    addr = 1;
-    int i = 0, r, off;
-
-    while (sym = sym->next) {
-        CType *type;
-        type = &sym->type;
-        size = type_size(type, &align);
-
-        if (reg_index < 10) {   /* Arguments passed by registers */
-            switch (size) {
-            case 8:
-                tcc_error("64-bit argument size is not yet supported");
-            case 4:
-                tcc_error("32-bit argument size is not yet supported");
-            case 2: /* Choose the odd valued register */
-                AVR_DEBUG("std Y%+d, %s\n", reg_index + 2, reg_names[arg_regs[reg_index]]);
-                r = reg_idx[arg_regs[reg_index]];
-                off = reg_index + 2;
-                o4(0x8 | ((off >> 4) & 0x2), 0x2 | ((off >> 3) & 0x3) | ((r >> 4) & 1), (r & 0xF), 0x8 | off & 0x7);
-            case 1: /* Choose the even-valued register */
-                AVR_DEBUG("std Y%+d, %s\n", reg_index + 1, reg_names[arg_regs[reg_index + 1]]);
-                r = reg_idx[arg_regs[reg_index + 1]];
-                off = reg_index + 1;
-                o4(0x8 | ((off >> 4) & 0x2), 0x2 | ((off >> 3) & 0x3) | ((r >> 4) & 1), (r & 0xF), 0x8 | off & 0x7);
-            }
-            reg_index += size;
-        } else {
+    /* frame setup, the frame size being patched by gfunc_epilog(),
+       which may also replace it by a jump to the frame helper */
+    AVR_DEBUG("push r28\npush r29\nin r28, SPL\n");
+    _PUSH(28);
+    _PUSH(29);
+    _IN(28, IO_SPL);
+    if (avr_have(AVR_HAVE_8BIT_SP)) {
+        AVR_DEBUG("clr r29\n");
+        _EOR(29, 29);
+    } else {
+        AVR_DEBUG("in r29, SPH\n");
+        _IN(29, IO_SPH);
+    }
+    func_sub_sp_offset = ind;
+    AVR_DEBUG("subi r28, lo(frame)\nsbci r29, hi(frame)\n");
+    _SUBI(28, 0);
+    _SBCI(29, 0);
+    gset_sp();
+    func_frame_end = ind;
+    func_helpers = 0;
+    loc = 0;
+    nb_yfixes = 0;
+    func_saved_regs = 0;
+    nb_func_calls = 0;
+    nb_loop_bounds = 0;
+    nb_cold_blocks = 0;
+    func_has_asm = 0;
+
+    n = 0;
+    while ((sym = sym->next) != NULL) {
+        if (n >= 9)
             tcc_error("arguments passed by stack is not yet supported");
-        }
-
-        sym_push(sym->v & ~SYM_FIELD, type, VT_LOCAL | lvalue_type(type->t), addr);
+        types[n++] = &sym->type;
+    }
+    gfunc_arg_regs(regs, types, n);
 
-        AVR_DEBUG("# gfun_prolog: arg[%d] at stack ptr %i [%d bytes]\n", i++, addr, size);
+    /* arguments are saved above the locals */
+    addr = 0;
+    sym = func_type->ref;
+    for (n = 0; (sym = sym->next) != NULL; n++) {
+        size = type_size(&sym->type, &align);
+        for (i = 0; i < size; i++)
+            gstd_y(regs[n] + i, addr + i);
+        sym_push(sym->v & ~SYM_FIELD, &sym->type,
+                 VT_LOCAL | lvalue_type(sym->type.t), addr);
+        AVR_DEBUG("# gfun_prolog: arg[%d] at stack ptr %i [%d bytes]\n", n, addr, size);
         addr += size;
     }
+    func_args_size = addr;
 }
 
-/* generate function epilog */
-ST_FUNC void gfunc_epilog(void)
+/* the 'ldd' or 'std' at 'a' cannot reach the displacement 'q': replace
+   it by an rjmp to a copy emitted here, which moves Y by 'q' around it.
+   The flags are kept in r0, or in r1 when r0 is the accessed register */
+static void gfar_y(int a, int q)
 {
-    AVR_DEBUG("# gfun_epilog()\n");
-    AVR_DEBUG("ret\n");
-    _RET();
-    AVR_DEBUG("//------------------------------------//\n");
+    int w, s, k;
+
+    w = read16(a);
+    s = ((w >> 4) & 0x1F) == TMP_REG ? ZERO_REG : TMP_REG;
+    k = (ind - a - 2) >> 1;
+    if (k > 2047)
+        tcc_error("jump out of range");
+    write16(a, 0xC000 | k);
+    AVR_DEBUG("push r%d\nin r%d, SREG\nsubi/sbci r28, -%d\n", s, s, q);
+    _PUSH(s);
+    _IN(s, IO_SREG);
+    _SUBI(28, -q & 0xFF);
+    _SBCI(29, (-q >> 8) & 0xFF);
+    gen_le16(w);
+    AVR_DEBUG("subi/sbci r28, %d\nout SREG, r%d\npop r%d\n", q, s, s);
+    _SUBI(28, q & 0xFF);
+    _SBCI(29, (q >> 8) & 0xFF);
+    _OUT(IO_SREG, s);
+    _POP(s);
+    gjmp_addr(a + 2);
 }
 
-/* generate a jump to a label */
-ST_FUNC int gjmp(int t)
+/* the first instruction of the function, which cannot depend on the
+   registers, becomes an rjmp to a copy emitted here after the pushes of
+   the call-saved registers in 'func_saved_regs' */
+static void gsave_regs(void)
 {
-    AVR_DEBUG("# gjmp(t=%d)\n", t);
-    int r = ind;
-    AVR_DEBUG("rjmp .%+d\n", t);
-    _RJMP(t);
-    return r;
+    int w, k, i;
+
+    w = read16(func_ind);
+    k = (ind - func_ind - 2) >> 1;
+    if (k > 2047)
+        tcc_error("jump out of range");
+    write16(func_ind, 0xC000 | k);
+    for (i = 2; i < 18; i++) {
+        if (func_saved_regs & (1 << i)) {
+            AVR_DEBUG("push r%d\n", i);
+            _PUSH(i);
+        }
+    }
+    gen_le16(w);
+    gjmp_addr(func_ind + 2);
 }
 
-/* generate a jump to a fixed address */
-ST_FUNC void gjmp_addr(int a)
+/* -mcall-prologues: replace the frame setup of the prolog by a jump to
+   __prologue_saves__ saving r(18-n) to r17, which returns through Z to
+   the end of the replaced code */
+static void gprologue_helper(int n, int size)
 {
-    AVR_DEBUG("# gjmp_addr(a=%d)\n", a);
+    Sym *sym;
+    int a;
+
+    a = ind;
+    ind = func_ind;
+    sym = get_sym_ref(&func_old_type, cur_text_section, func_frame_end, 0);
+    AVR_DEBUG("ldi r26, lo(frame)\nldi r27, hi(frame)\n");
+    _LDI(26, size & 0xFF);
+    _LDI(27, (size >> 8) & 0xFF);
+    AVR_DEBUG("ldi r30, pm_lo8(.+%d)\nldi r31, pm_hi8(.+%d)\n",
+              func_frame_end - ind, func_frame_end - ind);
+    greloca(sym, ind, R_AVR_LO8_LDI_PM, 0);
+    _LDI(30, 0);
+    greloca(sym, ind, R_AVR_HI8_LDI_PM, 0);
+    _LDI(31, 0);
+    gjmp_helper(TOK___prologue_saves__, 16 - n);
+    ind = a;
 }
 
-/* generate a test. set 'inv' to invert test. Stack entry is popped */
-ST_FUNC int gtst(int inv, int t)
+/* generate function epilog */
+ST_FUNC void gfunc_epilog(void)
 {
-    AVR_DEBUG("# gtst(inv=%d, t=%d)\n", inv, t);
+    int i, a, c, q, m, n, size;
 
-    int v, *p;
+    AVR_DEBUG("# gfun_epilog()\n");
 
-    v = vtop->r & VT_VALMASK;
-    AVR_DEBUG("v = %X\n", v);
-    if (v == VT_CMP) {
-        /* fast case : can jump directly since flags are set */
-        v = ind;
-        switch ((vtop->c.ui)) {
-        case TOK_GT:
-            AVR_DEBUG("brlt .%+d\n", t);
-            _BRLT(t);
-            break;
-        case TOK_LT:
-            AVR_DEBUG("brge .%+d\n", t);
-            _BRGE(t);
-            break;
-        }
-        t = v;
-    } else if (v == VT_JMP || v == VT_JMPI) {
-        /* && or || optimization */
-        //if ((v & 1) == inv) {
-        //    /* insert vtop->c jump list in t */
-        //    p = &vtop->c.i;
-        //    while (*p != 0)
-        //        p = (int *)(cur_text_section->data + *p);
-        //    *p = t;
-        //    t = vtop->c.i;
-        //} else {
-        //    t = gjmp(t);
-        //    gsym(vtop->c.i);
-        //}
+    size = func_args_size - loc;
+    gpatch_subi(func_sub_sp_offset, size);
+    func_frame_size = size;
+    /* the global register variables are not restored */
+    func_saved_regs &= ~avr_global_regs;
+
+    /* the helpers save r(18-n) to r17 */
+    m = 0;
+    for (i = 2; i < 18; i++)
+        m += (func_saved_regs >> i) & 1;
+    for (n = 16; n > 0 && !(func_saved_regs & (1 << (18 - n))); n--)
+        ;
+    if (avr_call_prologues() && m >= AVR_HELPER_MIN_REGS &&
+        !(avr_global_regs & (((1 << n) - 1) << (18 - n)))) {
+        func_helpers = 1;
+        func_saved_regs = ((1 << n) - 1) << (18 - n);
+        gprologue_helper(n, size);
+        AVR_DEBUG("subi r28, lo(-frame)\nsbci r29, hi(-frame)\n");
+        _SUBI(28, -size & 0xFF);
+        _SBCI(29, (-size >> 8) & 0xFF);
+        AVR_DEBUG("ldi r30, %d\n", n + 2);
+        _LDI(30, n + 2);
+        gjmp_helper(TOK___epilogue_restores__, 16 - n);
     } else {
-        //if (is_float(vtop->type.t) || 
-        //    (vtop->type.t & VT_BTYPE) == VT_LLONG) {
-        //    vpushi(0);
-        //    gen_op(TOK_NE);
-        //}
-        if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
-            /* constant jmp optimization */
-            if ((vtop->c.i != 0) != inv) 
-                t = gjmp(t);
-
-            /* Otherwise fall through */
-        } else {
-            int type = vtop->type.t;
-            if (type == VT_BYTE) {
-                v = gv(RC_BYTE);
-                AVR_DEBUG("and %s, %s\n", reg_names[v], reg_names[v]);
-                _AND(reg_idx[v], reg_idx[v]);
-                int r = ind;
-                AVR_DEBUG("breq .%+d\n", t);
-                _BREQ(t);
-                t = r;
-            } else if (type == VT_INT) {
-
-            } else {
-                /* XXX */
+        AVR_DEBUG("subi r28, lo(-frame)\nsbci r29, hi(-frame)\n");
+        _SUBI(28, -size & 0xFF);
+        _SBCI(29, (-size >> 8) & 0xFF);
+        gset_sp();
+        AVR_DEBUG("pop r29\npop r28\n");
+        _POP(29);
+        _POP(28);
+        for (i = 17; i >= 2; i--) {
+            if (func_saved_regs & (1 << i)) {
+                AVR_DEBUG("pop r%d\n", i);
+                _POP(i);
             }
-        //    v = gv(RC_INT);
-        //    o(0x85);
-        //    o(0xc0 + v * 9);
-        //    g(0x0f);
-        //    t = psym(0x85 ^ inv, t);
         }
+        AVR_DEBUG("ret\n");
+        _RET();
+        if (func_saved_regs)
+            gsave_regs();
     }
 
-    --vtop;
-    return t;
+    /* patch the frame offsets */
+    for (i = 0; i < nb_yfixes; i += 2) {
+        a = yfixes[i];
+        c = yfixes[i + 1];
+        q = c - loc + 1;
+        if (a & 1) {
+            /* address of a local, see gen_local_addr() */
+            gpatch_subi(a - 1, -q);
+        } else if (q > 63) {
+            gfar_y(a, q);
+        } else {
+            write16(a, read16(a) | ((q & 0x20) << 8) | ((q & 0x18) << 7) | (q & 7));
+        }
+    }
+    AVR_DEBUG("//------------------------------------//\n");
 }
 
-/* generate an integer binary operation */
-ST_FUNC void gen_opi(int op)
+static void put_word(unsigned char *p, unsigned w)
 {
-    AVR_DEBUG("# gen_opi(op=%d)\n", op);
+    p[0] = w;
+    p[1] = w >> 8;
+    p[2] = w >> 16;
+    p[3] = w >> 24;
+}
 
-    int r, _op, t;
-    unsigned c, _c;
+/* -fstack-usage: record in .stack_usage the stack used by the function
+   'sym' and the functions it calls, for the linker (see stack_usage()
+   in tccelf.c). A record is made of 32 bit words: the function, the
+   size of its frame, the bytes pushed (return address, r28, r29 and
+   the call-saved registers), the number of calls and the callees, 0
+   without relocation for an indirect call */
+ST_FUNC void gen_stack_usage(Sym *sym)
+{
+    Section *s;
+    unsigned char *p;
+    int i, n, offset;
+
+    s = NULL;
+    for (i = 1; i < tcc_state->nb_sections; i++)
+        if (!strcmp(tcc_state->sections[i]->name, ".stack_usage"))
+            s = tcc_state->sections[i];
+    if (!s) {
+        s = new_section(tcc_state, ".stack_usage", SHT_PROGBITS, 0);
+        s->sh_addralign = 4;
+    }
+    offset = s->data_offset;
+    p = section_ptr_add(s, 16 + 4 * nb_func_calls);
+    put_word(p + 4, func_frame_size);
+    n = 0;
+    for (i = 2; i < 18; i++)
+        n += (func_saved_regs >> i) & 1;
+    put_word(p + 8, (avr_have(AVR_HAVE_EIJMP_EICALL) ? 3 : 2) + 2 + n);
+    put_word(p + 12, nb_func_calls);
+    greloc(s, sym, offset, R_AVR_32);
+    for (i = 0; i < nb_func_calls; i++)
+        if (func_calls[i])
+            greloc(s, func_calls[i], offset + 16 + 4 * i, R_AVR_32);
+}
 
-    switch (op) {
-    case '+':
-    case TOK_ADDC1: /* add with carry */
-        _op = 0; /* Add */
-    gen_op:
-        if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
-            /* Immediate Operand */
-            int r2;
-            vswap();
-            t = vtop->type.t & VT_BTYPE;
+/* ------------------------------------------------------------------------- */
+/* cycle estimation
 
-            if (t == VT_BYTE) {
-                r = gv(RC_BYTE);
-            } else {
-                r = gv(RC_INT);
-                r2 = vtop->r2;
-            }
+   gen_cycles() rebuilds the basic blocks of the function just generated
+   from its jumps. An edge between two blocks carries the cycles of the
+   first one, with its last branch taken or not. The loops are the
+   targets of the back edges of a depth first search: they are collapsed
+   from the innermost one into edges leaving their header, with the
+   bounds given by gloop_bound(). The best and worst cycles are then the
+   shortest and longest paths of the remaining acyclic graph. Calls cost
+   the cycles of the callee when it was analyzed before */
 
-            vswap();
-            c = vtop->c.ui;
+#define CYC_INF ((long long)1 << 50) /* unbounded */
 
-            if (t == VT_BYTE) {
-                switch (_op) {
-                case TOK_GT:
-                    c += 1;
-                case TOK_LT:
-                    AVR_DEBUG("cpi %s, %d\n", reg_names[r], c);
-                    _CPI(reg_idx[r], c);
-                    break;
-                default:
-                    if (reg_idx[r] >= 16) {   /* Can use subi */
-                        c = _op? -c : c;
-                        AVR_DEBUG("subi %s, %d\n", reg_names[r], c & 0xFF);
-                        _SUBI(reg_idx[r], c);
-                    } else {
-                        tcc_error("XXX: Operation on register unsupported");
-                    }
+/* kinds of instructions, see avr_insn() */
+enum {
+    INSN_NEXT,      /* continues with the next instruction */
+    INSN_BRANCH,    /* conditional branch */
+    INSN_JUMP,      /* relative jump */
+    INSN_SKIP,      /* skips the next instruction if a condition holds */
+    INSN_CALL,      /* call, the callee being known from a relocation */
+    INSN_RET,       /* return */
+    INSN_INDIRECT,  /* jump to an unknown address */
+};
+
+typedef struct CycEdge {
+    int from, to;           /* blocks, 'to' being -1 for a return */
+    long long best, worst;
+    int back;               /* back edge of the last search */
+    int loop;               /* edge leaving the collapsed loop 'from' */
+    long long iter;         /* its worst number of iterations */
+} CycEdge;
+
+static CycEdge *cyc_edges;
+static int nb_cyc_edges, cyc_edges_allocated;
+static char cyc_reason[256]; /* why the worst case is unbounded */
+
+/* the loop whose header is at 'a' jumps back to it 'min' to 'max'
+   times each time it is entered */
+ST_FUNC void gloop_bound(int a, int min, int max)
+{
+    if (nocode_wanted)
+        return;
+    if (nb_loop_bounds + 3 > loop_bounds_allocated) {
+        loop_bounds_allocated = loop_bounds_allocated ? loop_bounds_allocated * 2 : 48;
+        loop_bounds = tcc_realloc(loop_bounds, loop_bounds_allocated * sizeof(int));
+    }
+    loop_bounds[nb_loop_bounds++] = a;
+    loop_bounds[nb_loop_bounds++] = min;
+    loop_bounds[nb_loop_bounds++] = max;
+}
+
+static long long cyc_add(long long a, long long b)
+{
+    return a + b >= CYC_INF ? CYC_INF : a + b;
+}
+
+static long long cyc_mul(long long a, long long n)
+{
+    if (a == 0 || n == 0)
+        return 0;
+    return a >= CYC_INF / n ? CYC_INF : a * n;
+}
+
+static void cyc_unbounded(const char *fmt, const char *name, int a)
+{
+    char buf[64];
+
+    if (cyc_reason[0])
+        return;
+    if (name) {
+        pstrcpy(cyc_reason, sizeof(cyc_reason), fmt);
+        pstrcat(cyc_reason, sizeof(cyc_reason), name);
+        pstrcat(cyc_reason, sizeof(cyc_reason), "'");
+    } else {
+        snprintf(buf, sizeof(buf), fmt, a);
+        pstrcpy(cyc_reason, sizeof(cyc_reason), buf);
+    }
+}
+
+/* decode the instruction at 'a': return its kind, its size in bytes in
+   'size', its cycles when it does not branch in 'cycles' and the target
+   of a branch or relative jump in 'target'. The cycles are those of
+   the classic cores, a call or return taking one more cycle with a 3
+   byte PC. A skip takes 1 more cycle per word skipped */
+static int avr_insn(int a, int *size, int *cycles, int *target)
+{
+    unsigned w = read16(a);
+    int pc = avr_have(AVR_HAVE_EIJMP_EICALL) ? 1 : 0;
+
+    *size = 2;
+    *cycles = 1;
+    switch (w >> 12) {
+    case 0x0:
+        if ((w & 0xFE00) == 0x0200) /* muls, mulsu, fmul... */
+            *cycles = 2;
+        break;
+    case 0x1:
+        if ((w & 0xFC00) == 0x1000) /* cpse */
+            return INSN_SKIP;
+        break;
+    case 0x8:
+    case 0xA: /* ldd, std */
+        *cycles = 2;
+        break;
+    case 0x9:
+        switch ((w >> 9) & 7) {
+        case 0:
+        case 1: /* loads, stores, push, pop */
+            *cycles = 2;
+            if ((w & 0xF) == 0)
+                *size = 4; /* lds, sts */
+            else if (!(w & 0x200) && (w & 0xC) == 0x4)
+                *cycles = 3; /* lpm, elpm */
+            else if (!(w & 0x200) && (w & 0x3) == 0x2)
+                *cycles = 3; /* ld -X, -Y, -Z */
+            break;
+        case 2:
+            switch (w & 0xF) {
+            case 0x8:
+                if (w == 0x9508 || w == 0x9518) { /* ret, reti */
+                    *cycles = 4 + pc;
+                    return INSN_RET;
                 }
-            } else {
-                c = _op? -c : c;
-                AVR_DEBUG("r = %d, r2 = %d, c = %d\n", reg_idx[r], reg_idx[r2], c);
-                if (reg_idx[r] >= 24 && 
-                    reg_idx[r2] == reg_idx[r] + 1 &&
-                    c >> 6 < 2) { /* Could be done in utmost 2 ADIW operations */
-                    while (c & 0x3F) {
-                        _c = c & 0x3F;
-                        AVR_DEBUG("adiw %s, %d\n", reg_names[r], c & 0x3F);
-                        _ADIW(reg_idx[r], c);
-                        c >>= 6;
-                    }
-                } else if (reg_idx[r] >= 16) {   /* Can use subi and sbci */
-                    AVR_DEBUG("subi %s, %d\n", reg_names[r], c & 0xFF);
-                    _SUBI(reg_idx[r], c & 0xFF);
-                    c >>= 16;
-                    AVR_DEBUG("sbci %s, %d\n", reg_names[r2], c & 0xFF);
-                    _SBCI(reg_idx[r2], c & 0xFF);
-                } else {
-                    tcc_error("XXX: Operation on register unsupported");
+                if (w == 0x95C8 || w == 0x95D8) /* lpm, elpm */
+                    *cycles = 3;
+                break;
+            case 0x9:
+                if (w & 0x100) { /* icall, eicall */
+                    *cycles = 3 + pc;
+                    return INSN_CALL;
                 }
+                *cycles = 2; /* ijmp, eijmp */
+                return INSN_INDIRECT;
+            case 0xC:
+            case 0xD: /* jmp */
+                *size = 4;
+                *cycles = 3;
+                return INSN_INDIRECT;
+            case 0xE:
+            case 0xF: /* call */
+                *size = 4;
+                *cycles = 4 + pc;
+                return INSN_CALL;
             }
-        } else {
-            if (vtop->type.t == VT_BYTE) {
-                int r2;
-                gv2(RC_BYTE, RC_BYTE);
-                r = vtop[0].r;
-                r2 = vtop[-1].r;
-                if (!_op) {  /* Add */
-                    AVR_DEBUG("add %s, %s\n", reg_names[r2], reg_names[r]);
-                    _ADD(reg_idx[r2], reg_idx[r]);
-                } else { /* Sub */
-                    AVR_DEBUG("sub %s, %s\n", reg_names[r2], reg_names[r]);
-                    _SUB(reg_idx[r2], reg_idx[r]);
+            break;
+        case 4:
+        case 5:
+            if (w & 0x100) /* sbic, sbis */
+                return INSN_SKIP;
+            *cycles = 2; /* cbi, sbi */
+            break;
+        default: /* adiw, sbiw, mul */
+            *cycles = 2;
+            break;
+        }
+        break;
+    case 0xC: /* rjmp */
+        *cycles = 2;
+        *target = a + 2 + (((w & 0xFFF) ^ 0x800) - 0x800) * 2;
+        return INSN_JUMP;
+    case 0xD: /* rcall */
+        *cycles = 3 + pc;
+        return INSN_CALL;
+    case 0xF:
+        if (!(w & 0x800)) { /* brbs, brbc */
+            *target = a + 2 + ((((w >> 3) & 0x7F) ^ 0x40) - 0x40) * 2;
+            return INSN_BRANCH;
+        }
+        if (w & 0x400) /* sbrc, sbrs */
+            return INSN_SKIP;
+        break;
+    }
+    return INSN_NEXT;
+}
+
+static void cyc_edge(int from, int to, long long best, long long worst)
+{
+    CycEdge *e;
+
+    if (nb_cyc_edges >= cyc_edges_allocated) {
+        cyc_edges_allocated = cyc_edges_allocated ? cyc_edges_allocated * 2 : 64;
+        cyc_edges = tcc_realloc(cyc_edges, cyc_edges_allocated * sizeof(CycEdge));
+    }
+    e = &cyc_edges[nb_cyc_edges++];
+    e->from = from;
+    e->to = to;
+    e->best = best;
+    e->worst = worst;
+    e->back = 0;
+    e->loop = -1;
+    e->iter = 0;
+}
+
+/* depth first search of the live blocks from block 0: mark the back
+   edges, and return the number of blocks reached, in reverse postorder
+   in 'order', their rank in it being in 'rank' (-1 if not reached).
+   The edges leaving block b are 'out[first[b]]' to 'out[first[b+1]-1]' */
+static int cyc_search(int nb_blocks, int *order, int *rank, int *first,
+                      int *out, int *stack)
+{
+    int i, j, n, sp, b, k;
+    CycEdge *e;
+
+    /* outgoing edges by block */
+    memset(first, 0, (nb_blocks + 1) * sizeof(int));
+    for (i = 0; i < nb_cyc_edges; i++) {
+        cyc_edges[i].back = 0;
+        if (cyc_edges[i].from >= 0)
+            first[cyc_edges[i].from + 1]++;
+    }
+    for (i = 0; i < nb_blocks; i++)
+        first[i + 1] += first[i];
+    for (i = 0; i < nb_cyc_edges; i++)
+        if (cyc_edges[i].from >= 0)
+            out[first[cyc_edges[i].from]++] = i;
+    for (i = nb_blocks; i > 0; i--)
+        first[i] = first[i - 1];
+    first[0] = 0;
+
+    /* 'rank' is -1 when not visited, -2 while on the stack, -3 after */
+    for (i = 0; i < nb_blocks; i++)
+        rank[i] = -1;
+    n = nb_blocks;
+    sp = 0;
+    stack[sp++] = 0;
+    stack[sp++] = first[0];
+    rank[0] = -2;
+    while (sp) {
+        b = stack[sp - 2];
+        k = stack[sp - 1];
+        if (k == first[b + 1]) {
+            order[--n] = b;
+            rank[b] = -3;
+            sp -= 2;
+            continue;
+        }
+        stack[sp - 1]++;
+        e = &cyc_edges[out[k]];
+        j = e->to;
+        if (j < 0)
+            continue;
+        if (rank[j] == -2) {
+            e->back = 1;
+        } else if (rank[j] == -1) {
+            rank[j] = -2;
+            stack[sp++] = j;
+            stack[sp++] = first[j];
+        }
+    }
+    memmove(order, order + n, (nb_blocks - n) * sizeof(int));
+    n = nb_blocks - n;
+    for (i = 0; i < n; i++)
+        rank[order[i]] = i;
+    return n;
+}
+
+/* mark in 'in_loop' with 'stamp' the blocks of the loop of header 'h':
+   those reaching one of its back edges without going through 'h'.
+   Return their number, or -1 if the loop can be entered elsewhere than
+   by 'h' */
+static int cyc_loop(int h, int *in_loop, int stamp, int *rank)
+{
+    int i, n, changed, irreducible;
+    CycEdge *e;
+
+    in_loop[h] = stamp;
+    n = 1;
+    irreducible = 0;
+    do {
+        changed = 0;
+        for (i = 0; i < nb_cyc_edges; i++) {
+            e = &cyc_edges[i];
+            if (e->from < 0 || e->to < 0 || rank[e->from] < 0 ||
+                in_loop[e->from] == stamp)
+                continue;
+            if (e->to == h ? e->back : in_loop[e->to] == stamp) {
+                if (rank[e->from] < rank[h]) {
+                    /* not reached from 'h' first */
+                    irreducible = 1;
+                    continue;
                 }
-            } else {
-                int r12, r21, r22;
-                gv2(RC_INT, RC_INT);
-                r = vtop[0].r;
-                r12 = vtop[0].r2;
-                r21 = vtop[-1].r;
-                r22 = vtop[-1].r2;
-                if (_op) {
-                    AVR_DEBUG("%s %s, %s\n", "sub", reg_names[r], reg_names[r21]);
-                    _SUB(reg_idx[r], reg_idx[r21]);
-                    AVR_DEBUG("%s %s, %s\n", "sbc", reg_names[r12], reg_names[r22]);
-                    _SBC(reg_idx[r12], reg_idx[r22]);
+                in_loop[e->from] = stamp;
+                n++;
+                changed = 1;
+            }
+        }
+    } while (changed);
+    for (i = 0; i < nb_cyc_edges; i++) {
+        e = &cyc_edges[i];
+        if (e->from >= 0 && e->to >= 0 && e->to != h &&
+            rank[e->from] >= 0 && in_loop[e->from] != stamp &&
+            in_loop[e->to] == stamp)
+            irreducible = 1;
+    }
+    return irreducible ? -1 : n;
+}
+
+/* the number of jumps back to the header at 'a' */
+static void cyc_bound(int a, long long *min, long long *max)
+{
+    int i, found = 0;
+
+    *min = 0;
+    *max = 0;
+    for (i = 0; i < nb_loop_bounds; i += 3) {
+        if (loop_bounds[i] != a)
+            continue;
+        /* loops sharing their header: each one jumps back for all
+           the iterations of the others */
+        if (!found) {
+            *min = loop_bounds[i + 1];
+            *max = loop_bounds[i + 2];
+        } else {
+            *min = (*min + 1) * (loop_bounds[i + 1] + 1) - 1;
+            *max = cyc_mul(*max + 1, loop_bounds[i + 2] + 1) - 1;
+        }
+        found = 1;
+    }
+    if (!found)
+        *max = -1;
+}
+
+/* collapse the loop of header 'h' whose blocks are marked by 'stamp'
+   into its exit edges */
+static void cyc_collapse(int h, int *in_loop, int stamp, int nb_order,
+                         int *order, int *first, int *out,
+                         long long *best, long long *worst, int *blocks)
+{
+    long long iter_best, iter_worst, min, max;
+    int i, j, b;
+    CycEdge *e;
+
+    /* cycles from the header to each block of the loop, the blocks
+       being in reverse postorder */
+    for (i = 0; i < nb_order; i++) {
+        best[order[i]] = CYC_INF;
+        worst[order[i]] = -1;
+    }
+    best[h] = worst[h] = 0;
+    for (i = 0; i < nb_order; i++) {
+        b = order[i];
+        if (in_loop[b] != stamp || worst[b] < 0)
+            continue;
+        for (j = first[b]; j < first[b + 1]; j++) {
+            e = &cyc_edges[out[j]];
+            if (e->to < 0 || e->back || in_loop[e->to] != stamp)
+                continue;
+            if (cyc_add(best[b], e->best) < best[e->to])
+                best[e->to] = cyc_add(best[b], e->best);
+            if (cyc_add(worst[b], e->worst) > worst[e->to])
+                worst[e->to] = cyc_add(worst[b], e->worst);
+        }
+    }
+
+    /* one iteration */
+    iter_best = CYC_INF;
+    iter_worst = 0;
+    for (j = 0; j < nb_cyc_edges; j++) {
+        e = &cyc_edges[j];
+        if (e->from < 0 || !e->back || e->to != h ||
+            in_loop[e->from] != stamp || worst[e->from] < 0)
+            continue;
+        if (cyc_add(best[e->from], e->best) < iter_best)
+            iter_best = cyc_add(best[e->from], e->best);
+        if (cyc_add(worst[e->from], e->worst) > iter_worst)
+            iter_worst = cyc_add(worst[e->from], e->worst);
+    }
+    cyc_bound(blocks[h], &min, &max);
+    if (max < 0) {
+        cyc_unbounded("the loop at +%#x has no bound", NULL, blocks[h] - func_ind);
+        max = CYC_INF;
+    }
+
+    /* the exits, after the iterations */
+    for (j = 0; j < nb_cyc_edges; j++) {
+        e = &cyc_edges[j];
+        if (e->from < 0 || in_loop[e->from] != stamp)
+            continue;
+        if (e->to >= 0 && in_loop[e->to] == stamp) {
+            e->from = -1; /* internal or back edge */
+            continue;
+        }
+        if (worst[e->from] < 0) {
+            e->from = -1;
+            continue;
+        }
+        e->best = cyc_add(cyc_mul(iter_best, min),
+                          cyc_add(best[e->from], e->best));
+        e->worst = cyc_add(cyc_mul(iter_worst, max),
+                           cyc_add(worst[e->from], e->worst));
+        e->from = h;
+        e->loop = h;
+        e->iter = max;
+    }
+}
+
+/* cycles of the shared frame helpers of lib/avr-prologue.S (see
+   avr_call_prologues()) entered at 'addend', from there to the return
+   into the function or its caller, -1 for another callee. '*resume' is
+   set for __prologue_saves__, which returns to the function */
+static int cyc_helper(int callee, int addend, int *resume)
+{
+    ElfW(Sym) *esym;
+    const char *name;
+    int n;
+
+    if (callee <= 0)
+        return -1;
+    esym = &((ElfW(Sym) *)symtab_section->data)[callee];
+    name = (char *)symtab_section->link->data + esym->st_name;
+    /* r(18-n) to r17 saved or restored */
+    n = 16 - addend / 2;
+    *resume = !strcmp(name, "__prologue_saves__");
+    if (*resume)
+        return 2 * n + 15;
+    if (!strcmp(name, "__epilogue_restores__"))
+        return 2 * n + 17;
+    return -1;
+}
+
+/* estimate the best and worst cycles of the function 'sym' from its
+   code in [func_ind, ind). Print them with -mcycles, and fail if they
+   exceed 'max_cycles' */
+ST_FUNC void gen_cycles(Sym *sym, int max_cycles)
+{
+    TCCState *s1 = tcc_state;
+    int nb_words, nb_blocks, nb_order, i, j, a, b, h, size, cycles;
+    int target, kind, n, next, stamp, *block_of, *blocks, *order, *rank;
+    int *first, *out, *stack, *in_loop, *pred, sym_index, callee;
+    int irreducible, helper, resume, *addends;
+    long long *best, *worst, cb, cw, result_best, result_worst;
+    int *callees;
+    Section *sr;
+    ElfW_Rel *rel;
+    ElfW(Sym) *esym;
+    char *name;
+    CycEdge *e;
+
+    if (nocode_wanted)
+        return;
+    name = get_tok_str(sym->v, NULL);
+    cyc_reason[0] = '\0';
+    nb_cyc_edges = 0;
+
+    /* leaders of the basic blocks */
+    nb_words = (ind - func_ind) >> 1;
+    block_of = tcc_malloc((nb_words + 1) * sizeof(int));
+    for (i = 0; i <= nb_words; i++)
+        block_of[i] = -1;
+    block_of[0] = 0;
+    for (a = func_ind; a < ind; a += size) {
+        kind = avr_insn(a, &size, &cycles, &target);
+        if (kind == INSN_BRANCH || kind == INSN_JUMP) {
+            if (target >= func_ind && target < ind)
+                block_of[(target - func_ind) >> 1] = 0;
+        } else if (kind == INSN_SKIP && a + size < ind) {
+            avr_insn(a + size, &n, &cycles, &target);
+            if (a + size + n < ind)
+                block_of[(a + size + n - func_ind) >> 1] = 0;
+        } else if (kind != INSN_RET && kind != INSN_INDIRECT) {
+            continue;
+        }
+        block_of[(a + size - func_ind) >> 1] = 0;
+    }
+    /* where __prologue_saves__ returns */
+    if (func_helpers)
+        block_of[(func_frame_end - func_ind) >> 1] = 0;
+    nb_blocks = 0;
+    blocks = tcc_malloc((nb_words + 1) * sizeof(int));
+    for (i = 0; i < nb_words; i++)
+        if (block_of[i] == 0) {
+            block_of[i] = nb_blocks;
+            blocks[nb_blocks++] = func_ind + 2 * i;
+        }
+    block_of[nb_words] = -1;
+
+    /* the callees, from the relocations of the calls */
+    callees = tcc_mallocz((nb_words + 1) * sizeof(int));
+    addends = tcc_mallocz((nb_words + 1) * sizeof(int));
+    sr = cur_text_section->reloc;
+    if (sr) {
+        for (rel = (ElfW_Rel *)(sr->data + sr->data_offset) - 1;
+             rel >= (ElfW_Rel *)sr->data && rel->r_offset >= func_ind; rel--)
+            if (rel->r_offset < ind &&
+                (ELFW(R_TYPE)(rel->r_info) == R_AVR_CALL ||
+                 ELFW(R_TYPE)(rel->r_info) == R_AVR_13_PCREL)) {
+                callees[(rel->r_offset - func_ind) >> 1] = ELFW(R_SYM)(rel->r_info);
+                addends[(rel->r_offset - func_ind) >> 1] = rel->r_addend;
+            }
+    }
+
+    /* the edges, with the cycles of the blocks */
+    for (b = 0; b < nb_blocks; b++) {
+        cb = cw = 0;
+        for (a = blocks[b];; a += size) {
+            kind = avr_insn(a, &size, &cycles, &target);
+            callee = callees[(a - func_ind) >> 1];
+            helper = cyc_helper(callee, addends[(a - func_ind) >> 1], &resume);
+            if (helper >= 0) {
+                /* jump to the shared prologue, which returns at the end
+                   of the frame setup, or to the shared epilogue */
+                j = resume ? block_of[(func_frame_end - func_ind) >> 1] : -1;
+                cyc_edge(b, j, cb + cycles + helper,
+                         cyc_add(cw, cycles + helper));
+                break;
+            }
+            if (kind == INSN_CALL) {
+                if (callee > 0 && callee < s1->nb_func_cycles &&
+                    s1->func_cycles[2 * callee + 1] >= 0) {
+                    cb = cyc_add(cb, s1->func_cycles[2 * callee]);
+                    cw = cyc_add(cw, s1->func_cycles[2 * callee + 1]);
                 } else {
-                    AVR_DEBUG("%s %s, %s\n", "add", reg_names[r], reg_names[r21]);
-                    _ADD(reg_idx[r], reg_idx[r21]);
-                    AVR_DEBUG("%s %s, %s\n", "adc", reg_names[r12], reg_names[r22]);
-                    _ADC(reg_idx[r12], reg_idx[r22]);
+                    cw = CYC_INF;
                 }
+                if (cw >= CYC_INF && callee > 0) {
+                    esym = &((ElfW(Sym) *)symtab_section->data)[callee];
+                    cyc_unbounded("it calls '", (char *)symtab_section->link->data +
+                                  esym->st_name, 0);
+                } else if (cw >= CYC_INF) {
+                    cyc_unbounded("indirect call at +%#x", NULL, a - func_ind);
+                }
+            }
+            next = a + size;
+            if (kind == INSN_BRANCH || kind == INSN_JUMP) {
+                j = target >= func_ind && target < ind ?
+                    block_of[(target - func_ind) >> 1] : -1;
+                if (j < 0)
+                    cyc_unbounded("jump out of the function at +%#x", NULL,
+                                  a - func_ind);
+                cyc_edge(b, j, cb + cycles + (kind == INSN_BRANCH),
+                         j < 0 ? CYC_INF : cyc_add(cw, cycles + (kind == INSN_BRANCH)));
+                if (kind == INSN_JUMP)
+                    break;
+            } else if (kind == INSN_SKIP) {
+                n = 2;
+                if (next < ind)
+                    avr_insn(next, &n, &i, &target);
+                j = next + n < ind ? block_of[(next + n - func_ind) >> 1] : -1;
+                cyc_edge(b, j, cb + cycles + n / 2,
+                         j < 0 ? CYC_INF : cyc_add(cw, cycles + n / 2));
+            } else if (kind == INSN_RET) {
+                cyc_edge(b, -1, cb + cycles, cyc_add(cw, cycles));
+                break;
+            } else if (kind == INSN_INDIRECT) {
+                cyc_unbounded("indirect jump at +%#x", NULL, a - func_ind);
+                cyc_edge(b, -1, cb + cycles, CYC_INF);
+                break;
+            }
+            cb += cycles;
+            cw = cyc_add(cw, cycles);
+            if (next >= ind || block_of[(next - func_ind) >> 1] >= 0) {
+                /* falls into the next block */
+                j = next < ind ? block_of[(next - func_ind) >> 1] : -1;
+                if (j < 0)
+                    cyc_unbounded("no return at the end of the function",
+                                  NULL, 0);
+                cyc_edge(b, j, cb, j < 0 ? CYC_INF : cw);
+                break;
             }
         }
+    }
 
-        vtop--;
-        if (op >= TOK_ULT && op <= TOK_GT) {
-            vtop->r = VT_CMP;
-            vtop->c.i = op;
+    /* collapse the loops, the smallest first */
+    order = tcc_malloc(nb_blocks * sizeof(int));
+    rank = tcc_malloc(nb_blocks * sizeof(int));
+    in_loop = tcc_malloc(nb_blocks * sizeof(int));
+    pred = tcc_malloc(nb_blocks * sizeof(int));
+    first = tcc_malloc((nb_blocks + 1) * sizeof(int));
+    out = tcc_malloc((nb_cyc_edges + 1) * sizeof(int));
+    stack = tcc_malloc(2 * nb_blocks * sizeof(int));
+    best = tcc_malloc(nb_blocks * sizeof(long long));
+    worst = tcc_malloc(nb_blocks * sizeof(long long));
+    memset(in_loop, 0, nb_blocks * sizeof(int));
+    stamp = 0;
+    irreducible = 0;
+    for (;;) {
+        nb_order = cyc_search(nb_blocks, order, rank, first, out, stack);
+        h = -1;
+        n = 0;
+        for (i = 0; i < nb_cyc_edges; i++) {
+            e = &cyc_edges[i];
+            if (e->from < 0 || !e->back)
+                continue;
+            j = cyc_loop(e->to, in_loop, ++stamp, rank);
+            if (j < 0) {
+                h = e->to;
+                break;
+            }
+            if (h < 0 || j < n) {
+                h = e->to;
+                n = j;
+            }
+        }
+        if (h < 0)
+            break;
+        if (cyc_loop(h, in_loop, ++stamp, rank) < 0) {
+            /* give up the loops, their back edges being removed */
+            cyc_unbounded("irreducible loop at +%#x", NULL, blocks[h] - func_ind);
+            irreducible = 1;
+            for (i = 0; i < nb_cyc_edges; i++)
+                if (cyc_edges[i].back)
+                    cyc_edges[i].from = -1;
+            continue;
+        }
+        cyc_collapse(h, in_loop, stamp, nb_order, order, first, out,
+                     best, worst, blocks);
+    }
+
+    /* shortest and longest paths to the returns */
+    for (i = 0; i < nb_blocks; i++) {
+        best[i] = CYC_INF;
+        worst[i] = -1;
+        pred[i] = -1;
+    }
+    best[0] = worst[0] = 0;
+    result_best = CYC_INF;
+    result_worst = -1;
+    h = -1;
+    for (i = 0; i < nb_order; i++) {
+        b = order[i];
+        if (worst[b] < 0)
+            continue;
+        for (j = first[b]; j < first[b + 1]; j++) {
+            e = &cyc_edges[out[j]];
+            cb = cyc_add(best[b], e->best);
+            cw = cyc_add(worst[b], e->worst);
+            if (e->to < 0) {
+                if (cb < result_best)
+                    result_best = cb;
+                if (cw > result_worst) {
+                    result_worst = cw;
+                    h = out[j];
+                }
+                continue;
+            }
+            if (cb < best[e->to])
+                best[e->to] = cb;
+            if (cw > worst[e->to]) {
+                worst[e->to] = cw;
+                pred[e->to] = out[j];
+            }
+        }
+    }
+    if (result_worst < 0) {
+        cyc_unbounded("the function does not return", NULL, 0);
+        result_best = result_worst = CYC_INF;
+    }
+    if (irreducible)
+        result_worst = CYC_INF;
+
+    /* results for the callers */
+    sym_index = sym->c;
+    if (sym_index >= s1->nb_func_cycles) {
+        n = sym_index + 64;
+        s1->func_cycles = tcc_realloc(s1->func_cycles, 2 * n * sizeof(long long));
+        for (i = 2 * s1->nb_func_cycles; i < 2 * n; i++)
+            s1->func_cycles[i] = -1;
+        s1->nb_func_cycles = n;
+    }
+    s1->func_cycles[2 * sym_index] = result_best;
+    s1->func_cycles[2 * sym_index + 1] = result_worst;
+
+    if (s1->avr_cycles) {
+        if (result_worst >= CYC_INF) {
+            printf("%s: '%s': unbounded, %s\n", file->filename, name, cyc_reason);
+        } else {
+            printf("%s: '%s': %lld to %lld cycles\n",
+                   file->filename, name, result_best, result_worst);
+            /* the longest path, from its end */
+            n = 0;
+            for (j = h; j >= 0; j = pred[cyc_edges[j].from])
+                stack[n++] = j;
+            printf("    longest path:");
+            while (n--) {
+                e = &cyc_edges[stack[n]];
+                printf(" +%#x", blocks[e->from] - func_ind);
+                if (e->loop >= 0)
+                    printf(" (loop x%lld)", e->iter);
+            }
+            printf("\n");
+        }
+    }
+
+    tcc_free(block_of);
+    tcc_free(blocks);
+    tcc_free(callees);
+    tcc_free(addends);
+    tcc_free(order);
+    tcc_free(rank);
+    tcc_free(in_loop);
+    tcc_free(pred);
+    tcc_free(first);
+    tcc_free(out);
+    tcc_free(stack);
+    tcc_free(best);
+    tcc_free(worst);
+
+    if (max_cycles && result_worst >= CYC_INF)
+        tcc_error("cannot bound the cycles of '%s': %s", name, cyc_reason);
+    if (max_cycles && result_worst > max_cycles)
+        tcc_error("'%s' may take %lld cycles, more than max_cycles(%d)",
+                  name, result_worst, max_cycles);
+}
+
+/* ------------------------------------------------------------------------- */
+/* hot/cold layout
+
+   gen_layout() moves the unlikely blocks given by gcold() after the end
+   of the function, so that the likely path falls through. A block is
+   preceded by the rjmp which jumps over it. When a branch over one
+   instruction makes this rjmp conditional, the branch is inverted and
+   the rjmp goes to the moved block, else the rjmp is removed. A moved
+   block which falls through ends with an rjmp back. The relative
+   branches and jumps are then encoded again */
+
+/* the code in [start, end) is unlikely to run. The blocks recorded
+   inside it move with it */
+ST_FUNC void gcold(int start, int end)
+{
+    AVR_DEBUG("# gcold(start=%d, end=%d)\n", start, end);
+    if (start >= end)
+        return;
+    while (nb_cold_blocks > 0 && cold_blocks[nb_cold_blocks - 2] >= start)
+        nb_cold_blocks -= 2;
+    if (nb_cold_blocks + 2 > cold_blocks_allocated) {
+        cold_blocks_allocated = cold_blocks_allocated ? cold_blocks_allocated * 2 : 16;
+        cold_blocks = tcc_realloc(cold_blocks, cold_blocks_allocated * sizeof(int));
+    }
+    cold_blocks[nb_cold_blocks++] = start;
+    cold_blocks[nb_cold_blocks++] = end;
+}
+
+ST_FUNC void gen_layout(void)
+{
+    int start, end, nb_words, n, i, j, b, p, a, q, t, k, w, size, cycles;
+    int *addr, *kind, *target, *owner, *blk, *map, *back, hot_end, ok;
+    char *flags;
+    unsigned char *buf;
+    Section *sr;
+    ElfW_Rel *rel, *rel_end;
+
+    if (nb_cold_blocks == 0 || func_has_asm)
+        return;
+    start = func_ind;
+    end = ind;
+    nb_words = (end - start) >> 1;
+    addr = tcc_malloc((nb_words + 1) * sizeof(int));
+    kind = tcc_malloc(nb_words * sizeof(int));
+    target = tcc_malloc(nb_words * sizeof(int));
+    blk = tcc_malloc(nb_words * sizeof(int));
+    flags = tcc_mallocz(nb_words); /* 1: relocated, 2: dropped, 4: inverted */
+    owner = tcc_malloc((nb_words + 1) * sizeof(int));
+    map = tcc_malloc((nb_words + 1) * sizeof(int));
+    back = tcc_malloc(nb_cold_blocks / 2 * sizeof(int));
+    buf = tcc_malloc(end - start + nb_cold_blocks);
+
+    /* the instructions */
+    ok = 1;
+    n = 0;
+    for (a = start; a < end; a += size) {
+        target[n] = -1;
+        kind[n] = avr_insn(a, &size, &cycles, &target[n]);
+        if (kind[n] == INSN_CALL && (read16(a) & 0xF000) == 0xD000) /* rcall */
+            target[n] = a + 2 + (((read16(a) & 0xFFF) ^ 0x800) - 0x800) * 2;
+        if (a + size > end)
+            ok = 0;
+        addr[n] = a;
+        blk[n] = -1;
+        for (i = 0; i < size && a + i < end; i += 2)
+            owner[(a + i - start) >> 1] = n;
+        n++;
+    }
+    addr[n] = end;
+    owner[nb_words] = n;
+    sr = cur_text_section->reloc;
+    if (sr) {
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for (rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++)
+            if (rel->r_offset >= start && rel->r_offset < end)
+                flags[owner[(rel->r_offset - start) >> 1]] |= 1;
+    }
+
+    /* the blocks which can move, with the rjmp before them */
+    for (b = 0; b < nb_cold_blocks && ok; b += 2) {
+        i = owner[(cold_blocks[b] - start) >> 1];
+        k = owner[(cold_blocks[b + 1] - start) >> 1];
+        j = i - 1;
+        p = j - 1;
+        back[b / 2] = -1;
+        if (addr[i] != cold_blocks[b] || k >= n ||
+            addr[k] != cold_blocks[b + 1] || j < 0 || blk[j] >= 0 ||
+            kind[j] != INSN_JUMP || (flags[j] & 1) ||
+            target[j] != cold_blocks[b + 1] ||
+            (p >= 0 && (kind[p] == INSN_SKIP || blk[p] >= 0)) ||
+            kind[k - 1] == INSN_SKIP)
+            continue;
+        if (p >= 0 && kind[p] == INSN_BRANCH && target[p] == addr[i]) {
+            flags[p] |= 4;
+            target[j] = addr[i];
+        } else {
+            flags[j] |= 2;
+        }
+        for (; i < k; i++)
+            blk[i] = b;
+        /* falls through the end */
+        if ((kind[k - 1] != INSN_JUMP && kind[k - 1] != INSN_RET &&
+             kind[k - 1] != INSN_INDIRECT) ||
+            (k >= 2 && kind[k - 2] == INSN_SKIP))
+            back[b / 2] = 0;
+    }
+
+    /* the new order: the likely code, then the blocks */
+    q = 0;
+    for (i = 0; i < n; i++) {
+        if (blk[i] >= 0)
+            continue;
+        for (a = addr[i]; a < addr[i + 1]; a += 2)
+            map[(a - start) >> 1] = q + a - addr[i];
+        if (!(flags[i] & 2))
+            q += addr[i + 1] - addr[i];
+    }
+    hot_end = q;
+    for (b = 0; b < nb_cold_blocks; b += 2) {
+        for (i = 0; i < n; i++) {
+            if (blk[i] != b)
+                continue;
+            for (a = addr[i]; a < addr[i + 1]; a += 2)
+                map[(a - start) >> 1] = q + a - addr[i];
+            q += addr[i + 1] - addr[i];
+        }
+        if (back[b / 2] == 0) {
+            back[b / 2] = q;
+            q += 2;
+        }
+    }
+    map[nb_words] = q;
+
+    /* the code, with the relative branches and jumps encoded again */
+    for (i = 0; i < n && ok; i++) {
+        if (flags[i] & 2)
+            continue;
+        p = map[(addr[i] - start) >> 1];
+        memcpy(buf + p, cur_text_section->data + addr[i], addr[i + 1] - addr[i]);
+        t = target[i];
+        if (t < 0 || (flags[i] & 1))
+            continue;
+        if (t < start || t >= end) {
+            ok = 0;
+            break;
+        }
+        k = (map[(t - start) >> 1] - p - 2) >> 1;
+        w = buf[p] | (buf[p + 1] << 8);
+        if (flags[i] & 4) {
+            w ^= 0x400; /* brbs <-> brbc, still over the rjmp */
+        } else if (kind[i] == INSN_BRANCH) {
+            if (k < -64 || k > 63)
+                ok = 0;
+            w = (w & ~0x3F8) | ((k & 0x7F) << 3);
+        } else {
+            if (k < -2048 || k > 2047)
+                ok = 0;
+            w = (w & 0xF000) | (k & 0xFFF);
+        }
+        buf[p] = w;
+        buf[p + 1] = w >> 8;
+    }
+    for (b = 0; b < nb_cold_blocks; b += 2) {
+        p = back[b / 2];
+        if (p < 0)
+            continue;
+        k = (map[(cold_blocks[b + 1] - start) >> 1] - p - 2) >> 1;
+        if (k < -2048 || k > 2047)
+            ok = 0;
+        w = 0xC000 | (k & 0xFFF); /* rjmp */
+        buf[p] = w;
+        buf[p + 1] = w >> 8;
+    }
+
+    if (ok && hot_end < q) {
+        AVR_DEBUG("# gen_layout(): %d bytes moved\n", q - hot_end);
+        if (start + q > cur_text_section->data_allocated)
+            section_realloc(cur_text_section, start + q);
+        memcpy(cur_text_section->data + start, buf, q);
+        ind = start + q;
+        if (sr) {
+            for (rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++)
+                if (rel->r_offset >= start && rel->r_offset < end)
+                    rel->r_offset = start + map[(rel->r_offset - start) >> 1] +
+                                    ((rel->r_offset - start) & 1);
+        }
+        for (i = 0; i < nb_loop_bounds; i += 3)
+            loop_bounds[i] = start + map[(loop_bounds[i] - start) >> 1];
+        outline_cold(start + hot_end, ind);
+    }
+
+    tcc_free(buf);
+    tcc_free(back);
+    tcc_free(map);
+    tcc_free(owner);
+    tcc_free(flags);
+    tcc_free(blk);
+    tcc_free(target);
+    tcc_free(kind);
+    tcc_free(addr);
+}
+
+/* generate a jump to a label */
+ST_FUNC int gjmp(int t)
+{
+    AVR_DEBUG("# gjmp(t=%d)\n", t);
+    int r = ind;
+    AVR_DEBUG("rjmp .L%d\n", t);
+    _RJMP(0);
+    gjmp_link(r, t);
+    return r;
+}
+
+/* generate a jump to a fixed address */
+ST_FUNC void gjmp_addr(int a)
+{
+    AVR_DEBUG("# gjmp_addr(a=%d)\n", a);
+    int k = (a - ind - 2) >> 1;
+    if (k < -2048 || k > 2047)
+        tcc_error("jump out of range");
+    AVR_DEBUG("rjmp .%+d\n", k << 1);
+    _RJMP(k);
+}
+
+/* generate a jump to 't' taken when the comparison 'op' is true */
+static int gjcc(int op, int t)
+{
+    int s, set;
+    gcond(op, &s, &set);
+    /* skip the jump when the condition is false */
+    gskip(s, !set);
+    return gjmp(t);
+}
+
+/* decrement the loop counter lvalue on vtop and jump to 'a' while it
+   is not zero. Stack entry is popped */
+ST_FUNC void gdecjnz(int a)
+{
+    AVR_DEBUG("# gdecjnz(a=%d)\n", a);
+    int size, align, fc, k;
+
+    size = type_size(&vtop->type, &align);
+    fc = vtop->c.i;
+    save_reg(TREG_R24);
+    gldd_y(24, fc);
+    if (size == 1) {
+        AVR_DEBUG("dec r24\n");
+        _DEC(24);
+        gstd_y(24, fc);
+    } else {
+        save_reg(TREG_R25);
+        gldd_y(25, fc + 1);
+        AVR_DEBUG("sbiw r24, 1\n");
+        _SBIW(24, 1);
+        gstd_y(24, fc);
+        gstd_y(25, fc + 1);
+    }
+    /* 'std' leaves the flags alone */
+    k = (a - ind - 2) >> 1;
+    if (k >= -64) {
+        AVR_DEBUG("brne .%+d\n", k << 1);
+        _BRNE(k);
+    } else {
+        gskip(1, 1);
+        gjmp_addr(a);
+    }
+    vtop--;
+}
+
+/* generate a test. set 'inv' to invert test. Stack entry is popped */
+ST_FUNC int gtst(int inv, int t)
+{
+    AVR_DEBUG("# gtst(inv=%d, t=%d)\n", inv, t);
+
+    int v, n, size, align;
+
+    if (is_float(vtop->type.t)) {
+        /* compare with 0 */
+        vpushi(0);
+        gen_op(TOK_NE);
+    }
+    v = vtop->r & VT_VALMASK;
+    AVR_DEBUG("v = %X\n", v);
+    if (v == VT_CMP) {
+        /* fast case : can jump directly since flags are set */
+        /* the comparison tokens come in pairs differing in bit 0 */
+        t = gjcc(vtop->c.i ^ inv, t);
+    } else if (v == VT_JMP || v == VT_JMPI) {
+        /* && or || optimization */
+        if ((v & 1) == inv) {
+            /* insert vtop->c jump list in t */
+            n = vtop->c.i;
+            while (gjmp_next(n))
+                n = gjmp_next(n);
+            gjmp_link(n, t);
+            t = vtop->c.i;
+        } else {
+            t = gjmp(t);
+            gsym(vtop->c.i);
+        }
+    } else {
+        if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+            /* constant jmp optimization */
+            if ((vtop->c.i != 0) != inv) 
+                t = gjmp(t);
+
+            /* Otherwise fall through */
+        } else {
+            size = type_size(&vtop->type, &align);
+            if (size == 1) {
+                v = gv(RC_BYTE);
+                AVR_DEBUG("and %s, %s\n", reg_names[v], reg_names[v]);
+                _AND(reg_idx[v], reg_idx[v]);
+            } else if (size == 2) {
+                v = gv(RC_INT);
+                AVR_DEBUG("or %s, %s\n", reg_names[v], reg_names[vtop->r2]);
+                _OR(reg_idx[v], reg_idx[vtop->r2]);
+            } else {
+                tcc_error("XXX: test of %d bytes values unsupported", size);
+            }
+            /* jump if zero when 'inv', if not zero otherwise */
+            t = gjcc(inv ? TOK_EQ : TOK_NE, t);
         }
+    }
+
+    --vtop;
+    return t;
+}
+
+/* emit the byte operation 'op' ('+' with carry, '-', '&', '|', '^',
+   comparison) between the destination register 'd' and the register
+   's', 'first' being set for the least significant byte */
+static void gopb(int op, int d, int s, int first)
+{
+    switch (op) {
+    case '+':
+        AVR_DEBUG("%s r%d, r%d\n", first ? "add" : "adc", d, s);
+        if (first)
+            _ADD(d, s);
+        else
+            _ADC(d, s);
         break;
     case '-':
-    case TOK_SUBC1: /* sub with carry generation */
-        _op = 1;
-        goto gen_op;
-    case TOK_GT:
-    case TOK_LT:
-        _op = op;
-        goto gen_op;
+        AVR_DEBUG("%s r%d, r%d\n", first ? "sub" : "sbc", d, s);
+        if (first)
+            _SUB(d, s);
+        else
+            _SBC(d, s);
+        break;
+    case '&':
+        AVR_DEBUG("and r%d, r%d\n", d, s);
+        _AND(d, s);
+        break;
+    case '|':
+        AVR_DEBUG("or r%d, r%d\n", d, s);
+        _OR(d, s);
+        break;
+    case '^':
+        AVR_DEBUG("eor r%d, r%d\n", d, s);
+        _EOR(d, s);
+        break;
+    default:
+        AVR_DEBUG("%s r%d, r%d\n", first ? "cp" : "cpc", d, s);
+        if (first)
+            _CP(d, s);
+        else
+            _CPC(d, s);
+        break;
+    }
+}
+
+/* emit the byte operation 'op' between register 'd' and the constant
+   byte 'k'. Zero bytes which do not change the result are skipped and
+   the zero register is used for the other ones. '*first' is set until
+   a carry chain is started */
+static void gopbi(int op, int d, int k, int *first)
+{
+    int t;
+
+    k &= 0xFF;
+    switch (op) {
+    case '-':
+        if (*first && k == 0)
+            return;
+        if (d >= 16) {
+            AVR_DEBUG("%s r%d, %d\n", *first ? "subi" : "sbci", d, k);
+            if (*first)
+                _SUBI(d, k);
+            else
+                _SBCI(d, k);
+            *first = 0;
+            return;
+        }
+        break;
+    case '&':
+        if (k == 0xFF)
+            return;
+        if (k == 0) {
+            AVR_DEBUG("mov r%d, r1\n", d);
+            _MOV(d, ZERO_REG);
+            return;
+        }
+        if (d >= 16) {
+            AVR_DEBUG("andi r%d, %d\n", d, k);
+            _ANDI(d, k);
+            return;
+        }
+        break;
+    case '|':
+        if (k == 0)
+            return;
+        if (d >= 16) {
+            AVR_DEBUG("ori r%d, %d\n", d, k);
+            _ORI(d, k);
+            return;
+        }
+        break;
+    case '^':
+        if (k == 0)
+            return;
+        if (k == 0xFF) {
+            AVR_DEBUG("com r%d\n", d);
+            _COM(d);
+            return;
+        }
+        break;
+    default: /* comparison */
+        if (*first && k && d >= 16) {
+            AVR_DEBUG("cpi r%d, %d\n", d, k);
+            _CPI(d, k);
+            *first = 0;
+            return;
+        }
+        break;
+    }
+    /* use the zero register or load the byte in a temporary one */
+    t = ZERO_REG;
+    if (k) {
+        t = reg_idx[get_reg(RC_LDI)];
+        AVR_DEBUG("ldi r%d, %d\n", t, k);
+        _LDI(t, k);
+    }
+    gopb(op, d, t, *first);
+    *first = 0;
+}
+
+/* allocate a register of class 'rc', reserved by pushing it on the
+   value stack */
+static int gtmp(int rc)
+{
+    int r;
+
+    r = get_reg(rc);
+    vpushi(0);
+    vtop->r = r;
+    return r;
+}
+
+/* shift the 'n' bytes of the registers 'r' by one bit */
+static void gshift1(int op, int *r, int n)
+{
+    int i;
+
+    if (op == TOK_SHL) {
+        for (i = 0; i < n; i++)
+            gopb('+', r[i], r[i], i == 0); /* lsl/rol */
+    } else {
+        for (i = n - 1; i >= 0; i--) {
+            if (i < n - 1) {
+                AVR_DEBUG("ror r%d\n", r[i]);
+                _ROR(r[i]);
+            } else if (op == TOK_SAR) {
+                AVR_DEBUG("asr r%d\n", r[i]);
+                _ASR(r[i]);
+            } else {
+                AVR_DEBUG("lsr r%d\n", r[i]);
+                _LSR(r[i]);
+            }
+        }
+    }
+}
+
+/* shift the 'n' bytes of the registers 'r' by 'c' bits */
+static void gshifti(int op, int *r, int n, int c)
+{
+    int t, a, k;
+
+    c &= n * 8 - 1;
+    if (n == 2 && c >= 8 && op == TOK_SAR) {
+        /* byte move, then sign extension */
+        AVR_DEBUG("mov r%d, r%d\n", r[0], r[1]);
+        _MOV(r[0], r[1]);
+        gopb('+', r[1], r[1], 1);
+        gopb('-', r[1], r[1], 0);
+        n = 1;
+        c -= 8;
+    } else if (n == 2 && c >= 8) {
+        /* byte move */
+        if (op == TOK_SHL) {
+            AVR_DEBUG("mov r%d, r%d\n", r[1], r[0]);
+            _MOV(r[1], r[0]);
+            AVR_DEBUG("mov r%d, r1\n", r[0]);
+            _MOV(r[0], ZERO_REG);
+            r++;
+        } else {
+            AVR_DEBUG("mov r%d, r%d\n", r[0], r[1]);
+            _MOV(r[0], r[1]);
+            AVR_DEBUG("mov r%d, r1\n", r[1]);
+            _MOV(r[1], ZERO_REG);
+        }
+        n = 1;
+        c -= 8;
+    }
+    if (tcc_state->optimize_size && c * n > n + 3) {
+        /* -Os: a counted loop is shorter */
+        t = reg_idx[gtmp(RC_LDI)];
+        AVR_DEBUG("ldi r%d, %d\n", t, c);
+        _LDI(t, c);
+        a = ind;
+        gshift1(op, r, n);
+        AVR_DEBUG("dec r%d\n", t);
+        _DEC(t);
+        gloop_bound(a, c - 1, c - 1);
+        k = (a - ind - 2) >> 1;
+        AVR_DEBUG("brne .%+d\n", k << 1);
+        _BRNE(k);
+        vtop--;
+        return;
     }
+    while (c--)
+        gshift1(op, r, n);
+}
+
+/* generate an integer binary operation */
+ST_FUNC void gen_opi(int op)
+{
+    AVR_DEBUG("# gen_opi(op=%d)\n", op);
+
+    int d[2], s[2], n, align, i, c, first, t;
+
+    /* an array is added to the index as a pointer */
+    if (vtop[-1].type.t & VT_ARRAY)
+        n = PTR_SIZE;
+    else
+        n = type_size(&vtop[-1].type, &align);
+    if (n > 2)
+        tcc_error("XXX: %d bytes integer operations unsupported", n);
+
+    switch (op) {
+    case TOK_ADDC1:
+        op = '+';
+        break;
+    case TOK_SUBC1:
+        op = '-';
+        break;
+    case '*':
+        if (!avr_have(AVR_HAVE_MUL)) {
+            /* library call, as avr-gcc does */
+            t = vtop[-1].type.t;
+            vpush_global_sym(&func_old_type,
+                             n == 1 ? TOK___mulqi3 : TOK___mulhi3);
+            vrott(3);
+            gfunc_call(2);
+            vpushi(0);
+            vtop->type.t = t;
+            vtop->r = REG_BRET;
+            if (n == 2)
+                vtop->r2 = REG_IRET;
+            return;
+        }
+        break;
+    }
+
+    c = vtop->c.i;
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST &&
+        op != '*' && op != '/' && op != '%' &&
+        op != TOK_PDIV && op != TOK_UDIV && op != TOK_UMOD) {
+        /* Immediate Operand */
+        vswap();
+        gv(n == 1 ? RC_BYTE : RC_INT);
+        vswap();
+        d[0] = reg_idx[vtop[-1].r];
+        d[1] = reg_idx[vtop[-1].r2];
+        switch (op) {
+        case TOK_GT:
+        case TOK_LE:
+        case TOK_UGT:
+        case TOK_ULE:
+            /* 'x > c' is 'x >= c + 1', and never true if 'c' is the
+               largest value */
+            t = (op == TOK_GT || op == TOK_LE) ? 1 << (n * 8 - 1) : 1 << (n * 8);
+            c = (c + 1) & ((1 << (n * 8)) - 1);
+            op = op == TOK_GT ? TOK_GE : op == TOK_LE ? TOK_LT :
+                 op == TOK_UGT ? TOK_UGE : TOK_ULT;
+            if (c == (t & ((1 << (n * 8)) - 1))) {
+                /* compare with the smallest value instead */
+                op ^= 1;
+            }
+            break;
+        case '+':
+            op = '-';
+            c = -c;
+            break;
+        case TOK_SHL:
+        case TOK_SHR:
+        case TOK_SAR:
+            gshifti(op, d, n, c);
+            vtop--;
+            return;
+        }
+        if (op == '-' && n == 2 && d[0] >= 24 && !(d[0] & 1) &&
+            d[1] == d[0] + 1 && ((c + 63) & 0xFFFF) < 127) {
+            c = (short)c;
+            if (c > 0) {
+                AVR_DEBUG("sbiw r%d, %d\n", d[0], c);
+                _SBIW(d[0], c);
+            } else if (c < 0) {
+                AVR_DEBUG("adiw r%d, %d\n", d[0], -c);
+                _ADIW(d[0], -c);
+            }
+        } else {
+            first = 1;
+            for (i = 0; i < n; i++)
+                gopbi(op, d[i], c >> (i * 8), &first);
+        }
+    } else {
+        gv2(n == 1 ? RC_BYTE : RC_INT, n == 1 ? RC_BYTE : RC_INT);
+        d[0] = reg_idx[vtop[-1].r];
+        d[1] = reg_idx[vtop[-1].r2];
+        s[0] = reg_idx[vtop[0].r];
+        s[1] = reg_idx[vtop[0].r2];
+        switch (op) {
+        case '*':
+            /* r1:r0 holds the product, r1 is cleared afterwards */
+            if (n == 1) {
+                AVR_DEBUG("mul r%d, r%d\n", d[0], s[0]);
+                _MUL(d[0], s[0]);
+                AVR_DEBUG("mov r%d, r0\n", d[0]);
+                _MOV(d[0], TMP_REG);
+            } else {
+                t = reg_idx[get_reg(RC_BYTE)];
+                AVR_DEBUG("mul r%d, r%d\n", d[0], s[1]);
+                _MUL(d[0], s[1]);
+                AVR_DEBUG("mov r%d, r0\n", t);
+                _MOV(t, TMP_REG);
+                AVR_DEBUG("mul r%d, r%d\n", d[1], s[0]);
+                _MUL(d[1], s[0]);
+                gopb('+', t, TMP_REG, 1);
+                AVR_DEBUG("mul r%d, r%d\n", d[0], s[0]);
+                _MUL(d[0], s[0]);
+                AVR_DEBUG("mov r%d, r0\n", d[0]);
+                _MOV(d[0], TMP_REG);
+                gopb('+', ZERO_REG, t, 1);
+                AVR_DEBUG("mov r%d, r1\n", d[1]);
+                _MOV(d[1], ZERO_REG);
+            }
+            AVR_DEBUG("clr r1\n");
+            _EOR(ZERO_REG, ZERO_REG);
+            break;
+        case TOK_SHL:
+        case TOK_SHR:
+        case TOK_SAR:
+            /* loop on the count, which is destroyed */
+            t = gjmp(0);
+            c = ind;
+            gshift1(op, d, n);
+            gsym(t);
+            gloop_bound(ind, 0, n * 8 - 1);
+            AVR_DEBUG("dec r%d\n", s[0]);
+            _DEC(s[0]);
+            t = (c - ind - 2) >> 1;
+            AVR_DEBUG("brpl .%+d\n", t << 1);
+            _BRPL(t);
+            break;
+        case TOK_GT:
+        case TOK_LE:
+        case TOK_UGT:
+        case TOK_ULE:
+            /* 'x > y' is 'y < x' */
+            for (i = 0; i < n; i++)
+                gopb(op, s[i], d[i], i == 0);
+            op = op == TOK_GT ? TOK_LT : op == TOK_LE ? TOK_GE :
+                 op == TOK_UGT ? TOK_ULT : TOK_UGE;
+            break;
+        case '+':
+        case '-':
+        case '&':
+        case '|':
+        case '^':
+        case TOK_EQ:
+        case TOK_NE:
+        case TOK_LT:
+        case TOK_GE:
+        case TOK_ULT:
+        case TOK_UGE:
+            for (i = 0; i < n; i++)
+                gopb(op, d[i], s[i], i == 0);
+            break;
+        default:
+            tcc_error("XXX: operation '%s' unsupported", get_tok_str(op, NULL));
+        }
+    }
+
+    vtop--;
+    if (op >= TOK_ULT && op <= TOK_GT) {
+        vtop->r = VT_CMP;
+        vtop->c.i = op;
+    }
+}
+
+/* generate a fixed point operation 'v = t1 op t2' (ISO/IEC TR 18037):
+   '*', or '+' and '-' on _Sat types. Both operands have the same type,
+   'short _Fract' (s.7), '_Fract' (s.15) or 'short _Accum' (s8.7), or
+   their unsigned versions which have one more fractional bit.
+
+   The signed products use fmuls/fmulsu/fmul, which shift the product
+   left once: the s.15 product of two s.7 values is then in r1:r0, and
+   the s.31 product of two s.15 values, or the s16.15 product of two
+   s8.7 values, in the 32 bits built from the partial products. */
+ST_FUNC void gen_opfix(int op)
+{
+    AVR_DEBUG("# gen_opfix(op=%d)\n", op);
+
+    int t, n, align, sat, uns, i, r[4], d[2], s[2], z, m, h0, h1;
+
+    t = vtop[-1].type.t;
+    n = type_size(&vtop[-1].type, &align);
+    if (n > 2)
+        tcc_error("XXX: %d bytes fixed point operations unsupported", n);
+    if (op == '*' && !avr_have(AVR_HAVE_MUL))
+        tcc_error("fixed point multiplication requires the mul instruction");
+    sat = t & VT_SAT;
+    uns = t & VT_UNSIGNED;
+
+    if (op != '*') {
+        /* saturating addition or subtraction */
+        gv2(RC_LDI, n == 1 ? RC_BYTE : RC_INT);
+        r[0] = vtop[-1].r;
+        r[1] = vtop[-1].r2;
+        s[0] = vtop[0].r;
+        s[1] = vtop[0].r2;
+        for (i = 0; i < n; i++)
+            gopb(op, reg_idx[r[i]], reg_idx[s[i]], i == 0);
+        if (uns) {
+            /* carry: largest value or zero */
+            AVR_DEBUG("brcc .+%d\n", n * 2);
+            _BRCC(n);
+            for (i = 0; i < n; i++)
+                gloadi(r[i], op == '+' ? 0xFF : 0);
+        } else {
+            /* overflow: the result has the wrong sign */
+            AVR_DEBUG("brvc .+%d\n", (n * 2 + 1) * 2);
+            _BRVC(n * 2 + 1);
+            for (i = 0; i < n; i++)
+                gloadi(r[i], i == n - 1 ? 0x7F : 0xFF);
+            AVR_DEBUG("brmi .+%d\n", n * 2);
+            _BRMI(n);
+            for (i = 0; i < n; i++)
+                gloadi(r[i], i == n - 1 ? 0x80 : 0);
+        }
+        vtop--;
+        return;
+    }
+
+    if (n == 1) {
+        gv2(uns ? RC_BYTE : RC_FMUL, uns ? RC_BYTE : RC_FMUL);
+        d[0] = reg_idx[vtop[-1].r];
+        s[0] = reg_idx[vtop[0].r];
+        if (uns) {
+            AVR_DEBUG("mul r%d, r%d\n", d[0], s[0]);
+            _MUL(d[0], s[0]);
+        } else {
+            AVR_DEBUG("fmuls r%d, r%d\n", d[0], s[0]);
+            _FMULS(d[0], s[0]);
+        }
+        AVR_DEBUG("mov r%d, r1\nclr r1\n", d[0]);
+        _MOV(d[0], ZERO_REG);
+        _EOR(ZERO_REG, ZERO_REG);
+        if (sat && !uns) {
+            /* -1 * -1 gives -1 */
+            AVR_DEBUG("cpi r%d, 0x80\nbrne .+2\ndec r%d\n", d[0], d[0]);
+            _CPI(d[0], 0x80);
+            _BRNE(1);
+            _DEC(d[0]);
+        }
+        vtop--;
+        return;
+    }
+
+    gv2(uns ? RC_INT : RC_FMUL, uns ? RC_INT : RC_FMUL);
+    d[0] = reg_idx[vtop[-1].r];
+    d[1] = reg_idx[vtop[-1].r2];
+    s[0] = reg_idx[vtop[0].r];
+    s[1] = reg_idx[vtop[0].r2];
+    /* 32 bit product in h1:h0:m, its low byte being dropped */
+    for (i = 0; i < 4; i++)
+        r[i] = gtmp(RC_LDI);
+    z = reg_idx[r[0]];
+    m = reg_idx[r[1]];
+    h0 = reg_idx[r[2]];
+    h1 = reg_idx[r[3]];
+    AVR_DEBUG("clr r%d\n", z);
+    _EOR(z, z);
+    if (uns) {
+        AVR_DEBUG("mul r%d, r%d\n", d[1], s[1]);
+        _MUL(d[1], s[1]);
+        gmovw(h0, h1, TMP_REG);
+        AVR_DEBUG("mul r%d, r%d\nmov r%d, r1\n", d[0], s[0], m);
+        _MUL(d[0], s[0]);
+        _MOV(m, ZERO_REG);
+        for (i = 0; i < 2; i++) {
+            AVR_DEBUG("mul r%d, r%d\n", d[1 - i], s[i]);
+            _MUL(d[1 - i], s[i]);
+            gopb('+', m, TMP_REG, 1);
+            gopb('+', h0, ZERO_REG, 0);
+            gopb('+', h1, z, 0);
+        }
+    } else {
+        AVR_DEBUG("fmuls r%d, r%d\n", d[1], s[1]);
+        _FMULS(d[1], s[1]);
+        gmovw(h0, h1, TMP_REG);
+        /* fmul leaves in the carry the bit shifted out of r1 */
+        AVR_DEBUG("fmul r%d, r%d\n", d[0], s[0]);
+        _FMUL(d[0], s[0]);
+        gopb('+', h0, z, 0);
+        AVR_DEBUG("mov r%d, r1\n", m);
+        _MOV(m, ZERO_REG);
+        for (i = 0; i < 2; i++) {
+            /* the carry is the sign of the signed * unsigned product */
+            AVR_DEBUG("fmulsu r%d, r%d\n", i ? s[1] : d[1], i ? d[0] : s[0]);
+            if (i)
+                _FMULSU(s[1], d[0]);
+            else
+                _FMULSU(d[1], s[0]);
+            gopb('-', h1, z, 0);
+            gopb('+', m, TMP_REG, 1);
+            gopb('+', h0, ZERO_REG, 0);
+            gopb('+', h1, z, 0);
+        }
+    }
+    AVR_DEBUG("clr r1\n");
+    _EOR(ZERO_REG, ZERO_REG);
+
+    if ((t & VT_BTYPE) == VT_FRACT) {
+        /* the result is h1:h0 */
+        if (sat && !uns) {
+            /* -1 * -1 gives -1 */
+            AVR_DEBUG("cpi r%d, 0x80\ncpc r%d, r%d\nbrne .+4\n", h1, h0, z);
+            _CPI(h1, 0x80);
+            _CPC(h0, z);
+            _BRNE(2);
+            gloadi(r[3], 0x7F);
+            gloadi(r[2], 0xFF);
+        }
+        i = 2;
+    } else {
+        /* the result is h0:m, h1 being its sign extension */
+        if (sat && uns) {
+            AVR_DEBUG("tst r%d\nbreq .+4\n", h1);
+            _AND(h1, h1);
+            _BREQ(2);
+            gloadi(r[1], 0xFF);
+            gloadi(r[2], 0xFF);
+        } else if (sat) {
+            AVR_DEBUG("mov r%d, r%d\nlsl r%d\nsbc r%d, r%d\n", z, h0, z, z, z);
+            _MOV(z, h0);
+            _ADD(z, z);
+            _SBC(z, z);
+            AVR_DEBUG("cp r%d, r%d\nbreq .+14\n", z, h1);
+            _CP(z, h1);
+            _BREQ(7);
+            gloadi(r[1], 0xFF);
+            gloadi(r[2], 0x7F);
+            /* h1 loses its sign for -256 * -256, the operands don't */
+            AVR_DEBUG("mov r%d, r%d\neor r%d, r%d\nbrpl .+4\n",
+                      z, d[1], z, s[1]);
+            _MOV(z, d[1]);
+            _EOR(z, s[1]);
+            _BRPL(2);
+            gloadi(r[1], 0);
+            gloadi(r[2], 0x80);
+        }
+        i = 1;
+    }
+    vtop -= 5;
+    vtop->r = r[i];
+    vtop->r2 = r[i + 1];
+}
+
+/* set vtop to the float returned in r25..r22 */
+static void gfloat_ret(void)
+{
+    vtop->r = REG_FRET;
+    vtop->r2 = TREG_R23;
+    vtop->r3 = TREG_R24;
+    vtop->r4 = TREG_R25;
 }
 
 /* generate a floating point operation 'v = t1 op t2' instruction. The
-   two operands are guaranted to have the same floating point type */
+   two operands are guaranted to have the same floating point type.
+   float and double being the same type, operations are library calls
+   taking their operands in r25..r22 and r21..r18 */
 ST_FUNC void gen_opf(int op)
 {
     AVR_DEBUG("# gen_opf(op=%d)\n", op);
-}
 
+    int func;
+
+    switch (op) {
+    case '+':
+        func = TOK___addsf3;
+        break;
+    case '-':
+        func = TOK___subsf3;
+        break;
+    case '*':
+        func = TOK___mulsf3;
+        break;
+    case '/':
+        func = TOK___divsf3;
+        break;
+    case TOK_GT:
+    case TOK_GE:
+        /* -1, 0 or 1, -1 if unordered */
+        func = TOK___gesf2;
+        break;
+    case TOK_LT:
+    case TOK_LE:
+    case TOK_EQ:
+    case TOK_NE:
+        /* -1, 0 or 1, 1 if unordered */
+        func = TOK___cmpsf2;
+        break;
+    default:
+        tcc_error("XXX: float operation '%s' unsupported", get_tok_str(op, NULL));
+    }
+    vpush_global_sym(&func_old_type, func);
+    vrott(3);
+    gfunc_call(2);
+    vpushi(0);
+    if (op >= TOK_ULT && op <= TOK_GT) {
+        /* compare the result with 0 */
+        vtop->type.t = VT_BYTE;
+        vtop->r = REG_BRET;
+        vpushi(0);
+        gen_opi(op);
+    } else {
+        gfloat_ret();
+    }
+}
 
 /* convert integers to fp 't' type. Must handle 'int', 'unsigned int'
    and 'long long' cases. */
 ST_FUNC void gen_cvt_itof(int t)
 {
     AVR_DEBUG("# gen_cvt_itof(t=%d)\n", t);
+
+    int bt, u;
+
+    bt = vtop->type.t & VT_BTYPE;
+    u = (vtop->type.t & VT_UNSIGNED) != 0;
+    if (bt == VT_BYTE || bt == VT_BOOL) {
+        gen_cvt_btoi(u || bt == VT_BOOL);
+        vtop->type.t = VT_INT | (vtop->type.t & VT_UNSIGNED);
+    } else if (bt != VT_INT && bt != VT_SHORT && bt != VT_PTR) {
+        tcc_error("XXX: conversion to float unsupported");
+    }
+    vpush_global_sym(&func_old_type, u ? TOK___floatunhisf : TOK___floathisf);
+    vswap();
+    gfunc_call(1);
+    vpushi(0);
+    gfloat_ret();
 }
 
 /* convert fp to int 't' type */
 ST_FUNC void gen_cvt_ftoi(int t)
 {
     AVR_DEBUG("# gen_cvt_ftoi(t=%d)\n", t);
+
+    if ((t & VT_BTYPE) != VT_INT)
+        tcc_error("XXX: conversion from float unsupported");
+    vpush_global_sym(&func_old_type,
+                     (t & VT_UNSIGNED) ? TOK___fixunssfhi : TOK___fixsfhi);
+    vswap();
+    gfunc_call(1);
+    vpushi(0);
+    vtop->r = REG_BRET;
+    vtop->r2 = REG_IRET;
 }
 
 /* convert from one floating point type to another */
 ST_FUNC void gen_cvt_ftof(int t)
 {
     AVR_DEBUG("# gen_cvt_ftof(t=%d)\n", t);
+    /* nothing to do: all of them are float */
+}
+
+/* extend the byte in 'vtop' to a 16 bits integer. The zero register
+   gives the high byte of unsigned values, 'lsl' then 'sbc' the one of
+   signed values */
+ST_FUNC void gen_cvt_btoi(int is_unsigned)
+{
+    AVR_DEBUG("# gen_cvt_btoi(is_unsigned=%d)\n", is_unsigned);
+
+    int r, r2;
+
+    r = reg_idx[gv(RC_BYTE)];
+    r2 = get_reg(RC_BYTE);
+    vtop->r2 = r2;
+    r2 = reg_idx[r2];
+    AVR_DEBUG("mov r%d, r%d\n", r2, is_unsigned ? ZERO_REG : r);
+    _MOV(r2, is_unsigned ? ZERO_REG : r);
+    if (!is_unsigned) {
+        gopb('+', r2, r2, 1);
+        gopb('-', r2, r2, 0);
+    }
+}
+
+/* a delay of exactly 'n' cycles: a counted loop of 'b' bytes takes
+   'b' ldi, then 'k' times 'subi, sbci..., brne' whose last branch is
+   not taken, (b + 2) * k + b - 1 cycles. The rest is made of
+   'rjmp .+0' (2 cycles) and 'nop' */
+static void gdelay(unsigned n)
+{
+    int r[4], i, b, a;
+    unsigned k;
+
+    if (n > 6) {
+        /* the shortest counter holding the number of iterations */
+        for (b = 1; b < 4; b++)
+            if ((n - b + 1) / (b + 2) < 1u << (8 * b))
+                break;
+        k = (n - b + 1) / (b + 2);
+        n -= (b + 2) * k + b - 1;
+        for (i = 0; i < b; i++) {
+            r[i] = reg_idx[gtmp(RC_LDI)];
+            AVR_DEBUG("ldi r%d, %u\n", r[i], (k >> (8 * i)) & 0xFF);
+            _LDI(r[i], (k >> (8 * i)) & 0xFF);
+        }
+        a = ind;
+        AVR_DEBUG("subi r%d, 1\n", r[0]);
+        _SUBI(r[0], 1);
+        for (i = 1; i < b; i++) {
+            AVR_DEBUG("sbci r%d, 0\n", r[i]);
+            _SBCI(r[i], 0);
+        }
+        AVR_DEBUG("brne .-%d\n", (b + 1) * 2);
+        _BRNE(-(b + 1));
+        gloop_bound(a, k - 1, k - 1);
+        vtop -= b;
+    }
+    for (; n >= 2; n -= 2) {
+        AVR_DEBUG("rjmp .+0\n");
+        _RJMP(0);
+    }
+    if (n) {
+        AVR_DEBUG("nop\n");
+        gen_le16(0);
+    }
+}
+
+/* the intrinsics of avr-gcc (see unary()), 'c' being the constant
+   argument of __builtin_avr_delay_cycles() and
+   __builtin_avr_insert_bits() */
+ST_FUNC void gen_avr_builtin(int t, unsigned c)
+{
+    AVR_DEBUG("# gen_avr_builtin(%s, 0x%x)\n", get_tok_str(t, NULL), c);
+
+    int d, s, r, i, n, m, k;
+
+    switch (t) {
+    case TOK_builtin_avr_nop:
+        AVR_DEBUG("nop\n");
+        gen_le16(0);
+        break;
+    case TOK_builtin_avr_sei:
+        AVR_DEBUG("sei\n");
+        o(0x9478);
+        break;
+    case TOK_builtin_avr_cli:
+        AVR_DEBUG("cli\n");
+        _CLI();
+        break;
+    case TOK_builtin_avr_sleep:
+        AVR_DEBUG("sleep\n");
+        o(0x9588);
+        break;
+    case TOK_builtin_avr_wdr:
+        AVR_DEBUG("wdr\n");
+        o(0x95A8);
+        break;
+    case TOK_builtin_avr_swap:
+        d = reg_idx[gv(RC_BYTE)];
+        AVR_DEBUG("swap r%d\n", d);
+        o4(0x9, 0x4 | (d >> 4), d & 0xF, 0x2);
+        break;
+    case TOK_builtin_avr_fmul:
+    case TOK_builtin_avr_fmuls:
+    case TOK_builtin_avr_fmulsu:
+        if (!avr_have(AVR_HAVE_MUL))
+            tcc_error("%s requires the mul instruction", get_tok_str(t, NULL));
+        gv2(RC_FMUL, RC_FMUL);
+        d = reg_idx[vtop[-1].r];
+        s = reg_idx[vtop[0].r];
+        r = gtmp(RC_BYTE);
+        AVR_DEBUG("%s r%d, r%d\n", get_tok_str(t, NULL) + 14, d, s);
+        if (t == TOK_builtin_avr_fmul)
+            _FMUL(d, s);
+        else if (t == TOK_builtin_avr_fmuls)
+            _FMULS(d, s);
+        else
+            _FMULSU(d, s);
+        AVR_DEBUG("mov r%d, r0\nmov r%d, r1\nclr r1\n", d, reg_idx[r]);
+        _MOV(d, TMP_REG);
+        _MOV(reg_idx[r], ZERO_REG);
+        _EOR(ZERO_REG, ZERO_REG);
+        vtop -= 2;
+        vtop->r2 = r;
+        break;
+    case TOK_builtin_avr_insert_bits:
+        /* bit 'i' of the result is bit 'n' of 'bits', 'n' being the
+           nibble 'i' of the map, or the bit 'i' of 'val' for 0xF */
+        m = 0;
+        k = 0;
+        for (i = 0; i < 8; i++) {
+            n = (c >> (4 * i)) & 0xF;
+            if (n != 0xF && n > 7)
+                tcc_error("invalid map 0x%08x of __builtin_avr_insert_bits", c);
+            if (n == i) {
+                m |= 1 << i;
+                k++;
+            }
+        }
+        gv2(RC_BYTE, RC_BYTE);
+        s = reg_idx[vtop[-1].r];
+        d = reg_idx[vtop[0].r];
+        if (m == 0xFF) {
+            AVR_DEBUG("mov r%d, r%d\n", d, s);
+            _MOV(d, s);
+        } else if (k > 2) {
+            /* the bits staying in place at once: val ^= (val ^ bits) & m */
+            r = reg_idx[gtmp(RC_LDI)];
+            AVR_DEBUG("mov r%d, r%d\neor r%d, r%d\nandi r%d, 0x%02x\n"
+                      "eor r%d, r%d\n", r, s, r, d, r, m, d, r);
+            _MOV(r, s);
+            _EOR(r, d);
+            _ANDI(r, m);
+            _EOR(d, r);
+            vtop--;
+        } else {
+            m = 0;
+        }
+        for (i = 0; i < 8; i++) {
+            n = (c >> (4 * i)) & 0xF;
+            if (n == 0xF || (m & (1 << i)))
+                continue;
+            AVR_DEBUG("bst r%d, %d\nbld r%d, %d\n", s, n, d, i);
+            o4(0xF, 0xA | (s >> 4), s & 0xF, n);
+            o4(0xF, 0x8 | (d >> 4), d & 0xF, i);
+        }
+        vswap();
+        vtop--;
+        break;
+    case TOK_builtin_avr_delay_cycles:
+        gdelay(c);
+        break;
+    }
 }
 
 /* computed goto support */
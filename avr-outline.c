@@ -0,0 +1,598 @@
+/*
+ *  AVR procedural abstraction for TCC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tcc.h"
+
+/* With -moutline or -Os, the instruction sequences repeated in the code
+   that a translation unit put in the text section are moved into
+   subroutines appended to it, each occurrence becoming an rcall (a call
+   beyond 4 KB on the devices which have it).
+
+   The repeats are the intervals of the suffix array of the
+   instructions, built again after each round of replacements. An
+   instruction which cannot move into a subroutine gets a key of its own
+   so that no sequence goes through it: jumps, branches, calls, returns,
+   push, pop and the accesses to SP (the return address is on the
+   stack), the accesses to SREG, cli and sei (an atomic sequence must
+   stay in one place), nop (there for timing), the instructions with a
+   relocation and the code left alone by outline_exclude(). The loops,
+   from a backward branch to its target, are hot and left alone too,
+   unless the branch is in the unlikely code given by outline_cold(). A
+   sequence may start on a branch target or a symbol but not contain
+   one, and may neither start on the instruction of a skip nor end with
+   a skip.
+
+   W words occurring k times save k * W - (k * C + W + 1) words, C
+   being the size of the call */
+
+#define OL_FIXED    0x01 /* cannot move into a subroutine */
+#define OL_TARGET   0x02 /* branch target or symbol */
+#define OL_SKIPPED  0x04 /* skipped by the previous instruction */
+#define OL_SKIP     0x08 /* skips the next instruction */
+#define OL_RELOC    0x10 /* has a relocation */
+#define OL_COLD     0x20 /* moved away by gen_layout() */
+
+#define OL_UNIQUE   ((unsigned long long)1 << 40) /* + index: fixed key */
+
+typedef struct OutlineInsn {
+    int a, size, flags;
+    int kind;       /* from avr_insn(), -1 for excluded code */
+    int target;     /* of a relative branch, jump or call, else -1 */
+} OutlineInsn;
+
+typedef struct OutlineCand {
+    int saving, len, words, lb, rb;
+} OutlineCand;
+
+static int outline_start; /* text offset of the translation unit */
+static int *outline_ranges; /* triples (start, end, OL_FIXED or OL_COLD) */
+static int nb_outline_ranges, outline_ranges_allocated;
+
+/* suffixes compared by ol_cmp() */
+static unsigned long long *ol_keys;
+static int ol_n;
+
+static OutlineCand *ol_cands;
+static int nb_ol_cands, ol_cands_allocated;
+
+/* start of a translation unit */
+ST_FUNC void outline_begin(void)
+{
+    outline_start = text_section->data_offset;
+    nb_outline_ranges = 0;
+}
+
+static void ol_range(int start, int end, int flags)
+{
+    if (cur_text_section != text_section || start >= end)
+        return;
+    if (nb_outline_ranges + 3 > outline_ranges_allocated) {
+        outline_ranges_allocated = outline_ranges_allocated ? outline_ranges_allocated * 2 : 24;
+        outline_ranges = tcc_realloc(outline_ranges, outline_ranges_allocated * sizeof(int));
+    }
+    outline_ranges[nb_outline_ranges++] = start;
+    outline_ranges[nb_outline_ranges++] = end;
+    outline_ranges[nb_outline_ranges++] = flags;
+}
+
+/* leave the code in [start, end) of the text section as it is: inline
+   asm, which can hold data, and the functions with a cycle budget */
+ST_FUNC void outline_exclude(int start, int end)
+{
+    ol_range(start, end, OL_FIXED);
+}
+
+/* the code in [start, end) is unlikely to run: its loops may be
+   outlined too */
+ST_FUNC void outline_cold(int start, int end)
+{
+    ol_range(start, end, OL_COLD);
+}
+
+/* the flags of the ranges holding 'a' */
+static int ol_range_flags(int a)
+{
+    int i, flags = 0;
+
+    for (i = 0; i < nb_outline_ranges; i += 3)
+        if (a >= outline_ranges[i] && a < outline_ranges[i + 1])
+            flags |= outline_ranges[i + 2];
+    return flags;
+}
+
+static int ol_cmp(const void *pa, const void *pb)
+{
+    int i = *(const int *)pa, j = *(const int *)pb;
+
+    while (i < ol_n && j < ol_n && ol_keys[i] == ol_keys[j])
+        i++, j++;
+    if (i == ol_n)
+        return -1;
+    if (j == ol_n)
+        return 1;
+    return ol_keys[i] < ol_keys[j] ? -1 : 1;
+}
+
+static int ol_int_cmp(const void *pa, const void *pb)
+{
+    return *(const int *)pa - *(const int *)pb;
+}
+
+static int ol_cand_cmp(const void *pa, const void *pb)
+{
+    const OutlineCand *a = pa, *b = pb;
+
+    if (a->saving != b->saving)
+        return b->saving - a->saving;
+    return b->len - a->len;
+}
+
+/* occurrences of the sequence of 'len' instructions at 'pos[0..n)',
+   sorted, which do not overlap each other nor a replaced one */
+static int ol_select(int *pos, int n, int len, char *used)
+{
+    int i, j, k, last;
+
+    qsort(pos, n, sizeof(int), ol_int_cmp);
+    k = 0;
+    last = -1;
+    for (i = 0; i < n; i++) {
+        if (pos[i] < last)
+            continue;
+        for (j = 0; j < len && !used[pos[i] + j]; j++)
+            ;
+        if (j < len)
+            continue;
+        pos[k++] = pos[i];
+        last = pos[i] + len;
+    }
+    return k;
+}
+
+/* record the candidate of the suffixes sa[lb..rb], which share their
+   first 'len' instructions */
+static void ol_interval(OutlineInsn *ins, int *wsum, int *sa, int *pos,
+                        char *used, int call, int len, int lb, int rb)
+{
+    OutlineCand *c;
+    int i, p, k, w, saving;
+
+    p = sa[lb];
+    if (ins[p].flags & OL_SKIPPED)
+        return;
+    for (i = 1; i < len; i++)
+        if (ins[p + i].flags & OL_TARGET)
+            break;
+    len = i;
+    while (len > 0 && (ins[p + len - 1].flags & OL_SKIP))
+        len--;
+    if (len == 0)
+        return;
+    w = wsum[p + len] - wsum[p];
+    memcpy(pos, sa + lb, (rb - lb + 1) * sizeof(int));
+    k = ol_select(pos, rb - lb + 1, len, used);
+    saving = k * w - (k * call + w + 1);
+    if (saving <= 0)
+        return;
+    if (nb_ol_cands >= ol_cands_allocated) {
+        ol_cands_allocated = ol_cands_allocated ? ol_cands_allocated * 2 : 64;
+        ol_cands = tcc_realloc(ol_cands, ol_cands_allocated * sizeof(OutlineCand));
+    }
+    c = &ol_cands[nb_ol_cands++];
+    c->saving = saving;
+    c->len = len;
+    c->words = w;
+    c->lb = lb;
+    c->rb = rb;
+}
+
+/* replace the occurrences chosen by gen_outline() with calls to the
+   subroutines and move the code, relocations and symbols */
+static void ol_rewrite(TCCState *s1, OutlineInsn *ins, int n, int *owner,
+                       char *used, int *occ_at, int *rt_src, int *rt_len,
+                       int nb_rt, int start, int end, int call)
+{
+    Section *sec, *sr, *s;
+    OutlineInsn *p;
+    ElfW(Sym) *esym, *sym_end;
+    ElfW_Rel *rel, *rel_end;
+    unsigned char *buf;
+    int nb_words, i, j, k, a, w, q, r, off, pc;
+    int *rt_addr, *rt_sym, *map, *sites, nb_sites, *funcs, nb_funcs;
+    char name[32];
+
+    sec = text_section;
+    nb_words = (end - start) >> 1;
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+
+    /* the functions which now call a subroutine, for -fstack-usage */
+    funcs = NULL;
+    nb_funcs = 0;
+    for (esym = (ElfW(Sym) *)symtab_section->data + 1; esym < sym_end; esym++) {
+        if (esym->st_shndx != sec->sh_num ||
+            ELFW(ST_TYPE)(esym->st_info) != STT_FUNC ||
+            esym->st_value < start || esym->st_value + esym->st_size > end)
+            continue;
+        j = owner[(esym->st_value + esym->st_size - start) >> 1];
+        for (i = owner[(esym->st_value - start) >> 1]; i < j && occ_at[i] < 0; i++)
+            ;
+        if (i < j) {
+            funcs = tcc_realloc(funcs, (nb_funcs + 1) * sizeof(int));
+            funcs[nb_funcs++] = esym - (ElfW(Sym) *)symtab_section->data;
+        }
+    }
+
+    /* the new code, then the subroutines */
+    buf = tcc_malloc(end - start);
+    map = tcc_malloc((nb_words + 1) * sizeof(int));
+    sites = tcc_malloc(n * 2 * sizeof(int));
+    nb_sites = 0;
+    q = 0;
+    for (i = 0; i < n;) {
+        p = &ins[i];
+        if (occ_at[i] >= 0) {
+            r = occ_at[i];
+            for (j = i; j < i + rt_len[r]; j++)
+                for (k = 0; k < ins[j].size; k += 2)
+                    map[(ins[j].a + k - start) >> 1] = q;
+            sites[nb_sites++] = q;
+            sites[nb_sites++] = r;
+            if (call == 2) {
+                buf[q] = 0x0E; /* call */
+                buf[q + 1] = 0x94;
+                buf[q + 2] = 0;
+                buf[q + 3] = 0;
+            } else {
+                buf[q] = 0; /* rcall */
+                buf[q + 1] = 0xD0;
+            }
+            q += call * 2;
+            i += rt_len[r];
+        } else {
+            for (k = 0; k < p->size; k += 2)
+                map[(p->a + k - start) >> 1] = q + k;
+            memcpy(buf + q, sec->data + p->a, p->size);
+            q += p->size;
+            i++;
+        }
+    }
+    map[nb_words] = q;
+    rt_addr = tcc_malloc(nb_rt * sizeof(int));
+    for (r = 0; r < nb_rt; r++) {
+        rt_addr[r] = q;
+        for (j = rt_src[r]; j < rt_src[r] + rt_len[r]; j++) {
+            memcpy(buf + q, sec->data + ins[j].a, ins[j].size);
+            q += ins[j].size;
+        }
+        buf[q++] = 0x08; /* ret */
+        buf[q++] = 0x95;
+    }
+
+    /* the relative branches, jumps and calls between the moved code */
+    for (i = 0; i < n; i++) {
+        p = &ins[i];
+        if (used[i] || p->target < 0)
+            continue;
+        a = map[(p->a - start) >> 1];
+        k = (map[(p->target - start) >> 1] - a - 2) >> 1;
+        w = buf[a] | (buf[a + 1] << 8);
+        if (p->kind == INSN_BRANCH)
+            w = (w & ~0x3F8) | ((k & 0x7F) << 3);
+        else
+            w = (w & 0xF000) | (k & 0xFFF);
+        buf[a] = w;
+        buf[a + 1] = w >> 8;
+    }
+    memcpy(sec->data + start, buf, q);
+    sec->data_offset = start + q;
+
+#define OL_MAP(x) (start + map[((x) - start) >> 1] + (((x) - start) & 1))
+
+    /* the relocations, in the code or against its section symbol */
+    for (i = 1; i < s1->nb_sections; i++) {
+        sr = s1->sections[i];
+        if (sr->sh_type != SHT_RELX || sr->link != symtab_section)
+            continue;
+        s = s1->sections[sr->sh_info];
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for (rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            if (s == sec && rel->r_offset >= start && rel->r_offset < end)
+                rel->r_offset = OL_MAP(rel->r_offset);
+            esym = &((ElfW(Sym) *)symtab_section->data)[ELFW(R_SYM)(rel->r_info)];
+            if (esym->st_shndx == sec->sh_num &&
+                ELFW(ST_TYPE)(esym->st_info) == STT_SECTION &&
+                rel->r_addend >= start && rel->r_addend <= end)
+                rel->r_addend = OL_MAP(rel->r_addend);
+        }
+    }
+
+    /* the symbols */
+    for (esym = (ElfW(Sym) *)symtab_section->data + 1; esym < sym_end; esym++) {
+        if (esym->st_shndx != sec->sh_num ||
+            ELFW(ST_TYPE)(esym->st_info) == STT_SECTION ||
+            esym->st_value < start || esym->st_value > end)
+            continue;
+        if (esym->st_value + esym->st_size <= end)
+            esym->st_size = OL_MAP(esym->st_value + esym->st_size) -
+                            OL_MAP(esym->st_value);
+        esym->st_value = OL_MAP(esym->st_value);
+    }
+
+    /* the subroutines and their calls */
+    rt_sym = tcc_malloc(nb_rt * sizeof(int));
+    for (r = 0; r < nb_rt; r++) {
+        snprintf(name, sizeof(name), "L..outline%d", r);
+        rt_sym[r] = put_elf_sym(symtab_section, start + rt_addr[r],
+                                (r + 1 < nb_rt ? rt_addr[r + 1] : q) - rt_addr[r],
+                                ELFW(ST_INFO)(STB_LOCAL, STT_FUNC), 0,
+                                sec->sh_num, name);
+    }
+    for (i = 0; i < nb_sites; i += 2)
+        put_elf_reloc(symtab_section, sec, start + sites[i],
+                      call == 2 ? R_AVR_CALL : R_AVR_13_PCREL,
+                      rt_sym[sites[i + 1]]);
+
+    /* -fstack-usage: the return address pushed by the calls */
+    pc = avr_have(AVR_HAVE_EIJMP_EICALL) ? 3 : 2;
+    for (i = 1; i < s1->nb_sections && nb_funcs; i++) {
+        s = s1->sections[i];
+        if (strcmp(s->name, ".stack_usage") || !s->reloc)
+            continue;
+        rel_end = (ElfW_Rel *)(s->reloc->data + s->reloc->data_offset);
+        for (off = 0; off + 16 <= s->data_offset;
+             off += 16 + 4 * get32(s->data + off + 12)) {
+            for (rel = (ElfW_Rel *)s->reloc->data; rel < rel_end; rel++)
+                if (rel->r_offset == off)
+                    break;
+            if (rel == rel_end)
+                continue;
+            for (j = 0; j < nb_funcs && funcs[j] != ELFW(R_SYM)(rel->r_info); j++)
+                ;
+            if (j < nb_funcs)
+                put_word(s->data + off + 8, get32(s->data + off + 8) + pc);
+        }
+    }
+
+    tcc_free(rt_sym);
+    tcc_free(rt_addr);
+    tcc_free(sites);
+    tcc_free(map);
+    tcc_free(buf);
+    tcc_free(funcs);
+}
+
+ST_FUNC void gen_outline(TCCState *s1)
+{
+    Section *sec, *saved, *sr;
+    OutlineInsn *ins, *p;
+    ElfW(Sym) *esym, *sym_end;
+    ElfW_Rel *rel, *rel_end;
+    unsigned long long *keys;
+    int start, end, nb_words, n, i, j, k, a, size, cycles, w, call;
+    int *owner, *wsum, *sa, *rank, *lcp, *pos, *stack, sp, lb, l, h;
+    int *rt_src, *rt_len, nb_rt, *occ_at, applied;
+    char *used;
+
+    sec = text_section;
+    start = outline_start;
+    end = sec->data_offset;
+    if (end - start < 8)
+        return;
+    saved = cur_text_section;
+    cur_text_section = sec;
+
+    /* the instructions */
+    nb_words = (end - start) >> 1;
+    owner = tcc_malloc((nb_words + 1) * sizeof(int));
+    ins = tcc_malloc(nb_words * sizeof(OutlineInsn));
+    n = 0;
+    for (a = start; a < end; a += size) {
+        p = &ins[n];
+        p->a = a;
+        p->flags = 0;
+        p->target = -1;
+        size = 2;
+        if (ol_range_flags(a) & OL_FIXED) {
+            p->kind = -1;
+            p->flags = OL_FIXED;
+        } else {
+            p->kind = avr_insn(a, &size, &cycles, &p->target);
+            w = read16(a);
+            if (a + size > end) {
+                size = 2;
+                p->kind = -1;
+                p->flags = OL_FIXED;
+            } else if (p->kind == INSN_SKIP) {
+                p->flags = OL_SKIP;
+            } else if (p->kind != INSN_NEXT) {
+                p->flags = OL_FIXED;
+                if (p->kind == INSN_CALL && (w & 0xF000) == 0xD000) /* rcall */
+                    p->target = a + 2 + (((w & 0xFFF) ^ 0x800) - 0x800) * 2;
+            }
+            if (w == 0 || w == 0x94F8 || w == 0x9478 || (w & 0xFC0F) == 0x900F) {
+                /* nop, cli, sei, push, pop */
+                p->flags |= OL_FIXED;
+            } else if ((w & 0xF000) == 0xB000) {
+                /* in, out */
+                k = ((w >> 5) & 0x30) | (w & 0xF);
+                if (k >= IO_SPL && k <= IO_SREG)
+                    p->flags |= OL_FIXED;
+            } else if (size == 4 && (w & 0xFC0F) == 0x9000) {
+                /* lds, sts */
+                k = read16(a + 2);
+                if (k >= IO_SPL + 0x20 && k <= IO_SREG + 0x20)
+                    p->flags |= OL_FIXED;
+            }
+        }
+        p->flags |= ol_range_flags(a) & OL_COLD;
+        p->size = size;
+        for (i = 0; i < size; i += 2)
+            owner[(a + i - start) >> 1] = n;
+        n++;
+    }
+    owner[nb_words] = n;
+    for (i = 1; i < n; i++)
+        if (ins[i - 1].flags & OL_SKIP)
+            ins[i].flags |= OL_SKIPPED;
+
+    /* the relocations, symbols, branch targets and loops */
+    sr = sec->reloc;
+    if (sr) {
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for (rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++)
+            if (rel->r_offset >= start && rel->r_offset < end)
+                ins[owner[(rel->r_offset - start) >> 1]].flags |= OL_FIXED | OL_RELOC;
+    }
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for (esym = (ElfW(Sym) *)symtab_section->data + 1; esym < sym_end; esym++)
+        if (esym->st_shndx == sec->sh_num &&
+            ELFW(ST_TYPE)(esym->st_info) != STT_SECTION &&
+            esym->st_value >= start && esym->st_value < end)
+            ins[owner[(esym->st_value - start) >> 1]].flags |= OL_TARGET;
+    for (i = 0; i < n; i++) {
+        p = &ins[i];
+        if (p->target < start || p->target >= end || (p->flags & OL_RELOC)) {
+            p->target = -1;
+            continue;
+        }
+        j = owner[(p->target - start) >> 1];
+        ins[j].flags |= OL_TARGET;
+        if (!(p->flags & OL_COLD))
+            for (; j < i; j++)
+                ins[j].flags |= OL_FIXED;
+    }
+
+    /* the keys */
+    keys = tcc_malloc(n * sizeof(unsigned long long));
+    wsum = tcc_malloc((n + 1) * sizeof(int));
+    wsum[0] = 0;
+    for (i = 0; i < n; i++) {
+        p = &ins[i];
+        if (p->flags & OL_FIXED) {
+            keys[i] = OL_UNIQUE + i;
+        } else {
+            keys[i] = read16(p->a) |
+                      (unsigned long long)(p->size == 4 ? read16(p->a + 2) : 0) << 16 |
+                      (unsigned long long)(p->flags & (OL_TARGET | OL_SKIPPED)) << 32;
+        }
+        wsum[i + 1] = wsum[i] + p->size / 2;
+    }
+
+    /* rounds of replacements, the best candidates first */
+    if (end - start <= 4096 || !avr_have(AVR_HAVE_JMP_CALL))
+        call = 1;
+    else
+        call = 2;
+    sa = tcc_malloc(n * sizeof(int));
+    rank = tcc_malloc(n * sizeof(int));
+    lcp = tcc_malloc((n + 1) * sizeof(int));
+    pos = tcc_malloc(n * sizeof(int));
+    stack = tcc_malloc(2 * (n + 1) * sizeof(int));
+    used = tcc_mallocz(n);
+    occ_at = tcc_malloc(n * sizeof(int));
+    for (i = 0; i < n; i++)
+        occ_at[i] = -1;
+    rt_src = rt_len = NULL;
+    nb_rt = 0;
+    do {
+        for (i = 0; i < n; i++)
+            sa[i] = i;
+        ol_keys = keys;
+        ol_n = n;
+        qsort(sa, n, sizeof(int), ol_cmp);
+        for (i = 0; i < n; i++)
+            rank[sa[i]] = i;
+        lcp[0] = 0;
+        for (i = 0, h = 0; i < n; i++) {
+            if (rank[i] == 0) {
+                h = 0;
+                continue;
+            }
+            j = sa[rank[i] - 1];
+            while (i + h < n && j + h < n && keys[i + h] == keys[j + h])
+                h++;
+            lcp[rank[i]] = h;
+            if (h)
+                h--;
+        }
+        lcp[n] = 0;
+
+        /* the lcp intervals, with a stack of (lcp, left bound) */
+        nb_ol_cands = 0;
+        sp = 0;
+        stack[0] = 0;
+        stack[1] = 0;
+        for (i = 1; i <= n; i++) {
+            l = lcp[i];
+            lb = i - 1;
+            while (l < stack[2 * sp]) {
+                lb = stack[2 * sp + 1];
+                ol_interval(ins, wsum, sa, pos, used, call,
+                            stack[2 * sp], lb, i - 1);
+                sp--;
+            }
+            if (l > stack[2 * sp]) {
+                sp++;
+                stack[2 * sp] = l;
+                stack[2 * sp + 1] = lb;
+            }
+        }
+        qsort(ol_cands, nb_ol_cands, sizeof(OutlineCand), ol_cand_cmp);
+
+        applied = 0;
+        for (i = 0; i < nb_ol_cands; i++) {
+            OutlineCand *c = &ol_cands[i];
+            memcpy(pos, sa + c->lb, (c->rb - c->lb + 1) * sizeof(int));
+            k = ol_select(pos, c->rb - c->lb + 1, c->len, used);
+            if (k * c->words - (k * call + c->words + 1) <= 0)
+                continue;
+            rt_src = tcc_realloc(rt_src, (nb_rt + 1) * sizeof(int));
+            rt_len = tcc_realloc(rt_len, (nb_rt + 1) * sizeof(int));
+            rt_src[nb_rt] = pos[0];
+            rt_len[nb_rt] = c->len;
+            for (j = 0; j < k; j++) {
+                occ_at[pos[j]] = nb_rt;
+                memset(used + pos[j], 1, c->len);
+            }
+            nb_rt++;
+            applied++;
+        }
+        for (i = 0; i < n; i++)
+            if (used[i])
+                keys[i] = OL_UNIQUE + i;
+    } while (applied);
+
+    if (nb_rt)
+        ol_rewrite(s1, ins, n, owner, used, occ_at, rt_src, rt_len, nb_rt,
+                   start, end, call);
+
+    tcc_free(rt_src);
+    tcc_free(rt_len);
+    tcc_free(occ_at);
+    tcc_free(used);
+    tcc_free(stack);
+    tcc_free(pos);
+    tcc_free(lcp);
+    tcc_free(rank);
+    tcc_free(sa);
+    tcc_free(wsum);
+    tcc_free(keys);
+    tcc_free(ins);
+    tcc_free(owner);
+    cur_text_section = saved;
+}
@@ -0,0 +1,1180 @@
+/*
+ *  AVR instruction set simulator for the -run switch of TCC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tcc.h"
+
+/* The program relocated by tcc_relocate() runs on a model of the core
+   of the -mmcu device: the code is loaded in flash from address 0, the
+   data in SRAM, and main() is called with the arguments of -run copied
+   at the top of the SRAM. The cycles are those of the classic cores,
+   as in avr_insn().
+
+   There are no peripherals: the I/O registers read back what was
+   written to them, except the data and status registers of the USART 0.
+   A byte written to UDR goes to stdout, a byte read from it comes from
+   stdin, and the status register is always ready.
+
+   The functions of sim_funcs[] left undefined by the program are run by
+   the host, at no cycle cost, from the last words of the flash. The
+   program stops when main() returns, on exit() or abort(), and on a
+   'sleep', a 'break' or a jump to itself: nothing can interrupt them */
+
+#define SIM_DATA_SIZE 0x10000
+
+/* the I/O registers used by the core, as data addresses */
+#define SIM_RAMPZ 0x5B
+#define SIM_EIND  0x5C
+#define SIM_SPL   0x5D
+#define SIM_SPH   0x5E
+#define SIM_SREG  0x5F
+
+#define SREG_C 0x01
+#define SREG_Z 0x02
+#define SREG_N 0x04
+#define SREG_V 0x08
+#define SREG_S 0x10
+#define SREG_H 0x20
+#define SREG_T 0x40
+#define SREG_I 0x80
+
+typedef struct AVRSim {
+    const AVRDevice *d;
+    unsigned char *flash;
+    unsigned char *data;    /* registers, I/O registers and SRAM */
+    unsigned pc;            /* in words */
+    unsigned pc_mask;
+    int pc_bytes;           /* bytes of a return address */
+    unsigned udr, ucsra;    /* data addresses of the USART 0 registers */
+    unsigned heap;          /* end of the data: the stack must stay above */
+    unsigned text;          /* end of the code and constants in flash */
+    unsigned sp_max, sp_min;
+    unsigned host_pc;       /* first word of the host functions */
+    long long cycles, insns;
+    int halted, status;
+    const char *stop;       /* why the program stopped if not by exit() */
+    unsigned stop_pc;
+} AVRSim;
+
+typedef struct SimFunc {
+    const char *name;
+    int (*func)(AVRSim *m);
+} SimFunc;
+
+/* ------------------------------------------------------------- */
+/* memory */
+
+static int sim_read(AVRSim *m, unsigned a)
+{
+    int c;
+
+    a &= SIM_DATA_SIZE - 1;
+    if (a == m->udr) {
+        fflush(stdout);
+        c = getchar();
+        return c == EOF ? 0 : c;
+    }
+    if (a == m->ucsra)
+        return 0xE0; /* RXC, TXC, UDRE */
+    return m->data[a];
+}
+
+static void sim_write(AVRSim *m, unsigned a, int v)
+{
+    a &= SIM_DATA_SIZE - 1;
+    if (a == m->udr)
+        putchar(v & 0xFF);
+    else
+        m->data[a] = v;
+}
+
+static unsigned sim_word(AVRSim *m, unsigned pc)
+{
+    pc = (pc & m->pc_mask) * 2;
+    return m->flash[pc] | (m->flash[pc + 1] << 8);
+}
+
+static unsigned sim_reg16(AVRSim *m, int r)
+{
+    return m->data[r] | (m->data[r + 1] << 8);
+}
+
+static void sim_set_reg16(AVRSim *m, int r, unsigned v)
+{
+    m->data[r] = v;
+    m->data[r + 1] = v >> 8;
+}
+
+static unsigned sim_sp(AVRSim *m)
+{
+    return sim_reg16(m, SIM_SPL);
+}
+
+static void sim_push(AVRSim *m, int v)
+{
+    unsigned sp = sim_sp(m);
+
+    if (sp < m->heap && !m->halted) {
+        tcc_error_noabort("stack overflow at 0x%05x, SP = 0x%04x",
+                          (m->pc - 1) * 2, sp);
+        m->halted = 1;
+        m->status = 1;
+    }
+    m->data[sp & (SIM_DATA_SIZE - 1)] = v;
+    sim_set_reg16(m, SIM_SPL, sp - 1);
+    if (sp - 1 < m->sp_min)
+        m->sp_min = sp - 1;
+}
+
+static int sim_pop(AVRSim *m)
+{
+    unsigned sp = sim_sp(m) + 1;
+
+    sim_set_reg16(m, SIM_SPL, sp);
+    return m->data[sp & (SIM_DATA_SIZE - 1)];
+}
+
+static void sim_push_pc(AVRSim *m, unsigned pc)
+{
+    sim_push(m, pc);
+    sim_push(m, pc >> 8);
+    if (m->pc_bytes == 3)
+        sim_push(m, pc >> 16);
+}
+
+static unsigned sim_pop_pc(AVRSim *m)
+{
+    unsigned pc = 0;
+
+    if (m->pc_bytes == 3)
+        pc = sim_pop(m) << 16;
+    pc |= sim_pop(m) << 8;
+    pc |= sim_pop(m);
+    return pc;
+}
+
+/* ------------------------------------------------------------- */
+/* flags */
+
+/* add N, Z and S = N ^ V to the flags 'f' of the result 'r', and set
+   the flags of 'mask' in SREG */
+static void sim_flags(AVRSim *m, int mask, int f, int r)
+{
+    if (r & 0x80)
+        f |= SREG_N;
+    if (!(r & 0xFF))
+        f |= SREG_Z;
+    if (!(f & SREG_N) != !(f & SREG_V))
+        f |= SREG_S;
+    m->data[SIM_SREG] = (m->data[SIM_SREG] & ~mask) | (f & mask);
+}
+
+/* d + s + c */
+static int sim_add(AVRSim *m, int d, int s, int c)
+{
+    int r, carries, f;
+
+    r = (d + s + c) & 0xFF;
+    carries = (d & s) | (s & ~r) | (~r & d);
+    f = 0;
+    if (carries & 0x08)
+        f |= SREG_H;
+    if (carries & 0x80)
+        f |= SREG_C;
+    if (((d & s & ~r) | (~d & ~s & r)) & 0x80)
+        f |= SREG_V;
+    sim_flags(m, 0x3F, f, r);
+    return r;
+}
+
+/* d - s - c, Z being only cleared if 'keep_z' (sbc, sbci, cpc) */
+static int sim_sub(AVRSim *m, int d, int s, int c, int keep_z)
+{
+    int r, borrows, f, z;
+
+    z = m->data[SIM_SREG] & SREG_Z;
+    r = (d - s - c) & 0xFF;
+    borrows = (~d & s) | (s & r) | (r & ~d);
+    f = 0;
+    if (borrows & 0x08)
+        f |= SREG_H;
+    if (borrows & 0x80)
+        f |= SREG_C;
+    if (((d & ~s & ~r) | (~d & s & r)) & 0x80)
+        f |= SREG_V;
+    sim_flags(m, 0x3F, f, r);
+    if (keep_z && !z)
+        m->data[SIM_SREG] &= ~SREG_Z;
+    return r;
+}
+
+/* logical operations */
+static int sim_logic(AVRSim *m, int r)
+{
+    sim_flags(m, SREG_S | SREG_V | SREG_N | SREG_Z, 0, r);
+    return r & 0xFF;
+}
+
+/* shifts right of 'd' in 'r' */
+static int sim_shift(AVRSim *m, int d, int r)
+{
+    int f = 0;
+
+    if (d & 1)
+        f |= SREG_C;
+    if (!(r & 0x80) != !(d & 1))
+        f |= SREG_V;
+    sim_flags(m, SREG_S | SREG_V | SREG_N | SREG_Z | SREG_C, f, r);
+    return r & 0xFF;
+}
+
+/* 16 bit result of mul, muls, mulsu and fmul* in r1:r0 */
+static void sim_mul(AVRSim *m, int p, int shift)
+{
+    int f = 0;
+
+    p &= 0xFFFF;
+    if (p & 0x8000)
+        f |= SREG_C;
+    p = (p << shift) & 0xFFFF;
+    if (!p)
+        f |= SREG_Z;
+    sim_set_reg16(m, 0, p);
+    m->data[SIM_SREG] = (m->data[SIM_SREG] & ~(SREG_C | SREG_Z)) | f;
+}
+
+/* ------------------------------------------------------------- */
+/* execution */
+
+/* size in words of the instruction at 'pc' */
+static int sim_size(AVRSim *m, unsigned pc)
+{
+    unsigned w = sim_word(m, pc);
+
+    /* lds, sts, jmp, call */
+    return (w & 0xFC0F) == 0x9000 || (w & 0xFE0C) == 0x940C ? 2 : 1;
+}
+
+static void sim_skip(AVRSim *m, int cond)
+{
+    int n;
+
+    if (cond) {
+        n = sim_size(m, m->pc);
+        m->pc += n;
+        m->cycles += n;
+    }
+}
+
+static void sim_stop(AVRSim *m, const char *why, unsigned pc)
+{
+    m->stop = why;
+    m->stop_pc = pc;
+    m->halted = 1;
+}
+
+static void sim_illegal(AVRSim *m, unsigned a, unsigned w)
+{
+    tcc_error_noabort("illegal instruction 0x%04x at 0x%05x", w, a * 2);
+    m->halted = 1;
+    m->status = 1;
+}
+
+/* X, Y or Z for the loads and stores: 'mode' is 0 for (r), 1 for (r+)
+   and 2 for (-r) */
+static unsigned sim_ptr(AVRSim *m, int r, int mode)
+{
+    unsigned a = sim_reg16(m, r);
+
+    if (mode == 1)
+        sim_set_reg16(m, r, a + 1);
+    else if (mode == 2)
+        sim_set_reg16(m, r, --a);
+    return a;
+}
+
+/* execute the instruction at m->pc */
+static void sim_step(AVRSim *m)
+{
+    unsigned char *r = m->data;
+    unsigned pc, w, a, k;
+    int d, s, q, b, pcc;
+
+    pc = m->pc;
+    w = sim_word(m, pc);
+    m->pc = pc + 1;
+    m->insns++;
+    m->cycles++;
+    pcc = m->pc_bytes - 2;
+    d = (w >> 4) & 0x1F;
+    s = (w & 0xF) | ((w >> 5) & 0x10);
+
+    switch (w >> 12) {
+    case 0x0:
+        switch ((w >> 10) & 3) {
+        case 0:
+            if (w == 0) /* nop */
+                break;
+            switch ((w >> 8) & 3) {
+            case 1: /* movw */
+                d = (w >> 3) & 0x1E;
+                s = (w << 1) & 0x1E;
+                r[d] = r[s];
+                r[d + 1] = r[s + 1];
+                break;
+            case 2: /* muls */
+                m->cycles++;
+                d = 16 + ((w >> 4) & 0xF);
+                s = 16 + (w & 0xF);
+                sim_mul(m, (signed char)r[d] * (signed char)r[s], 0);
+                break;
+            case 3: /* mulsu, fmul, fmuls, fmulsu */
+                m->cycles++;
+                d = 16 + ((w >> 4) & 7);
+                s = 16 + (w & 7);
+                switch (w & 0x88) {
+                case 0x00:
+                    sim_mul(m, (signed char)r[d] * r[s], 0);
+                    break;
+                case 0x08:
+                    sim_mul(m, r[d] * r[s], 1);
+                    break;
+                case 0x80:
+                    sim_mul(m, (signed char)r[d] * (signed char)r[s], 1);
+                    break;
+                default:
+                    sim_mul(m, (signed char)r[d] * r[s], 1);
+                    break;
+                }
+                break;
+            default:
+                sim_illegal(m, pc, w);
+                break;
+            }
+            break;
+        case 1: /* cpc */
+            sim_sub(m, r[d], r[s], r[SIM_SREG] & SREG_C, 1);
+            break;
+        case 2: /* sbc */
+            r[d] = sim_sub(m, r[d], r[s], r[SIM_SREG] & SREG_C, 1);
+            break;
+        case 3: /* add */
+            r[d] = sim_add(m, r[d], r[s], 0);
+            break;
+        }
+        break;
+    case 0x1:
+        switch ((w >> 10) & 3) {
+        case 0: /* cpse */
+            sim_skip(m, r[d] == r[s]);
+            break;
+        case 1: /* cp */
+            sim_sub(m, r[d], r[s], 0, 0);
+            break;
+        case 2: /* sub */
+            r[d] = sim_sub(m, r[d], r[s], 0, 0);
+            break;
+        case 3: /* adc */
+            r[d] = sim_add(m, r[d], r[s], r[SIM_SREG] & SREG_C);
+            break;
+        }
+        break;
+    case 0x2:
+        switch ((w >> 10) & 3) {
+        case 0: /* and */
+            r[d] = sim_logic(m, r[d] & r[s]);
+            break;
+        case 1: /* eor */
+            r[d] = sim_logic(m, r[d] ^ r[s]);
+            break;
+        case 2: /* or */
+            r[d] = sim_logic(m, r[d] | r[s]);
+            break;
+        case 3: /* mov */
+            r[d] = r[s];
+            break;
+        }
+        break;
+    case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xE:
+        d = 16 + ((w >> 4) & 0xF);
+        k = (w & 0xF) | ((w >> 4) & 0xF0);
+        switch (w >> 12) {
+        case 0x3: /* cpi */
+            sim_sub(m, r[d], k, 0, 0);
+            break;
+        case 0x4: /* sbci */
+            r[d] = sim_sub(m, r[d], k, r[SIM_SREG] & SREG_C, 1);
+            break;
+        case 0x5: /* subi */
+            r[d] = sim_sub(m, r[d], k, 0, 0);
+            break;
+        case 0x6: /* ori */
+            r[d] = sim_logic(m, r[d] | k);
+            break;
+        case 0x7: /* andi */
+            r[d] = sim_logic(m, r[d] & k);
+            break;
+        default: /* ldi */
+            r[d] = k;
+            break;
+        }
+        break;
+    case 0x8:
+    case 0xA: /* ldd, std */
+        m->cycles++;
+        q = (w & 7) | ((w >> 7) & 0x18) | ((w >> 8) & 0x20);
+        a = sim_reg16(m, w & 8 ? 28 : 30) + q;
+        if (w & 0x200)
+            sim_write(m, a, r[d]);
+        else
+            r[d] = sim_read(m, a);
+        break;
+    case 0x9:
+        switch ((w >> 9) & 7) {
+        case 0: /* loads */
+            m->cycles++;
+            switch (w & 0xF) {
+            case 0x0: /* lds */
+                r[d] = sim_read(m, sim_word(m, m->pc++));
+                break;
+            case 0x1: case 0x2: /* ld Z+, -Z */
+                m->cycles += (w & 0xF) == 2;
+                r[d] = sim_read(m, sim_ptr(m, 30, w & 3));
+                break;
+            case 0x9: case 0xA: /* ld Y+, -Y */
+                m->cycles += (w & 0xF) == 0xA;
+                r[d] = sim_read(m, sim_ptr(m, 28, w & 3));
+                break;
+            case 0xC: case 0xD: case 0xE: /* ld X, X+, -X */
+                m->cycles += (w & 0xF) == 0xE;
+                r[d] = sim_read(m, sim_ptr(m, 26, w & 3));
+                break;
+            case 0x4: case 0x5: case 0x6: case 0x7: /* lpm, elpm */
+                m->cycles++;
+                a = sim_reg16(m, 30);
+                if (w & 2)
+                    a |= r[SIM_RAMPZ] << 16;
+                r[d] = m->flash[a % m->d->flash_size];
+                if (w & 1) {
+                    a++;
+                    sim_set_reg16(m, 30, a);
+                    if (w & 2)
+                        r[SIM_RAMPZ] = a >> 16;
+                }
+                break;
+            case 0xF: /* pop */
+                r[d] = sim_pop(m);
+                break;
+            default:
+                sim_illegal(m, pc, w);
+                break;
+            }
+            break;
+        case 1: /* stores */
+            m->cycles++;
+            switch (w & 0xF) {
+            case 0x0: /* sts */
+                sim_write(m, sim_word(m, m->pc++), r[d]);
+                break;
+            case 0x1: case 0x2: /* st Z+, -Z */
+                sim_write(m, sim_ptr(m, 30, w & 3), r[d]);
+                break;
+            case 0x9: case 0xA: /* st Y+, -Y */
+                sim_write(m, sim_ptr(m, 28, w & 3), r[d]);
+                break;
+            case 0xC: case 0xD: case 0xE: /* st X, X+, -X */
+                sim_write(m, sim_ptr(m, 26, w & 3), r[d]);
+                break;
+            case 0xF: /* push */
+                sim_push(m, r[d]);
+                break;
+            default:
+                sim_illegal(m, pc, w);
+                break;
+            }
+            break;
+        case 2:
+            switch (w & 0xF) {
+            case 0x0: /* com */
+                r[d] = ~r[d];
+                sim_flags(m, 0x1F, SREG_C, r[d]);
+                break;
+            case 0x1: /* neg */
+                b = r[d];
+                r[d] = -b;
+                q = 0;
+                if ((r[d] | b) & 0x08)
+                    q |= SREG_H;
+                if (r[d] == 0x80)
+                    q |= SREG_V;
+                if (r[d])
+                    q |= SREG_C;
+                sim_flags(m, 0x3F, q, r[d]);
+                break;
+            case 0x2: /* swap */
+                r[d] = (r[d] << 4) | (r[d] >> 4);
+                break;
+            case 0x3: /* inc */
+                r[d]++;
+                sim_flags(m, 0x1E, r[d] == 0x80 ? SREG_V : 0, r[d]);
+                break;
+            case 0x5: /* asr */
+                r[d] = sim_shift(m, r[d], (r[d] >> 1) | (r[d] & 0x80));
+                break;
+            case 0x6: /* lsr */
+                r[d] = sim_shift(m, r[d], r[d] >> 1);
+                break;
+            case 0x7: /* ror */
+                r[d] = sim_shift(m, r[d],
+                                 (r[d] >> 1) | ((r[SIM_SREG] & SREG_C) << 7));
+                break;
+            case 0xA: /* dec */
+                r[d]--;
+                sim_flags(m, 0x1E, r[d] == 0x7F ? SREG_V : 0, r[d]);
+                break;
+            case 0x8:
+                if (!(w & 0x100)) { /* bset, bclr */
+                    b = 1 << ((w >> 4) & 7);
+                    if (w & 0x80)
+                        r[SIM_SREG] &= ~b;
+                    else
+                        r[SIM_SREG] |= b;
+                    break;
+                }
+                switch ((w >> 4) & 0xF) {
+                case 0x0: /* ret */
+                case 0x1: /* reti */
+                    m->cycles += 3 + pcc;
+                    m->pc = sim_pop_pc(m);
+                    if (w & 0x10)
+                        r[SIM_SREG] |= SREG_I;
+                    break;
+                case 0x8: /* sleep */
+                    sim_stop(m, "'sleep'", pc);
+                    break;
+                case 0x9: /* break */
+                    sim_stop(m, "'break'", pc);
+                    break;
+                case 0xA: /* wdr */
+                case 0xE: /* spm */
+                    break;
+                case 0xC: /* lpm */
+                case 0xD: /* elpm */
+                    m->cycles += 2;
+                    a = sim_reg16(m, 30);
+                    if (w & 0x10)
+                        a |= r[SIM_RAMPZ] << 16;
+                    r[0] = m->flash[a % m->d->flash_size];
+                    break;
+                default:
+                    sim_illegal(m, pc, w);
+                    break;
+                }
+                break;
+            case 0x9: /* ijmp, eijmp, icall, eicall */
+                if ((w & 0xEF) != 0x09 || (w & 0x10 && m->pc_bytes != 3)) {
+                    sim_illegal(m, pc, w);
+                    break;
+                }
+                a = sim_reg16(m, 30);
+                if (w & 0x10)
+                    a |= r[SIM_EIND] << 16;
+                if (w & 0x100) {
+                    m->cycles += 2 + pcc;
+                    sim_push_pc(m, m->pc);
+                } else {
+                    m->cycles++;
+                }
+                m->pc = a;
+                break;
+            case 0xC: case 0xD: /* jmp */
+            case 0xE: case 0xF: /* call */
+                a = ((((w >> 3) & 0x3E) | (w & 1)) << 16) | sim_word(m, m->pc++);
+                if (w & 2) {
+                    m->cycles += 3 + pcc;
+                    sim_push_pc(m, m->pc);
+                } else {
+                    m->cycles += 2;
+                }
+                if (a == pc && !(w & 2))
+                    sim_stop(m, "a jump to itself", pc);
+                m->pc = a;
+                break;
+            default:
+                sim_illegal(m, pc, w);
+                break;
+            }
+            break;
+        case 3: /* adiw, sbiw */
+            m->cycles++;
+            d = 24 + ((w >> 3) & 6);
+            k = (w & 0xF) | ((w >> 2) & 0x30);
+            a = sim_reg16(m, d);
+            b = (w & 0x100) ? a - k : a + k;
+            sim_set_reg16(m, d, b);
+            b &= 0xFFFF;
+            q = 0;
+            if (w & 0x100) {
+                if (b & ~a & 0x8000)
+                    q |= SREG_C;
+                if (a & ~b & 0x8000)
+                    q |= SREG_V;
+            } else {
+                if (~b & a & 0x8000)
+                    q |= SREG_C;
+                if (~a & b & 0x8000)
+                    q |= SREG_V;
+            }
+            /* N of the high byte, Z of the 16 bits */
+            sim_flags(m, 0x1F, q, (b >> 8) | (b & 0xFF ? 1 : 0));
+            break;
+        case 4: /* cbi, sbic */
+        case 5: /* sbi, sbis */
+            a = 0x20 + ((w >> 3) & 0x1F);
+            b = 1 << (w & 7);
+            if (w & 0x100) {
+                q = sim_read(m, a) & b;
+                sim_skip(m, (w & 0x200) ? q != 0 : q == 0);
+            } else {
+                m->cycles++;
+                if (w & 0x200)
+                    sim_write(m, a, sim_read(m, a) | b);
+                else
+                    sim_write(m, a, sim_read(m, a) & ~b);
+            }
+            break;
+        default: /* mul */
+            m->cycles++;
+            sim_mul(m, r[d] * r[s], 0);
+            break;
+        }
+        break;
+    case 0xB: /* in, out */
+        a = 0x20 + ((w & 0xF) | ((w >> 5) & 0x30));
+        if (w & 0x800)
+            sim_write(m, a, r[d]);
+        else
+            r[d] = sim_read(m, a);
+        break;
+    case 0xC: /* rjmp */
+    case 0xD: /* rcall */
+        a = m->pc + ((w & 0xFFF) ^ 0x800) - 0x800;
+        if (w & 0x1000) {
+            m->cycles += 2 + pcc;
+            sim_push_pc(m, m->pc);
+        } else {
+            m->cycles++;
+            if (a == pc)
+                sim_stop(m, "a jump to itself", pc);
+        }
+        m->pc = a;
+        break;
+    case 0xF:
+        b = 1 << (w & 7);
+        if (!(w & 0x800)) { /* brbs, brbc */
+            if (!(r[SIM_SREG] & b) == !!(w & 0x400)) {
+                m->cycles++;
+                m->pc += (((w >> 3) & 0x7F) ^ 0x40) - 0x40;
+            }
+        } else if (w & 8) {
+            sim_illegal(m, pc, w);
+        } else {
+            switch ((w >> 9) & 3) {
+            case 0: /* bld */
+                if (r[SIM_SREG] & SREG_T)
+                    r[d] |= b;
+                else
+                    r[d] &= ~b;
+                break;
+            case 1: /* bst */
+                if (r[d] & b)
+                    r[SIM_SREG] |= SREG_T;
+                else
+                    r[SIM_SREG] &= ~SREG_T;
+                break;
+            case 2: /* sbrc */
+                sim_skip(m, !(r[d] & b));
+                break;
+            case 3: /* sbrs */
+                sim_skip(m, (r[d] & b) != 0);
+                break;
+            }
+        }
+        break;
+    }
+    m->pc &= m->pc_mask;
+}
+
+/* ------------------------------------------------------------- */
+/* C library functions run by the host */
+
+/* the bytes of the string at 'a' in 'cstr', nul terminated */
+static void sim_string(AVRSim *m, unsigned a, CString *cstr)
+{
+    int c;
+
+    while ((c = m->data[a++ & (SIM_DATA_SIZE - 1)]) != 0)
+        cstr_ccat(cstr, c);
+    cstr_ccat(cstr, '\0');
+}
+
+/* the next variable argument of 'size' bytes, the previous one being in
+   the registers from 'reg' up. See gfunc_arg_regs() */
+static unsigned long long sim_arg(AVRSim *m, int *reg, int size)
+{
+    unsigned long long v;
+    int i;
+
+    *reg -= (size + 1) & ~1;
+    if (*reg < 8) {
+        if (!m->halted)
+            tcc_error_noabort("too many arguments for a host function");
+        m->halted = 1;
+        m->status = 1;
+        return 0;
+    }
+    v = 0;
+    for (i = size - 1; i >= 0; i--)
+        v = (v << 8) | m->data[*reg + i];
+    return v;
+}
+
+/* format in 'out' the string at 'fmt', the variable arguments following
+   the register 'reg' */
+static void sim_format(AVRSim *m, unsigned fmt, int reg, CString *out)
+{
+    CString f;
+    char spec[32], buf[512], *p, *q;
+    unsigned long long v;
+    int size;
+    union { float f; unsigned int i; } u;
+
+    cstr_new(&f);
+    sim_string(m, fmt, &f);
+    for (p = f.data; *p; p++) {
+        if (*p != '%') {
+            cstr_ccat(out, *p);
+            continue;
+        }
+        q = spec;
+        *q++ = *p++;
+        while (strchr("-+ #0", *p) && q < spec + 8)
+            *q++ = *p++;
+        if (*p == '*') {
+            q += sprintf(q, "%d", (short)sim_arg(m, &reg, 2));
+            p++;
+        } else {
+            while (isnum(*p) && q < spec + 16)
+                *q++ = *p++;
+        }
+        if (*p == '.') {
+            *q++ = *p++;
+            if (*p == '*') {
+                q += sprintf(q, "%d", (short)sim_arg(m, &reg, 2));
+                p++;
+            } else {
+                while (isnum(*p) && q < spec + 24)
+                    *q++ = *p++;
+            }
+        }
+        size = 2;
+        while (*p == 'h' || *p == 'l') {
+            if (*p == 'l')
+                size *= 2;
+            p++;
+        }
+        if (size > 8)
+            size = 8;
+        buf[0] = '\0';
+        switch (*p) {
+        case 'd': case 'i':
+            v = sim_arg(m, &reg, size);
+            if (v & (1ULL << (size * 8 - 1)))
+                v |= -1ULL << (size * 8 - 1);
+            strcpy(q, "lld");
+            snprintf(buf, sizeof(buf), spec, (long long)v);
+            break;
+        case 'u': case 'x': case 'X': case 'o':
+            v = sim_arg(m, &reg, size);
+            q[0] = q[1] = 'l';
+            q[2] = *p;
+            q[3] = '\0';
+            snprintf(buf, sizeof(buf), spec, v);
+            break;
+        case 'p':
+            snprintf(buf, sizeof(buf), "0x%04x", (int)sim_arg(m, &reg, 2));
+            break;
+        case 'c':
+            q[0] = 'c';
+            q[1] = '\0';
+            snprintf(buf, sizeof(buf), spec, (int)sim_arg(m, &reg, 2) & 0xFF);
+            break;
+        case 's': {
+            CString s;
+            cstr_new(&s);
+            sim_string(m, sim_arg(m, &reg, 2), &s);
+            q[0] = 's';
+            q[1] = '\0';
+            snprintf(buf, sizeof(buf), spec, (char *)s.data);
+            cstr_free(&s);
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+            /* double is float */
+            u.i = sim_arg(m, &reg, 4);
+            q[0] = *p;
+            q[1] = '\0';
+            snprintf(buf, sizeof(buf), spec, (double)u.f);
+            break;
+        case '%':
+            strcpy(buf, "%");
+            break;
+        default:
+            *q = '\0';
+            cstr_cat(out, spec);
+            if (!*p)
+                p--;
+            else
+                cstr_ccat(out, *p);
+            continue;
+        }
+        cstr_cat(out, buf);
+        if (!*p)
+            p--;
+    }
+    cstr_free(&f);
+}
+
+static unsigned sim_arg0(AVRSim *m) { return sim_reg16(m, 24); }
+static unsigned sim_arg1(AVRSim *m) { return sim_reg16(m, 22); }
+static unsigned sim_arg2(AVRSim *m) { return sim_reg16(m, 20); }
+#define SIM_BYTE(a) m->data[(a) & (SIM_DATA_SIZE - 1)]
+
+static int sim_putchar(AVRSim *m)
+{
+    putchar(sim_arg0(m) & 0xFF);
+    return sim_arg0(m) & 0xFF;
+}
+
+static int sim_puts(AVRSim *m)
+{
+    CString s;
+
+    cstr_new(&s);
+    sim_string(m, sim_arg0(m), &s);
+    puts(s.data);
+    cstr_free(&s);
+    return 0;
+}
+
+static int sim_printf(AVRSim *m)
+{
+    CString s;
+    int n;
+
+    cstr_new(&s);
+    sim_format(m, sim_arg0(m), 24, &s);
+    n = s.size;
+    fwrite(s.data, 1, n, stdout);
+    cstr_free(&s);
+    return n;
+}
+
+static int sim_sprintf(AVRSim *m)
+{
+    CString s;
+    unsigned a;
+    int i, n;
+
+    cstr_new(&s);
+    sim_format(m, sim_arg1(m), 22, &s);
+    n = s.size;
+    a = sim_arg0(m);
+    for (i = 0; i < n; i++)
+        SIM_BYTE(a + i) = ((char *)s.data)[i];
+    SIM_BYTE(a + n) = 0;
+    cstr_free(&s);
+    return n;
+}
+
+static int sim_exit(AVRSim *m)
+{
+    m->status = (short)sim_arg0(m);
+    m->halted = 1;
+    return 0;
+}
+
+static int sim_abort(AVRSim *m)
+{
+    sim_stop(m, "abort()", m->pc);
+    m->status = 1;
+    return 0;
+}
+
+static int sim_memcpy(AVRSim *m)
+{
+    unsigned d = sim_arg0(m), s = sim_arg1(m), n = sim_arg2(m);
+
+    if (d > s)
+        while (n--)
+            SIM_BYTE(d + n) = SIM_BYTE(s + n);
+    else
+        while (n--)
+            SIM_BYTE(d++) = SIM_BYTE(s++);
+    return sim_arg0(m);
+}
+
+static int sim_memset(AVRSim *m)
+{
+    unsigned d = sim_arg0(m), n = sim_arg2(m);
+
+    while (n--)
+        SIM_BYTE(d++) = sim_arg1(m);
+    return sim_arg0(m);
+}
+
+static int sim_memcmp(AVRSim *m)
+{
+    unsigned a = sim_arg0(m), b = sim_arg1(m), n = sim_arg2(m);
+
+    for (; n; n--, a++, b++)
+        if (SIM_BYTE(a) != SIM_BYTE(b))
+            return SIM_BYTE(a) - SIM_BYTE(b);
+    return 0;
+}
+
+static int sim_strlen(AVRSim *m)
+{
+    unsigned a = sim_arg0(m);
+
+    while (SIM_BYTE(a))
+        a++;
+    return a - sim_arg0(m);
+}
+
+static int sim_strcpy(AVRSim *m)
+{
+    unsigned d = sim_arg0(m), s = sim_arg1(m);
+
+    while ((SIM_BYTE(d++) = SIM_BYTE(s++)) != 0)
+        ;
+    return sim_arg0(m);
+}
+
+static int sim_strcat(AVRSim *m)
+{
+    unsigned d = sim_arg0(m), s = sim_arg1(m);
+
+    while (SIM_BYTE(d))
+        d++;
+    while ((SIM_BYTE(d++) = SIM_BYTE(s++)) != 0)
+        ;
+    return sim_arg0(m);
+}
+
+static int sim_strcmp(AVRSim *m)
+{
+    unsigned a = sim_arg0(m), b = sim_arg1(m);
+
+    while (SIM_BYTE(a) && SIM_BYTE(a) == SIM_BYTE(b))
+        a++, b++;
+    return SIM_BYTE(a) - SIM_BYTE(b);
+}
+
+static int sim_strchr(AVRSim *m)
+{
+    unsigned a = sim_arg0(m);
+    int c = sim_arg1(m) & 0xFF;
+
+    for (;; a++) {
+        if (SIM_BYTE(a) == c)
+            return a;
+        if (!SIM_BYTE(a))
+            return 0;
+    }
+}
+
+static const SimFunc sim_funcs[] = {
+    { "exit", sim_exit }, /* first: main() returns to it */
+    { "abort", sim_abort },
+    { "putchar", sim_putchar },
+    { "puts", sim_puts },
+    { "printf", sim_printf },
+    { "sprintf", sim_sprintf },
+    { "memcpy", sim_memcpy },
+    { "memmove", sim_memcpy },
+    { "memset", sim_memset },
+    { "memcmp", sim_memcmp },
+    { "strlen", sim_strlen },
+    { "strcpy", sim_strcpy },
+    { "strcat", sim_strcat },
+    { "strcmp", sim_strcmp },
+    { "strchr", sim_strchr },
+};
+
+static const int nb_sim_funcs = countof(sim_funcs);
+
+/* first word of the host functions in the flash of the device */
+static unsigned sim_host_pc(TCCState *s1)
+{
+    return s1->avr_device->flash_size / 2 - nb_sim_funcs;
+}
+
+/* address of the host function 'name', 0 if there is none */
+ST_FUNC addr_t avr_sim_resolve(TCCState *s1, const char *name)
+{
+    int i;
+
+    for (i = 0; i < nb_sim_funcs; i++)
+        if (!strcmp(name, sim_funcs[i].name))
+            return (sim_host_pc(s1) + i) * 2;
+    return 0;
+}
+
+/* ------------------------------------------------------------- */
+
+/* load the sections relocated by tcc_relocate() */
+static int sim_load(TCCState *s1, AVRSim *m)
+{
+    const AVRDevice *d = s1->avr_device;
+    Section *s;
+    unsigned long a, end;
+    int i;
+
+    m->heap = d->ram_start;
+    for (i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!(s->sh_flags & SHF_ALLOC) || s->sh_addr >= AVR_EEPROM_VMA)
+            continue;
+        a = s->sh_addr;
+        end = a + s->data_offset;
+        if (a >= AVR_DATA_VMA) {
+            a -= AVR_DATA_VMA;
+            end -= AVR_DATA_VMA;
+            if (end > d->ram_start + d->ram_size) {
+                tcc_error_noabort("the data do not fit in the SRAM of the %s",
+                                  d->name);
+                return -1;
+            }
+            if (s->sh_type != SHT_NOBITS)
+                memcpy(m->data + a, s->data, s->data_offset);
+            if (end > m->heap)
+                m->heap = end;
+        } else {
+            if (end > m->host_pc * 2) {
+                tcc_error_noabort("the code does not fit in the flash of the %s",
+                                  d->name);
+                return -1;
+            }
+            memcpy(m->flash + a, s->data, s->data_offset);
+            if (end > m->text)
+                m->text = end;
+        }
+    }
+    return 0;
+}
+
+/* copy the arguments of main() at the top of the SRAM */
+static void sim_args(AVRSim *m, int argc, char **argv)
+{
+    unsigned sp, *ptrs;
+    int i, n;
+
+    sp = m->d->ram_start + m->d->ram_size;
+    ptrs = tcc_malloc((argc + 1) * sizeof(unsigned));
+    for (i = argc - 1; i >= 0; i--) {
+        n = strlen(argv[i]) + 1;
+        sp -= n;
+        memcpy(m->data + sp, argv[i], n);
+        ptrs[i] = sp;
+    }
+    ptrs[argc] = 0;
+    for (i = argc; i >= 0; i--) {
+        sp -= 2;
+        sim_set_reg16(m, sp, ptrs[i]);
+    }
+    tcc_free(ptrs);
+    sim_set_reg16(m, 24, argc);
+    sim_set_reg16(m, 22, sp);
+    sim_set_reg16(m, SIM_SPL, sp - 1);
+}
+
+/* run main() of the program relocated by tcc_relocate() on the simulator
+   and print the cycles it took on stderr. Return its exit status */
+ST_FUNC int avr_sim_run(TCCState *s1, int argc, char **argv)
+{
+    const AVRDevice *d = s1->avr_device;
+    AVRSim sim, *m = &sim;
+    ElfW(Sym) *sym;
+    int i;
+
+    i = find_elf_sym(symtab_section, "main");
+    sym = &((ElfW(Sym) *)symtab_section->data)[i];
+    if (!i || sym->st_shndx == SHN_UNDEF) {
+        tcc_error_noabort("main not defined");
+        return 1;
+    }
+
+    memset(m, 0, sizeof(*m));
+    m->d = d;
+    m->flash = tcc_malloc(d->flash_size);
+    memset(m->flash, 0xFF, d->flash_size);
+    m->data = tcc_mallocz(SIM_DATA_SIZE);
+    m->pc_mask = d->flash_size / 2 - 1;
+    m->pc_bytes = (d->flags & AVR_HAVE_EIJMP_EICALL) ? 3 : 2;
+    m->host_pc = sim_host_pc(s1);
+    /* USART 0 of the devices with extended I/O, as the ATmega328P, and
+       USART of the others, as the ATmega8 */
+    if (d->ram_start > 0x60) {
+        m->udr = 0xC6;
+        m->ucsra = 0xC0;
+    } else {
+        m->udr = 0x2C;
+        m->ucsra = 0x2B;
+    }
+    if (sim_load(s1, m) < 0) {
+        m->status = 1;
+        goto the_end;
+    }
+    sim_args(m, argc, argv);
+    m->sp_max = m->sp_min = sim_sp(m);
+    /* main() returns to exit() */
+    sim_push_pc(m, m->host_pc);
+    m->pc = sym->st_value / 2;
+
+    while (!m->halted) {
+        if (m->pc >= m->host_pc) {
+            i = m->pc - m->host_pc;
+            m->pc = sim_pop_pc(m);
+            sim_set_reg16(m, 24, sim_funcs[i].func(m));
+        } else {
+            sim_step(m);
+        }
+    }
+    fflush(stdout);
+    if (m->stop)
+        fprintf(stderr, "stopped by %s at 0x%05x\n", m->stop,
+                m->stop_pc * 2);
+    fprintf(stderr, "%u bytes of flash, %u bytes of data\n",
+            m->text, m->heap - m->d->ram_start);
+    fprintf(stderr, "%lld cycles, %lld instructions, %u bytes of stack\n",
+            m->cycles, m->insns, m->sp_max - m->sp_min);
+the_end:
+    tcc_free(m->flash);
+    tcc_free(m->data);
+    return m->status;
+}
@@ -0,0 +1,179 @@
+/* AVR assembler tokens, see avr-asm.c */
+
+ /* WARNING: relative order of tokens is important. */
+ DEF_ASM(r0)
+ DEF_ASM(r1)
+ DEF_ASM(r2)
+ DEF_ASM(r3)
+ DEF_ASM(r4)
+ DEF_ASM(r5)
+ DEF_ASM(r6)
+ DEF_ASM(r7)
+ DEF_ASM(r8)
+ DEF_ASM(r9)
+ DEF_ASM(r10)
+ DEF_ASM(r11)
+ DEF_ASM(r12)
+ DEF_ASM(r13)
+ DEF_ASM(r14)
+ DEF_ASM(r15)
+ DEF_ASM(r16)
+ DEF_ASM(r17)
+ DEF_ASM(r18)
+ DEF_ASM(r19)
+ DEF_ASM(r20)
+ DEF_ASM(r21)
+ DEF_ASM(r22)
+ DEF_ASM(r23)
+ DEF_ASM(r24)
+ DEF_ASM(r25)
+ DEF_ASM(r26)
+ DEF_ASM(r27)
+ DEF_ASM(r28)
+ DEF_ASM(r29)
+ DEF_ASM(r30)
+ DEF_ASM(r31)
+ DEF_ASM(X)
+ DEF_ASM(Y)
+ DEF_ASM(Z)
+ DEF_ASM(x)
+ DEF_ASM(y)
+ DEF_ASM(z)
+
+ /* register names and I/O addresses of avr-libc */
+ DEF(TOK_ASM_tmp_reg, "__tmp_reg__")
+ DEF(TOK_ASM_zero_reg, "__zero_reg__")
+ DEF(TOK_ASM_SREG, "__SREG__")
+ DEF(TOK_ASM_SP_H, "__SP_H__")
+ DEF(TOK_ASM_SP_L, "__SP_L__")
+ DEF(TOK_ASM_RAMPZ, "__RAMPZ__")
+
+ /* relocation modifiers */
+ DEF_ASM(lo8)
+ DEF_ASM(hi8)
+ DEF_ASM(hlo8)
+ DEF_ASM(hh8)
+ DEF_ASM(hhi8)
+ DEF_ASM(pm)
+ DEF_ASM(gs)
+ DEF_ASM(pm_lo8)
+ DEF_ASM(pm_hi8)
+ DEF_ASM(pm_hh8)
+
+ /* instructions, but 'push' and 'pop' (tcctok.h) and 'break' (TOK_BREAK) */
+ DEF_ASM(adc)
+ DEF_ASM(add)
+ DEF_ASM(adiw)
+ DEF_ASM(and)
+ DEF_ASM(andi)
+ DEF_ASM(asr)
+ DEF_ASM(bclr)
+ DEF_ASM(bld)
+ DEF_ASM(brbc)
+ DEF_ASM(brbs)
+ DEF_ASM(brcc)
+ DEF_ASM(brcs)
+ DEF_ASM(breq)
+ DEF_ASM(brge)
+ DEF_ASM(brhc)
+ DEF_ASM(brhs)
+ DEF_ASM(brid)
+ DEF_ASM(brie)
+ DEF_ASM(brlo)
+ DEF_ASM(brlt)
+ DEF_ASM(brmi)
+ DEF_ASM(brne)
+ DEF_ASM(brpl)
+ DEF_ASM(brsh)
+ DEF_ASM(brtc)
+ DEF_ASM(brts)
+ DEF_ASM(brvc)
+ DEF_ASM(brvs)
+ DEF_ASM(bset)
+ DEF_ASM(bst)
+ DEF_ASM(call)
+ DEF_ASM(cbi)
+ DEF_ASM(cbr)
+ DEF_ASM(clc)
+ DEF_ASM(clh)
+ DEF_ASM(cli)
+ DEF_ASM(cln)
+ DEF_ASM(clr)
+ DEF_ASM(cls)
+ DEF_ASM(clt)
+ DEF_ASM(clv)
+ DEF_ASM(clz)
+ DEF_ASM(com)
+ DEF_ASM(cp)
+ DEF_ASM(cpc)
+ DEF_ASM(cpi)
+ DEF_ASM(cpse)
+ DEF_ASM(dec)
+ DEF_ASM(des)
+ DEF_ASM(eicall)
+ DEF_ASM(eijmp)
+ DEF_ASM(elpm)
+ DEF_ASM(eor)
+ DEF_ASM(fmul)
+ DEF_ASM(fmuls)
+ DEF_ASM(fmulsu)
+ DEF_ASM(icall)
+ DEF_ASM(ijmp)
+ DEF_ASM(in)
+ DEF_ASM(inc)
+ DEF_ASM(jmp)
+ DEF_ASM(lac)
+ DEF_ASM(las)
+ DEF_ASM(lat)
+ DEF_ASM(ld)
+ DEF_ASM(ldd)
+ DEF_ASM(ldi)
+ DEF_ASM(lds)
+ DEF_ASM(lpm)
+ DEF_ASM(lsl)
+ DEF_ASM(lsr)
+ DEF_ASM(mov)
+ DEF_ASM(movw)
+ DEF_ASM(mul)
+ DEF_ASM(muls)
+ DEF_ASM(mulsu)
+ DEF_ASM(neg)
+ DEF_ASM(nop)
+ DEF_ASM(or)
+ DEF_ASM(ori)
+ DEF_ASM(out)
+ DEF_ASM(rcall)
+ DEF_ASM(ret)
+ DEF_ASM(reti)
+ DEF_ASM(rjmp)
+ DEF_ASM(rol)
+ DEF_ASM(ror)
+ DEF_ASM(sbc)
+ DEF_ASM(sbci)
+ DEF_ASM(sbi)
+ DEF_ASM(sbic)
+ DEF_ASM(sbis)
+ DEF_ASM(sbiw)
+ DEF_ASM(sbr)
+ DEF_ASM(sbrc)
+ DEF_ASM(sbrs)
+ DEF_ASM(sec)
+ DEF_ASM(seh)
+ DEF_ASM(sei)
+ DEF_ASM(sen)
+ DEF_ASM(ser)
+ DEF_ASM(ses)
+ DEF_ASM(set)
+ DEF_ASM(sev)
+ DEF_ASM(sez)
+ DEF_ASM(sleep)
+ DEF_ASM(spm)
+ DEF_ASM(st)
+ DEF_ASM(std)
+ DEF_ASM(sts)
+ DEF_ASM(sub)
+ DEF_ASM(subi)
+ DEF_ASM(swap)
+ DEF_ASM(tst)
+ DEF_ASM(wdr)
+ DEF_ASM(xch)
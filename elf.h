@@ -1729,10 +1729,48 @@ typedef Elf32_Addr Elf32_Conflict;
 #define R_C60LO16      0x54       // low 16 bit MVKL embedded
 
 /* AVR specific declarations */
-#define R_AVR_NONE      0
-#define R_AVR_32        1
-#define R_AVR_7_PCREL   2
-#define R_AVR_13_PCREL  3
+
+/* e_flags: the avr-gcc architecture number (2, 25, 5...) */
+#define EF_AVR_MACH     0x7F
+
+/* AVR relocs. Program memory (pm) addresses are in words */
+#define R_AVR_NONE              0
+#define R_AVR_32                1
+#define R_AVR_7_PCREL           2       /* brxx */
+#define R_AVR_13_PCREL          3       /* rjmp, rcall */
+#define R_AVR_16                4
+#define R_AVR_16_PM             5
+#define R_AVR_LO8_LDI           6       /* ldi of bits 0-7 */
+#define R_AVR_HI8_LDI           7       /* ldi of bits 8-15 */
+#define R_AVR_HH8_LDI           8       /* ldi of bits 16-23 */
+#define R_AVR_LO8_LDI_NEG       9
+#define R_AVR_HI8_LDI_NEG       10
+#define R_AVR_HH8_LDI_NEG       11
+#define R_AVR_LO8_LDI_PM        12
+#define R_AVR_HI8_LDI_PM        13
+#define R_AVR_HH8_LDI_PM        14
+#define R_AVR_LO8_LDI_PM_NEG    15
+#define R_AVR_HI8_LDI_PM_NEG    16
+#define R_AVR_HH8_LDI_PM_NEG    17
+#define R_AVR_CALL              18      /* jmp, call */
+#define R_AVR_LDI               19      /* ldi of an 8 bit value */
+#define R_AVR_6                 20      /* ldd, std displacement */
+#define R_AVR_6_ADIW            21      /* adiw, sbiw */
+#define R_AVR_MS8_LDI           22      /* ldi of bits 24-31 */
+#define R_AVR_MS8_LDI_NEG       23
+#define R_AVR_LO8_LDI_GS        24      /* as _PM, through a stub if needed */
+#define R_AVR_HI8_LDI_GS        25
+#define R_AVR_8                 26
+#define R_AVR_8_LO8             27
+#define R_AVR_8_HI8             28
+#define R_AVR_8_HLO8            29
+#define R_AVR_DIFF8             30      /* for linker relaxation */
+#define R_AVR_DIFF16            31
+#define R_AVR_DIFF32            32
+#define R_AVR_LDS_STS_16        33      /* lds, sts of the reduced tiny */
+#define R_AVR_PORT6             34      /* in, out */
+#define R_AVR_PORT5             35      /* sbi, cbi, sbic, sbis */
+#define R_AVR_32_PCREL          36
 
 /* TMS320C67xx relocs. */
 
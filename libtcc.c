@@ -53,12 +53,17 @@ ST_DATA struct TCCState *tcc_state;
 #endif
 #ifdef TCC_TARGET_AVR
 #include "avr-gen.c"
+#include "avr-sim.c"
+#include "avr-outline.c"
 #endif
 #ifdef CONFIG_TCC_ASM
 #include "tccasm.c"
 #if defined TCC_TARGET_I386 || defined TCC_TARGET_X86_64
 #include "i386-asm.c"
 #endif
+#ifdef TCC_TARGET_AVR
+#include "avr-asm.c"
+#endif
 #endif
 #ifdef TCC_TARGET_COFF
 #include "tcccoff.c"
@@ -351,7 +356,11 @@ ST_FUNC Section *new_section(TCCState *s1, const char *name, int sh_type, int sh
         sec->sh_addralign = 1;
         break;
     default:
+#ifdef TCC_TARGET_AVR
+        sec->sh_addralign = 2; /* flash words */
+#else
         sec->sh_addralign = 32; /* default conservative alignment */
+#endif
         break;
     }
 
@@ -368,6 +377,7 @@ ST_FUNC Section *new_section(TCCState *s1, const char *name, int sh_type, int sh
 static void free_section(Section *s)
 {
     tcc_free(s->data);
+    tcc_free(s->str_hash);
 }
 
 /* realloc section and set its content to zero */
@@ -718,6 +728,10 @@ static int tcc_compile(TCCState *s1)
     printf("%s: **** new file\n", file->filename);
 #endif
     preprocess_init(s1);
+#ifdef TCC_TARGET_AVR
+    avr_regs_init();
+    outline_begin();
+#endif
 
     cur_text_section = NULL;
     funcname = "";
@@ -809,6 +823,11 @@ static int tcc_compile(TCCState *s1)
     free_defines(define_start); 
 
     gen_inline_functions();
+#ifdef TCC_TARGET_AVR
+    if (s1->nb_errors == 0 && (s1->avr_outline || s1->optimize_size) &&
+        !s1->do_debug && !s1->avr_cycles)
+        gen_outline(s1);
+#endif
 
     sym_pop(&global_stack, NULL);
     sym_pop(&local_stack, NULL);
@@ -944,6 +963,10 @@ LIBTCCAPI TCCState *tcc_new(void)
     tcc_define_symbol(s, "__arm", NULL);
     tcc_define_symbol(s, "arm", NULL);
     tcc_define_symbol(s, "__APCS_32__", NULL);
+#elif defined(TCC_TARGET_AVR)
+    tcc_define_symbol(s, "__AVR__", NULL);
+    tcc_define_symbol(s, "__AVR", NULL);
+    tcc_define_symbol(s, "AVR", NULL);
 #endif
 
 #ifdef TCC_TARGET_PE
@@ -1016,6 +1039,11 @@ LIBTCCAPI TCCState *tcc_new(void)
     s->alacarte_link = 1;
     s->nocommon = 1;
     s->section_align = ELF_PAGE_SIZE;
+#ifdef TCC_TARGET_AVR
+    s->avr_device = avr_find_device(AVR_DEFAULT_DEVICE);
+    /* nothing is loaded dynamically on a microcontroller */
+    s->static_link = 1;
+#endif
 
 #ifdef CHAR_IS_UNSIGNED
     s->char_is_unsigned = 1;
@@ -1067,6 +1095,15 @@ LIBTCCAPI void tcc_delete(TCCState *s1)
     tcc_free(s1->tcc_lib_path);
     tcc_free(s1->soname);
     tcc_free(s1->rpath);
+    tcc_free(s1->flash_diff);
+    tcc_free(s1->mapfile);
+    tcc_free(s1->call_graph_file);
+    dynarray_reset(&s1->map_files, &s1->nb_map_files);
+    dynarray_reset(&s1->map_inputs, &s1->nb_map_inputs);
+    tcc_free(s1->map_offsets);
+#ifdef TCC_TARGET_AVR
+    tcc_free(s1->func_cycles);
+#endif
     tcc_free(s1->init_symbol);
     tcc_free(s1->fini_symbol);
     tcc_free(s1->outfile);
@@ -1127,6 +1164,10 @@ ST_FUNC int tcc_add_file_internal(TCCState *s1, const char *filename, int flags)
     dynarray_add((void ***)&s1->target_deps, &s1->nb_target_deps,
             tcc_strdup(filename));
 
+    /* what comes from this file is recorded at the end */
+    if (s1->mapfile)
+        map_input(s1, NULL, NULL);
+
     if (flags & AFF_PREPROCESS) {
         ret = tcc_preprocess(s1);
         goto the_end;
@@ -1217,6 +1258,8 @@ ST_FUNC int tcc_add_file_internal(TCCState *s1, const char *filename, int flags)
         tcc_error_noabort("unrecognized file type");
 
 the_end:
+    if (s1->mapfile && ret >= 0)
+        map_input(s1, filename, NULL);
     tcc_close();
     return ret;
 }
@@ -1257,6 +1300,7 @@ ST_FUNC int tcc_add_dll(TCCState *s, const char *filename, int flags)
         s->library_paths, s->nb_library_paths);
 }
 
+#ifndef TCC_TARGET_AVR
 ST_FUNC int tcc_add_crt(TCCState *s, const char *filename)
 {
     if (-1 == tcc_add_library_internal(s, "%s/%s",
@@ -1264,6 +1308,7 @@ ST_FUNC int tcc_add_crt(TCCState *s, const char *filename)
         tcc_error_noabort("file '%s' not found", filename);
     return 0;
 }
+#endif
 
 /* the library name is the same as the argument of the '-l' option */
 LIBTCCAPI int tcc_add_library(TCCState *s, const char *libraryname)
@@ -1327,6 +1372,10 @@ LIBTCCAPI int tcc_set_output_type(TCCState *s, int output_type)
         tcc_define_symbol(s, "__CHAR_UNSIGNED__", NULL);
     }
 
+#ifdef TCC_TARGET_AVR
+    avr_define_device(s);
+#endif
+
     /* add debug sections */
     if (s->do_debug) {
         /* stab symbols */
@@ -1344,6 +1393,8 @@ LIBTCCAPI int tcc_set_output_type(TCCState *s, int output_type)
 # ifdef _WIN32
     tcc_add_systemdir(s);
 # endif
+#elif defined TCC_TARGET_AVR
+    /* the startup is generated by the linker, see avr_startup() */
 #else
     /* add libc crt1/crti objects */
     if ((output_type == TCC_OUTPUT_EXE || output_type == TCC_OUTPUT_DLL) &&
@@ -1426,6 +1477,10 @@ static const FlagDef flag_defs[] = {
     { offsetof(TCCState, char_is_unsigned), FD_INVERT, "signed-char" },
     { offsetof(TCCState, nocommon), FD_INVERT, "common" },
     { offsetof(TCCState, leading_underscore), 0, "leading-underscore" },
+    { offsetof(TCCState, function_sections), 0, "function-sections" },
+    { offsetof(TCCState, data_sections), 0, "data-sections" },
+    { offsetof(TCCState, stack_usage), 0, "stack-usage" },
+    { offsetof(TCCState, no_inline), FD_INVERT, "inline" },
 };
 
 /* set/reset a flag */
@@ -1501,6 +1556,13 @@ static const char *skip_linker_arg(const char **str)
     return s2;
 }
 
+/* return true if the linker argument at 'p' is 'val' */
+static int linker_arg_is(const char *p, const char *val)
+{
+    int n = strlen(val);
+    return !strncmp(p, val, n) && (p[n] == '\0' || p[n] == ',');
+}
+
 static char *copy_linker_arg(const char *p)
 {
     const char *q = p;
@@ -1521,6 +1583,47 @@ static int tcc_set_linker(TCCState *s, const char *option)
             s->symbolic = 1;
         } else if (link_option(option, "nostdlib", &p)) {
             s->nostdlib = 1;
+        } else if (link_option(option, "flash-diff=", &p)) {
+            s->flash_diff = copy_linker_arg(p);
+        } else if (link_option(option, "flash-page-size=", &p)) {
+            s->flash_page_size = strtoul(p, &end, 0);
+            if (s->flash_page_size <= 0 ||
+                (s->flash_page_size & (s->flash_page_size - 1)))
+                goto err;
+        } else if (link_option(option, "gc-sections", &p)) {
+            s->gc_sections = 1;
+        } else if (link_option(option, "no-gc-sections", &p)) {
+            s->gc_sections = 0;
+        } else if (link_option(option, "print-gc-sections", &p)) {
+            s->print_gc_sections = 1;
+        } else if (link_option(option, "icf=", &p)) {
+            if (linker_arg_is(p, "none"))
+                s->icf = 0;
+            else if (linker_arg_is(p, "safe"))
+                s->icf = 1;
+            else if (linker_arg_is(p, "all"))
+                s->icf = 2;
+            else
+                goto err;
+        } else if (link_option(option, "print-icf-sections", &p)) {
+            s->print_icf_sections = 1;
+        } else if (link_option(option, "call-graph-sort", &p)) {
+            s->call_graph_sort = 1;
+        } else if (link_option(option, "call-graph-ordering-file=", &p)) {
+            s->call_graph_file = copy_linker_arg(p);
+            s->call_graph_sort = 1;
+        } else if (link_option(option, "relax", &p)) {
+#ifdef TCC_TARGET_AVR
+            s->avr_relax = 1;
+#else
+            ignoring = 1;
+#endif
+        } else if (link_option(option, "print-stack-usage", &p)) {
+            s->print_stack_usage = 1;
+        } else if (link_option(option, "stack-isr-nesting", &p)) {
+            s->stack_isr_nesting = 1;
+        } else if (link_option(option, "Map=", &p)) {
+            s->mapfile = copy_linker_arg(p);
         } else if (link_option(option, "fini=", &p)) {
             s->fini_symbol = copy_linker_arg(p);
             ignoring = 1;
@@ -1540,10 +1643,12 @@ static int tcc_set_linker(TCCState *s, const char *option)
             if (strstart("elf32-", &p)) {
 #endif
                 s->output_format = TCC_OUTPUT_FORMAT_ELF;
-            } else if (!strcmp(p, "binary")) {
+            } else if (linker_arg_is(p, "binary")) {
                 s->output_format = TCC_OUTPUT_FORMAT_BINARY;
+            } else if (linker_arg_is(p, "ihex")) {
+                s->output_format = TCC_OUTPUT_FORMAT_IHEX;
 #ifdef TCC_TARGET_COFF
-            } else if (!strcmp(p, "coff")) {
+            } else if (linker_arg_is(p, "coff")) {
                 s->output_format = TCC_OUTPUT_FORMAT_COFF;
 #endif
             } else
@@ -1815,6 +1920,30 @@ PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv)
             s->soname = tcc_strdup(optarg);
             break;
         case TCC_OPTION_m:
+#ifdef TCC_TARGET_AVR
+            if (!strncmp(optarg, "mcu=", 4)) {
+                s->avr_device = avr_find_device(optarg + 4);
+                if (!s->avr_device)
+                    tcc_error("unknown device '%s'", optarg + 4);
+                break;
+            }
+            if (!strcmp(optarg, "cycles")) {
+                s->avr_cycles = 1;
+                break;
+            }
+            if (!strcmp(optarg, "call-prologues")) {
+                s->avr_call_prologues = 1;
+                break;
+            }
+            if (!strcmp(optarg, "outline")) {
+                s->avr_outline = 1;
+                break;
+            }
+            if (!strcmp(optarg, "relax")) {
+                s->avr_relax = 1;
+                break;
+            }
+#endif
             s->option_m = tcc_strdup(optarg);
             break;
         case TCC_OPTION_o:
@@ -1879,6 +2008,10 @@ PUB_FUNC int tcc_parse_args(TCCState *s, int argc, char **argv)
             printf ("%s\n", TCC_VERSION);
             exit(0);
         case TCC_OPTION_O:
+#ifdef TCC_TARGET_AVR
+            s->optimize_size = !strcmp(optarg, "s");
+#endif
+            break;
         case TCC_OPTION_pedantic:
         case TCC_OPTION_pipe:
         case TCC_OPTION_s:
@@ -67,6 +67,14 @@ static void help(void)
            "  -nostdinc   do not use standard system include paths\n"
            "  -nostdlib   do not link with standard crt and libraries\n"
            "  -Bdir       use 'dir' as tcc internal library and include path\n"
+#ifdef TCC_TARGET_AVR
+           "  -mmcu=dev   generate code for the AVR device 'dev' (atmega328p, avr5...)\n"
+           "  -mcycles    print the cycles taken by each function\n"
+           "  -mcall-prologues  share the frame setup of the functions\n"
+           "  -moutline   move repeated code into subroutines (also -Os)\n"
+           "  -mrelax     shorten the calls and jumps in the linker (also -Os)\n"
+           "  -Os         prefer smaller code to faster code\n"
+#endif
            "  -MD         generate target dependencies for make\n"
            "  -MF depfile put generated dependencies here\n"
            );
@@ -328,7 +336,7 @@ int main(int argc, char **argv)
             tcc_print_stats(s, getclock_us() - start_time);
 
         if (s->output_type == TCC_OUTPUT_MEMORY) {
-#ifdef TCC_IS_NATIVE
+#if defined TCC_IS_NATIVE || defined TCC_TARGET_AVR
             ret = tcc_run(s, argc - 1 - optind, argv + 1 + optind);
 #else
             tcc_error_noabort("-run is not available in a cross compiler");
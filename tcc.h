@@ -82,6 +82,14 @@
 # define REL_SECTION_FMT ".rela%s"
 /* XXX: DLL with PLT would only work with x86-64 for now */
 # define TCC_OUTPUT_DLL_WITH_PLT
+#elif defined TCC_TARGET_AVR
+/* as binutils, so that avr-gcc objects can be linked */
+# define ELFCLASSW ELFCLASS32
+# define ElfW(type) Elf##32##_##type
+# define ELFW(type) ELF##32##_##type
+# define ElfW_Rel ElfW(Rela)
+# define SHT_RELX SHT_RELA
+# define REL_SECTION_FMT ".rela%s"
 #else
 # define ELFCLASSW ELFCLASS32
 # define ElfW(type) Elf##32##_##type
@@ -128,7 +136,7 @@
 #endif
 
 /* define it to include assembler support */
-#if !defined(TCC_TARGET_ARM) && !defined(TCC_TARGET_C67) && !defined(TCC_TARGET_AVR)
+#if !defined(TCC_TARGET_ARM) && !defined(TCC_TARGET_C67)
 #define CONFIG_TCC_ASM
 #endif
 
@@ -373,6 +381,9 @@ typedef struct Section {
     struct Section *link;    /* link to another section */
     struct Section *reloc;   /* corresponding section for relocation, if any */
     struct Section *hash;     /* hash table for symbols */
+    int *str_hash;           /* merged strings: offsets + 1 of the strings
+                                and of their tails, see put_merge_str() */
+    int str_hash_size, nb_str_hash;
     struct Section *next;
     char name[1];           /* section name */
 } Section;
@@ -383,6 +394,19 @@ typedef struct DLLReference {
     char name[1];
 } DLLReference;
 
+/* an input file or archive member, for the map file */
+typedef struct MapFile {
+    char *why;              /* reference which pulled an archive member */
+    char name[1];
+} MapFile;
+
+/* the part of a section coming from an input file */
+typedef struct MapInput {
+    Section *s;
+    unsigned long offset, size;
+    MapFile *file;
+} MapInput;
+
 /* GNUC attribute definition */
 typedef struct AttributeDef {
     unsigned
@@ -394,9 +418,14 @@ typedef struct AttributeDef {
       func_args     : 5,
       mode          : 4,
       weak          : 1,
-      fill          : 11;
+      func_cold     : 1,
+      func_always_inline : 1,
+      func_noinline : 1,
+      global_reg    : 1, /* 'register', see avr_global_reg() */
+      fill          : 7;
     struct Section *section;
     int alias_target;    /* token */
+    int max_cycles;      /* max_cycles(N), 0 if none */
 } AttributeDef;
 
 /* gr: wrappers for casting sym->r for other purposes */
@@ -405,6 +434,9 @@ typedef struct AttributeDef {
 #define FUNC_IMPORT(r) (((AttributeDef*)&(r))->func_import)
 #define FUNC_ARGS(r) (((AttributeDef*)&(r))->func_args)
 #define FUNC_ALIGN(r) (((AttributeDef*)&(r))->aligned)
+#define FUNC_COLD(r) (((AttributeDef*)&(r))->func_cold)
+#define FUNC_ALWAYS_INLINE(r) (((AttributeDef*)&(r))->func_always_inline)
+#define FUNC_NOINLINE(r) (((AttributeDef*)&(r))->func_noinline)
 #define FUNC_PACKED(r) (((AttributeDef*)&(r))->packed)
 #define ATTR_MODE(r)  (((AttributeDef*)&(r))->mode)
 #define INT_ATTR(ad) (*(int*)(ad))
@@ -480,6 +512,8 @@ typedef struct TokenString {
 typedef struct InlineFunc {
     int *token_str;
     Sym *sym;
+    int size; /* tokens of the body, -1 if it cannot be inlined */
+    unsigned written; /* parameters the body may modify, one bit each */
     char filename[1];
 } InlineFunc;
 
@@ -528,6 +562,9 @@ struct TCCState {
     int nostdinc; /* if true, no standard headers are added */
     int nostdlib; /* if true, no standard libraries are added */
     int nocommon; /* if true, do not use common symbols for .bss data */
+    int function_sections; /* if true, one '.text.name' section per function */
+    int data_sections; /* if true, one section per variable */
+    int no_inline; /* if true, the calls are never inlined */
     int static_link; /* if true, static linking is performed */
     int rdynamic; /* if true, all symbols are exported */
     int symbolic; /* if true, resolve symbols in the current module first */
@@ -565,12 +602,41 @@ struct TCCState {
 
     unsigned long section_align; /* section alignment */
 
+    char *flash_diff; /* previous image, only its changed pages are output */
+    int flash_page_size; /* their size, 0 for the default */
+    int gc_sections; /* if true, discard the unreachable sections */
+    int print_gc_sections; /* if true, list the discarded sections */
+    int icf; /* identical code folding: 0 none, 1 safe, 2 all */
+    int print_icf_sections; /* if true, list the folded sections */
+    int call_graph_sort; /* if true, order the functions by call graph */
+    char *call_graph_file; /* weights of the call graph edges */
+    int stack_usage; /* if true, record the stack used by the functions */
+    int print_stack_usage; /* if true, print the stack analysis */
+    int stack_isr_nesting; /* if true, the interrupts can be nested */
+    char *mapfile; /* -Map=, where to output the map of the program */
+    MapFile **map_files;
+    int nb_map_files;
+    MapInput **map_inputs;
+    int nb_map_inputs;
+    unsigned long *map_offsets; /* data_offset of the sections when the */
+    int nb_map_offsets;         /* last input was recorded */
+
     char *init_symbol; /* symbols to call at load-time (not used currently) */
     char *fini_symbol; /* symbols to call at unload-time (not used currently) */
     
 #ifdef TCC_TARGET_I386
     int seg_size; /* 32. Can be 16 with i386 assembler (.code16) */
 #endif
+#ifdef TCC_TARGET_AVR
+    const AVRDevice *avr_device; /* -mmcu= */
+    int avr_cycles; /* -mcycles: print the cycles of the functions */
+    int avr_call_prologues; /* -mcall-prologues: shared frame setup */
+    int avr_outline; /* -moutline: repeated code into subroutines */
+    int avr_relax; /* -mrelax: call and jmp shortened by the linker */
+    int optimize_size; /* -Os: prefer smaller code to faster code */
+    long long *func_cycles; /* best and worst cycles of the functions */
+    int nb_func_cycles;     /* by ELF symbol index, see gen_cycles() */
+#endif
 
     /* array of all loaded dlls (including those referenced by loaded dlls) */
     DLLReference **loaded_dlls;
@@ -729,6 +795,8 @@ struct TCCState {
 #define VT_LLONG           12  /* 64 bit integer */
 #define VT_LONG            13  /* long integer (NEVER USED as type, only
                                   during parsing) */
+#define VT_FRACT           14  /* ISO/IEC TR 18037 _Fract (AVR) */
+#define VT_ACCUM           15  /* ISO/IEC TR 18037 _Accum (AVR) */
 #define VT_UNSIGNED    0x0010  /* unsigned type */
 #define VT_ARRAY       0x0020  /* array type (also has VT_PTR) */
 #define VT_BITFIELD    0x0040  /* bitfield modifier */
@@ -736,6 +804,9 @@ struct TCCState {
 #define VT_VOLATILE    0x1000  /* volatile modifier */
 #define VT_SIGNED      0x2000  /* signed type */
 #define VT_VLA     0x00020000  /* VLA type (also has VT_PTR and VT_ARRAY) */
+/* fixed point types are never bitfields: they use the bitfield bits */
+#define VT_FIXSHORT 0x00040000 /* short _Fract or short _Accum */
+#define VT_SAT      0x00080000 /* _Sat fixed point type */
 
 /* storage */
 #define VT_EXTERN  0x00000080  /* extern definition */
@@ -1066,7 +1137,9 @@ ST_FUNC int tcc_open(TCCState *s1, const char *filename);
 ST_FUNC void tcc_close(void);
 
 ST_FUNC int tcc_add_file_internal(TCCState *s1, const char *filename, int flags);
+#ifndef TCC_TARGET_AVR
 ST_FUNC int tcc_add_crt(TCCState *s, const char *filename);
+#endif
 ST_FUNC int tcc_add_dll(TCCState *s, const char *filename, int flags);
 
 PUB_FUNC void tcc_print_stats(TCCState *s, int64_t total_time);
@@ -1214,6 +1287,7 @@ ST_FUNC Sym *get_sym_ref(CType *type, Section *sec, unsigned long offset, unsign
 #define TCC_OUTPUT_FORMAT_ELF    0 /* default output format: ELF */
 #define TCC_OUTPUT_FORMAT_BINARY 1 /* binary image output */
 #define TCC_OUTPUT_FORMAT_COFF   2 /* COFF */
+#define TCC_OUTPUT_FORMAT_IHEX   3 /* Intel HEX image output */
 
 #define ARMAG  "!<arch>\012"    /* For COFF and a.out archives */
 
@@ -1228,6 +1302,8 @@ typedef struct {
 ST_FUNC Section *new_symtab(TCCState *s1, const char *symtab_name, int sh_type, int sh_flags, const char *strtab_name, const char *hash_name, int hash_sh_flags);
 
 ST_FUNC int put_elf_str(Section *s, const char *sym);
+ST_FUNC unsigned long put_merge_str(Section *s, const void *str, int len);
+ST_FUNC Section *merge_str_section(TCCState *s1);
 ST_FUNC int put_elf_sym(Section *s, addr_t value, unsigned long size, int info, int other, int shndx, const char *name);
 ST_FUNC int add_elf_sym(Section *s, addr_t value, unsigned long size, int info, int other, int sh_num, const char *name);
 ST_FUNC int find_elf_sym(Section *s, const char *name);
@@ -1243,8 +1319,13 @@ ST_FUNC void relocate_syms(TCCState *s1, int do_resolve);
 ST_FUNC void relocate_section(TCCState *s1, Section *s);
 
 ST_FUNC void tcc_add_linker_symbols(TCCState *s1);
+ST_FUNC void sort_call_graph(TCCState *s1);
+#ifdef TCC_TARGET_AVR
+ST_FUNC void avr_relax(TCCState *s1);
+#endif
 ST_FUNC int tcc_load_object_file(TCCState *s1, int fd, unsigned long file_offset);
 ST_FUNC int tcc_load_archive(TCCState *s1, int fd);
+ST_FUNC void map_input(TCCState *s1, const char *name, const char *why);
 ST_FUNC void tcc_add_bcheck(TCCState *s1);
 
 ST_FUNC void build_got_entries(TCCState *s1);
@@ -1268,6 +1349,8 @@ ST_FUNC int handle_eob(void);
 
 #ifdef TCC_TARGET_X86_64
 ST_DATA const int reg_classes[NB_REGS+7];
+#elif defined TCC_TARGET_AVR
+ST_DATA int reg_classes[NB_REGS];
 #else
 ST_DATA const int reg_classes[NB_REGS];
 #endif
@@ -1328,6 +1411,43 @@ ST_FUNC void gen_cvt_itof1(int t);
 
 /* ------------ avr-gen.c ------------ */
 #ifdef TCC_TARGET_AVR
+ST_FUNC void g(int c);
+ST_FUNC void gen_le16(int c);
+ST_FUNC void gen_le32(int c);
+ST_FUNC void gdecjnz(int a);
+ST_FUNC void gen_cvt_btoi(int is_unsigned);
+ST_FUNC void gen_local_addr(int r, int r2, int c);
+ST_FUNC void gen_opfix(int op);
+ST_FUNC const AVRDevice *avr_find_device(const char *name);
+ST_FUNC void avr_define_device(TCCState *s);
+ST_FUNC void gen_stack_usage(Sym *sym);
+ST_FUNC void gloop_bound(int a, int min, int max);
+ST_FUNC void gen_cycles(Sym *sym, int max_cycles);
+ST_FUNC void gen_avr_builtin(int t, unsigned c);
+ST_FUNC void gcold(int start, int end);
+ST_FUNC void gen_layout(void);
+ST_DATA unsigned avr_global_regs;
+ST_FUNC void avr_regs_init(void);
+ST_FUNC void avr_use_reg(int r);
+ST_FUNC void avr_global_reg(CType *type, int v, char *name);
+/* the register of a global register variable, 0 for the others */
+#define SYM_GLOBAL_REG(sym) ((int)((sym)->r >> 16))
+#endif
+
+/* ------------ avr-sim.c ------------ */
+
+#ifdef TCC_TARGET_AVR
+ST_FUNC addr_t avr_sim_resolve(TCCState *s1, const char *name);
+ST_FUNC int avr_sim_run(TCCState *s1, int argc, char **argv);
+#endif
+
+/* ------------ avr-outline.c ------------ */
+
+#ifdef TCC_TARGET_AVR
+ST_FUNC void outline_begin(void);
+ST_FUNC void outline_exclude(int start, int end);
+ST_FUNC void outline_cold(int start, int end);
+ST_FUNC void gen_outline(TCCState *s1);
 #endif
 
 /* ------------ tcccoff.c ------------ */
@@ -1345,13 +1465,16 @@ ST_FUNC int find_constraint(ASMOperand *operands, int nb_operands, const char *n
 ST_FUNC void asm_expr(TCCState *s1, ExprValue *pe);
 ST_FUNC int asm_int_expr(TCCState *s1);
 ST_FUNC int tcc_assemble(TCCState *s1, int do_preprocess);
-/* ------------ i386-asm.c ------------ */
+/* ------------ i386-asm.c, avr-asm.c ------------ */
 ST_FUNC void gen_expr32(ExprValue *pe);
 ST_FUNC void asm_opcode(TCCState *s1, int opcode);
 ST_FUNC void asm_compute_constraints(ASMOperand *operands, int nb_operands, int nb_outputs, const uint8_t *clobber_regs, int *pout_reg);
 ST_FUNC void subst_asm_operand(CString *add_str, SValue *sv, int modifier);
 ST_FUNC void asm_gen_code(ASMOperand *operands, int nb_operands, int nb_outputs, int is_output, uint8_t *clobber_regs, int out_reg);
 ST_FUNC void asm_clobber(uint8_t *clobber_regs, const char *str);
+#ifdef TCC_TARGET_AVR
+ST_FUNC void asm_word(TCCState *s1, Section *sec);
+#endif
 #endif
 
 /* ------------ tccpe.c -------------- */
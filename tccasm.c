@@ -394,10 +394,24 @@ static void asm_parse_directive(TCCState *s1)
     case TOK_ASM_byte:
         size = 1;
         goto asm_data;
+#ifdef TCC_TARGET_AVR
+    case TOK_ASM_word:
+    case TOK_SHORT:
+        /* addresses are 16 bits, see asm_word() */
+        next();
+        for(;;) {
+            asm_word(s1, sec);
+            if (tok != ',')
+                break;
+            next();
+        }
+        break;
+#else
     case TOK_ASM_word:
     case TOK_SHORT:
         size = 2;
         goto asm_data;
+#endif
     case TOK_LONG:
     case TOK_INT:
         size = 4;
@@ -911,6 +925,13 @@ static void subst_asm_operands(ASMOperand *operands, int nb_operands,
             if (*str == 'c' || *str == 'n' ||
                 *str == 'b' || *str == 'w' || *str == 'h')
                 modifier = *str++;
+#ifdef TCC_TARGET_AVR
+            /* bytes of a multi-byte operand, pointer register, I/O
+               address and register number */
+            else if ((*str >= 'A' && *str <= 'D') || *str == 'a' ||
+                     *str == 'i' || *str == 'r')
+                modifier = *str++;
+#endif
             index = find_constraint(operands, nb_operands, str, &str);
             if (index < 0)
                 tcc_error("invalid operand reference after %%");
@@ -993,6 +1014,9 @@ ST_FUNC void asm_instr(void)
     ASMOperand operands[MAX_ASM_OPERANDS];
     int nb_outputs, nb_operands, i, must_subst, out_reg;
     uint8_t clobber_regs[NB_ASM_REGS];
+#ifdef TCC_TARGET_AVR
+    int start;
+#endif
 
     next();
     /* since we always generate the asm() instruction, we can ignore
@@ -1068,7 +1092,14 @@ ST_FUNC void asm_instr(void)
                  clobber_regs, out_reg);    
 
     /* assemble the string with tcc internal assembler */
+#ifdef TCC_TARGET_AVR
+    start = ind;
+#endif
     tcc_assemble_inline(tcc_state, astr1.data, astr1.size - 1);
+#ifdef TCC_TARGET_AVR
+    /* may hold data or count on its timing */
+    outline_exclude(start, ind);
+#endif
 
     /* restore the current C token */
     next();
@@ -1108,6 +1139,9 @@ ST_FUNC void asm_global_instr(void)
     /* assemble the string with tcc internal assembler */
     tcc_assemble_inline(tcc_state, astr.data, astr.size - 1);
     
+#ifdef TCC_TARGET_AVR
+    outline_exclude(cur_text_section->data_offset, ind);
+#endif
     cur_text_section->data_offset = ind;
 
     /* restore the current C token */
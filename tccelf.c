@@ -34,6 +34,103 @@ ST_FUNC int put_elf_str(Section *s, const char *sym)
     return offset;
 }
 
+/* hash of the 'len' bytes of 'str', computed from the end so that the
+   hashes of all the tails of a string are found in one pass */
+static unsigned int str_tail_hash(const unsigned char *str, int len,
+                                  unsigned int h)
+{
+    while (len > 0)
+        h = (h ^ str[--len]) * 16777619;
+    return h;
+}
+
+/* add the offset 'offset' of a string of hash 'h' to the table */
+static void str_hash_add(Section *s, unsigned int h, int offset)
+{
+    int i;
+
+    i = h & (s->str_hash_size - 1);
+    while (s->str_hash[i])
+        i = (i + 1) & (s->str_hash_size - 1);
+    s->str_hash[i] = offset + 1;
+    s->nb_str_hash++;
+}
+
+static void str_hash_resize(Section *s)
+{
+    int *old, old_size, i, offset, len;
+
+    old = s->str_hash;
+    old_size = s->str_hash_size;
+    s->str_hash_size = old_size ? old_size * 2 : 256;
+    s->str_hash = tcc_mallocz(s->str_hash_size * sizeof(int));
+    s->nb_str_hash = 0;
+    for(i = 0; i < old_size; i++) {
+        if (old[i]) {
+            offset = old[i] - 1;
+            len = strlen((char *)s->data + offset) + 1;
+            str_hash_add(s, str_tail_hash(s->data + offset, len, 2166136261u),
+                         offset);
+        }
+    }
+    tcc_free(old);
+}
+
+/* add the string 'str' of 'len' bytes, its final zero included, to the
+   SHF_MERGE | SHF_STRINGS section 's' and return its offset. An
+   identical string or the tail of a longer one is used if present */
+ST_FUNC unsigned long put_merge_str(Section *s, const void *str, int len)
+{
+    const unsigned char *p = str;
+    unsigned int h;
+    int i, offset;
+
+    if (!s->str_hash)
+        str_hash_resize(s);
+    h = str_tail_hash(p, len, 2166136261u);
+    for(i = h & (s->str_hash_size - 1); s->str_hash[i];
+        i = (i + 1) & (s->str_hash_size - 1)) {
+        offset = s->str_hash[i] - 1;
+        if (offset + len <= s->data_offset &&
+            !memcmp(s->data + offset, p, len))
+            return offset;
+    }
+    offset = s->data_offset;
+    memcpy(section_ptr_add(s, len), p, len);
+    /* the string and its tails */
+    h = 2166136261u;
+    for(i = len - 1; i >= 0; i--) {
+        if (2 * (s->nb_str_hash + 1) > s->str_hash_size)
+            str_hash_resize(s);
+        h = (h ^ p[i]) * 16777619;
+        str_hash_add(s, h, offset + i);
+    }
+    return offset;
+}
+
+/* return the section of the merged string literals */
+ST_FUNC Section *merge_str_section(TCCState *s1)
+{
+    Section *s;
+    int i, flags;
+
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!strcmp(s->name, ".rodata.str1.1"))
+            return s;
+    }
+    flags = SHF_ALLOC | SHF_MERGE | SHF_STRINGS;
+#ifdef TCC_TARGET_AVR
+    /* the data pointers address the SRAM: the strings are copied there
+       with the initialized data */
+    flags |= SHF_WRITE;
+#endif
+    s = new_section(s1, ".rodata.str1.1", SHT_PROGBITS, flags);
+    s->sh_addralign = 1;
+    s->sh_entsize = 1;
+    return s;
+}
+
 /* elf symbol hashing function */
 static unsigned long elf_hash(const unsigned char *name)
 {
@@ -287,7 +384,7 @@ ST_FUNC void put_elf_reloc(Section *symtab, Section *s, unsigned long offset,
     rel = section_ptr_add(sr, sizeof(ElfW_Rel));
     rel->r_offset = offset;
     rel->r_info = ELFW(R_INFO)(symbol, type);
-#ifdef TCC_TARGET_X86_64
+#if defined TCC_TARGET_X86_64 || defined TCC_TARGET_AVR
     rel->r_addend = 0;
 #endif
 }
@@ -441,6 +538,11 @@ ST_FUNC void relocate_syms(TCCState *s1, int do_resolve)
                     sym->st_value = (addr_t)addr;
                     goto found;
                 }
+#elif defined TCC_TARGET_AVR
+                /* C library functions of the simulator */
+                sym->st_value = avr_sim_resolve(s1, name);
+                if (sym->st_value)
+                    goto found;
 #endif
             } else if (s1->dynsym) {
                 /* if dynamic symbol exist, then use it */
@@ -507,6 +609,179 @@ static addr_t add_jmp_table(TCCState *s1, int val)
 #endif
 #endif /* def TCC_HAS_RUNTIME_PLTGOT */
 
+#ifdef TCC_TARGET_AVR
+static unsigned avr_get16(unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void avr_put16(unsigned char *p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void avr_check_reloc(int ok, int type, addr_t addr)
+{
+    if (!ok)
+        tcc_error("relocation %d at 0x%x out of range", type, (unsigned)addr);
+}
+
+/* apply the relocation 'type' at 'ptr' (address 'addr') of the value
+   'val', which is a byte address in flash or an address tagged with
+   0x800000 in SRAM */
+static void avr_relocate(TCCState *s1, int type, unsigned char *ptr,
+                         addr_t addr, addr_t val)
+{
+    unsigned w;
+    int x, k;
+
+    w = avr_get16(ptr);
+    switch(type) {
+    case R_AVR_NONE:
+    case R_AVR_DIFF8:
+    case R_AVR_DIFF16:
+    case R_AVR_DIFF32:
+        /* the differences are already there, nothing is relaxed */
+        break;
+    case R_AVR_32:
+        val += w | (avr_get16(ptr + 2) << 16);
+        avr_put16(ptr, val);
+        avr_put16(ptr + 2, val >> 16);
+        break;
+    case R_AVR_32_PCREL:
+        val += (w | (avr_get16(ptr + 2) << 16)) - addr;
+        avr_put16(ptr, val);
+        avr_put16(ptr + 2, val >> 16);
+        break;
+    case R_AVR_16:
+        avr_put16(ptr, w + val);
+        break;
+    case R_AVR_16_PM:
+        avr_put16(ptr, (w + val) >> 1);
+        break;
+    case R_AVR_7_PCREL:
+        x = val - addr - 2;
+        avr_check_reloc(!(x & 1) && x >= -128 && x <= 126, type, addr);
+        avr_put16(ptr, (w & ~0x3F8) | ((x << 2) & 0x3F8));
+        break;
+    case R_AVR_13_PCREL:
+        x = val - addr - 2;
+        /* up to 8K of flash, the relative jumps wrap around */
+        if (s1->avr_device->flash_size <= 0x2000)
+            x = ((x & 0x1FFF) ^ 0x1000) - 0x1000;
+        avr_check_reloc(!(x & 1) && x >= -4096 && x <= 4094, type, addr);
+        avr_put16(ptr, (w & 0xF000) | ((x >> 1) & 0xFFF));
+        break;
+    case R_AVR_CALL:
+        avr_check_reloc(!(val & 1), type, addr);
+        x = val >> 1;
+        avr_put16(ptr, w | ((x >> 16) & 1) | ((x >> 13) & 0x1F0));
+        avr_put16(ptr + 2, x);
+        break;
+    case R_AVR_LDI:
+    case R_AVR_LO8_LDI:
+    case R_AVR_HI8_LDI:
+    case R_AVR_HH8_LDI:
+    case R_AVR_MS8_LDI:
+    case R_AVR_LO8_LDI_NEG:
+    case R_AVR_HI8_LDI_NEG:
+    case R_AVR_HH8_LDI_NEG:
+    case R_AVR_MS8_LDI_NEG:
+    case R_AVR_LO8_LDI_PM:
+    case R_AVR_HI8_LDI_PM:
+    case R_AVR_HH8_LDI_PM:
+    case R_AVR_LO8_LDI_PM_NEG:
+    case R_AVR_HI8_LDI_PM_NEG:
+    case R_AVR_HH8_LDI_PM_NEG:
+    case R_AVR_LO8_LDI_GS:
+    case R_AVR_HI8_LDI_GS:
+        /* ldi Rd, K: 1110 KKKK dddd KKKK */
+        switch(type) {
+        case R_AVR_LDI:
+            avr_check_reloc((int)val >= -128 && (int)val <= 255, type, addr);
+            k = val;
+            break;
+        case R_AVR_LO8_LDI:
+            k = val;
+            break;
+        case R_AVR_HI8_LDI:
+            k = val >> 8;
+            break;
+        case R_AVR_HH8_LDI:
+            k = val >> 16;
+            break;
+        case R_AVR_MS8_LDI:
+            k = val >> 24;
+            break;
+        case R_AVR_LO8_LDI_NEG:
+            k = -val;
+            break;
+        case R_AVR_HI8_LDI_NEG:
+            k = -val >> 8;
+            break;
+        case R_AVR_HH8_LDI_NEG:
+            k = -val >> 16;
+            break;
+        case R_AVR_MS8_LDI_NEG:
+            k = -val >> 24;
+            break;
+        default:
+            /* word addresses of program memory: there are no stubs,
+               so the _GS ones are the _PM ones */
+            if (type == R_AVR_LO8_LDI_PM_NEG || type == R_AVR_HI8_LDI_PM_NEG ||
+                type == R_AVR_HH8_LDI_PM_NEG)
+                val = -val;
+            avr_check_reloc(!(val & 1), type, addr);
+            val >>= 1;
+            if (type == R_AVR_HI8_LDI_PM || type == R_AVR_HI8_LDI_PM_NEG ||
+                type == R_AVR_HI8_LDI_GS)
+                val >>= 8;
+            else if (type == R_AVR_HH8_LDI_PM || type == R_AVR_HH8_LDI_PM_NEG)
+                val >>= 16;
+            k = val;
+            break;
+        }
+        avr_put16(ptr, (w & 0xF0F0) | ((k & 0xF0) << 4) | (k & 0xF));
+        break;
+    case R_AVR_6:
+        /* ldd/std displacement q */
+        avr_check_reloc(val <= 63, type, addr);
+        avr_put16(ptr, w | ((val & 0x20) << 8) | ((val & 0x18) << 7) | (val & 7));
+        break;
+    case R_AVR_6_ADIW:
+        avr_check_reloc(val <= 63, type, addr);
+        avr_put16(ptr, w | ((val & 0x30) << 2) | (val & 0xF));
+        break;
+    case R_AVR_PORT6:
+        avr_check_reloc(val <= 63, type, addr);
+        avr_put16(ptr, w | ((val & 0x30) << 5) | (val & 0xF));
+        break;
+    case R_AVR_PORT5:
+        avr_check_reloc(val <= 31, type, addr);
+        avr_put16(ptr, w | ((val & 0x1F) << 3));
+        break;
+    case R_AVR_8:
+        avr_check_reloc((int)val >= -128 && (int)val <= 255, type, addr);
+        *ptr = val;
+        break;
+    case R_AVR_8_LO8:
+        *ptr = val;
+        break;
+    case R_AVR_8_HI8:
+        *ptr = val >> 8;
+        break;
+    case R_AVR_8_HLO8:
+        *ptr = val >> 16;
+        break;
+    default:
+        fprintf(stderr,"FIXME: handle reloc type %x at %x [%p] to %x\n",
+            type, (unsigned)addr, ptr, (unsigned)val);
+        break;
+    }
+}
+#endif
+
 /* relocate a given section (CPU dependent) */
 ST_FUNC void relocate_section(TCCState *s1, Section *s)
 {
@@ -531,7 +806,7 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
         sym_index = ELFW(R_SYM)(rel->r_info);
         sym = &((ElfW(Sym) *)symtab_section->data)[sym_index];
         val = sym->st_value;
-#ifdef TCC_TARGET_X86_64
+#if defined TCC_TARGET_X86_64 || defined TCC_TARGET_AVR
         val += rel->r_addend;
 #endif
         type = ELFW(R_TYPE)(rel->r_info);
@@ -803,30 +1078,8 @@ ST_FUNC void relocate_section(TCCState *s1, Section *s)
                 type, (unsigned)addr, ptr, (unsigned)val);
             break;
 #elif defined(TCC_TARGET_AVR)
-        case R_C60_32:
-            *(int *)ptr += val;
-            break;
-        case R_C60LO16:
-            {
-                uint32_t orig;
-                
-                /* put the low 16 bits of the absolute address */
-                // add to what is already there
-                
-                orig  =   ((*(int *)(ptr  )) >> 7) & 0xffff;
-                orig |=  (((*(int *)(ptr+4)) >> 7) & 0xffff) << 16;
-                
-                //patch both at once - assumes always in pairs Low - High
-                
-                *(int *) ptr    = (*(int *) ptr    & (~(0xffff << 7)) ) |  (((val+orig)      & 0xffff) << 7);
-                *(int *)(ptr+4) = (*(int *)(ptr+4) & (~(0xffff << 7)) ) | ((((val+orig)>>16) & 0xffff) << 7);
-            }
-            break;
-        case R_C60HI16:
-            break;
         default:
-            fprintf(stderr,"FIXME: handle reloc type %x at %x [%p] to %x\n",
-                type, (unsigned)addr, ptr, (unsigned)val);
+            avr_relocate(s1, type, ptr, addr, val);
             break;
 #elif defined(TCC_TARGET_X86_64)
         case R_X86_64_64:
@@ -1000,13 +1253,10 @@ static void put32(unsigned char *p, uint32_t val)
     p[3] = val >> 24;
 }
 
-#if defined(TCC_TARGET_I386) || defined(TCC_TARGET_ARM) || \
-    defined(TCC_TARGET_X86_64)
 static uint32_t get32(unsigned char *p)
 {
     return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
 }
-#endif
 
 static void build_got(TCCState *s1)
 {
@@ -1153,7 +1403,7 @@ static void put_got_entry(TCCState *s1,
 #elif defined(TCC_TARGET_C67)
         tcc_error("C67 got not implemented");
 #elif defined(TCC_TARGET_AVR)
-        tcc_error("AVR got not implemented");
+        tcc_error("AVR has no got");
 #else
 #error unsupported CPU
 #endif
@@ -1173,8 +1423,11 @@ ST_FUNC void build_got_entries(TCCState *s1)
 {
     Section *s;
     ElfW_Rel *rel, *rel_end;
+#ifndef TCC_TARGET_AVR
     ElfW(Sym) *sym;
-    int i, type, reloc_type, sym_index;
+    int reloc_type, sym_index;
+#endif
+    int i, type;
 
     for(i = 1; i < s1->nb_sections; i++) {
         s = s1->sections[i];
@@ -1247,24 +1500,7 @@ ST_FUNC void build_got_entries(TCCState *s1)
                 }
                 break;
 #elif defined(TCC_TARGET_AVR)
-            case R_C60_GOT32:
-            case R_C60_GOTOFF:
-            case R_C60_GOTPC:
-            case R_C60_PLT32:
-                if (!s1->got)
-                    build_got(s1);
-                if (type == R_C60_GOT32 || type == R_C60_PLT32) {
-                    sym_index = ELFW(R_SYM)(rel->r_info);
-                    sym = &((ElfW(Sym) *)symtab_section->data)[sym_index];
-                    /* look at the symbol got offset. If none, then add one */
-                    if (type == R_C60_GOT32)
-                        reloc_type = R_C60_GLOB_DAT;
-                    else
-                        reloc_type = R_C60_JMP_SLOT;
-                    put_got_entry(s1, reloc_type, sym->st_size, sym->st_info, 
-                                  sym_index);
-                }
-                break;
+            /* static code only: no got nor plt */
 #elif defined(TCC_TARGET_X86_64)
             case R_X86_64_GOT32:
             case R_X86_64_GOTTPOFF:
@@ -1411,135 +1647,1642 @@ ST_FUNC void tcc_add_runtime(TCCState *s1)
 #ifdef CONFIG_USE_LIBGCC
         tcc_add_file(s1, TCC_LIBGCC);
 #elif !defined WITHOUT_LIBTCC
+# ifdef TCC_TARGET_AVR
+        /* where lib/Makefile builds it */
+        tcc_add_support(s1, "lib/avr/libtcc1.a");
+# else
         tcc_add_support(s1, "libtcc1.a");
+# endif
 #endif
+#ifndef TCC_TARGET_AVR
         /* add crt end if not memory output */
         if (s1->output_type != TCC_OUTPUT_MEMORY)
             tcc_add_crt(s1, "crtn.o");
+#endif
     }
 }
 
-/* add various standard linker symbols (must be done after the
-   sections are filled (for example after allocating common
-   symbols)) */
-ST_FUNC void tcc_add_linker_symbols(TCCState *s1)
+/* return true if --gc-sections may discard the section: the sections of
+   -ffunction-sections and -fdata-sections */
+static int is_gc_section(Section *s)
 {
-    char buf[1024];
+    static const char * const prefixes[] = {
+        ".text.", ".data.", ".bss.", ".rodata.",
+    };
     int i;
-    Section *s;
-
-    add_elf_sym(symtab_section, 
-                text_section->data_offset, 0,
-                ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
-                text_section->sh_num, "_etext");
-    add_elf_sym(symtab_section, 
-                data_section->data_offset, 0,
-                ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
-                data_section->sh_num, "_edata");
-    add_elf_sym(symtab_section, 
-                bss_section->data_offset, 0,
-                ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
-                bss_section->sh_num, "_end");
-    /* horrible new standard ldscript defines */
-    add_init_array_defines(s1, ".preinit_array");
-    add_init_array_defines(s1, ".init_array");
-    add_init_array_defines(s1, ".fini_array");
-    
-    /* add start and stop symbols for sections whose name can be
-       expressed in C */
-    for(i = 1; i < s1->nb_sections; i++) {
-        s = s1->sections[i];
-        if (s->sh_type == SHT_PROGBITS &&
-            (s->sh_flags & SHF_ALLOC)) {
-            const char *p;
-            int ch;
 
-            /* check if section name can be expressed in C */
-            p = s->name;
-            for(;;) {
-                ch = *p;
-                if (!ch)
-                    break;
-                if (!isid(ch) && !isnum(ch))
-                    goto next_sec;
-                p++;
-            }
-            snprintf(buf, sizeof(buf), "__start_%s", s->name);
-            add_elf_sym(symtab_section, 
-                        0, 0,
-                        ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
-                        s->sh_num, buf);
-            snprintf(buf, sizeof(buf), "__stop_%s", s->name);
-            add_elf_sym(symtab_section,
-                        s->data_offset, 0,
-                        ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
-                        s->sh_num, buf);
-        }
-    next_sec: ;
+    if (!(s->sh_flags & SHF_ALLOC))
+        return 0;
+    for(i = 0; i < countof(prefixes); i++) {
+        if (!strncmp(s->name, prefixes[i], strlen(prefixes[i])))
+            return 1;
     }
+    return 0;
 }
 
-static void tcc_output_binary(TCCState *s1, FILE *f,
-                              const int *section_order)
+/* return true if the symbol is a root of --gc-sections */
+static int is_gc_root(const char *name)
 {
-    Section *s;
-    int i, offset, size;
+#ifdef TCC_TARGET_AVR
+    /* interrupt handlers, and main for the generated startup */
+    if (!strncmp(name, "__vector_", 9) || !strcmp(name, "main"))
+        return 1;
+#endif
+    return !strcmp(name, "_start");
+}
 
-    offset = 0;
-    for(i=1;i<s1->nb_sections;i++) {
-        s = s1->sections[section_order[i]];
-        if (s->sh_type != SHT_NOBITS &&
-            (s->sh_flags & SHF_ALLOC)) {
-            while (offset < s->sh_offset) {
-                fputc(0, f);
-                offset++;
+/* discard the sections which cannot be reached through relocations from
+   the entry point and the sections which are always kept. The undefined
+   symbols referenced only from the discarded sections become weak, so
+   that they are not reported */
+static void gc_sections(TCCState *s1)
+{
+    Section *s, *sr;
+    ElfW(Sym) *sym, *syms;
+    ElfW_Rel *rel, *rel_end;
+    char *live, *used;
+    int *stack, sp, i, nb_syms, sh_num, nb_removed, size;
+
+    syms = (ElfW(Sym) *)symtab_section->data;
+    nb_syms = symtab_section->data_offset / sizeof(ElfW(Sym));
+    live = tcc_mallocz(s1->nb_sections);
+    used = tcc_mallocz(nb_syms);
+    stack = tcc_malloc(s1->nb_sections * sizeof(int));
+    sp = 0;
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if ((s->sh_flags & SHF_ALLOC) && !is_gc_section(s)) {
+            live[i] = 1;
+            stack[sp++] = i;
+        }
+    }
+    for(i = 1; i < nb_syms; i++) {
+        sh_num = syms[i].st_shndx;
+        if (sh_num != SHN_UNDEF && sh_num < SHN_LORESERVE && !live[sh_num] &&
+            is_gc_root((char *)symtab_section->link->data + syms[i].st_name)) {
+            live[sh_num] = 1;
+            stack[sp++] = sh_num;
+        }
+    }
+    /* mark the sections referenced by the live ones */
+    while (sp > 0) {
+        sr = s1->sections[stack[--sp]]->reloc;
+        if (!sr || sr->link != symtab_section)
+            continue;
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            i = ELFW(R_SYM)(rel->r_info);
+            used[i] = 1;
+            sh_num = syms[i].st_shndx;
+            if (sh_num != SHN_UNDEF && sh_num < SHN_LORESERVE &&
+                !live[sh_num]) {
+                live[sh_num] = 1;
+                stack[sp++] = sh_num;
             }
-            size = s->sh_size;
-            fwrite(s->data, 1, size, f);
-            offset += size;
         }
     }
+    nb_removed = 0;
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (live[i] || !is_gc_section(s))
+            continue;
+        size = s->data_offset;
+        if (s1->print_gc_sections)
+            printf("removing unused section '%s' (%d bytes)\n", s->name, size);
+        nb_removed += size;
+        s->data_offset = 0;
+        s->sh_flags &= ~SHF_ALLOC;
+        sr = s->reloc;
+        if (sr && sr->link == symtab_section) {
+            rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+            for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+                sym = &syms[ELFW(R_SYM)(rel->r_info)];
+                if (sym->st_shndx == SHN_UNDEF &&
+                    !used[ELFW(R_SYM)(rel->r_info)])
+                    sym->st_info = ELFW(ST_INFO)(STB_WEAK,
+                                                 ELFW(ST_TYPE)(sym->st_info));
+            }
+            sr->data_offset = 0;
+        }
+    }
+    if (s1->print_gc_sections || s1->verbose)
+        printf("%d bytes removed by --gc-sections\n", nb_removed);
+    tcc_free(stack);
+    tcc_free(used);
+    tcc_free(live);
 }
 
-#if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
-#define	HAVE_PHDR	1
-#define	EXTRA_RELITEMS	14
-
-/* move the relocation value from .dynsym to .got */
-void patch_dynsym_undef(TCCState *s1, Section *s)
+/* return true if the relocation 'rel' of the section 's' is a call or a
+   jump, which does not take the address of its target */
+static int is_call_reloc(Section *s, ElfW_Rel *rel)
 {
-    uint32_t *gotd = (void *)s1->got->data;
-    ElfW(Sym) *sym, *sym_end;
+    int type = ELFW(R_TYPE)(rel->r_info);
 
-    gotd += 3;	// dummy entries in .got
-    /* relocate symbols in .dynsym */
-    sym_end = (ElfW(Sym) *)(s->data + s->data_offset);
-    for (sym = (ElfW(Sym) *)s->data + 1; sym < sym_end; sym++) {
-	if (sym->st_shndx == SHN_UNDEF) {
-	    *gotd++ = sym->st_value + 6; // XXX 6 is magic ?
-	    sym->st_value = 0;
-	}
+    switch(type) {
+#if defined(TCC_TARGET_I386) || defined(TCC_TARGET_X86_64)
+#if defined(TCC_TARGET_I386)
+    case R_386_PC32:
+    case R_386_PLT32:
+#else
+    case R_X86_64_PC32:
+    case R_X86_64_PLT32:
+#endif
+        /* the same relocation also gives addresses: look at the opcode */
+        return rel->r_offset >= 1 &&
+            (s->data[rel->r_offset - 1] == 0xe8 ||
+             s->data[rel->r_offset - 1] == 0xe9);
+#elif defined(TCC_TARGET_ARM)
+    case R_ARM_PC24:
+    case R_ARM_CALL:
+    case R_ARM_JUMP24:
+    case R_ARM_PLT32:
+        return 1;
+#elif defined(TCC_TARGET_AVR)
+    case R_AVR_7_PCREL:
+    case R_AVR_13_PCREL:
+    case R_AVR_CALL:
+        return 1;
+#endif
     }
+    return 0;
 }
-#else
-#define	HAVE_PHDR	0
-#define	EXTRA_RELITEMS	9
 
-/* zero plt offsets of weak symbols in .dynsym */
-void patch_dynsym_undef(TCCState *s1, Section *s)
+/* return the section into which 'sh_num' was folded */
+static int icf_find(int *fold, int sh_num)
 {
-    ElfW(Sym) *sym, *sym_end;
-
-    sym_end = (ElfW(Sym) *)(s->data + s->data_offset);
-    for (sym = (ElfW(Sym) *)s->data + 1; sym < sym_end; sym++)
-        if (sym->st_shndx == SHN_UNDEF && ELFW(ST_BIND)(sym->st_info) == STB_WEAK)
-            sym->st_value = 0;
+    while (fold[sh_num] != sh_num)
+        sh_num = fold[sh_num];
+    return sh_num;
 }
+
+/* return true if the sections 'a' and 'b' have the same content and
+   relocations, their targets being compared as folded so far. A
+   relocation targeting its own section matches the same in the other */
+static int icf_equal(TCCState *s1, int *fold, int a, int b)
+{
+    Section *sa, *sb, *ra, *rb;
+    ElfW(Sym) *syms, *syma, *symb;
+    ElfW_Rel *rela, *relb, *rel_end;
+    int ta, tb;
+
+    sa = s1->sections[a];
+    sb = s1->sections[b];
+    if (sa->data_offset != sb->data_offset ||
+        memcmp(sa->data, sb->data, sa->data_offset))
+        return 0;
+    ra = sa->reloc;
+    rb = sb->reloc;
+    if ((ra ? ra->data_offset : 0) != (rb ? rb->data_offset : 0))
+        return 0;
+    if (!ra)
+        return 1;
+    syms = (ElfW(Sym) *)symtab_section->data;
+    rel_end = (ElfW_Rel *)(ra->data + ra->data_offset);
+    for(rela = (ElfW_Rel *)ra->data, relb = (ElfW_Rel *)rb->data;
+        rela < rel_end; rela++, relb++) {
+        if (rela->r_offset != relb->r_offset ||
+            ELFW(R_TYPE)(rela->r_info) != ELFW(R_TYPE)(relb->r_info))
+            return 0;
+#if defined(TCC_TARGET_X86_64) || defined(TCC_TARGET_AVR)
+        if (rela->r_addend != relb->r_addend)
+            return 0;
 #endif
+        if (ELFW(R_SYM)(rela->r_info) == ELFW(R_SYM)(relb->r_info))
+            continue;
+        syma = &syms[ELFW(R_SYM)(rela->r_info)];
+        symb = &syms[ELFW(R_SYM)(relb->r_info)];
+        if (syma->st_shndx == SHN_UNDEF || syma->st_shndx >= SHN_LORESERVE ||
+            symb->st_shndx == SHN_UNDEF || symb->st_shndx >= SHN_LORESERVE ||
+            syma->st_value != symb->st_value)
+            return 0;
+        ta = icf_find(fold, syma->st_shndx);
+        tb = icf_find(fold, symb->st_shndx);
+        if (ta != tb && (ta != icf_find(fold, a) || tb != icf_find(fold, b)))
+            return 0;
+    }
+    return 1;
+}
 
-ST_FUNC void fill_got_entry(TCCState *s1, ElfW_Rel *rel)
+/* identical code folding: merge the function sections which have the
+   same code and relocations, their symbols being moved to the kept
+   section. With --icf=safe, the functions whose address is taken are
+   kept distinct */
+static void icf_sections(TCCState *s1)
 {
-	int sym_index = ELFW(R_SYM) (rel->r_info);
+    Section *s, *sr;
+    ElfW(Sym) *syms, *sym, *sym_end;
+    ElfW_Rel *rel, *rel_end;
+    unsigned int *hash, h;
+    int *fold, *cand, nb_cand, i, j, a, b, sh_num, changed, nb_folded;
+    char *taken;
+    unsigned char *p;
+
+    syms = (ElfW(Sym) *)symtab_section->data;
+    hash = tcc_mallocz(s1->nb_sections * sizeof(unsigned int));
+    fold = tcc_malloc(s1->nb_sections * sizeof(int));
+    cand = tcc_malloc(s1->nb_sections * sizeof(int));
+    taken = tcc_mallocz(s1->nb_sections);
+    for(i = 0; i < s1->nb_sections; i++)
+        fold[i] = i;
+
+    /* the sections whose address is taken by a relocation which is not
+       a call */
+    for(i = 1; i < s1->nb_sections && s1->icf == 1; i++) {
+        s = s1->sections[i];
+        sr = s->reloc;
+        if (!(s->sh_flags & SHF_ALLOC) || !sr || sr->link != symtab_section)
+            continue;
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            sh_num = syms[ELFW(R_SYM)(rel->r_info)].st_shndx;
+            if (sh_num != SHN_UNDEF && sh_num < SHN_LORESERVE &&
+                !is_call_reloc(s, rel))
+                taken[sh_num] = 1;
+        }
+    }
+
+    /* the candidates, with a hash of their content without the targets
+       of the relocations */
+    nb_cand = 0;
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!(s->sh_flags & SHF_ALLOC) || !(s->sh_flags & SHF_EXECINSTR) ||
+            strncmp(s->name, ".text.", 6) || s->data_offset == 0 || taken[i])
+            continue;
+        h = 2166136261u;
+        for(p = s->data; p < s->data + s->data_offset; p++)
+            h = (h ^ *p) * 16777619;
+        sr = s->reloc;
+        if (sr) {
+            rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+            for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++)
+                h = (h ^ (rel->r_offset + ELFW(R_TYPE)(rel->r_info))) * 16777619;
+        }
+        hash[i] = h;
+        cand[nb_cand++] = i;
+    }
+
+    /* fold until no more changes, as folding the callees can make the
+       callers identical */
+    do {
+        changed = 0;
+        for(i = 0; i < nb_cand; i++) {
+            a = cand[i];
+            if (fold[a] != a)
+                continue;
+            for(j = i + 1; j < nb_cand; j++) {
+                b = cand[j];
+                if (fold[b] == b && hash[a] == hash[b] &&
+                    icf_equal(s1, fold, a, b)) {
+                    fold[b] = a;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    /* move the symbols and remove the folded sections */
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for(sym = syms + 1; sym < sym_end; sym++) {
+        if (sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE)
+            sym->st_shndx = icf_find(fold, sym->st_shndx);
+    }
+    nb_folded = 0;
+    for(i = 0; i < nb_cand; i++) {
+        b = cand[i];
+        if (fold[b] == b)
+            continue;
+        s = s1->sections[b];
+        if (s1->print_icf_sections)
+            printf("folding section '%s' into '%s' (%lu bytes)\n", s->name,
+                   s1->sections[icf_find(fold, b)]->name, s->data_offset);
+        nb_folded += s->data_offset;
+        s->data_offset = 0;
+        s->sh_flags &= ~SHF_ALLOC;
+        if (s->reloc)
+            s->reloc->data_offset = 0;
+    }
+    if (s1->print_icf_sections || s1->verbose)
+        printf("%d bytes removed by --icf\n", nb_folded);
+    tcc_free(taken);
+    tcc_free(cand);
+    tcc_free(fold);
+    tcc_free(hash);
+}
+
+/* the calls from the section 'from' to the section 'to' */
+typedef struct CallEdge {
+    int from, to;
+    unsigned long weight;
+} CallEdge;
+
+/* the chains of sections are kept within 4 KB, the reach of rcall on AVR */
+#define CALL_CHAIN_SIZE 4096
+
+static int call_edge_cmp(const void *a, const void *b)
+{
+    const CallEdge *e1 = a, *e2 = b;
+
+    if (e1->from != e2->from)
+        return e1->from < e2->from ? -1 : 1;
+    if (e1->to != e2->to)
+        return e1->to < e2->to ? -1 : 1;
+    return 0;
+}
+
+/* the heaviest first */
+static int call_weight_cmp(const void *a, const void *b)
+{
+    const CallEdge *e1 = a, *e2 = b;
+
+    if (e1->weight != e2->weight)
+        return e1->weight > e2->weight ? -1 : 1;
+    return call_edge_cmp(a, b);
+}
+
+static void add_call_edge(CallEdge **pedges, int *pnb, int from, int to,
+                          unsigned long weight)
+{
+    int nb = *pnb;
+
+    if ((nb & (nb - 1)) == 0)
+        *pedges = tcc_realloc(*pedges, (nb ? 2 * nb : 1) * sizeof(CallEdge));
+    (*pedges)[nb].from = from;
+    (*pedges)[nb].to = to;
+    (*pedges)[nb].weight = weight;
+    *pnb = nb + 1;
+}
+
+/* the ordered section defining the function 'name', 0 if none */
+static int call_graph_section(const char *name, const char *cand)
+{
+    ElfW(Sym) *sym, *sym_end;
+
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for(sym = (ElfW(Sym) *)symtab_section->data + 1; sym < sym_end; sym++) {
+        if (sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE &&
+            cand[sym->st_shndx] &&
+            !strcmp((char *)symtab_section->link->data + sym->st_name, name))
+            return sym->st_shndx;
+    }
+    return 0;
+}
+
+/* order the sections from -ffunction-sections by call graph. Their
+   pairs are taken by decreasing weight, the number of calls from one to
+   the other plus their count in the --call-graph-ordering-file (lines
+   'caller callee count'), and the chain of the callee is appended to the
+   chain of the caller as long as it stays within CALL_CHAIN_SIZE. The
+   chains, the heaviest first, then take the places of their sections
+   among the others, which do not move. The cold functions and the entry
+   point are left alone */
+/* move the section i to the index map[i], with its relocations and
+   symbols */
+static void permute_sections(TCCState *s1, const int *map)
+{
+    Section *s, **sections;
+    ElfW(Sym) *sym, *sym_end;
+    int i, n;
+
+    n = s1->nb_sections;
+    sections = tcc_malloc(n * sizeof(Section *));
+    memcpy(sections, s1->sections, n * sizeof(Section *));
+    for(i = 1; i < n; i++) {
+        s = sections[i];
+        s1->sections[map[i]] = s;
+        s->sh_num = map[i];
+        if (s->reloc)
+            s->reloc->sh_info = map[i];
+    }
+    sym = (ElfW(Sym) *)symtab_section->data;
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for(sym++; sym < sym_end; sym++) {
+        if (sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE)
+            sym->st_shndx = map[sym->st_shndx];
+    }
+    tcc_free(sections);
+}
+
+ST_FUNC void sort_call_graph(TCCState *s1)
+{
+    Section *s, *sr;
+    ElfW(Sym) *syms;
+    ElfW_Rel *rel, *rel_end;
+    CallEdge *edges, *e;
+    unsigned long count, *size, *weight;
+    int *head, *next, *tail, *slot, *map;
+    int i, j, k, a, b, n, nb_edges, nb_slots, sh_num;
+    char *cand, line[1024], caller[256], callee[256];
+    FILE *f;
+
+    n = s1->nb_sections;
+    syms = (ElfW(Sym) *)symtab_section->data;
+    cand = tcc_mallocz(n);
+    /* the entry point does not move */
+    i = find_elf_sym(symtab_section, "_start");
+    sh_num = i ? syms[i].st_shndx : SHN_UNDEF;
+    nb_slots = 0;
+    for(i = 1; i < n; i++) {
+        s = s1->sections[i];
+        if ((s->sh_flags & SHF_ALLOC) && (s->sh_flags & SHF_EXECINSTR) &&
+            !strncmp(s->name, ".text.", 6) &&
+            strncmp(s->name, ".text.unlikely", 14) && s->data_offset > 0 &&
+            i != sh_num) {
+            cand[i] = 1;
+            nb_slots++;
+        }
+    }
+
+    /* the calls */
+    edges = NULL;
+    nb_edges = 0;
+    for(i = 1; i < n; i++) {
+        s = s1->sections[i];
+        sr = s->reloc;
+        if (!cand[i] || !sr || sr->link != symtab_section)
+            continue;
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            sh_num = syms[ELFW(R_SYM)(rel->r_info)].st_shndx;
+            if (sh_num != i && sh_num < SHN_LORESERVE && cand[sh_num] &&
+                is_call_reloc(s, rel))
+                add_call_edge(&edges, &nb_edges, i, sh_num, 1);
+        }
+    }
+    if (s1->call_graph_file) {
+        f = fopen(s1->call_graph_file, "r");
+        if (!f) {
+            tcc_error_noabort("could not read '%s'", s1->call_graph_file);
+        } else {
+            while (fgets(line, sizeof(line), f)) {
+                if (line[0] == '#' ||
+                    sscanf(line, "%255s %255s %lu", caller, callee, &count) != 3)
+                    continue;
+                a = call_graph_section(caller, cand);
+                b = call_graph_section(callee, cand);
+                if (a && b && a != b)
+                    add_call_edge(&edges, &nb_edges, a, b, count);
+            }
+            fclose(f);
+        }
+    }
+    if (nb_edges > 0) {
+        qsort(edges, nb_edges, sizeof(CallEdge), call_edge_cmp);
+        for(i = j = 0; i < nb_edges; i++) {
+            if (j > 0 && !call_edge_cmp(&edges[j - 1], &edges[i]))
+                edges[j - 1].weight += edges[i].weight;
+            else
+                edges[j++] = edges[i];
+        }
+        nb_edges = j;
+        qsort(edges, nb_edges, sizeof(CallEdge), call_weight_cmp);
+    }
+
+    /* the chains, by their first section. 0 ends them */
+    head = tcc_malloc(n * sizeof(int));
+    next = tcc_mallocz(n * sizeof(int));
+    tail = tcc_malloc(n * sizeof(int));
+    size = tcc_malloc(n * sizeof(unsigned long));
+    weight = tcc_mallocz(n * sizeof(unsigned long));
+    for(i = 1; i < n; i++) {
+        head[i] = tail[i] = i;
+        size[i] = s1->sections[i]->data_offset;
+    }
+    for(e = edges; e < edges + nb_edges; e++) {
+        a = head[e->from];
+        b = head[e->to];
+        if (a == b) {
+            weight[a] += e->weight;
+            continue;
+        }
+        if (size[a] + size[b] > CALL_CHAIN_SIZE)
+            continue;
+        next[tail[a]] = b;
+        tail[a] = tail[b];
+        size[a] += size[b];
+        weight[a] += weight[b] + e->weight;
+        for(j = b; j; j = next[j])
+            head[j] = a;
+    }
+
+    /* the chains by decreasing weight, in the places of their sections */
+    k = 0;
+    for(i = 1; i < n; i++) {
+        if (cand[i] && head[i] == i)
+            add_call_edge(&edges, &k, i, 0, weight[i]);
+    }
+    qsort(edges, k, sizeof(CallEdge), call_weight_cmp);
+    slot = tcc_malloc(nb_slots * sizeof(int));
+    map = tcc_malloc(n * sizeof(int));
+    for(i = 0; i < n; i++)
+        map[i] = i;
+    for(i = 1, j = 0; i < n; i++) {
+        if (cand[i])
+            slot[j++] = i;
+    }
+    for(i = 0, j = 0; i < k; i++) {
+        for(a = edges[i].from; a; a = next[a])
+            map[a] = slot[j++];
+    }
+    permute_sections(s1, map);
+
+    tcc_free(map);
+    tcc_free(slot);
+    tcc_free(weight);
+    tcc_free(size);
+    tcc_free(tail);
+    tcc_free(next);
+    tcc_free(head);
+    tcc_free(edges);
+    tcc_free(cand);
+}
+
+/* add various standard linker symbols (must be done after the
+   sections are filled (for example after allocating common
+   symbols)) */
+ST_FUNC void tcc_add_linker_symbols(TCCState *s1)
+{
+    char buf[1024];
+    int i;
+    Section *s;
+
+    add_elf_sym(symtab_section, 
+                text_section->data_offset, 0,
+                ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
+                text_section->sh_num, "_etext");
+    add_elf_sym(symtab_section, 
+                data_section->data_offset, 0,
+                ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
+                data_section->sh_num, "_edata");
+    add_elf_sym(symtab_section, 
+                bss_section->data_offset, 0,
+                ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
+                bss_section->sh_num, "_end");
+    /* horrible new standard ldscript defines */
+    add_init_array_defines(s1, ".preinit_array");
+    add_init_array_defines(s1, ".init_array");
+    add_init_array_defines(s1, ".fini_array");
+    
+    /* add start and stop symbols for sections whose name can be
+       expressed in C */
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (s->sh_type == SHT_PROGBITS &&
+            (s->sh_flags & SHF_ALLOC)) {
+            const char *p;
+            int ch;
+
+            /* check if section name can be expressed in C */
+            p = s->name;
+            for(;;) {
+                ch = *p;
+                if (!ch)
+                    break;
+                if (!isid(ch) && !isnum(ch))
+                    goto next_sec;
+                p++;
+            }
+            snprintf(buf, sizeof(buf), "__start_%s", s->name);
+            add_elf_sym(symtab_section, 
+                        0, 0,
+                        ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
+                        s->sh_num, buf);
+            snprintf(buf, sizeof(buf), "__stop_%s", s->name);
+            add_elf_sym(symtab_section,
+                        s->data_offset, 0,
+                        ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE), 0,
+                        s->sh_num, buf);
+        }
+    next_sec: ;
+    }
+}
+
+#ifdef TCC_TARGET_AVR
+/* the EEPROM is a separate address space: its section is not loaded
+   with the program and goes to its own image */
+static int avr_is_eeprom(Section *s)
+{
+    return !strcmp(s->name, ".eeprom");
+}
+
+/* the offset 'offset' once the words at the 'nb' sorted offsets 'del'
+   are removed */
+static long relax_offset(const unsigned long *del, int nb, long offset)
+{
+    int a = 0, b = nb, m;
+
+    while (a < b) {
+        m = (a + b) >> 1;
+        if ((long)del[m] < offset)
+            a = m + 1;
+        else
+            b = m;
+    }
+    return offset - 2 * a;
+}
+
+/* remove from the code section 's' the words at the 'nb' sorted offsets
+   'del', the second words of the relaxed calls and jumps */
+static void relax_section(TCCState *s1, Section *s, const unsigned long *del,
+                          int nb)
+{
+    Section *sr;
+    ElfW(Sym) *syms, *sym, *sym_end;
+    ElfW_Rel *rel, *rel_end;
+    MapInput *mi;
+    unsigned char *has_rel;
+    unsigned long a, end;
+    unsigned w;
+    int i, k, size;
+    long t;
+
+    /* the branches resolved when compiled which cross removed words */
+    has_rel = tcc_mallocz((s->data_offset >> 1) + 1);
+    rel_end = (ElfW_Rel *)(s->reloc->data + s->reloc->data_offset);
+    for(rel = (ElfW_Rel *)s->reloc->data; rel < rel_end; rel++)
+        has_rel[rel->r_offset >> 1] = 1;
+    for(a = 0, i = 0; a + 1 < s->data_offset; a += size) {
+        size = 2;
+        if (i < nb && del[i] == a) {
+            i++;
+            continue;
+        }
+        w = avr_get16(s->data + a);
+        if ((w & 0xFE0C) == 0x940C || (w & 0xFC0F) == 0x9000)
+            size = 4; /* jmp, call, lds, sts */
+        if (has_rel[a >> 1])
+            continue;
+        if ((w & 0xF800) == 0xF000) { /* brbs, brbc */
+            k = (((w >> 3) & 0x7F) ^ 0x40) - 0x40;
+            t = a + 2 + 2 * k;
+            k = (relax_offset(del, nb, t) - relax_offset(del, nb, a) - 2) >> 1;
+            avr_put16(s->data + a, (w & ~0x3F8) | ((k & 0x7F) << 3));
+        } else if ((w & 0xE000) == 0xC000) { /* rjmp, rcall */
+            k = ((w & 0xFFF) ^ 0x800) - 0x800;
+            t = a + 2 + 2 * k;
+            k = (relax_offset(del, nb, t) - relax_offset(del, nb, a) - 2) >> 1;
+            avr_put16(s->data + a, (w & 0xF000) | (k & 0xFFF));
+        }
+    }
+    tcc_free(has_rel);
+
+    /* the relocations in the section and against its symbols */
+    syms = (ElfW(Sym) *)symtab_section->data;
+    for(i = 1; i < s1->nb_sections; i++) {
+        sr = s1->sections[i];
+        if (sr->sh_type != SHT_RELX || sr->link != symtab_section)
+            continue;
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            if (sr == s->reloc)
+                rel->r_offset = relax_offset(del, nb, rel->r_offset);
+            sym = &syms[ELFW(R_SYM)(rel->r_info)];
+            if (sym->st_shndx == s->sh_num) {
+                t = sym->st_value + rel->r_addend;
+                rel->r_addend = relax_offset(del, nb, t) -
+                                relax_offset(del, nb, sym->st_value);
+            }
+        }
+    }
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    for(sym = syms + 1; sym < sym_end; sym++) {
+        if (sym->st_shndx != s->sh_num)
+            continue;
+        end = sym->st_value + sym->st_size;
+        sym->st_value = relax_offset(del, nb, sym->st_value);
+        if (sym->st_size)
+            sym->st_size = relax_offset(del, nb, end) - sym->st_value;
+    }
+    for(i = 0; i < s1->nb_map_inputs; i++) {
+        mi = s1->map_inputs[i];
+        if (mi->s != s)
+            continue;
+        end = mi->offset + mi->size;
+        mi->offset = relax_offset(del, nb, mi->offset);
+        mi->size = relax_offset(del, nb, end) - mi->offset;
+    }
+
+    /* the code */
+    for(i = 0, a = del[0]; i < nb; i++) {
+        end = i + 1 < nb ? del[i + 1] : s->data_offset;
+        memmove(s->data + a, s->data + del[i] + 2, end - del[i] - 2);
+        a += end - del[i] - 2;
+    }
+    s->data_offset = a;
+}
+
+static int relax_del_cmp(const void *a, const void *b)
+{
+    unsigned long d1 = *(const unsigned long *)a;
+    unsigned long d2 = *(const unsigned long *)b;
+
+    return d1 < d2 ? -1 : d1 > d2;
+}
+
+/* -mrelax: the calls and jumps to a target within reach of rcall and
+   rjmp become rcall and rjmp, which take a word and a cycle less. The
+   flash sections are laid out in order as in the program, and the
+   distances can only get shorter, until no more instruction changes.
+   The interrupt vectors, whose entries have a fixed size, stay as they
+   are. Not done with -g, whose line numbers would be off */
+ST_FUNC void avr_relax(TCCState *s1)
+{
+    Section *s, *ts, *sr;
+    ElfW(Sym) *sym;
+    ElfW_Rel *rel, *rel_end;
+    unsigned long *del;
+    addr_t addr;
+    int i, nb, nb_allocated, nb_relaxed, changed;
+    unsigned w;
+    long x;
+
+    if (s1->avr_device->flash_size <= 0x2000 || s1->do_debug)
+        return;
+    del = NULL;
+    nb_allocated = 0;
+    nb_relaxed = 0;
+    do {
+        addr = 0;
+        for(i = 1; i < s1->nb_sections; i++) {
+            s = s1->sections[i];
+            if ((s->sh_flags & (SHF_ALLOC | SHF_WRITE)) != SHF_ALLOC ||
+                s->sh_type == SHT_NOBITS || avr_is_eeprom(s))
+                continue;
+            if (s->sh_addralign > 1)
+                addr = (addr + s->sh_addralign - 1) &
+                       ~(addr_t)(s->sh_addralign - 1);
+            s->sh_addr = addr;
+            addr += s->data_offset;
+        }
+        changed = 0;
+        for(i = 1; i < s1->nb_sections; i++) {
+            s = s1->sections[i];
+            sr = s->reloc;
+            if (!(s->sh_flags & SHF_ALLOC) || !(s->sh_flags & SHF_EXECINSTR) ||
+                !sr || sr->link != symtab_section ||
+                !strcmp(s->name, ".vectors"))
+                continue;
+            nb = 0;
+            rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+            for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+                if (ELFW(R_TYPE)(rel->r_info) != R_AVR_CALL ||
+                    rel->r_offset + 4 > s->data_offset)
+                    continue;
+                w = avr_get16(s->data + rel->r_offset);
+                if ((w & 0xFE0C) != 0x940C) /* jmp, call */
+                    continue;
+                sym = &((ElfW(Sym) *)symtab_section->data)[ELFW(R_SYM)(rel->r_info)];
+                if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE)
+                    continue;
+                ts = s1->sections[sym->st_shndx];
+                if ((ts->sh_flags & (SHF_ALLOC | SHF_WRITE)) != SHF_ALLOC)
+                    continue;
+                x = (long)(ts->sh_addr + sym->st_value + rel->r_addend) -
+                    (long)(s->sh_addr + rel->r_offset) - 2;
+                if ((x & 1) || x < -4096 || x > 4094)
+                    continue;
+                avr_put16(s->data + rel->r_offset, w & 2 ? 0xD000 : 0xC000);
+                rel->r_info = ELFW(R_INFO)(ELFW(R_SYM)(rel->r_info),
+                                           R_AVR_13_PCREL);
+                if (nb >= nb_allocated) {
+                    nb_allocated = nb_allocated ? 2 * nb_allocated : 16;
+                    del = tcc_realloc(del, nb_allocated * sizeof(unsigned long));
+                }
+                del[nb++] = rel->r_offset + 2;
+            }
+            if (nb > 0) {
+                qsort(del, nb, sizeof(unsigned long), relax_del_cmp);
+                relax_section(s1, s, del, nb);
+                nb_relaxed += nb;
+                changed = 1;
+            }
+        }
+    } while (changed);
+    if (s1->verbose)
+        printf("%d bytes removed by --relax\n", 2 * nb_relaxed);
+    tcc_free(del);
+}
+
+/* The startup linked when no _start is given: the interrupt vectors up
+   to the highest __vector_N defined, then _start, which sets up the
+   stack, fills the data from their image in flash, clears the bss and
+   calls main. The data image is run-length encoded by avr_rle() */
+
+#define AVR_IO_RAMPZ 0x3B
+#define AVR_IO_SPL   0x3D
+#define AVR_IO_SPH   0x3E
+#define AVR_IO_SREG  0x3F
+
+/* bytes of the bss clear loop after the decoder: a trailing bss whose
+   runs take less is decoded with the data */
+#define AVR_CLEAR_SIZE 14
+
+/* append the instruction 'w' to 's', return its offset */
+static int avr_op(Section *s, unsigned w)
+{
+    int at = s->data_offset;
+
+    avr_put16(section_ptr_add(s, 2), w);
+    return at;
+}
+
+/* point the branch or the rjmp at 'at' to the offset 'to' */
+static void avr_op_patch(Section *s, int at, int to)
+{
+    unsigned w = avr_get16(s->data + at);
+    int k = (to - at - 2) >> 1;
+
+    if ((w & 0xF000) == 0xC000)
+        w |= k & 0xFFF;
+    else
+        w |= (k & 0x7F) << 3;
+    avr_put16(s->data + at, w);
+}
+
+/* ldi rd, with the relocation 'type' of the symbol 'sym' */
+static void avr_op_ldi(Section *s, int d, int type, int sym)
+{
+    put_elf_reloc(symtab_section, s, s->data_offset, type, sym);
+    avr_op(s, 0xE000 | (d - 16) << 4);
+}
+
+/* out a, rr */
+static void avr_op_out(Section *s, int a, int r)
+{
+    avr_op(s, 0xB800 | (a & 0x30) << 5 | r << 4 | (a & 0xF));
+}
+
+/* jmp or call to 'sym', rjmp or rcall without them */
+static void avr_op_jump(TCCState *s1, Section *s, int call, int sym)
+{
+    if (s1->avr_device->flags & AVR_HAVE_JMP_CALL) {
+        put_elf_reloc(symtab_section, s, s->data_offset, R_AVR_CALL, sym);
+        avr_op(s, call ? 0x940E : 0x940C);
+        avr_op(s, 0);
+    } else {
+        put_elf_reloc(symtab_section, s, s->data_offset, R_AVR_13_PCREL, sym);
+        avr_op(s, call ? 0xD000 : 0xC000);
+    }
+}
+
+/* true if a byte of flash is loaded with post-increment in one
+   instruction. The devices with more than 64 KB have elpm rd, Z+ */
+static int avr_have_lpmx(TCCState *s1)
+{
+    const AVRDevice *d = s1->avr_device;
+
+    return d->flash_size > 0x10000 || (d->flags & AVR_HAVE_LPMX);
+}
+
+/* load the next byte of flash at Z in rd */
+static void avr_op_load(TCCState *s1, Section *s, int d)
+{
+    if (s1->avr_device->flash_size > 0x10000) {
+        avr_op(s, 0x9007 | d << 4); /* elpm rd, Z+ */
+    } else if (avr_have_lpmx(s1)) {
+        avr_op(s, 0x9005 | d << 4); /* lpm rd, Z+ */
+    } else {
+        avr_op(s, 0x95C8); /* lpm */
+        if (d)
+            avr_op(s, 0x2C00 | d << 4); /* mov rd, r0 */
+        avr_op(s, 0x9631); /* adiw r30, 1 */
+    }
+}
+
+/* load the next byte of flash in r0 if bit 7 of r24 is 'set' */
+static void avr_op_load_if(TCCState *s1, Section *s, int set)
+{
+    int at;
+
+    if (avr_have_lpmx(s1)) {
+        avr_op(s, (set ? 0xFC00 : 0xFE00) | 24 << 4 | 7); /* sbrc, sbrs */
+        avr_op_load(s1, s, 0);
+    } else {
+        avr_op(s, (set ? 0xFE00 : 0xFC00) | 24 << 4 | 7);
+        at = avr_op(s, 0xC000);
+        avr_op_load(s1, s, 0);
+        avr_op_patch(s, at, s->data_offset);
+    }
+}
+
+/* bytes patched by a relocation of the data */
+static int avr_reloc_size(int type)
+{
+    switch(type) {
+    case R_AVR_32:
+    case R_AVR_32_PCREL:
+    case R_AVR_DIFF32:
+        return 4;
+    case R_AVR_8:
+    case R_AVR_8_LO8:
+    case R_AVR_8_HI8:
+    case R_AVR_8_HLO8:
+    case R_AVR_DIFF8:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+/* repeated bytes at 'i', none of them relocated */
+static int avr_rle_run(const unsigned char *img, const char *fixed,
+                       int i, int size)
+{
+    int n;
+
+    if (fixed[i])
+        return 0;
+    for(n = 1; i + n < size && n < 127 && img[i + n] == img[i] &&
+        !fixed[i + n]; n++)
+        ;
+    return n;
+}
+
+/* append the 'size' bytes of 'img' to 's' as blocks: a byte n | 0x80
+   followed by a byte repeated n times, or a byte n followed by n bytes,
+   a 0 ending them. fixed[i] is the number of bytes of a relocation from
+   'i': they are kept in one block, where[i] receiving their offset in
+   's' */
+static void avr_rle(Section *s, const unsigned char *img, const char *fixed,
+                    int size, int *where)
+{
+    unsigned char *p;
+    int i, k, n;
+
+    i = 0;
+    while (i < size) {
+        n = avr_rle_run(img, fixed, i, size);
+        if (n >= 3) {
+            p = section_ptr_add(s, 2);
+            p[0] = 0x80 | n;
+            p[1] = img[i];
+            i += n;
+            continue;
+        }
+        for(k = i; k < size; k += n) {
+            n = fixed[k] ? fixed[k] : 1;
+            if (k - i + n > 127 ||
+                (k > i && avr_rle_run(img, fixed, k, size) >= 3))
+                break;
+        }
+        p = section_ptr_add(s, 1);
+        *p = k - i;
+        for(; i < k; i++) {
+            where[i] = s->data_offset;
+            p = section_ptr_add(s, 1);
+            *p = img[i];
+        }
+    }
+    p = section_ptr_add(s, 1);
+    *p = 0;
+}
+
+/* return true if the section goes to SRAM */
+static int avr_is_ram(Section *s)
+{
+    return (s->sh_flags & (SHF_ALLOC | SHF_WRITE)) == (SHF_ALLOC | SHF_WRITE) &&
+        !avr_is_eeprom(s);
+}
+
+/* the SRAM sections are laid out as in elf_output_file(), their offset
+   from the first one in base[]. Return the end of the initialized ones,
+   '*pend' being the end of all */
+static unsigned long avr_ram_layout(TCCState *s1, unsigned long *base,
+                                    unsigned long *pend)
+{
+    Section *s;
+    unsigned long end, data_end;
+    int i;
+
+    end = data_end = 0;
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!avr_is_ram(s))
+            continue;
+        if (s->sh_addralign > 1)
+            end = (end + s->sh_addralign - 1) & ~(s->sh_addralign - 1);
+        base[i] = end;
+        end += s->data_offset;
+        if (s->sh_type != SHT_NOBITS)
+            data_end = end;
+    }
+    *pend = end;
+    return data_end;
+}
+
+/* fill 'image' with the encoded data up to 'data_end' and move their
+   relocations to it. The SRAM sections become NOBITS, so that they take
+   no flash */
+static void avr_data_image(TCCState *s1, Section *image,
+                           const unsigned long *base, unsigned long data_end)
+{
+    Section *s, *sr;
+    ElfW_Rel *rel, *rel_end, *r;
+    unsigned char *img;
+    char *fixed;
+    int *where;
+    unsigned long o;
+    int i, j, n;
+
+    img = tcc_mallocz(data_end);
+    fixed = tcc_mallocz(data_end);
+    where = tcc_malloc(data_end * sizeof(int));
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!avr_is_ram(s) || s->sh_type == SHT_NOBITS)
+            continue;
+        memcpy(img + base[i], s->data, s->data_offset);
+        sr = s->reloc;
+        if (!sr)
+            continue;
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+            n = avr_reloc_size(ELFW(R_TYPE)(rel->r_info));
+            o = base[i] + rel->r_offset;
+            for(j = 0; j < n && rel->r_offset + j < s->data_offset; j++) {
+                if (fixed[o + j] < n - j)
+                    fixed[o + j] = n - j;
+            }
+        }
+    }
+    avr_rle(image, img, fixed, data_end, where);
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (!avr_is_ram(s))
+            continue;
+        sr = s->reloc;
+        if (sr && s->sh_type != SHT_NOBITS) {
+            rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+            for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++) {
+                if (rel->r_offset >= s->data_offset)
+                    continue;
+                put_elf_reloc(symtab_section, image,
+                              where[base[i] + rel->r_offset],
+                              ELFW(R_TYPE)(rel->r_info),
+                              ELFW(R_SYM)(rel->r_info));
+                r = (ElfW_Rel *)(image->reloc->data +
+                                 image->reloc->data_offset) - 1;
+                r->r_addend = rel->r_addend;
+            }
+        }
+        s->sh_type = SHT_NOBITS;
+    }
+    tcc_free(where);
+    tcc_free(fixed);
+    tcc_free(img);
+}
+
+/* generate the startup unless a _start is linked */
+static void avr_startup(TCCState *s1)
+{
+    const AVRDevice *d = s1->avr_device;
+    Section *vectors, *init, *image, *first;
+    ElfW(Sym) *sym;
+    unsigned long *base, data_end, end, ramend;
+    const char *name;
+    char *p;
+    int *vec, *map;
+    int i, n, nb_vectors, nb_moved, at, loop, info;
+    int sym_start, sym_main, sym_bad, sym_data, sym_load, sym_bss_end;
+
+    i = find_elf_sym(symtab_section, "_start");
+    if (i && ((ElfW(Sym) *)symtab_section->data)[i].st_shndx != SHN_UNDEF)
+        return;
+    if (s1->mapfile)
+        map_input(s1, NULL, NULL);
+
+    /* the interrupt handlers */
+    vec = NULL;
+    nb_vectors = 0;
+    n = symtab_section->data_offset / sizeof(ElfW(Sym));
+    for(i = 1; i < n; i++) {
+        sym = &((ElfW(Sym) *)symtab_section->data)[i];
+        name = (char *)symtab_section->link->data + sym->st_name;
+        if (sym->st_shndx == SHN_UNDEF ||
+            ELFW(ST_BIND)(sym->st_info) == STB_LOCAL ||
+            strncmp(name, "__vector_", 9) || !isnum(name[9]))
+            continue;
+        at = strtol(name + 9, &p, 10);
+        if (*p || at < 1)
+            continue;
+        if (at >= nb_vectors) {
+            vec = tcc_realloc(vec, (at + 1) * sizeof(int));
+            memset(vec + nb_vectors, 0, (at + 1 - nb_vectors) * sizeof(int));
+            nb_vectors = at + 1;
+        }
+        vec[at] = i;
+    }
+
+    /* the data and the bss */
+    base = tcc_mallocz(s1->nb_sections * sizeof(unsigned long));
+    data_end = avr_ram_layout(s1, base, &end);
+    if (data_end > 0 && 2 * ((end - data_end + 126) / 127) <= AVR_CLEAR_SIZE)
+        data_end = end;
+    first = NULL;
+    for(i = 1; i < s1->nb_sections && !first; i++) {
+        if (avr_is_ram(s1->sections[i]))
+            first = s1->sections[i];
+    }
+
+    /* the sections before the relocation sections, which are not moved */
+    n = s1->nb_sections;
+    vectors = NULL;
+    if (nb_vectors > 0) {
+        vectors = new_section(s1, ".vectors", SHT_PROGBITS,
+                              SHF_ALLOC | SHF_EXECINSTR);
+    }
+    init = new_section(s1, ".init", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR);
+    image = NULL;
+    if (data_end > 0) {
+        image = new_section(s1, ".data.load", SHT_PROGBITS, SHF_ALLOC);
+        image->sh_addralign = 1;
+        avr_data_image(s1, image, base, data_end);
+    }
+
+    info = ELFW(ST_INFO)(STB_GLOBAL, STT_NOTYPE);
+    sym_start = add_elf_sym(symtab_section, 0, 0,
+                            ELFW(ST_INFO)(STB_GLOBAL, STT_FUNC), 0,
+                            init->sh_num, "_start");
+    sym_main = add_elf_sym(symtab_section, 0, 0, info, 0, SHN_UNDEF, "main");
+    sym_data = sym_load = sym_bss_end = sym_bad = 0;
+    if (first) {
+        sym_data = add_elf_sym(symtab_section, 0, 0, info, 0,
+                               first->sh_num, "__data_start");
+        add_elf_sym(symtab_section, data_end, 0, info, 0,
+                    first->sh_num, "__data_end");
+        add_elf_sym(symtab_section, data_end, 0, info, 0,
+                    first->sh_num, "__bss_start");
+        sym_bss_end = add_elf_sym(symtab_section, end, 0, info, 0,
+                                  first->sh_num, "__bss_end");
+    }
+    if (image) {
+        sym_load = add_elf_sym(symtab_section, 0, 0, info, 0,
+                               image->sh_num, "__data_load_start");
+    }
+
+    if (vectors) {
+        avr_op_jump(s1, vectors, 0, sym_start);
+        for(i = 1; i < nb_vectors; i++) {
+            if (!vec[i] && !sym_bad) {
+                sym_bad = add_elf_sym(symtab_section, 0, 0, info, 0,
+                                      init->sh_num, "__bad_interrupt");
+            }
+            avr_op_jump(s1, vectors, 0, vec[i] ? vec[i] : sym_bad);
+        }
+    }
+
+    /* _start: r1 is the zero register, the stack at the end of SRAM */
+    avr_op(init, 0x2411); /* clr r1 */
+    avr_op_out(init, AVR_IO_SREG, 1);
+    ramend = d->ram_start + d->ram_size - 1;
+    avr_op(init, 0xE000 | (ramend & 0xF0) << 4 | (28 - 16) << 4 | (ramend & 0xF));
+    if (!(d->flags & AVR_HAVE_8BIT_SP)) {
+        ramend >>= 8;
+        avr_op(init, 0xE000 | (ramend & 0xF0) << 4 | (29 - 16) << 4 | (ramend & 0xF));
+        avr_op_out(init, AVR_IO_SPH, 29);
+    }
+    avr_op_out(init, AVR_IO_SPL, 28);
+
+    if (image) {
+        /* X: the data, Z: their image */
+        avr_op_ldi(init, 26, R_AVR_LO8_LDI, sym_data);
+        avr_op_ldi(init, 27, R_AVR_HI8_LDI, sym_data);
+        avr_op_ldi(init, 30, R_AVR_LO8_LDI, sym_load);
+        avr_op_ldi(init, 31, R_AVR_HI8_LDI, sym_load);
+        if (d->flash_size > 0x10000) {
+            avr_op_ldi(init, 24, R_AVR_HH8_LDI, sym_load);
+            avr_op_out(init, AVR_IO_RAMPZ, 24);
+        }
+        /* the blocks, r24 being their header and r25 their length */
+        loop = init->data_offset;
+        avr_op_load(s1, init, 24);
+        avr_op(init, 0x2F98); /* mov r25, r24 */
+        avr_op(init, 0x779F); /* andi r25, 0x7F */
+        at = avr_op(init, 0xF001); /* breq */
+        avr_op_load_if(s1, init, 1);
+        i = init->data_offset;
+        avr_op_load_if(s1, init, 0);
+        avr_op(init, 0x920D); /* st X+, r0 */
+        avr_op(init, 0x959A); /* dec r25 */
+        avr_op_patch(init, avr_op(init, 0xF401), i); /* brne */
+        avr_op_patch(init, avr_op(init, 0xC000), loop);
+        avr_op_patch(init, at, init->data_offset);
+    }
+
+    if (end > data_end) {
+        /* clear the bss from X, which follows the data */
+        if (!image) {
+            avr_op_ldi(init, 26, R_AVR_LO8_LDI, sym_data);
+            avr_op_ldi(init, 27, R_AVR_HI8_LDI, sym_data);
+        }
+        avr_op_ldi(init, 24, R_AVR_LO8_LDI, sym_bss_end);
+        avr_op_ldi(init, 25, R_AVR_HI8_LDI, sym_bss_end);
+        at = avr_op(init, 0xC000);
+        loop = avr_op(init, 0x921D); /* st X+, r1 */
+        avr_op_patch(init, at, init->data_offset);
+        avr_op(init, 0x17A8); /* cp r26, r24 */
+        avr_op(init, 0x07B9); /* cpc r27, r25 */
+        avr_op_patch(init, avr_op(init, 0xF401), loop); /* brne */
+    }
+
+    avr_op_jump(s1, init, 1, sym_main);
+    avr_op(init, 0x94F8); /* cli */
+    avr_op(init, 0xCFFF); /* rjmp . */
+    if (sym_bad) {
+        ((ElfW(Sym) *)symtab_section->data)[sym_bad].st_value =
+            init->data_offset;
+        avr_op_jump(s1, init, 0, add_elf_sym(symtab_section, 0, 0, info, 0,
+                                             vectors->sh_num, "__vectors"));
+    }
+    if (s1->mapfile)
+        map_input(s1, "(startup)", NULL);
+
+    /* the vectors at address 0, _start after them */
+    nb_moved = vectors ? 2 : 1;
+    map = tcc_malloc(s1->nb_sections * sizeof(int));
+    for(i = 0; i < s1->nb_sections; i++)
+        map[i] = i < n ? i + nb_moved : i;
+    map[0] = 0;
+    if (vectors)
+        map[vectors->sh_num] = 1;
+    map[init->sh_num] = nb_moved;
+    permute_sections(s1, map);
+
+    tcc_free(map);
+    tcc_free(base);
+    tcc_free(vec);
+}
+#endif
+
+/* return true if the section is part of the loaded image */
+static int is_image_section(Section *s)
+{
+#ifdef TCC_TARGET_AVR
+    if (avr_is_eeprom(s))
+        return 0;
+#endif
+    return s->sh_type != SHT_NOBITS && (s->sh_flags & SHF_ALLOC) &&
+        s->sh_size > 0;
+}
+
+/* return the load address of the image section 's', translated from its
+   address by the program header containing it */
+static addr_t section_lma(ElfW(Phdr) *phdr, int phnum, Section *s)
+{
+    ElfW(Phdr) *ph;
+    int i;
+
+    if (phnum == 0)
+        return s->sh_offset;
+    for(i = 0, ph = phdr; i < phnum; i++, ph++) {
+        if (ph->p_type == PT_LOAD && s->sh_addr >= ph->p_vaddr &&
+            s->sh_addr < ph->p_vaddr + ph->p_memsz)
+            return s->sh_addr - ph->p_vaddr + ph->p_paddr;
+    }
+    return s->sh_addr;
+}
+
+/* 'filename' with its extension replaced by 'ext' */
+static void change_extension(char *buf, int size, const char *filename,
+                             const char *ext)
+{
+    pstrcpy(buf, size - strlen(ext), filename);
+    strcpy(tcc_fileextension(buf), ext);
+}
+
+/* the sections are written at their load address, the image starting at
+   the file offset of the first one */
+static void tcc_output_binary(TCCState *s1, FILE *f,
+                              const int *section_order,
+                              ElfW(Phdr) *phdr, int phnum)
+{
+    static const unsigned char zeros[256];
+    Section *s;
+    addr_t base, pos;
+    int i, offset, size;
+
+    offset = 0;
+    base = -1;
+    for(i=1;i<s1->nb_sections;i++) {
+        s = s1->sections[section_order[i]];
+        if (is_image_section(s)) {
+            pos = section_lma(phdr, phnum, s);
+            if (base == (addr_t)-1)
+                base = pos - s->sh_offset;
+            pos -= base;
+            /* the padding is written by blocks */
+            while (offset < pos) {
+                size = pos - offset;
+                if (size > sizeof(zeros))
+                    size = sizeof(zeros);
+                fwrite(zeros, 1, size, f);
+                offset += size;
+            }
+            size = s->sh_size;
+            fwrite(s->data, 1, size, f);
+            offset += size;
+        }
+    }
+}
+
+/* Intel HEX output: the bytes are gathered in data records of up to
+   16 bytes, a gap in the addresses just starts a new record */
+typedef struct IHexWriter {
+    FILE *f;
+    unsigned long addr; /* address of buf[0] */
+    unsigned long high; /* current extended linear address */
+    int len;
+    unsigned char buf[16];
+} IHexWriter;
+
+static void ihex_record(FILE *f, int type, unsigned long addr,
+                        const unsigned char *data, int len)
+{
+    int i, sum;
+
+    sum = len + ((addr >> 8) & 0xff) + (addr & 0xff) + type;
+    fprintf(f, ":%02X%04lX%02X", len, addr & 0xffff, type);
+    for(i = 0; i < len; i++) {
+        fprintf(f, "%02X", data[i]);
+        sum += data[i];
+    }
+    fprintf(f, "%02X\n", -sum & 0xff);
+}
+
+static void ihex_flush(IHexWriter *w)
+{
+    unsigned char b[2];
+
+    if (w->len == 0)
+        return;
+    if ((w->addr >> 16) != w->high) {
+        w->high = w->addr >> 16;
+        b[0] = w->high >> 8;
+        b[1] = w->high;
+        ihex_record(w->f, 4, 0, b, 2);
+    }
+    ihex_record(w->f, 0, w->addr, w->buf, w->len);
+    w->addr += w->len;
+    w->len = 0;
+}
+
+static void ihex_write(IHexWriter *w, unsigned long addr,
+                       const unsigned char *data, int size)
+{
+    for(; size > 0; size--) {
+        /* a record does not cross a 64K boundary */
+        if (w->len && (addr != w->addr + w->len || w->len == sizeof(w->buf)
+                       || (addr & 0xffff) == 0))
+            ihex_flush(w);
+        if (w->len == 0)
+            w->addr = addr;
+        w->buf[w->len++] = *data++;
+        addr++;
+    }
+}
+
+static void ihex_end(IHexWriter *w)
+{
+    ihex_flush(w);
+    ihex_record(w->f, 1, 0, NULL, 0);
+}
+
+/* read the image 'filename' in 'image', which covers the addresses from
+   'start' to 'end'. An Intel HEX file gives its addresses, a raw binary
+   one is loaded at 'base'. Return -1 if it cannot be read */
+static int load_flash_image(const char *filename, unsigned char *image,
+                            unsigned long start, unsigned long end,
+                            unsigned long base)
+{
+    char line[1024];
+    unsigned char b[256 + 5];
+    unsigned long high, addr;
+    unsigned int x;
+    int i, n, c, sum;
+    FILE *f;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return -1;
+    c = getc(f);
+    if (c != ':') {
+        ungetc(c, f);
+        if (base >= start && base < end)
+            fread(image + base - start, 1, end - base, f);
+        fclose(f);
+        return 0;
+    }
+    ungetc(c, f);
+    high = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] != ':')
+            continue;
+        sum = 0;
+        for(n = 0; n < sizeof(b) &&
+                sscanf(line + 1 + 2 * n, "%2x", &x) == 1; n++) {
+            b[n] = x;
+            sum += x;
+        }
+        if (n < 5 || n != b[0] + 5 || (sum & 0xff) != 0)
+            break;
+        addr = high + (b[1] << 8) + b[2];
+        if (b[3] == 0) {
+            for(i = 0; i < b[0]; i++, addr++) {
+                if (addr >= start && addr < end)
+                    image[addr - start] = b[4 + i];
+            }
+        } else if (b[3] == 1) {
+            fclose(f);
+            return 0;
+        } else if (b[3] == 2) {
+            high = ((b[4] << 8) + b[5]) << 4;
+        } else if (b[3] == 4) {
+            high = (unsigned long)((b[4] << 8) + b[5]) << 16;
+        }
+    }
+    fclose(f);
+    return -1;
+}
+
+/* output only the pages of the image which differ from the previous one
+   given by -Wl,--flash-diff, as whole pages, and list them in
+   'file.pages' for the programmer. Missing bytes are erased flash */
+static int output_flash_diff(TCCState *s1, IHexWriter *w,
+                             const char *filename, const int *section_order,
+                             ElfW(Phdr) *phdr, int phnum)
+{
+    unsigned char *image, *prev;
+    unsigned long start, end, base, lma, a, size;
+    char buf[1024];
+    Section *s;
+    FILE *m;
+    int i, page, nb_changed, ret;
+
+    page = s1->flash_page_size;
+    if (page == 0)
+#ifdef TCC_TARGET_AVR
+        page = s1->avr_device->page_size;
+#else
+        page = 256;
+#endif
+    base = -1;
+    end = 0;
+    for(i=1;i<s1->nb_sections;i++) {
+        s = s1->sections[section_order[i]];
+        if (is_image_section(s)) {
+            lma = section_lma(phdr, phnum, s);
+            if (base == (unsigned long)-1)
+                base = lma - s->sh_offset;
+            if (lma + s->sh_size > end)
+                end = lma + s->sh_size;
+        }
+    }
+    if (base == (unsigned long)-1)
+        base = 0;
+    start = base & -page;
+    end = (end + page - 1) & -page;
+    size = end > start ? end - start : 0;
+    image = tcc_malloc(2 * size + 1);
+    prev = image + size;
+    memset(image, 0xff, 2 * size);
+    for(i=1;i<s1->nb_sections;i++) {
+        s = s1->sections[section_order[i]];
+        if (is_image_section(s)) {
+            lma = section_lma(phdr, phnum, s);
+            memcpy(image + lma - start, s->data, s->sh_size);
+        }
+    }
+    ret = -1;
+    if (load_flash_image(s1->flash_diff, prev, start, end, base) < 0) {
+        tcc_error_noabort("could not read image '%s'", s1->flash_diff);
+        goto the_end;
+    }
+    change_extension(buf, sizeof(buf), filename, ".pages");
+    m = fopen(buf, "w");
+    if (!m) {
+        tcc_error_noabort("could not write '%s'", buf);
+        goto the_end;
+    }
+    if (s1->verbose)
+        printf("<- %s\n", buf);
+    fprintf(m, "# page size %d\n", page);
+    nb_changed = 0;
+    for(a = start; a < end; a += page) {
+        if (memcmp(image + a - start, prev + a - start, page)) {
+            ihex_write(w, a, image + a - start, page);
+            fprintf(m, "0x%06lx %d\n", a, page);
+            nb_changed++;
+        }
+    }
+    fprintf(m, "# %d of %lu pages changed\n", nb_changed, size / page);
+    fclose(m);
+    ihex_end(w);
+    ret = 0;
+ the_end:
+    tcc_free(image);
+    return ret;
+}
+
+static int tcc_output_ihex(TCCState *s1, FILE *f, const char *filename,
+                           const int *section_order,
+                           ElfW(Phdr) *phdr, int phnum)
+{
+    IHexWriter w;
+    Section *s;
+    int i;
+
+    memset(&w, 0, sizeof(w));
+    w.f = f;
+    if (s1->flash_diff)
+        return output_flash_diff(s1, &w, filename, section_order,
+                                 phdr, phnum);
+    for(i=1;i<s1->nb_sections;i++) {
+        s = s1->sections[section_order[i]];
+        if (is_image_section(s))
+            ihex_write(&w, section_lma(phdr, phnum, s), s->data, s->sh_size);
+    }
+    ihex_end(&w);
+    return 0;
+}
+
+#ifdef TCC_TARGET_AVR
+/* write the initial content of the EEPROM, if any, to 'file.eep' in the
+   same format as the program image */
+static int avr_output_eeprom(TCCState *s1, const char *filename)
+{
+    char buf[1024];
+    IHexWriter w;
+    Section *s;
+    FILE *f;
+    int i;
+
+    s = NULL;
+    for(i = 1; i < s1->nb_sections; i++) {
+        if (avr_is_eeprom(s1->sections[i]))
+            s = s1->sections[i];
+    }
+    if (!s || s->sh_size == 0)
+        return 0;
+    change_extension(buf, sizeof(buf), filename, ".eep");
+    f = fopen(buf, "wb");
+    if (!f) {
+        tcc_error_noabort("could not write '%s'", buf);
+        return -1;
+    }
+    if (s1->verbose)
+        printf("<- %s\n", buf);
+    if (s1->output_format == TCC_OUTPUT_FORMAT_IHEX) {
+        memset(&w, 0, sizeof(w));
+        w.f = f;
+        ihex_write(&w, 0, s->data, s->sh_size);
+        ihex_end(&w);
+    } else {
+        fwrite(s->data, 1, s->sh_size, f);
+    }
+    fclose(f);
+    return 0;
+}
+#endif
+
+#if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
+#define	HAVE_PHDR	1
+#define	EXTRA_RELITEMS	14
+
+/* move the relocation value from .dynsym to .got */
+void patch_dynsym_undef(TCCState *s1, Section *s)
+{
+    uint32_t *gotd = (void *)s1->got->data;
+    ElfW(Sym) *sym, *sym_end;
+
+    gotd += 3;	// dummy entries in .got
+    /* relocate symbols in .dynsym */
+    sym_end = (ElfW(Sym) *)(s->data + s->data_offset);
+    for (sym = (ElfW(Sym) *)s->data + 1; sym < sym_end; sym++) {
+	if (sym->st_shndx == SHN_UNDEF) {
+	    *gotd++ = sym->st_value + 6; // XXX 6 is magic ?
+	    sym->st_value = 0;
+	}
+    }
+}
+#else
+#define	HAVE_PHDR	0
+#define	EXTRA_RELITEMS	9
+
+/* zero plt offsets of weak symbols in .dynsym */
+void patch_dynsym_undef(TCCState *s1, Section *s)
+{
+    ElfW(Sym) *sym, *sym_end;
+
+    sym_end = (ElfW(Sym) *)(s->data + s->data_offset);
+    for (sym = (ElfW(Sym) *)s->data + 1; sym < sym_end; sym++)
+        if (sym->st_shndx == SHN_UNDEF && ELFW(ST_BIND)(sym->st_info) == STB_WEAK)
+            sym->st_value = 0;
+}
+#endif
+
+ST_FUNC void fill_got_entry(TCCState *s1, ElfW_Rel *rel)
+{
+	int sym_index = ELFW(R_SYM) (rel->r_info);
 	ElfW(Sym) *sym = &((ElfW(Sym) *) symtab_section->data)[sym_index];
 	unsigned long offset;
 
@@ -1581,6 +3324,551 @@ ST_FUNC void fill_got(TCCState *s1)
 }
 
 
+/* record the parts of the sections added since the previous call as
+   coming from the input 'name', or forget them if 'name' is NULL */
+ST_FUNC void map_input(TCCState *s1, const char *name, const char *why)
+{
+    MapFile *mf;
+    MapInput *mi;
+    Section *s;
+    unsigned long offset;
+    int i, len;
+
+    mf = NULL;
+    if (name) {
+        len = strlen(name) + 1;
+        mf = tcc_malloc(sizeof(MapFile) + len + (why ? strlen(why) + 1 : 0));
+        strcpy(mf->name, name);
+        mf->why = why ? strcpy(mf->name + len, why) : NULL;
+        dynarray_add((void ***)&s1->map_files, &s1->nb_map_files, mf);
+    }
+    s1->map_offsets = tcc_realloc(s1->map_offsets,
+                                  s1->nb_sections * sizeof(unsigned long));
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        offset = i < s1->nb_map_offsets ? s1->map_offsets[i] : 0;
+        if (mf && (s->sh_flags & SHF_ALLOC) && s->data_offset > offset) {
+            mi = tcc_malloc(sizeof(MapInput));
+            mi->s = s;
+            mi->offset = offset;
+            mi->size = s->data_offset - offset;
+            mi->file = mf;
+            dynarray_add((void ***)&s1->map_inputs, &s1->nb_map_inputs, mi);
+        }
+        s1->map_offsets[i] = s->data_offset;
+    }
+    s1->nb_map_offsets = s1->nb_sections;
+}
+
+#ifdef TCC_TARGET_AVR
+/* the bytes of flash, SRAM and EEPROM used by the program */
+static void avr_memory_usage(TCCState *s1, ElfW(Phdr) *phdr, int phnum,
+                             unsigned long *used)
+{
+    int i;
+
+    used[0] = used[1] = used[2] = 0;
+    for(i = 0; i < phnum; i++) {
+        if (phdr[i].p_type != PT_LOAD)
+            continue;
+        used[0] += phdr[i].p_filesz;
+        if (phdr[i].p_vaddr >= AVR_DATA_VMA)
+            used[1] += phdr[i].p_memsz;
+    }
+    for(i = 1; i < s1->nb_sections; i++)
+        if (avr_is_eeprom(s1->sections[i]))
+            used[2] += s1->sections[i]->data_offset;
+}
+
+/* fail if the program does not fit in the memories of the device */
+static int avr_check_memory(TCCState *s1, ElfW(Phdr) *phdr, int phnum)
+{
+    const AVRDevice *d = s1->avr_device;
+    unsigned long used[3];
+
+    avr_memory_usage(s1, phdr, phnum, used);
+    if (used[0] > d->flash_size)
+        tcc_error_noabort("program of %lu bytes too large for the %u bytes of flash of %s",
+                          used[0], d->flash_size, d->name);
+    if (used[1] > d->ram_size)
+        tcc_error_noabort("data of %lu bytes too large for the %u bytes of SRAM of %s",
+                          used[1], d->ram_size, d->name);
+    if (used[2] > d->eeprom_size)
+        tcc_error_noabort("EEPROM data of %lu bytes too large for the %u bytes of EEPROM of %s",
+                          used[2], d->eeprom_size, d->name);
+    return s1->nb_errors ? -1 : 0;
+}
+#endif
+
+/* a function of the stack analysis */
+typedef struct StackFunc {
+    addr_t addr;
+    const char *name;
+    unsigned long frame, saved; /* locals, pushed bytes */
+    unsigned long depth; /* worst case with the callees */
+    int *calls; /* index of each callee, -1 if indirect, -2 if unknown */
+    int nb_calls;
+    int flags;
+    int next; /* callee on the deepest path, -1 if none */
+    int state; /* 0: not seen, 1: in progress, 2: done */
+} StackFunc;
+
+#define SF_RECURSIVE 1 /* calls a function being evaluated */
+#define SF_INDIRECT  2 /* calls through a pointer */
+#define SF_UNKNOWN   4 /* calls a function without stack information */
+#define SF_PARTIAL   8 /* 'depth' is a lower bound */
+
+typedef struct StackUsage {
+    StackFunc *funcs;
+    int nb_funcs;
+    int entry; /* the program entry, -1 if none */
+    unsigned long isr_depth; /* worst case of the interrupts */
+    int isr; /* the deepest interrupt, -1 if none */
+    int partial; /* the worst case is a lower bound */
+} StackUsage;
+
+static int stack_func_cmp(const void *a, const void *b)
+{
+    const StackFunc *f1 = a, *f2 = b;
+
+    if (f1->addr != f2->addr)
+        return f1->addr < f2->addr ? -1 : 1;
+    return 0;
+}
+
+static int stack_func_find(StackUsage *su, addr_t addr)
+{
+    int a = 0, b = su->nb_funcs - 1, m;
+
+    while (a <= b) {
+        m = (a + b) >> 1;
+        if (su->funcs[m].addr == addr)
+            return m;
+        if (su->funcs[m].addr < addr)
+            a = m + 1;
+        else
+            b = m - 1;
+    }
+    return -1;
+}
+
+/* return true if the symbol is defined in the program */
+static int is_live_sym(TCCState *s1, ElfW(Sym) *sym)
+{
+    return sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE &&
+        (s1->sections[sym->st_shndx]->sh_flags & SHF_ALLOC);
+}
+
+static void stack_depth(StackUsage *su, int i)
+{
+    StackFunc *f = &su->funcs[i], *c;
+    int j, k;
+
+    f->state = 1;
+    f->depth = f->frame + f->saved;
+    f->next = -1;
+    for(j = 0; j < f->nb_calls; j++) {
+        k = f->calls[j];
+        if (k == -1) {
+            f->flags |= SF_INDIRECT | SF_PARTIAL;
+            continue;
+        }
+        if (k == -2) {
+            f->flags |= SF_UNKNOWN | SF_PARTIAL;
+            continue;
+        }
+        c = &su->funcs[k];
+        if (c->state == 1) {
+            f->flags |= SF_RECURSIVE | SF_PARTIAL;
+            continue;
+        }
+        if (c->state == 0)
+            stack_depth(su, k);
+        if (c->flags & SF_PARTIAL)
+            f->flags |= SF_PARTIAL;
+        if (f->frame + f->saved + c->depth > f->depth) {
+            f->depth = f->frame + f->saved + c->depth;
+            f->next = k;
+        }
+    }
+    f->state = 2;
+}
+
+/* compute from the .stack_usage records of -fstack-usage the worst
+   case stack of each function with the functions it calls, of the
+   program entry and of the interrupts. Return 0 if there is no record */
+static int stack_usage(TCCState *s1, StackUsage *su)
+{
+    Section *s, *sr;
+    ElfW(Sym) *syms, *sym;
+    ElfW_Rel *rel, *rel_end;
+    StackFunc *f;
+    int *relsym, i, j, k, n, nb_words, max;
+    unsigned long offset, isr_sum, isr_max;
+    static const char * const entries[] = { "_start", "main" };
+
+    memset(su, 0, sizeof(*su));
+    su->entry = su->isr = -1;
+    s = NULL;
+    for(i = 1; i < s1->nb_sections; i++)
+        if (!strcmp(s1->sections[i]->name, ".stack_usage"))
+            s = s1->sections[i];
+    if (!s || !s->data_offset)
+        return 0;
+
+    /* the symbol of each relocated word */
+    syms = (ElfW(Sym) *)symtab_section->data;
+    nb_words = s->data_offset / 4;
+    relsym = tcc_mallocz((nb_words + 1) * sizeof(int));
+    sr = s->reloc;
+    if (sr) {
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end; rel++)
+            if (rel->r_offset / 4 < nb_words)
+                relsym[rel->r_offset / 4] = ELFW(R_SYM)(rel->r_info);
+    }
+
+    /* the functions of the program */
+    max = 0;
+    for(offset = 0; offset + 16 <= s->data_offset; offset += 16 + 4 * n) {
+        n = get32(s->data + offset + 12);
+        sym = &syms[relsym[offset / 4]];
+        if (!relsym[offset / 4] || !is_live_sym(s1, sym))
+            continue;
+        if (su->nb_funcs >= max) {
+            max = max ? max * 2 : 64;
+            su->funcs = tcc_realloc(su->funcs, max * sizeof(StackFunc));
+        }
+        f = &su->funcs[su->nb_funcs++];
+        memset(f, 0, sizeof(StackFunc));
+        f->addr = sym->st_value;
+        f->name = (char *)symtab_section->link->data + sym->st_name;
+        f->frame = get32(s->data + offset + 4);
+        f->saved = get32(s->data + offset + 8);
+        /* symbols for now, resolved once the functions are sorted */
+        f->calls = tcc_malloc(n * sizeof(int) + 1);
+        for(j = 0; j < n && (offset + 16) / 4 + j < nb_words; j++)
+            f->calls[f->nb_calls++] = relsym[(offset + 16) / 4 + j];
+    }
+    qsort(su->funcs, su->nb_funcs, sizeof(StackFunc), stack_func_cmp);
+    /* the same code from several objects or folded by --icf */
+    for(i = j = 0; i < su->nb_funcs; i++) {
+        if (j > 0 && su->funcs[j - 1].addr == su->funcs[i].addr) {
+            tcc_free(su->funcs[i].calls);
+            continue;
+        }
+        su->funcs[j++] = su->funcs[i];
+    }
+    su->nb_funcs = j;
+    for(i = 0; i < su->nb_funcs; i++) {
+        f = &su->funcs[i];
+        for(j = 0; j < f->nb_calls; j++) {
+            k = f->calls[j];
+            if (!k) {
+                f->calls[j] = -1;
+            } else {
+                sym = &syms[k];
+                k = is_live_sym(s1, sym) ? stack_func_find(su, sym->st_value) : -1;
+                f->calls[j] = k < 0 ? -2 : k;
+            }
+        }
+    }
+    tcc_free(relsym);
+
+    for(i = 0; i < su->nb_funcs; i++)
+        if (!su->funcs[i].state)
+            stack_depth(su, i);
+
+    /* the entry, then the interrupts which can come on top of it */
+    for(i = 0; i < countof(entries) && su->entry < 0; i++) {
+        k = find_elf_sym(symtab_section, entries[i]);
+        if (k && is_live_sym(s1, &syms[k]))
+            su->entry = stack_func_find(su, syms[k].st_value);
+    }
+    isr_sum = isr_max = 0;
+    for(i = 0; i < su->nb_funcs; i++) {
+        f = &su->funcs[i];
+        if (strncmp(f->name, "__vector_", 9))
+            continue;
+        isr_sum += f->depth;
+        if (f->flags & SF_PARTIAL)
+            su->partial = 1;
+        if (su->isr < 0 || f->depth > isr_max) {
+            isr_max = f->depth;
+            su->isr = i;
+        }
+    }
+    su->isr_depth = s1->stack_isr_nesting ? isr_sum : isr_max;
+    if (su->entry >= 0 && (su->funcs[su->entry].flags & SF_PARTIAL))
+        su->partial = 1;
+    return 1;
+}
+
+static void stack_usage_free(StackUsage *su)
+{
+    int i;
+
+    for(i = 0; i < su->nb_funcs; i++)
+        tcc_free(su->funcs[i].calls);
+    tcc_free(su->funcs);
+}
+
+static void stack_print_path(FILE *f, StackUsage *su, int i)
+{
+    StackFunc *sf = &su->funcs[i];
+
+    fprintf(f, "\nDeepest path from %s, %lu%s bytes:\n", sf->name,
+            sf->depth, sf->flags & SF_PARTIAL ? "+" : "");
+    for(; i >= 0; i = su->funcs[i].next) {
+        sf = &su->funcs[i];
+        fprintf(f, "    %-24s %6lu\n", sf->name, sf->frame + sf->saved);
+    }
+}
+
+static int stack_depth_cmp(const void *a, const void *b)
+{
+    const StackFunc *f1 = *(StackFunc **)a, *f2 = *(StackFunc **)b;
+
+    if (f1->depth != f2->depth)
+        return f1->depth > f2->depth ? -1 : 1;
+    return strcmp(f1->name, f2->name);
+}
+
+/* print the stack analysis: each function, deepest first, then the
+   deepest paths and the worst case of the program */
+static void stack_usage_print(FILE *f, StackUsage *su, int nesting)
+{
+    StackFunc **sorted, *sf;
+    int i;
+
+    fprintf(f, "Stack usage (+: lower bound)\n\n");
+    fprintf(f, "%-24s %6s %6s %10s\n", "Function", "Frame", "Saved", "Worst case");
+    sorted = tcc_malloc(su->nb_funcs * sizeof(StackFunc *) + 1);
+    for(i = 0; i < su->nb_funcs; i++)
+        sorted[i] = &su->funcs[i];
+    qsort(sorted, su->nb_funcs, sizeof(StackFunc *), stack_depth_cmp);
+    for(i = 0; i < su->nb_funcs; i++) {
+        sf = sorted[i];
+        fprintf(f, "%-24s %6lu %6lu %9lu%c%s%s%s\n", sf->name, sf->frame,
+                sf->saved, sf->depth, sf->flags & SF_PARTIAL ? '+' : ' ',
+                sf->flags & SF_RECURSIVE ? " recursion" : "",
+                sf->flags & SF_INDIRECT ? " indirect call" : "",
+                sf->flags & SF_UNKNOWN ? " unknown callee" : "");
+    }
+    tcc_free(sorted);
+    if (su->entry >= 0)
+        stack_print_path(f, su, su->entry);
+    if (su->isr >= 0)
+        stack_print_path(f, su, su->isr);
+    if (su->entry >= 0) {
+        sf = &su->funcs[su->entry];
+        fprintf(f, "\nWorst case: %lu%s bytes from %s", sf->depth,
+                sf->flags & SF_PARTIAL ? "+" : "", sf->name);
+        if (su->isr >= 0 && nesting)
+            fprintf(f, " + %lu bytes of the nested interrupts", su->isr_depth);
+        else if (su->isr >= 0)
+            fprintf(f, " + %lu bytes of %s", su->isr_depth,
+                    su->funcs[su->isr].name);
+        fprintf(f, " = %lu%s bytes\n", sf->depth + su->isr_depth,
+                su->partial ? "+" : "");
+    }
+}
+
+static int map_section_cmp(const void *a, const void *b)
+{
+    Section *s1 = *(Section **)a, *s2 = *(Section **)b;
+
+    if (s1->sh_addr != s2->sh_addr)
+        return s1->sh_addr < s2->sh_addr ? -1 : 1;
+    return s1->sh_num - s2->sh_num;
+}
+
+static int map_sym_cmp(const void *a, const void *b)
+{
+    ElfW(Sym) *s1 = *(ElfW(Sym) **)a, *s2 = *(ElfW(Sym) **)b;
+
+    if (s1->st_value != s2->st_value)
+        return s1->st_value < s2->st_value ? -1 : 1;
+    return s1 - s2;
+}
+
+/* return true if the symbol is listed in the map file: the functions
+   and objects, but not the anonymous symbols of the compiler */
+static int is_map_sym(TCCState *s1, ElfW(Sym) *sym)
+{
+    const char *name = (char *)symtab_section->link->data + sym->st_name;
+    int type = ELFW(ST_TYPE)(sym->st_info);
+
+    return sym->st_shndx != SHN_UNDEF && sym->st_shndx < SHN_LORESERVE &&
+        (type == STT_FUNC || type == STT_OBJECT || type == STT_NOTYPE) &&
+        name[0] && strncmp(name, "L.", 2) &&
+        (s1->sections[sym->st_shndx]->sh_flags & SHF_ALLOC);
+}
+
+static void map_print_input(FILE *f, MapInput *mi)
+{
+    fprintf(f, "%16s 0x%08lx %#10lx %s\n", "",
+            (unsigned long)(mi->s->sh_addr + mi->offset), mi->size,
+            mi->file->name);
+}
+
+/* output the map file: the archive members loaded and why, the
+   discarded sections, the memory used, the address and size of each
+   section, input part and symbol, and the stack analysis if any */
+static int tcc_output_map(TCCState *s1, ElfW(Phdr) *phdr, int phnum,
+                          StackUsage *su)
+{
+    FILE *f;
+    Section **secs, *s;
+    MapInput *mi;
+    ElfW(Sym) *sym, *sym_end, **syms;
+    int i, j, k, nb_secs, nb_syms;
+#ifdef TCC_TARGET_AVR
+    static const char * const regions[3] = { "flash", "sram", "eeprom" };
+    const AVRDevice *d = s1->avr_device;
+    unsigned long used[3], size[3];
+#endif
+
+    f = fopen(s1->mapfile, "w");
+    if (!f) {
+        tcc_error_noabort("could not write '%s'", s1->mapfile);
+        return -1;
+    }
+    if (s1->verbose)
+        printf("<- %s\n", s1->mapfile);
+
+    fprintf(f, "Archive member included to satisfy reference by file (symbol)\n\n");
+    for(i = 0; i < s1->nb_map_files; i++)
+        if (s1->map_files[i]->why)
+            fprintf(f, "%s\n%16s %s\n", s1->map_files[i]->name, "",
+                    s1->map_files[i]->why);
+
+    fprintf(f, "\nDiscarded input sections\n\n");
+    for(i = 0; i < s1->nb_map_inputs; i++) {
+        mi = s1->map_inputs[i];
+        if (!(mi->s->sh_flags & SHF_ALLOC))
+            fprintf(f, " %-15s 0x%08lx %#10lx %s\n", mi->s->name,
+                    mi->offset, mi->size, mi->file->name);
+    }
+
+    fprintf(f, "\nMemory usage\n\n");
+#ifdef TCC_TARGET_AVR
+    avr_memory_usage(s1, phdr, phnum, used);
+    size[0] = d->flash_size;
+    size[1] = d->ram_size;
+    size[2] = d->eeprom_size;
+    fprintf(f, "%-16s %10s %10s %7s\n", "Region", "Used", "Size", "Use%");
+    for(i = 0; i < 3; i++)
+        fprintf(f, "%-16s %10lu %10lu %6.1f%%%s\n", regions[i], used[i],
+                size[i], size[i] ? 100.0 * used[i] / size[i] : 0.0,
+                used[i] > size[i] ? " overflow" : "");
+#else
+    fprintf(f, "%-16s %-18s %10s %10s\n",
+            "Segment", "Address", "File size", "Mem size");
+    for(i = 0; i < phnum; i++) {
+        if (phdr[i].p_type != PT_LOAD)
+            continue;
+        fprintf(f, "%c%c%c%13s 0x%016llx %10lu %10lu\n",
+                phdr[i].p_flags & PF_R ? 'R' : ' ',
+                phdr[i].p_flags & PF_W ? 'W' : ' ',
+                phdr[i].p_flags & PF_X ? 'X' : ' ', "",
+                (unsigned long long)phdr[i].p_vaddr,
+                (unsigned long)phdr[i].p_filesz,
+                (unsigned long)phdr[i].p_memsz);
+    }
+#endif
+
+    /* the sections in address order, each with its input parts and
+       its symbols */
+    fprintf(f, "\nMemory map\n\n");
+    secs = tcc_malloc(s1->nb_sections * sizeof(Section *));
+    nb_secs = 0;
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if ((s->sh_flags & SHF_ALLOC) && s->sh_size)
+            secs[nb_secs++] = s;
+    }
+    qsort(secs, nb_secs, sizeof(Section *), map_section_cmp);
+    sym_end = (ElfW(Sym) *)(symtab_section->data + symtab_section->data_offset);
+    syms = tcc_malloc((sym_end - (ElfW(Sym) *)symtab_section->data) *
+                      sizeof(ElfW(Sym) *));
+    nb_syms = 0;
+    for(sym = (ElfW(Sym) *)symtab_section->data + 1; sym < sym_end; sym++)
+        if (is_map_sym(s1, sym))
+            syms[nb_syms++] = sym;
+    qsort(syms, nb_syms, sizeof(ElfW(Sym) *), map_sym_cmp);
+
+    for(i = 0; i < nb_secs; i++) {
+        s = secs[i];
+        fprintf(f, "%-16s 0x%08lx %#10lx\n", s->name,
+                (unsigned long)s->sh_addr, (unsigned long)s->sh_size);
+        k = 0;
+        for(j = 0; j < nb_syms; j++) {
+            sym = syms[j];
+            if (s1->sections[sym->st_shndx] != s)
+                continue;
+            for(; k < s1->nb_map_inputs; k++) {
+                mi = s1->map_inputs[k];
+                if (mi->s != s)
+                    continue;
+                if (mi->s->sh_addr + mi->offset > sym->st_value)
+                    break;
+                map_print_input(f, mi);
+            }
+            fprintf(f, "%16s 0x%08lx %#10lx     %s\n", "",
+                    (unsigned long)sym->st_value, (unsigned long)sym->st_size,
+                    (char *)symtab_section->link->data + sym->st_name);
+        }
+        for(; k < s1->nb_map_inputs; k++)
+            if (s1->map_inputs[k]->s == s)
+                map_print_input(f, s1->map_inputs[k]);
+    }
+    tcc_free(syms);
+    tcc_free(secs);
+    if (su) {
+        fprintf(f, "\n");
+        stack_usage_print(f, su, s1->stack_isr_nesting);
+    }
+    fclose(f);
+    return 0;
+}
+
+/* output the map file and the stack analysis, and check that the
+   program fits in the memories of the device */
+static int tcc_output_reports(TCCState *s1, ElfW(Phdr) *phdr, int phnum)
+{
+    StackUsage su;
+    int has_su, ret;
+#ifdef TCC_TARGET_AVR
+    const AVRDevice *d = s1->avr_device;
+    unsigned long used[3], stack;
+#endif
+
+    ret = 0;
+    has_su = stack_usage(s1, &su);
+    if (has_su && s1->print_stack_usage)
+        stack_usage_print(stdout, &su, s1->stack_isr_nesting);
+    /* the map is also useful when the program does not fit */
+    if (s1->mapfile)
+        ret = tcc_output_map(s1, phdr, phnum, has_su ? &su : NULL);
+#ifdef TCC_TARGET_AVR
+    if (phnum > 0 && ret == 0) {
+        ret = avr_check_memory(s1, phdr, phnum);
+        avr_memory_usage(s1, phdr, phnum, used);
+        if (has_su && su.entry >= 0) {
+            stack = su.funcs[su.entry].depth + su.isr_depth;
+            if (ret == 0 && used[1] + stack > d->ram_size)
+                tcc_warning("stack of up to %lu%s bytes may overflow the %lu bytes of SRAM left by the data",
+                            stack, su.partial ? "+" : "",
+                            d->ram_size - used[1]);
+        }
+    }
+#endif
+    if (has_su)
+        stack_usage_free(&su);
+    return ret;
+}
+
 /* output an ELF file */
 /* XXX: suppress unneeded sections */
 static int elf_output_file(TCCState *s1, const char *filename)
@@ -1600,6 +3888,9 @@ static int elf_output_file(TCCState *s1, const char *filename)
     ElfW(Sym) *sym;
     int type, file_type;
     addr_t rel_addr, rel_size;
+#ifdef TCC_TARGET_AVR
+    Section *flash_end;
+#endif
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
     addr_t bss_addr, bss_size;
 #endif
@@ -1623,6 +3914,20 @@ static int elf_output_file(TCCState *s1, const char *filename)
 
         tcc_add_linker_symbols(s1);
 
+        if (s1->gc_sections && file_type == TCC_OUTPUT_EXE && !s1->rdynamic)
+            gc_sections(s1);
+        if (s1->icf && file_type == TCC_OUTPUT_EXE && !s1->rdynamic)
+            icf_sections(s1);
+        if (s1->call_graph_sort && file_type == TCC_OUTPUT_EXE)
+            sort_call_graph(s1);
+#ifdef TCC_TARGET_AVR
+        if (file_type == TCC_OUTPUT_EXE)
+            avr_startup(s1);
+        if ((s1->avr_relax || s1->optimize_size) &&
+            file_type == TCC_OUTPUT_EXE)
+            avr_relax(s1);
+#endif
+
         if (!s1->static_link) {
             const char *name;
             int sym_index, index;
@@ -1945,6 +4250,19 @@ static int elf_output_file(TCCState *s1, const char *filename)
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
         bss_addr = bss_size = 0;
+#endif
+#ifdef TCC_TARGET_AVR
+        /* for an incremental image, the initial values of the data are
+           at the end of the flash, where a change of the code size does
+           not move them */
+        flash_end = NULL;
+        if (s1->flash_diff && s1->output_format == TCC_OUTPUT_FORMAT_IHEX) {
+            for(i = 1; i < s1->nb_sections; i++) {
+                s = s1->sections[i];
+                if (!strcmp(strsec->data + s->sh_name, ".data.load"))
+                    flash_end = s;
+            }
+        }
 #endif
         /* leave one program header for the program interpreter */
         ph = &phdr[0];
@@ -1965,6 +4283,10 @@ static int elf_output_file(TCCState *s1, const char *filename)
             for(k = 0; k < 5; k++) {
                 for(i = 1; i < s1->nb_sections; i++) {
                     s = s1->sections[i];
+#ifdef TCC_TARGET_AVR
+                    if (avr_is_eeprom(s))
+                        continue;
+#endif
                     /* compute if section should be included */
                     if (j == 0) {
                         if ((s->sh_flags & (SHF_ALLOC | SHF_WRITE)) != 
@@ -1989,6 +4311,12 @@ static int elf_output_file(TCCState *s1, const char *filename)
                     } else if (s->sh_type == SHT_NOBITS) {
                         if (k != 4)
                             continue;
+#ifdef TCC_TARGET_AVR
+                    } else if (s == flash_end) {
+                        /* laid out last */
+                        if (k != 4)
+                            continue;
+#endif
                     } else {
                         if (k != 3)
                             continue;
@@ -2000,6 +4328,13 @@ static int elf_output_file(TCCState *s1, const char *filename)
                     addr = (addr + s->sh_addralign - 1) & 
                         ~(s->sh_addralign - 1);
                     file_offset += (int) ( addr - tmp );
+#ifdef TCC_TARGET_AVR
+                    /* only the address moves, the Intel HEX output
+                       does not use the file offsets */
+                    if (s == flash_end &&
+                        addr + s->sh_size <= s1->avr_device->flash_size)
+                        addr = (s1->avr_device->flash_size - s->sh_size) & -2;
+#endif
                     s->sh_offset = file_offset;
                     s->sh_addr = addr;
                     
@@ -2033,8 +4368,21 @@ static int elf_output_file(TCCState *s1, const char *filename)
             }
             ph->p_filesz = file_offset - ph->p_offset;
             ph->p_memsz = addr - ph->p_vaddr;
+#ifdef TCC_TARGET_AVR
+            if (j == 1) {
+                /* the initial values of the data are stored in flash
+                   after the text */
+                ph->p_paddr = ph[-1].p_paddr + ph[-1].p_filesz;
+            }
+#endif
             ph++;
             if (j == 0) {
+#ifdef TCC_TARGET_AVR
+                /* the data run in SRAM */
+                addr = AVR_DATA_VMA + s1->avr_device->ram_start;
+                ph->p_vaddr = addr;
+                ph->p_paddr = addr;
+#else
                 if (s1->output_format == TCC_OUTPUT_FORMAT_ELF) {
                     /* if in the middle of a page, we duplicate the page in
                        memory so that one copy is RX and the other is RW */
@@ -2045,6 +4393,7 @@ static int elf_output_file(TCCState *s1, const char *filename)
                     file_offset = (file_offset + s1->section_align - 1) &
                         ~(s1->section_align - 1);
                 }
+#endif
             }
         }
 
@@ -2197,6 +4546,11 @@ static int elf_output_file(TCCState *s1, const char *filename)
     /* all other sections come after */
     for(i = 1; i < s1->nb_sections; i++) {
         s = s1->sections[i];
+#ifdef TCC_TARGET_AVR
+        if (phnum > 0 && avr_is_eeprom(s))
+            s->sh_addr = AVR_EEPROM_VMA;
+        else
+#endif
         if (phnum > 0 && (s->sh_flags & SHF_ALLOC))
             continue;
         section_order[sh_order_index++] = i;
@@ -2242,6 +4596,9 @@ static int elf_output_file(TCCState *s1, const char *filename)
             ehdr.e_entry = get_elf_sym_addr(s1, "_start", 1);
         else
             ehdr.e_entry = text_section->sh_addr; /* XXX: is it correct ? */
+
+        if (tcc_output_reports(s1, phdr, phnum) < 0)
+            goto fail;
     }
     if (file_type == TCC_OUTPUT_EXE && s1->static_link)
         fill_got(s1);
@@ -2261,6 +4618,9 @@ static int elf_output_file(TCCState *s1, const char *filename)
     if (s1->verbose)
         printf("<- %s\n", filename);
 
+    if (s1->flash_diff && s1->output_format != TCC_OUTPUT_FORMAT_IHEX)
+        tcc_warning("-Wl,--flash-diff ignored without -Wl,--oformat=ihex");
+    ret = 0;
 #ifdef TCC_TARGET_COFF
     if (s1->output_format == TCC_OUTPUT_FORMAT_COFF) {
         tcc_output_coff(s1, f);
@@ -2290,6 +4650,9 @@ static int elf_output_file(TCCState *s1, const char *filename)
 #else
         ehdr.e_ident[EI_OSABI] = ELFOSABI_ARM;
 #endif
+#endif
+#ifdef TCC_TARGET_AVR
+        ehdr.e_flags = s1->avr_device->arch & EF_AVR_MACH;
 #endif
         switch(file_type) {
         default:
@@ -2355,12 +4718,17 @@ static int elf_output_file(TCCState *s1, const char *filename)
             }
             fwrite(sh, 1, sizeof(ElfW(Shdr)), f);
         }
+    } else if (s1->output_format == TCC_OUTPUT_FORMAT_IHEX) {
+        ret = tcc_output_ihex(s1, f, filename, section_order, phdr, phnum);
     } else {
-        tcc_output_binary(s1, f, section_order);
+        tcc_output_binary(s1, f, section_order, phdr, phnum);
     }
     fclose(f);
-
-    ret = 0;
+#ifdef TCC_TARGET_AVR
+    if (ret == 0 && s1->output_format != TCC_OUTPUT_FORMAT_ELF &&
+        file_type == TCC_OUTPUT_EXE)
+        ret = avr_output_eeprom(s1, filename);
+#endif
  the_end:
     tcc_free(s1->symtab_to_dynsym);
     tcc_free(section_order);
@@ -2398,8 +4766,25 @@ typedef struct SectionMergeInfo {
     unsigned long offset;  /* offset of the new section in the existing section */
     uint8_t new_section;       /* true if section 's' was added */
     uint8_t link_once;         /* true if link once section */
+    unsigned long *str_map;    /* merged strings: new offset of each byte */
+    unsigned long size;        /* size of the section in the object */
 } SectionMergeInfo;
 
+/* return true if the strings of the section of the object are merged
+   with the ones in memory. The addends of the relocations are needed to
+   find the strings, so only RELA targets can do it */
+static int is_merge_str(ElfW(Shdr) *sh, unsigned char *data)
+{
+#if defined(TCC_TARGET_X86_64) || defined(TCC_TARGET_AVR)
+    return (sh->sh_flags & (SHF_MERGE | SHF_STRINGS)) ==
+        (SHF_MERGE | SHF_STRINGS) && sh->sh_entsize == 1 &&
+        sh->sh_type == SHT_PROGBITS && sh->sh_size > 0 &&
+        data[sh->sh_size - 1] == 0;
+#else
+    return 0;
+#endif
+}
+
 /* load an object file and merge it with current files */
 /* XXX: handle correctly stab (debug) info */
 ST_FUNC int tcc_load_object_file(TCCState *s1, 
@@ -2407,7 +4792,7 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
 { 
     ElfW(Ehdr) ehdr;
     ElfW(Shdr) *shdr, *sh;
-    int size, i, j, offset, offseti, nb_syms, sym_index, ret;
+    int size, i, j, k, offset, offseti, nb_syms, sym_index, ret;
     unsigned char *strsec, *strtab;
     int *old_to_new_syms;
     char *sh_name, *name;
@@ -2544,6 +4929,7 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
     no_align:
         sm_table[i].offset = offset;
         sm_table[i].s = s;
+        sm_table[i].size = sh->sh_size;
         /* concatenate sections */
         size = sh->sh_size;
         if (sh->sh_type != SHT_NOBITS) {
@@ -2551,6 +4937,26 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
             lseek(fd, file_offset + sh->sh_offset, SEEK_SET);
             ptr = section_ptr_add(s, size);
             read(fd, ptr, size);
+            if (is_merge_str(sh, ptr)) {
+                /* add the strings one by one instead */
+                unsigned char *str = tcc_malloc(size);
+                unsigned long *map, o = 0;
+                memcpy(str, ptr, size);
+                s->data_offset = offset;
+                memset(ptr, 0, size);
+                map = tcc_malloc((size + 1) * sizeof(unsigned long));
+                for(j = 0; j < size; j = k) {
+                    for(k = j; str[k]; k++);
+                    k++;
+                    o = put_merge_str(s, str + j, k - j);
+                    for(; j < k; j++, o++)
+                        map[j] = o;
+                }
+                map[size] = o;
+                sm_table[i].str_map = map;
+                sm_table[i].offset = 0;
+                tcc_free(str);
+            }
         } else {
             s->data_offset += size;
         }
@@ -2584,6 +4990,34 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
             s1->sections[s->sh_info]->reloc = s;
         }
     }
+#if defined(TCC_TARGET_X86_64) || defined(TCC_TARGET_AVR)
+    /* the relocations to merged strings, through a symbol of value v,
+       address v + addend: translate this address */
+    for(i = 1; i < ehdr.e_shnum; i++) {
+        s = sm_table[i].s;
+        if (!s || s->sh_type != SHT_RELX)
+            continue;
+        rel_end = (ElfW_Rel *)(s->data + s->data_offset);
+        for(rel = (ElfW_Rel *)(s->data + sm_table[i].offset);
+            rel < rel_end; rel++) {
+            unsigned long v, a, size;
+            sym_index = ELFW(R_SYM)(rel->r_info);
+            if (sym_index >= nb_syms)
+                continue;
+            sym = &symtab[sym_index];
+            if (sym->st_shndx == SHN_UNDEF ||
+                sym->st_shndx >= SHN_LORESERVE ||
+                !sm_table[sym->st_shndx].str_map)
+                continue;
+            sm = &sm_table[sym->st_shndx];
+            size = sm->size;
+            v = sym->st_value < size ? sym->st_value : size;
+            a = v + rel->r_addend < size ? v + rel->r_addend : size;
+            rel->r_addend = sm->str_map[a] - sm->str_map[v];
+        }
+    }
+#endif
+
     sm = sm_table;
 
     /* resolve symbols */
@@ -2612,7 +5046,11 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
             /* convert section number */
             sym->st_shndx = sm->s->sh_num;
             /* offset value */
-            sym->st_value += sm->offset;
+            if (sm->str_map)
+                sym->st_value = sm->str_map[sym->st_value < sm->size ?
+                                            sym->st_value : sm->size];
+            else
+                sym->st_value += sm->offset;
         }
         /* add symbol */
         name = strtab + sym->st_name;
@@ -2684,6 +5122,8 @@ ST_FUNC int tcc_load_object_file(TCCState *s1,
     tcc_free(symtab);
     tcc_free(strtab);
     tcc_free(old_to_new_syms);
+    for(i = 0; i < ehdr.e_shnum; i++)
+        tcc_free(sm_table[i].str_map);
     tcc_free(sm_table);
     tcc_free(strsec);
     tcc_free(shdr);
@@ -2706,6 +5146,61 @@ static int get_be32(const uint8_t *b)
 }
 
 /* load only the objects which resolve undefined symbols */
+/* record an archive member for the map file */
+static void map_member(TCCState *s1, ArchiveHeader *hdr, const char *why)
+{
+    char buf[1024], name[sizeof(hdr->ar_name) + 1];
+    int i;
+
+    memcpy(name, hdr->ar_name, sizeof(hdr->ar_name));
+    for(i = sizeof(hdr->ar_name) - 1; i >= 0; i--)
+        if (name[i] != ' ' && name[i] != '/')
+            break;
+    name[i + 1] = '\0';
+    pstrcpy(buf, sizeof(buf), file->filename);
+    pstrcat(buf, sizeof(buf), "(");
+    pstrcat(buf, sizeof(buf), name);
+    pstrcat(buf, sizeof(buf), ")");
+    map_input(s1, buf, why);
+}
+
+/* describe for the map file the input which refers to the undefined
+   symbol 'sym_index' */
+static void map_referrer(TCCState *s1, char *buf, int size, int sym_index,
+                         const char *name)
+{
+    Section *s, *sr;
+    ElfW_Rel *rel, *rel_end;
+    MapInput *mi;
+    const char *ref;
+    int i, j;
+
+    ref = NULL;
+    for(i = 1; i < s1->nb_sections && !ref; i++) {
+        sr = s1->sections[i];
+        if (sr->sh_type != SHT_RELX || sr->link != symtab_section)
+            continue;
+        s = s1->sections[sr->sh_info];
+        rel_end = (ElfW_Rel *)(sr->data + sr->data_offset);
+        for(rel = (ElfW_Rel *)sr->data; rel < rel_end && !ref; rel++) {
+            if (ELFW(R_SYM)(rel->r_info) != sym_index)
+                continue;
+            for(j = 0; j < s1->nb_map_inputs; j++) {
+                mi = s1->map_inputs[j];
+                if (mi->s == s && rel->r_offset >= mi->offset &&
+                    rel->r_offset < mi->offset + mi->size) {
+                    ref = mi->file->name;
+                    break;
+                }
+            }
+        }
+    }
+    if (ref)
+        snprintf(buf, size, "%s (%s)", ref, name);
+    else
+        snprintf(buf, size, "(%s)", name);
+}
+
 static int tcc_load_alacarte(TCCState *s1, int fd, int size)
 {
     int i, bound, nsyms, sym_index, off, ret;
@@ -2713,6 +5208,8 @@ static int tcc_load_alacarte(TCCState *s1, int fd, int size)
     const char *ar_names, *p;
     const uint8_t *ar_index;
     ElfW(Sym) *sym;
+    ArchiveHeader hdr;
+    char why[1024];
 
     data = tcc_malloc(size);
     if (read(fd, data, size) != size)
@@ -2733,12 +5230,19 @@ static int tcc_load_alacarte(TCCState *s1, int fd, int size)
                     printf("%5d\t%s\t%08x\n", i, p, sym->st_shndx);
 #endif
                     ++bound;
+                    if (s1->mapfile) {
+                        lseek(fd, off - sizeof(ArchiveHeader), SEEK_SET);
+                        read(fd, &hdr, sizeof(hdr));
+                        map_referrer(s1, why, sizeof(why), sym_index, p);
+                    }
                     lseek(fd, off, SEEK_SET);
                     if(tcc_load_object_file(s1, fd, off) < 0) {
                     fail:
                         ret = -1;
                         goto the_end;
                     }
+                    if (s1->mapfile)
+                        map_member(s1, &hdr, why);
                 }
             }
         }
@@ -2795,6 +5299,8 @@ ST_FUNC int tcc_load_archive(TCCState *s1, int fd)
         } else {
             if (tcc_load_object_file(s1, fd, file_offset) < 0)
                 return -1;
+            if (s1->mapfile)
+                map_member(s1, &hdr, NULL);
         }
         lseek(fd, file_offset + size, SEEK_SET);
     }
@@ -64,6 +64,20 @@ ST_DATA CType func_vt; /* current function return type (used by return instructi
 ST_DATA int func_vc;
 ST_DATA int last_line_num, last_ind, func_ind; /* debug last line number and pc */
 ST_DATA char *funcname;
+static int expect_value; /* c of the last '__builtin_expect(e, c)' closing a test */
+static int nb_cold_calls; /* calls to cold functions generated */
+#define INLINE_MAX_TOKENS 40 /* larger bodies need always_inline */
+#define INLINE_MAX_DEPTH 8 /* nesting of the inlined calls */
+static int inline_depth; /* nesting of the inlined calls */
+static Sym *inline_bottom; /* local scope of the innermost inlined call */
+#ifdef TCC_TARGET_AVR
+static int *func_budgets; /* pairs (token, N) of max_cycles(N) functions */
+static int nb_func_budgets;
+static int *loop_bound; /* __builtin_loop_bound() of the innermost loop */
+static int *addr_taken; /* frame offsets of the locals given to '&' */
+static int nb_addr_taken;
+static int func_line; /* line of the declarator of the function */
+#endif
 
 ST_DATA CType char_pointer_type, func_old_type, int_type, size_type;
 
@@ -77,6 +91,7 @@ static void parse_expr_type(CType *type);
 static void decl_initializer(CType *type, Section *sec, unsigned long c, int first, int size_only);
 static void block(int *bsym, int *csym, int *case_sym, int *def_sym, int case_reg, int is_expr);
 static void decl_initializer_alloc(CType *type, AttributeDef *ad, int r, int has_init, int v, char *asm_label, int scope);
+static void merge_str_literal(void);
 static int decl0(int l, int is_for_loop_init);
 static void expr_eq(void);
 static void unary_type(CType *type);
@@ -91,6 +106,15 @@ ST_INLN int is_float(int t)
     return bt == VT_LDOUBLE || bt == VT_DOUBLE || bt == VT_FLOAT;
 }
 
+#ifdef TCC_TARGET_AVR
+static inline int is_fixed(int t)
+{
+    int bt;
+    bt = t & VT_BTYPE;
+    return bt == VT_FRACT || bt == VT_ACCUM;
+}
+#endif
+
 /* we use our own 'finite' function to avoid potential problems with
    non standard math libs */
 /* XXX: endianness dependent */
@@ -315,6 +339,9 @@ static void vsetc(CType *type, int r, CValue *vc)
     vtop->type = *type;
     vtop->r = r;
     vtop->r2 = VT_CONST;
+#ifdef TCC_TARGET_AVR
+    vtop->r3 = vtop->r4 = vtop->r5 = vtop->r6 = vtop->r7 = vtop->r8 = VT_CONST;
+#endif
     vtop->c = *vc;
 }
 
@@ -486,6 +513,21 @@ static void vdup(void)
     vpushv(vtop);
 }
 
+#ifdef TCC_TARGET_AVR
+/* AVR values use one register per byte: r, r2 ... r8 */
+#define SV_REG(sv, i) ((&(sv)->r)[i])
+
+/* return true if the value 'p' uses the register 'r' */
+static int sv_uses_reg(SValue *p, int r)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+        if ((SV_REG(p, i) & VT_VALMASK) == r)
+            return 1;
+    return 0;
+}
+#endif
+
 /* save r to the memory stack, and mark it as being free */
 ST_FUNC void save_reg(int r)
 {
@@ -493,32 +535,55 @@ ST_FUNC void save_reg(int r)
     int l, saved, size, align;
     SValue *p, sv;
     CType *type;
+#ifdef TCC_TARGET_AVR
+    int i;
+#endif
 
     /* modify all stack values */
     saved = 0;
     l = 0;
     for(p=vstack;p<=vtop;p++) {
+#ifdef TCC_TARGET_AVR
+        if (sv_uses_reg(p, r)) {
+#else
         if ((p->r & VT_VALMASK) == r ||
             ((p->type.t & VT_BTYPE) == VT_LLONG && (p->r2 & VT_VALMASK) == r)) {
+#endif
             /* must save value on stack if not already done */
             if (!saved) {
                 /* NOTE: must reload 'r' because r might be equal to r2 */
                 r = p->r & VT_VALMASK;
                 /* store register in the stack */
                 type = &p->type;
+#ifdef TCC_TARGET_AVR
+                /* a function or an array is its address, see gv() */
+                if ((p->r & VT_LVAL) || (type->t & VT_ARRAY) ||
+                    (type->t & VT_BTYPE) == VT_FUNC)
+                    type = &char_pointer_type;
+#else
                 if ((p->r & VT_LVAL) ||
                     (!is_float(type->t) && (type->t & VT_BTYPE) != VT_LLONG))
 #ifdef TCC_TARGET_X86_64
                     type = &char_pointer_type;
 #else
                     type = &int_type;
+#endif
 #endif
                 size = type_size(type, &align);
                 loc = (loc - size) & -align;
                 sv.type.t = type->t;
                 sv.r = VT_LOCAL | VT_LVAL;
                 sv.c.ul = loc;
+#ifdef TCC_TARGET_AVR
+                /* one store per byte */
+                for (i = 0; i < size; i++) {
+                    sv.c.ul = loc + i;
+                    r = SV_REG(p, i) & VT_VALMASK;
+                    store(r < VT_CONST ? r : TREG_R1, &sv);
+                }
+#else
                 store(r, &sv);
+#endif
 #if defined(TCC_TARGET_I386) || defined(TCC_TARGET_X86_64)
                 /* x86 specific: need to pop fp register ST0 if saved */
                 if (r == TREG_ST0) {
@@ -545,6 +610,9 @@ ST_FUNC void save_reg(int r)
                 p->r = lvalue_type(p->type.t) | VT_LOCAL;
             }
             p->r2 = VT_CONST;
+#ifdef TCC_TARGET_AVR
+            p->r3 = p->r4 = p->r5 = p->r6 = p->r7 = p->r8 = VT_CONST;
+#endif
             p->c.ul = l;
         }
     }
@@ -586,10 +654,17 @@ ST_FUNC int get_reg(int rc)
     for(r=0;r<NB_REGS;r++) {
         if (reg_classes[r] & rc) {
             for(p=vstack;p<=vtop;p++) {
+#ifdef TCC_TARGET_AVR
+                if (sv_uses_reg(p, r))
+#else
                 if ((p->r & VT_VALMASK) == r ||
                     (p->r2 & VT_VALMASK) == r)
+#endif
                     goto notfound;
             }
+#ifdef TCC_TARGET_AVR
+            avr_use_reg(r);
+#endif
             return r;
         }
     notfound: ;
@@ -599,10 +674,19 @@ ST_FUNC int get_reg(int rc)
        IMPORTANT to start from the bottom to ensure that we don't
        spill registers used in gen_opi()) */
     for(p=vstack;p<=vtop;p++) {
+#ifdef TCC_TARGET_AVR
+        int i;
+        for (i = 1; i < 8; i++) {
+            r = SV_REG(p, i) & VT_VALMASK;
+            if (r < VT_CONST && (reg_classes[r] & rc))
+                goto save_found;
+        }
+#else
         /* look at second register (if long long) */
         r = p->r2 & VT_VALMASK;
         if (r < VT_CONST && (reg_classes[r] & rc))
             goto save_found;
+#endif
         r = p->r & VT_VALMASK;
         if (r < VT_CONST && (reg_classes[r] & rc)) {
         save_found:
@@ -628,6 +712,7 @@ ST_FUNC void save_regs(int n)
     }
 }
 
+#ifndef TCC_TARGET_AVR
 /* move register 's' to 'r', and flush previous value of r to memory
    if needed */
 static void move_reg(int r, int s)
@@ -642,6 +727,49 @@ static void move_reg(int r, int s)
         load(r, &sv);
     }
 }
+#else
+/* move the byte registers of vtop to those of 'sv', which are free. As
+   the two sets may overlap, a byte is only moved once its destination
+   is no longer a source, r0 breaking the cycles */
+static void move_regs(SValue *sv)
+{
+    int i, j, d, n, moved;
+    SValue v;
+
+    v.type.t = VT_BYTE;
+    v.c.ul = 0;
+    do {
+        n = moved = 0;
+        for (i = 0; i < 8; i++) {
+            d = SV_REG(sv, i) & VT_VALMASK;
+            if (d >= VT_CONST || d == (SV_REG(vtop, i) & VT_VALMASK))
+                continue;
+            n++;
+            for (j = 0; j < 8; j++)
+                if (j != i && (SV_REG(vtop, j) & VT_VALMASK) == d &&
+                    (SV_REG(sv, j) & VT_VALMASK) != d)
+                    break;
+            if (j < 8)
+                continue;
+            v.r = SV_REG(vtop, i) & VT_VALMASK;
+            load(d, &v);
+            SV_REG(vtop, i) = d;
+            moved = 1;
+        }
+        if (n && !moved) {
+            /* a cycle: free its first destination through r0 */
+            for (i = 0; (SV_REG(sv, i) & VT_VALMASK) >= VT_CONST ||
+                        (SV_REG(sv, i) & VT_VALMASK) ==
+                        (SV_REG(vtop, i) & VT_VALMASK); i++);
+            d = SV_REG(sv, i) & VT_VALMASK;
+            for (j = 0; (SV_REG(vtop, j) & VT_VALMASK) != d; j++);
+            v.r = d;
+            load(TREG_R0, &v);
+            SV_REG(vtop, j) = TREG_R0;
+        }
+    } while (n);
+}
+#endif
 
 /* get address of vtop (vtop MUST BE an lvalue) */
 static void gaddrof(void)
@@ -684,6 +812,161 @@ static void gbound(void)
 }
 #endif
 
+#ifdef TCC_TARGET_AVR
+/* return true if one of the 'n' bytes of vtop is not in a register of
+   its class in 'rcs' */
+static int gv_misplaced(int *rcs, int n)
+{
+    int i, r;
+    for (i = 0; i < n; i++) {
+        r = SV_REG(vtop, i) & VT_VALMASK;
+        if (r >= VT_CONST || !(reg_classes[r] & rcs[i]))
+            return 1;
+    }
+    return 0;
+}
+
+/* make the byte lvalue vtop refer to the next address. The increment
+   modifies the address registers in place, so they are copied first if
+   another value of the stack still uses them */
+static void gnext_byte(void)
+{
+    SValue *p, sv;
+    int i, r;
+
+    gaddrof();
+    vtop->type = char_pointer_type;
+    if ((vtop->r & VT_VALMASK) < VT_CONST) {
+        for (p = vstack; p < vtop; p++)
+            if (sv_uses_reg(p, vtop->r & VT_VALMASK) ||
+                sv_uses_reg(p, vtop->r2 & VT_VALMASK))
+                break;
+        if (p < vtop) {
+            sv.type.t = VT_BYTE;
+            sv.c.ul = 0;
+            for (i = 0; i < PTR_SIZE; i++) {
+                sv.r = SV_REG(vtop, i) & VT_VALMASK;
+                r = get_reg(RC_BYTE);
+                load(r, &sv);
+                SV_REG(vtop, i) = r;
+            }
+        }
+    }
+    vpushi(1);
+    gen_op('+');
+    vtop->type.t = VT_BYTE;
+    vtop->r |= VT_LVAL;
+}
+
+/* load in 'r' the byte 'i' of the constant 'ui'. For the address of
+   'sym', load() gets the whole offset and the byte number in r2 */
+static void gv_const_byte(int r, unsigned int ui, Sym *sym, int i)
+{
+    SValue sv;
+
+    sv.type.t = VT_BYTE;
+    sv.r = VT_CONST;
+    sv.c.ul = (ui >> (i * 8)) & 0xFF;
+    if (sym) {
+        sv.r |= VT_SYM;
+        sv.sym = sym;
+        sv.c.ul = ui;
+        sv.r2 = i;
+    }
+    load(r, &sv);
+}
+
+/* load the 'n' bytes of vtop in registers of the classes 'rcs' */
+static void gv_bytes(int *rcs, int n)
+{
+    int i, j, r, v;
+    unsigned int ui;
+    float f;
+    Sym *sym = NULL;
+    SValue sv;
+
+    v = vtop->r & VT_VALMASK;
+    if (v < VT_CONST && !(vtop->r & VT_LVAL)) {
+        /* a byte cannot be moved to a register still holding another
+           byte of the value: save the value on the stack instead */
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < n; j++) {
+                r = SV_REG(vtop, j) & VT_VALMASK;
+                if (j != i && r < VT_CONST && (reg_classes[r] & rcs[i]) &&
+                    rcs[i] >= RC_R(8) && rcs[i] <= RC_R25)
+                    break;
+            }
+            if (j < n)
+                break;
+        }
+        if (i < n) {
+            save_reg(v);
+        } else {
+            for (i = 0; i < n; i++) {
+                r = SV_REG(vtop, i) & VT_VALMASK;
+                if (r < VT_CONST && (reg_classes[r] & rcs[i]))
+                    continue;
+                j = get_reg(rcs[i]);
+                sv.type.t = VT_BYTE;
+                sv.r = r < VT_CONST ? r : VT_CONST;
+                sv.c.ul = 0;
+                load(j, &sv);
+                SV_REG(vtop, i) = j;
+            }
+            return;
+        }
+    }
+
+    v = vtop->r & VT_VALMASK;
+    if (v == VT_CMP || v == VT_JMP || v == VT_JMPI) {
+        /* flag value: 0 or 1 in the first byte */
+        r = get_reg(rcs[0]);
+        load(r, vtop);
+        vtop->r = r;
+        ui = 0;
+    } else if ((vtop->r & (VT_VALMASK | VT_LVAL)) == VT_CONST) {
+        ui = vtop->c.ui;
+        if (is_float(vtop->type.t)) {
+            /* float and double have the same format */
+            if ((vtop->type.t & VT_BTYPE) == VT_FLOAT)
+                f = vtop->c.f;
+            else if ((vtop->type.t & VT_BTYPE) == VT_DOUBLE)
+                f = vtop->c.d;
+            else
+                f = vtop->c.ld;
+            memcpy(&ui, &f, 4);
+        }
+        if (vtop->r & VT_SYM)
+            sym = vtop->sym;
+        r = get_reg(rcs[0]);
+        gv_const_byte(r, ui, sym, 0);
+        vtop->r = r;
+    } else {
+        /* load from memory, from the lowest address */
+        vdup();
+        vtop->type.t = VT_BYTE;
+        r = get_reg(rcs[0]);
+        load(r, vtop);
+        for (i = 1; i < 8; i++)
+            SV_REG(&vtop[-1], i) = VT_CONST;
+        vtop[-1].r = r;
+        for (i = 1; i < n; i++) {
+            gnext_byte();
+            r = get_reg(rcs[i]);
+            load(r, vtop);
+            SV_REG(&vtop[-1], i) = r;
+        }
+        vpop();
+        return;
+    }
+    for (i = 1; i < n; i++) {
+        r = get_reg(rcs[i]);
+        gv_const_byte(r, ui, sym, i);
+        SV_REG(vtop, i) = r;
+    }
+}
+#endif
+
 /* store vtop a register belonging to class 'rc'. lvalues are
    converted to values. Cannot be used if cannot be converted to
    register value (such as structures). */
@@ -693,7 +976,7 @@ ST_FUNC int gv(int rc)
     int r, bit_pos, bit_size, size, align, i;
 #ifndef TCC_TARGET_X86_64
 #ifdef TCC_TARGET_AVR
-    int rc2, rc3, rc4, rc5, rc6, rc7, rc8;
+    int rcs[8], n;
 #else
     int rc2;
 #endif
@@ -726,7 +1009,12 @@ ST_FUNC int gv(int rc)
         r = gv(rc);
     } else {
         if (is_float(vtop->type.t) && 
-            (vtop->r & (VT_VALMASK | VT_LVAL)) == VT_CONST) {
+            (vtop->r & (VT_VALMASK | VT_LVAL)) == VT_CONST
+#ifdef TCC_TARGET_AVR
+            /* loaded with 'ldi', see gv_bytes() */
+            && 0
+#endif
+            ) {
             Sym *sym;
             int *ptr;
             unsigned long offset;
@@ -774,35 +1062,23 @@ ST_FUNC int gv(int rc)
         r = vtop->r & VT_VALMASK;
 #ifndef TCC_TARGET_X86_64
 #ifdef TCC_TARGET_AVR
-        switch (rc) {
-        /* Return values */
-        case RC_LLRET:
-            rc8 = RC_R18;
-            rc7 = RC_R19;
-            rc6 = RC_R20;
-            rc5 = RC_R21;
-        case RC_LRET:   /* case RC_FRET */
-            rc4 = RC_R22;
-            rc3 = RC_R23;
-        case RC_IRET:
-            rc2 = RC_R25;
-        case RC_BRET:
-            rc = RC_R24;
-            break;
-        /* Generic registers */
-        case RC_LLONG:
-            rc8 = RC_BYTE;
-            rc7 = RC_BYTE;
-            rc6 = RC_BYTE;
-            rc5 = RC_BYTE;
-        case RC_LONG:
-            rc4 = RC_BYTE;
-            rc3 = RC_BYTE;
-        case RC_INT:
-            rc2 = RC_BYTE;
-        case RC_BYTE:
-            rc  = RC_BYTE;
+        /* a fixed register class asks for the value in consecutive
+           registers, otherwise any byte register is used */
+        n = type_size(&vtop->type, &align);
+        if (n > 8 || (vtop->type.t & VT_BTYPE) == VT_FUNC ||
+            (vtop->type.t & VT_ARRAY))
+            n = PTR_SIZE;
+        else if (n < 1)
+            n = 1;
+        for (i = 0; i < n; i++) {
+            if (rc >= RC_R(8) && rc <= RC_R25)
+                rcs[i] = rc << i;
+            else if (rc == RC_LDI || rc == RC_FMUL)
+                rcs[i] = rc;
+            else
+                rcs[i] = RC_BYTE;
         }
+        rc = rcs[0];
 #else
         rc2 = RC_INT;
         if (rc == RC_IRET)
@@ -818,77 +1094,35 @@ ST_FUNC int gv(int rc)
          || !(reg_classes[r] & rc)
 #if !defined(TCC_TARGET_X86_64) && !defined(TCC_TARGET_AVR)
          || ((vtop->type.t & VT_BTYPE) == VT_LLONG && !(reg_classes[vtop->r2] & rc2))
+#endif
+#ifdef TCC_TARGET_AVR
+         || gv_misplaced(rcs, n)
 #endif
             )
         {
+#ifndef TCC_TARGET_AVR
             r = get_reg(rc);
+#endif
 #ifndef TCC_TARGET_X86_64
 #ifdef TCC_TARGET_AVR
             printf("r = %X, type = %X\n", vtop->r, vtop->type.t);
             if ((vtop->type.t & VT_BTYPE) == VT_PTR &&
                 (vtop->r & (VT_VALMASK | VT_LVAL)) == VT_LOCAL) {
-                /* Load address of local variable */
-                vtop->r = r;
-                int r2;
-                /* Load registers r2:r1 from register Y */
-                vpushi(0);  /* Push dummy */
-                vtop->r = TREG_R28;
-                load(r, vtop);
-
-                r2 = get_reg(rc2);
-                vtop->r = TREG_R29;
-                load(r2, vtop);
-                --vtop;
-                vtop->r2 = r2;
-
-                /* Add offset */
-                vpushi(vtop->c.ul);
-                gen_op('+');
-            } else if ((vtop->type.t & VT_BTYPE) == VT_INT ||
-                       (vtop->type.t & VT_BTYPE) == VT_SHORT ||
-                       (vtop->type.t & VT_BTYPE) == VT_PTR) {
-                /* Two registers load */
+                /* Load address of local variable, from register Y */
                 int r2;
-                unsigned int ui;
-                if ((vtop->r & (VT_VALMASK | VT_LVAL)) == VT_CONST) {
-                    /* load constant */
-                    ui = vtop->c.ui & 0xFFFF;
-                    vtop->c.ui = ui & 0xFF; /* first word */
-                    load(r, vtop);
-                    vtop->r = r; /* save register value */
-                    vpushi(ui >> 8); /* second word */
-                } else if (r >= VT_CONST || /* XXX: test to VT_CONST incorrect ? */
-                           (vtop->r & VT_LVAL)) {
-                    /* We do not want to modifier the long long
-                       pointer here, so the safest (and less
-                       efficient) is to save all the other registers
-                       in the stack. XXX: totally inefficient. */
-                    //save_regs(1);
-                    /* load from memory */
-                    load(r, vtop);
-                    vdup();
-                    vtop[-1].r = r; /* save register value */
-                    /* increment pointer to get second word */
-                    vtop->type.t = VT_BYTE;
-                    gaddrof();
-                    vpushi(1);
-                    gen_op('+');
-                    vtop->r |= VT_LVAL;
-                } else {
-                    /* move registers */
-                    load(r, vtop);
-                    vdup();
-                    vtop[-1].r = r; /* save register value */
-                    vtop->r = vtop[-1].r2;
-                }
-                /* Allocate second register. Here we rely on the fact that
-                   get_reg() tries first to free r2 of an SValue. */
-                r2 = get_reg(rc2);
-                load(r2, vtop);
-                vpop();
-                /* write second register */
+                r = get_reg(RC_LDI);
+                vtop->r = r;
+                r2 = get_reg(RC_LDI);
+                vtop->r = VT_LOCAL;
+                gen_local_addr(r, r2, vtop->c.i);
+                vtop->r = r;
                 vtop->r2 = r2;
-            } else
+                if (gv_misplaced(rcs, n))
+                    gv_bytes(rcs, n);
+            } else {
+                gv_bytes(rcs, n);
+            }
+            r = vtop->r;
 #else
             if ((vtop->type.t & VT_BTYPE) == VT_LLONG) {
                 int r2;
@@ -936,6 +1170,7 @@ ST_FUNC int gv(int rc)
             } else
 #endif
 #endif
+#ifndef TCC_TARGET_AVR
             if ((vtop->r & VT_LVAL) && !is_float(vtop->type.t)) {
                 int t1, t;
                 /* lvalue of scalar type : need to use lvalue type
@@ -957,17 +1192,13 @@ ST_FUNC int gv(int rc)
                 /* one register type load */
                 load(r, vtop);
             }
+#endif
         }
         vtop->r = r;
 #ifdef TCC_TARGET_C67
         /* uses register pairs for doubles */
         if ((vtop->type.t & VT_BTYPE) == VT_DOUBLE) 
             vtop->r2 = r+1;
-#endif
-#ifdef TCC_TARGET_AVR
-        /* uses register pairs for doubles */
-        if ((vtop->type.t & VT_BTYPE) == VT_DOUBLE) 
-            vtop->r2 = r+1;
 #endif
     }
     return r;
@@ -1156,6 +1387,28 @@ static void gv_dup(void)
         lbuild(t);
         vswap();
     } else {
+#ifdef TCC_TARGET_AVR
+        int size, align;
+        /* duplicate value byte by byte */
+        size = type_size(&vtop->type, &align);
+        if (!is_float(t) && size <= 2) {
+            r = gv(size == 1 ? RC_BYTE : RC_INT);
+            vdup();
+            sv.type.t = VT_BYTE;
+            sv.c.ul = 0;
+            sv.r = r;
+            r1 = get_reg(RC_BYTE);
+            load(r1, &sv);
+            vtop->r = r1;
+            if (size == 2) {
+                sv.r = vtop[-1].r2;
+                r1 = get_reg(RC_BYTE);
+                load(r1, &sv);
+                vtop->r2 = r1;
+            }
+            return;
+        }
+#endif
         /* duplicate value */
         rc = RC_INT;
         sv.type.t = VT_INT;
@@ -1701,6 +1954,256 @@ static void check_comparison_pointer_types(SValue *p1, SValue *p2, int op)
 }
 
 /* generic gen_op: handles types problems */
+#ifdef TCC_TARGET_AVR
+#define VT_FIXTYPE (VT_BTYPE | VT_UNSIGNED | VT_FIXSHORT | VT_SAT)
+
+/* fixed point values are integers scaled by 2^fixed_fbits() */
+static int fixed_fbits(int t)
+{
+    int n;
+    n = t & VT_FIXSHORT ? 8 : 16;
+    return t & VT_UNSIGNED ? n : n - 1;
+}
+
+/* integer type of the size and signedness of the fixed point type 't' */
+static int fixed_itype(int t)
+{
+    CType type;
+    int align;
+
+    type.t = t;
+    if (type_size(&type, &align) == 1)
+        return VT_BYTE | (t & VT_UNSIGNED);
+    return VT_INT | (t & VT_UNSIGNED);
+}
+
+/* the bits of the fixed point constant 'v' of type 't', possibly
+   saturated */
+static long long fixed_const(int t, long long v, int sat)
+{
+    CType type;
+    int n, align;
+    long long max, min;
+
+    type.t = t;
+    n = type_size(&type, &align) * 8;
+    if (t & VT_UNSIGNED) {
+        min = 0;
+        max = (1LL << n) - 1;
+    } else {
+        min = -1LL << (n - 1);
+        max = -min - 1;
+    }
+    if (sat)
+        return v < min ? min : v > max ? max : v;
+    v &= (1LL << n) - 1;
+    return v > max ? v - (1LL << n) : v;
+}
+
+static void vpush_float(double f)
+{
+    CType type;
+    CValue cval;
+
+    type.t = VT_FLOAT;
+    cval.f = f;
+    vsetc(&type, VT_CONST, &cval);
+}
+
+/* cast from or to a fixed point type */
+static void gen_cast_fixed(CType *type)
+{
+    int st, dt, n, align, sbits, dbits;
+    long double v;
+    CType itype;
+
+    st = vtop->type.t;
+    dt = type->t;
+    if ((vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+        /* constant case: convert the real value */
+        if (is_fixed(st))
+            v = ldexp(fixed_const(st, vtop->c.i, 0), -fixed_fbits(st));
+        else if ((st & VT_BTYPE) == VT_FLOAT)
+            v = vtop->c.f;
+        else if ((st & VT_BTYPE) == VT_DOUBLE)
+            v = vtop->c.d;
+        else if ((st & VT_BTYPE) == VT_LDOUBLE)
+            v = vtop->c.ld;
+        else if (st & VT_UNSIGNED)
+            v = vtop->c.ui;
+        else
+            v = vtop->c.i;
+        if (is_fixed(dt)) {
+            /* round to nearest and saturate */
+            v = floor(ldexp(v, fixed_fbits(dt)) + 0.5);
+            if (v > 0x7FFFFFFF)
+                v = 0x7FFFFFFF;
+            else if (v < -0x7FFFFFFF)
+                v = -0x7FFFFFFF;
+            vtop->c.i = fixed_const(dt, (long long)v, 1);
+            vtop->type = *type;
+        } else {
+            vtop->c.ld = v;
+            vtop->type.t = VT_LDOUBLE;
+            gen_cast(type);
+        }
+        return;
+    }
+    if (nocode_wanted) {
+        vtop->type = *type;
+        return;
+    }
+
+    if (is_fixed(st) && is_fixed(dt)) {
+        /* align the binary points */
+        sbits = fixed_fbits(st);
+        dbits = fixed_fbits(dt);
+        vtop->type.t = fixed_itype(st);
+        itype.t = fixed_itype(dt);
+        if (sbits > dbits) {
+            vpushi(sbits - dbits);
+            gen_op(TOK_SAR);
+        }
+        gen_cast(&itype);
+        if (dbits > sbits) {
+            vpushi(dbits - sbits);
+            gen_op(TOK_SHL);
+            gen_cast(&itype);
+        }
+    } else if (is_fixed(dt)) {
+        itype.t = fixed_itype(dt);
+        if (is_float(st)) {
+            vpush_float(ldexp(1, fixed_fbits(dt)));
+            gen_op('*');
+            gen_cast(&itype);
+        } else {
+            gen_cast(&itype);
+            vpushi(fixed_fbits(dt));
+            gen_op(TOK_SHL);
+            gen_cast(&itype);
+        }
+    } else {
+        sbits = fixed_fbits(st);
+        vtop->type.t = fixed_itype(st);
+        if (is_float(dt)) {
+            itype.t = VT_FLOAT;
+            gen_cast(&itype);
+            vpush_float(ldexp(1, -sbits));
+            gen_op('*');
+        } else if ((dt & VT_BTYPE) != VT_BOOL) {
+            if (!(st & VT_UNSIGNED)) {
+                /* round toward zero: the negative values are first
+                   increased by 2^sbits - 1 */
+                n = type_size(&vtop->type, &align) * 8;
+                gv_dup();
+                vpushi(n - 1);
+                gen_op(TOK_SAR);
+                vpushi((1 << sbits) - 1);
+                gen_op('&');
+                gen_op('+');
+            }
+            vpushi(sbits);
+            gen_op(TOK_SAR);
+        }
+        gen_cast(type);
+        return;
+    }
+    vtop->type = *type;
+}
+
+/* the fixed point types of higher rank have more integer bits */
+static int fixed_rank(int t)
+{
+    CType type;
+    int align;
+
+    type.t = t;
+    return type_size(&type, &align) * 2 + ((t & VT_BTYPE) == VT_ACCUM);
+}
+
+/* the type to which the operands of types 't1' and 't2', one of them at
+   least being fixed point, are converted */
+static int fixed_common_type(int t1, int t2)
+{
+    int t;
+
+    if (!is_fixed(t1)) {
+        t = t2;
+    } else if (!is_fixed(t2)) {
+        t = t1;
+    } else {
+        t = fixed_rank(t1) >= fixed_rank(t2) ? t1 : t2;
+        if (!(t1 & t2 & VT_UNSIGNED))
+            t &= ~VT_UNSIGNED;
+        t |= (t1 | t2) & VT_SAT;
+    }
+    return t & VT_FIXTYPE;
+}
+
+/* fixed point operation: except the multiplication and the saturating
+   operations, it is the integer operation on the scaled values */
+static void gen_op_fixed(int op)
+{
+    int t1, t2, t;
+    long long v;
+    CType type;
+
+    t1 = vtop[-1].type.t;
+    t2 = vtop[0].type.t;
+    if (op == TOK_SAR || op == TOK_SHL || op == TOK_SHR) {
+        if (!is_fixed(t1) || is_fixed(t2))
+            tcc_error("invalid operands for binary operation");
+        t = t1;
+        vtop[-1].type.t = fixed_itype(t);
+        gen_op(op);
+    } else if ((op == '*' || op == '/') &&
+               (!is_fixed(t1) || !is_fixed(t2))) {
+        /* multiplication or division by an integer */
+        if (!is_fixed(t1)) {
+            if (op == '/')
+                tcc_error("XXX: division by a fixed point value unsupported");
+            vswap();
+            t1 = t2;
+        }
+        t = t1;
+        vtop[-1].type.t = fixed_itype(t);
+        gen_op(op);
+    } else {
+        /* convert both operands to the type of higher rank */
+        t = fixed_common_type(t1, t2);
+        type.t = t;
+        vswap();
+        gen_cast(&type);
+        vswap();
+        gen_cast(&type);
+        if (op == '*' &&
+            (vtop[-1].r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST &&
+            (vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST) {
+            v = fixed_const(t, vtop[-1].c.i, 0) * fixed_const(t, vtop->c.i, 0);
+            vtop--;
+            vtop->c.i = fixed_const(t, v >> fixed_fbits(t), 1);
+            return;
+        } else if (op == '*' || ((op == '+' || op == '-') && (t & VT_SAT))) {
+            gen_opfix(op);
+            vtop->type.t = t;
+            return;
+        } else if (op == '+' || op == '-' || (op >= TOK_ULT && op <= TOK_GT)) {
+            vtop[-1].type.t = vtop->type.t = fixed_itype(t);
+            gen_op(op);
+            if (op != '+' && op != '-')
+                return;
+        } else if (op == '/') {
+            tcc_error("XXX: fixed point division unsupported");
+        } else {
+            tcc_error("invalid operands for binary operation");
+        }
+    }
+    type.t = fixed_itype(t);
+    gen_cast(&type);
+    vtop->type.t = t;
+}
+#endif
+
 ST_FUNC void gen_op(int op)
 {
     int u, t1, t2, bt1, bt2, t;
@@ -1804,6 +2307,10 @@ ST_FUNC void gen_op(int op)
             (op < TOK_ULT || op > TOK_GT))
             tcc_error("invalid operands for binary operation");
         goto std_op;
+#ifdef TCC_TARGET_AVR
+    } else if (is_fixed(bt1) || is_fixed(bt2)) {
+        gen_op_fixed(op);
+#endif
     } else if (op == TOK_SHR || op == TOK_SAR || op == TOK_SHL) {
         t = bt1 == VT_LLONG ? VT_LLONG : VT_INT;
         if ((t1 & (VT_BTYPE | VT_UNSIGNED)) == (t | VT_UNSIGNED))
@@ -1939,6 +2446,22 @@ static void force_charshort_cast(int t)
     int bits, dbt;
     dbt = t & VT_BTYPE;
     /* XXX: add optimization if lvalue : just change type and offset */
+#ifdef TCC_TARGET_AVR
+    /* int and short have the same size, and a byte is the low
+       register of the pair */
+    if (dbt == VT_SHORT) {
+        if ((vtop->type.t & VT_BTYPE) == VT_BYTE ||
+            (vtop->type.t & VT_BTYPE) == VT_BOOL)
+            gen_cvt_btoi((vtop->type.t & VT_UNSIGNED) ||
+                         (vtop->type.t & VT_BTYPE) == VT_BOOL);
+        return;
+    }
+    if (dbt == VT_BYTE) {
+        gv(RC_INT);
+        vtop->r2 = VT_CONST;
+        return;
+    }
+#endif
     if (dbt == VT_BYTE)
         bits = 8;
     else
@@ -1980,6 +2503,13 @@ static void gen_cast(CType *type)
     dbt = type->t & (VT_BTYPE | VT_UNSIGNED);
     sbt = vtop->type.t & (VT_BTYPE | VT_UNSIGNED);
 
+#ifdef TCC_TARGET_AVR
+    if ((is_fixed(sbt) || is_fixed(dbt)) &&
+        (vtop->type.t & VT_FIXTYPE) != (type->t & VT_FIXTYPE)) {
+        gen_cast_fixed(type);
+        return;
+    }
+#endif
     if (sbt != dbt) {
         sf = is_float(sbt);
         df = is_float(dbt);
@@ -2127,6 +2657,13 @@ static void gen_cast(CType *type)
                 force_charshort_cast(dbt);
             } else if ((dbt & VT_BTYPE) == VT_INT) {
                 /* scalar to int */
+#ifdef TCC_TARGET_AVR
+                if ((sbt & VT_BTYPE) == VT_BYTE ||
+                    (sbt & VT_BTYPE) == VT_BOOL) {
+                    /* the lvalue holds a single byte */
+                    gen_cvt_btoi((sbt & VT_UNSIGNED) || (sbt & VT_BTYPE) == VT_BOOL);
+                } else
+#endif
                 if (sbt == VT_LLONG) {
                     /* from long long: just take low order word */
                     lexpand();
@@ -2173,6 +2710,12 @@ ST_FUNC int type_size(CType *type, int *a)
             *a = PTR_SIZE;
             return PTR_SIZE;
         }
+#ifdef TCC_TARGET_AVR
+    } else if (bt == VT_DOUBLE || bt == VT_LDOUBLE) {
+        /* same as float */
+        *a = 4;
+        return 4;
+#endif
     } else if (bt == VT_LDOUBLE) {
         *a = LDOUBLE_ALIGN;
         return LDOUBLE_SIZE;
@@ -2200,6 +2743,10 @@ ST_FUNC int type_size(CType *type, int *a)
     } else if (bt == VT_SHORT || bt == VT_INT || bt == VT_ENUM) {
         *a = 2;
         return 2;
+    } else if (bt == VT_FRACT || bt == VT_ACCUM) {
+        /* s.7, s.15 or s8.7 */
+        *a = bt == VT_ACCUM || !(type->t & VT_FIXSHORT) ? 2 : 1;
+        return *a;
 #else
     } else if (bt == VT_INT || bt == VT_ENUM || bt == VT_FLOAT) {
         *a = 4;
@@ -2339,6 +2886,10 @@ static void type_to_str(char *buf, int buf_size,
         pstrcat(buf, buf_size, "const ");
     if (t & VT_VOLATILE)
         pstrcat(buf, buf_size, "volatile ");
+#ifdef TCC_TARGET_AVR
+    if (t & VT_SAT)
+        pstrcat(buf, buf_size, "_Sat ");
+#endif
     if (t & VT_UNSIGNED)
         pstrcat(buf, buf_size, "unsigned ");
     switch(bt) {
@@ -2371,6 +2922,14 @@ static void type_to_str(char *buf, int buf_size,
         goto add_tstr;
     case VT_LDOUBLE:
         tstr = "long double";
+        goto add_tstr;
+#ifdef TCC_TARGET_AVR
+    case VT_FRACT:
+        tstr = t & VT_FIXSHORT ? "short _Fract" : "_Fract";
+        goto add_tstr;
+    case VT_ACCUM:
+        tstr = t & VT_FIXSHORT ? "short _Accum" : "_Accum";
+#endif
     add_tstr:
         pstrcat(buf, buf_size, tstr);
         break;
@@ -2503,7 +3062,12 @@ static void gen_assign_cast(CType *dt)
 ST_FUNC void vstore(void)
 {
     printf("## vstore()\n");
-    int sbt, dbt, ft, r, t, size, align, bit_size, bit_pos, rc, delayed_cast;
+    int sbt, dbt, ft, r, size, align, bit_size, bit_pos, rc, delayed_cast;
+#ifdef TCC_TARGET_AVR
+    int i;
+#else
+    int t;
+#endif
 
     ft = vtop[-1].type.t;
     sbt = vtop->type.t & VT_BTYPE;
@@ -2623,16 +3187,8 @@ ST_FUNC void vstore(void)
 #endif
         if (!nocode_wanted) {
 #ifdef TCC_TARGET_AVR
-            switch (ft & VT_BTYPE) {
-            case VT_BYTE:
-                rc = RC_BYTE;
-                break;
-            case VT_PTR:
-            case VT_SHORT:
-            case VT_INT:
-                rc = RC_INT;
-                break;
-            }
+            /* any byte registers, see gv() */
+            rc = RC_INT;
 #else
             rc = RC_INT;
             if (is_float(ft)) {
@@ -2645,7 +3201,9 @@ ST_FUNC void vstore(void)
             }
 #endif
             r = gv(rc);  /* generate value */
-            /* if lvalue was saved on stack, must read it */
+#ifndef TCC_TARGET_AVR
+            /* if lvalue was saved on stack, must read it (store() of
+               AVR reads it in Z) */
             if ((vtop[-1].r & VT_VALMASK) == VT_LLOCAL) {
                 SValue sv;
                 t = get_reg(RC_INT);
@@ -2659,21 +3217,17 @@ ST_FUNC void vstore(void)
                 load(t, &sv);
                 vtop[-1].r = t | VT_LVAL;
             }
+#endif
             store(r, vtop - 1);
 #ifdef TCC_TARGET_AVR
-            switch (ft & VT_BTYPE) {
-            case VT_SHORT:
-            case VT_INT:
-            case VT_PTR:
+            /* store the other bytes at the next addresses */
+            size = type_size(&vtop[-1].type, &align);
+            for (i = 1; i < size && i < 8; i++) {
                 vswap();
-                /* convert to int to increment easily */
-                vtop->type.t = VT_INT;
-                gaddrof();
-                vpushi(1);
-                gen_op('+');
-                vtop->r |= VT_LVAL;
+                vtop->type.t = VT_BYTE;
+                gnext_byte();
                 vswap();
-                store(vtop->r2, vtop - 1);
+                store(SV_REG(vtop, i), vtop - 1);
             }
 #endif
 #ifndef TCC_TARGET_X86_64
@@ -2788,6 +3342,18 @@ static void parse_attribute(AttributeDef *ad)
             /* currently, no need to handle it because tcc does not
                track unused objects */
             break;
+        case TOK_COLD1:
+        case TOK_COLD2:
+            ad->func_cold = 1;
+            break;
+        case TOK_ALWAYS_INLINE1:
+        case TOK_ALWAYS_INLINE2:
+            ad->func_always_inline = 1;
+            break;
+        case TOK_NOINLINE1:
+        case TOK_NOINLINE2:
+            ad->func_noinline = 1;
+            break;
         case TOK_CDECL1:
         case TOK_CDECL2:
         case TOK_CDECL3:
@@ -2842,6 +3408,17 @@ static void parse_attribute(AttributeDef *ad)
         case TOK_DLLIMPORT:
             ad->func_import = 1;
             break;
+#ifdef TCC_TARGET_AVR
+        case TOK_MAX_CYCLES1:
+        case TOK_MAX_CYCLES2:
+            skip('(');
+            n = expr_const();
+            if (n <= 0)
+                tcc_error("max_cycles must be positive");
+            ad->max_cycles = n;
+            skip(')');
+            break;
+#endif
         default:
             if (tcc_state->warn_unsupported)
                 tcc_warning("'%s' attribute ignored", get_tok_str(t, NULL));
@@ -3125,6 +3702,24 @@ static int parse_btype(CType *type, AttributeDef *ad)
         case TOK_BOOL:
             u = VT_BOOL;
             goto basic_type;
+#ifdef TCC_TARGET_AVR
+        case TOK_FRACT:
+            u = VT_FRACT;
+            goto fixed_type;
+        case TOK_ACCUM:
+            u = VT_ACCUM;
+        fixed_type:
+            next();
+            /* 'short' was taken as the basic type */
+            if ((t & VT_BTYPE) == VT_SHORT)
+                t = (t & ~VT_BTYPE) | VT_FIXSHORT;
+            goto basic_type1;
+        case TOK_SAT:
+            t |= VT_SAT;
+            next();
+            typespec_found = 1;
+            break;
+#endif
         case TOK_FLOAT:
             u = VT_FLOAT;
             goto basic_type;
@@ -3173,6 +3768,10 @@ static int parse_btype(CType *type, AttributeDef *ad)
             next();
             break;
         case TOK_REGISTER:
+#ifdef TCC_TARGET_AVR
+            ad->global_reg = 1;
+            /* FALL THRU */
+#endif
         case TOK_AUTO:
         case TOK_RESTRICT1:
         case TOK_RESTRICT2:
@@ -3259,12 +3858,21 @@ the_end:
     if ((t & VT_BTYPE) == VT_LONG || (t & VT_BTYPE) == VT_LLONG) {
         tcc_error("long and long long types are not yet supported");
     }
+    if ((t & VT_SAT) && !is_fixed(t))
+        tcc_error("_Sat requires a fixed point type");
+    if ((t & VT_BTYPE) == VT_ACCUM && !(t & VT_FIXSHORT))
+        tcc_error("_Accum type is not yet supported, use short _Accum");
 
     /* By default, int is short int in AVR */
     if ((t & VT_BTYPE) == VT_SHORT) {
         t = (t & ~VT_BTYPE) | VT_INT;
     }
 
+    /* and double is float */
+    if ((t & VT_BTYPE) == VT_DOUBLE || (t & VT_BTYPE) == VT_LDOUBLE) {
+        t = (t & ~VT_BTYPE) | VT_FLOAT;
+    }
+
     /* We use long type */
 
     type->t = t;
@@ -3627,6 +4235,249 @@ static void parse_type(CType *type)
     type_decl(type, &ad, &n, TYPE_ABSTRACT);
 }
 
+/* push the value of type 'type' returned in registers by a call */
+static void vpush_ret(CType *type)
+{
+    int r, r2;
+
+    r2 = VT_CONST;
+    if (is_float(type->t)) {
+        r = reg_fret(type->t);
+    } else {
+#ifdef TCC_TARGET_AVR
+        int align;
+        switch (type->t & VT_BTYPE) {
+        case VT_FRACT:
+        case VT_ACCUM:
+            if (type_size(type, &align) == 1)
+                goto byte_ret;
+        case VT_INT: r2 = REG_IRET;
+        case VT_BYTE:
+        default: byte_ret: r = REG_BRET;
+        }
+#else
+        if ((type->t & VT_BTYPE) == VT_LLONG)
+            r2 = REG_LRET;
+        r = REG_IRET;
+#endif
+    }
+    vset(type, r, 0);
+    vtop->r2 = r2;
+#ifdef TCC_TARGET_AVR
+    if (is_float(type->t)) {
+        vtop->r2 = TREG_R23;
+        vtop->r3 = TREG_R24;
+        vtop->r4 = TREG_R25;
+    }
+#endif
+}
+
+/* true if the token 't' of the body of the function 'v', after the
+   token 'prev' and before 'tok', prevents inlining the function */
+static int inline_forbidden(int t, int prev, int v)
+{
+    if (t == TOK_GOTO || t == TOK_STATIC || t == TOK_LABEL || t == v)
+        return 1;
+#if defined TCC_TARGET_I386 || defined TCC_TARGET_X86_64
+    if (t == TOK_alloca)
+        return 1;
+#endif
+    /* a label would be defined twice */
+    return t >= TOK_UIDENT && tok == ':' &&
+        (prev == ';' || prev == '{' || prev == '}');
+}
+
+/* true if a variable between the tokens 'prev' and 'next' may be
+   modified: assigned, incremented or its address taken */
+static int inline_modifies(int prev, int next)
+{
+    if (prev == '&' || prev == TOK_INC || prev == TOK_DEC ||
+        next == TOK_INC || next == TOK_DEC)
+        return 1;
+    /* '*p = x' only modifies what 'p' points to */
+    return prev != '*' &&
+        (next == '=' || (next >= TOK_A_MOD && next <= TOK_A_DIV) ||
+         next == TOK_A_XOR || next == TOK_A_OR ||
+         next == TOK_A_SHL || next == TOK_A_SAR);
+}
+
+/* index of the parameter 't' of the function 'f', -1 if none */
+static int inline_param(Sym *f, int t)
+{
+    int n;
+
+    if (t < TOK_UIDENT)
+        return -1;
+    for (n = 0; (f = f->next) != NULL && n < 32; n++)
+        if ((f->v & ~SYM_FIELD) == t)
+            return n;
+    return -1;
+}
+
+/* the inline function to expand for a call to 's', NULL if the call
+   must be generated */
+static InlineFunc *inline_candidate(Sym *s)
+{
+    InlineFunc *fn;
+    Sym *f;
+    int i;
+
+    if (nocode_wanted || const_wanted || !local_stack ||
+        tcc_state->no_inline || tcc_state->do_debug ||
+        inline_depth >= INLINE_MAX_DEPTH)
+        return NULL;
+    if ((s->type.t & (VT_STATIC | VT_INLINE | VT_BTYPE)) !=
+        (VT_STATIC | VT_INLINE | VT_FUNC))
+        return NULL;
+    f = s->type.ref;
+    if (f->c != FUNC_NEW || FUNC_NOINLINE(f->r) ||
+        (f->type.t & VT_BTYPE) == VT_STRUCT)
+        return NULL;
+    for (i = 0; i < tcc_state->nb_inline_fns; i++) {
+        fn = tcc_state->inline_fns[i];
+        if (fn->sym == s) {
+            if (fn->size < 0 ||
+                (fn->size > INLINE_MAX_TOKENS && !FUNC_ALWAYS_INLINE(f->r)))
+                return NULL;
+            return fn;
+        }
+    }
+    return NULL;
+}
+
+/* the head of the identifier or structure chain of the local 's', NULL
+   for the fields and the anonymous symbols */
+static Sym **sym_tok_head(Sym *s)
+{
+    TokenSym *ts;
+    int v = s->v;
+
+    if ((v & SYM_FIELD) || (v & ~SYM_STRUCT) >= SYM_FIRST_ANOM)
+        return NULL;
+    ts = table_ident[(v & ~SYM_STRUCT) - TOK_IDENT];
+    if (v & SYM_STRUCT)
+        return &ts->sym_struct;
+    return &ts->sym_identifier;
+}
+
+/* make visible again the locals from 'b' (excluded) up to 's' */
+static void sym_unhide(Sym *s, Sym *b)
+{
+    Sym **ps;
+
+    if (s == b)
+        return;
+    sym_unhide(s->prev, b);
+    ps = sym_tok_head(s);
+    if (ps) {
+        s->prev_tok = *ps;
+        *ps = s;
+    }
+}
+
+/* expand the call to 'fn', whose symbol is on the value stack, by
+   parsing its body in the current function. 'tok' is the '(' */
+static void gen_inline_call(InlineFunc *fn)
+{
+    ParseState saved_parse_state;
+    CType type, saved_func_vt;
+    Sym *f, *sa, *s, *frame_bottom, *saved_bottom, **ps;
+    char *saved_funcname;
+    int *args, n, size, align, saved_rsym;
+
+    f = vtop->sym->type.ref;
+    vpop();
+    next();
+    n = 0;
+    for (sa = f->next; sa; sa = sa->next)
+        n++;
+    args = tcc_malloc((2 * n + 1) * sizeof(int));
+
+    /* the arguments are evaluated in the scope of the caller, the
+       constants passed to unmodified parameters are not stored */
+    n = 0;
+    sa = f->next;
+    if (tok != ')') {
+        for(;;) {
+            expr_eq();
+            gfunc_param_typed(f, sa);
+            type = sa->type;
+            type.t &= ~VT_CONSTANT;
+            if (n < 32 && !(fn->written & (1u << n)) &&
+                (vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) == VT_CONST &&
+                ((type.t & VT_BTYPE) == VT_INT ||
+                 (type.t & VT_BTYPE) == VT_BYTE ||
+                 (type.t & VT_BTYPE) == VT_SHORT ||
+                 (type.t & VT_BTYPE) == VT_BOOL ||
+                 ((type.t & VT_BTYPE) == VT_PTR && PTR_SIZE <= 4))) {
+                args[2 * n] = VT_CONST;
+                args[2 * n + 1] = vtop->c.i;
+            } else {
+                size = type_size(&type, &align);
+                loc = (loc - size) & -align;
+                args[2 * n] = VT_LOCAL | lvalue_type(type.t);
+                args[2 * n + 1] = loc;
+                vset(&type, args[2 * n], loc);
+                vswap();
+                vstore();
+            }
+            vpop();
+            n++;
+            sa = sa->next;
+            if (tok == ')')
+                break;
+            skip(',');
+        }
+    }
+    if (sa)
+        tcc_error("too few arguments to function");
+    skip(')');
+    save_regs(0);
+
+    /* the body only sees the globals and its parameters */
+    for (s = local_stack; s != inline_bottom; s = s->prev) {
+        ps = sym_tok_head(s);
+        if (ps)
+            *ps = s->prev_tok;
+    }
+    saved_bottom = inline_bottom;
+    frame_bottom = sym_push2(&local_stack, SYM_FIELD, 0, 0);
+    frame_bottom->next = scope_stack_bottom;
+    scope_stack_bottom = frame_bottom;
+    inline_bottom = frame_bottom;
+    n = 0;
+    for (sa = f->next; sa; sa = sa->next) {
+        sym_push(sa->v & ~SYM_FIELD, &sa->type, args[2 * n], args[2 * n + 1]);
+        n++;
+    }
+    tcc_free(args);
+
+    /* 'return' jumps to the end of the expansion */
+    saved_rsym = rsym;
+    saved_func_vt = func_vt;
+    saved_funcname = funcname;
+    rsym = 0;
+    func_vt = f->type;
+    funcname = get_tok_str(fn->sym->v, NULL);
+    inline_depth++;
+    save_parse_state(&saved_parse_state);
+    macro_ptr = fn->token_str;
+    next();
+    block(NULL, NULL, NULL, NULL, 0, 0);
+    restore_parse_state(&saved_parse_state);
+    gsym(rsym);
+    inline_depth--;
+    rsym = saved_rsym;
+    func_vt = saved_func_vt;
+    funcname = saved_funcname;
+
+    scope_stack_bottom = frame_bottom->next;
+    sym_pop(&local_stack, frame_bottom->prev);
+    inline_bottom = saved_bottom;
+    sym_unhide(local_stack, inline_bottom);
+    vpush_ret(&f->type);
+}
+
 static void vpush_tokc(int t)
 {
     CType type;
@@ -3641,6 +4492,7 @@ ST_FUNC void unary(void)
     CType type;
     Sym *s;
     AttributeDef ad;
+    InlineFunc *fn;
     static int in_sizeof = 0;
 
     sizeof_caller = in_sizeof;
@@ -3674,6 +4526,19 @@ ST_FUNC void unary(void)
         vpush_tokc(VT_FLOAT);
         next();
         break;
+#ifdef TCC_TARGET_AVR
+    /* double constants are float */
+    case TOK_CDOUBLE:
+        tokc.f = tokc.d;
+        vpush_tokc(VT_FLOAT);
+        next();
+        break;
+    case TOK_CLDOUBLE:
+        tokc.f = tokc.ld;
+        vpush_tokc(VT_FLOAT);
+        next();
+        break;
+#else
     case TOK_CDOUBLE:
         vpush_tokc(VT_DOUBLE);
         next();
@@ -3682,6 +4547,7 @@ ST_FUNC void unary(void)
         vpush_tokc(VT_LDOUBLE);
         next();
         break;
+#endif
     case TOK___FUNCTION__:
         if (!gnu_ext)
             goto tok_identifier;
@@ -3721,6 +4587,8 @@ ST_FUNC void unary(void)
         type.t |= VT_ARRAY;
         memset(&ad, 0, sizeof(AttributeDef));
         decl_initializer_alloc(&type, &ad, VT_CONST, 2, 0, NULL, 0);
+        if ((t & VT_BTYPE) == VT_BYTE)
+            merge_str_literal();
         break;
     case '(':
         next();
@@ -3776,6 +4644,17 @@ ST_FUNC void unary(void)
         if ((vtop->type.t & VT_BTYPE) != VT_FUNC &&
             !(vtop->type.t & VT_ARRAY) && !(vtop->type.t & VT_LLOCAL))
             test_lvalue();
+#ifdef TCC_TARGET_AVR
+        if ((vtop->r & VT_SYM) && SYM_GLOBAL_REG(vtop->sym))
+            tcc_error("address of global register variable '%s' requested",
+                      get_tok_str(vtop->sym->v, NULL));
+        /* for the hidden pointers of the counted loops */
+        if ((vtop->r & (VT_VALMASK | VT_LVAL)) == (VT_LOCAL | VT_LVAL)) {
+            addr_taken = tcc_realloc(addr_taken,
+                                     (nb_addr_taken + 1) * sizeof(int));
+            addr_taken[nb_addr_taken++] = vtop->c.i;
+        }
+#endif
         mk_pointer(&vtop->type);
         gaddrof();
         break;
@@ -3860,6 +4739,96 @@ ST_FUNC void unary(void)
             vpushi(res);
         }
         break;
+    case TOK_builtin_expect:
+        /* '__builtin_expect(e, c)' is 'e', expected to be 'c' */
+        {
+            int c;
+            next();
+            skip('(');
+            expr_eq();
+            skip(',');
+            c = expr_const();
+            skip(')');
+            if (tok == ')')
+                expect_value = c != 0;
+        }
+        break;
+#ifdef TCC_TARGET_AVR
+    case TOK_builtin_loop_bound:
+        /* '__builtin_loop_bound(N)': the innermost loop runs its body
+           at most N times, for the cycle estimator (see gen_cycles()) */
+        {
+            int n;
+            next();
+            skip('(');
+            n = expr_const();
+            if (!loop_bound)
+                tcc_error("__builtin_loop_bound outside of a loop");
+            if (n < 0)
+                tcc_error("negative loop bound");
+            *loop_bound = n;
+            skip(')');
+            vpushi(0);
+            vtop->type.t = VT_VOID;
+        }
+        break;
+    case TOK_builtin_avr_nop:
+    case TOK_builtin_avr_sei:
+    case TOK_builtin_avr_cli:
+    case TOK_builtin_avr_sleep:
+    case TOK_builtin_avr_wdr:
+    case TOK_builtin_avr_swap:
+    case TOK_builtin_avr_fmul:
+    case TOK_builtin_avr_fmuls:
+    case TOK_builtin_avr_fmulsu:
+    case TOK_builtin_avr_insert_bits:
+    case TOK_builtin_avr_delay_cycles:
+        /* the intrinsics of avr-gcc, expanded inline by gen_avr_builtin().
+           The delay and the map of insert_bits are constants, the other
+           arguments are bytes */
+        {
+            unsigned c;
+            int i, n;
+            t = tok;
+            next();
+            skip('(');
+            c = 0;
+            n = 0;
+            if (t == TOK_builtin_avr_delay_cycles) {
+                c = expr_const();
+            } else if (t == TOK_builtin_avr_insert_bits) {
+                c = expr_const();
+                skip(',');
+                n = 2;
+            } else if (t == TOK_builtin_avr_swap) {
+                n = 1;
+            } else if (t >= TOK_builtin_avr_fmul) {
+                n = 2;
+            }
+            for (i = 0; i < n; i++) {
+                if (i)
+                    skip(',');
+                expr_eq();
+                type.t = VT_BYTE | VT_UNSIGNED;
+                if (t == TOK_builtin_avr_fmuls
+                    || (t == TOK_builtin_avr_fmulsu && i == 0))
+                    type.t = VT_BYTE;
+                type.ref = NULL;
+                gen_cast(&type);
+            }
+            skip(')');
+            gen_avr_builtin(t, c);
+            if (n == 0) {
+                vpushi(0);
+                vtop->type.t = VT_VOID;
+            } else if (t != TOK_builtin_avr_swap
+                       && t != TOK_builtin_avr_insert_bits) {
+                vtop->type.t = t == TOK_builtin_avr_fmul
+                    ? VT_INT | VT_UNSIGNED : VT_INT;
+            }
+        }
+        break;
+#endif
     case TOK_builtin_frame_address:
         {
             int level;
@@ -3980,7 +4949,7 @@ ST_FUNC void unary(void)
                effect to generate code for it at the end of the
                compilation unit. Inline function as always
                generated in the text section. */
-            if (!s->c)
+            if (!s->c && !(tok == '(' && inline_candidate(s)))
                 put_extern_sym(s, text_section, 0, 0);
             r = VT_SYM | VT_CONST;
         } else {
@@ -4044,6 +5013,11 @@ ST_FUNC void unary(void)
             gen_op('+');
             indir();
             skip(']');
+        } else if (tok == '(' && (vtop->type.t & VT_BTYPE) == VT_FUNC &&
+                   (vtop->r & (VT_VALMASK | VT_LVAL | VT_SYM)) ==
+                   (VT_CONST | VT_SYM) && vtop->c.ul == 0 &&
+                   (fn = inline_candidate(vtop->sym)) != NULL) {
+            gen_inline_call(fn);
         } else if (tok == '(') {
             SValue ret;
             Sym *sa;
@@ -4065,10 +5039,11 @@ ST_FUNC void unary(void)
             }
             /* get return type */
             s = vtop->type.ref;
+            if (FUNC_COLD(s->r))
+                nb_cold_calls++;
             next();
             sa = s->next; /* first parameter */
             nb_args = 0;
-            ret.r2 = VT_CONST;
             /* compute first implicit argument if a structure is returned */
             if ((s->type.t & VT_BTYPE) == VT_STRUCT) {
                 /* get some space for the returned structure */
@@ -4081,25 +5056,6 @@ ST_FUNC void unary(void)
                 vseti(VT_LOCAL, loc);
                 ret.c = vtop->c;
                 nb_args++;
-            } else {
-                ret.type = s->type; 
-                /* return in register */
-                if (is_float(ret.type.t)) {
-                    ret.r = reg_fret(ret.type.t);
-                } else {
-#ifdef TCC_TARGET_AVR
-                    switch (ret.type.t & VT_BTYPE) {
-                    case VT_INT: ret.r2 = REG_IRET;
-                    case VT_BYTE:
-                    default: ret.r = REG_BRET;
-                    }
-#else
-                    if ((ret.type.t & VT_BTYPE) == VT_LLONG)
-                        ret.r2 = REG_LRET;
-                    ret.r = REG_IRET;
-#endif
-                }
-                ret.c.i = 0;
             }
             if (tok != ')') {
                 for(;;) {
@@ -4122,8 +5078,10 @@ ST_FUNC void unary(void)
                 vtop -= (nb_args + 1);
             }
             /* return value */
-            vsetc(&ret.type, ret.r, &ret.c);
-            vtop->r2 = ret.r2;
+            if ((s->type.t & VT_BTYPE) == VT_STRUCT)
+                vsetc(&ret.type, ret.r, &ret.c);
+            else
+                vpush_ret(&s->type);
         } else {
             break;
         }
@@ -4292,8 +5250,13 @@ static void expr_lor(void)
 /* XXX: better constant handling */
 static void expr_cond(void)
 {
-    int tt, u, r1, r2, rc, t1, t2, bt1, bt2;
+    int tt, u, rc, t1, t2, bt1, bt2;
     SValue sv;
+#ifdef TCC_TARGET_AVR
+    SValue sv2;
+#else
+    int r1, r2;
+#endif
     CType type, type1, type2;
 
     if (const_wanted) {
@@ -4367,6 +5330,10 @@ static void expr_cond(void)
                 } else {
                     type.t = VT_FLOAT;
                 }
+#ifdef TCC_TARGET_AVR
+            } else if (is_fixed(bt1) || is_fixed(bt2)) {
+                type.t = fixed_common_type(t1, t2);
+#endif
             } else if (bt1 == VT_LLONG || bt2 == VT_LLONG) {
                 /* cast to biggest op */
                 type.t = VT_LLONG;
@@ -4421,7 +5388,12 @@ static void expr_cond(void)
                 rc = RC_IRET; 
             }
             
+#ifdef TCC_TARGET_AVR
+            gv(rc);
+            sv2 = *vtop;
+#else
             r2 = gv(rc);
+#endif
             /* this is horrible, but we must also convert first
                operand */
             tt = gjmp(0);
@@ -4431,9 +5403,15 @@ static void expr_cond(void)
             gen_cast(&type);
             if (VT_STRUCT == (vtop->type.t & VT_BTYPE))
                 gaddrof();
+#ifdef TCC_TARGET_AVR
+            gv(rc);
+            /* every byte, before the join */
+            move_regs(&sv2);
+#else
             r1 = gv(rc);
             move_reg(r2, r1);
             vtop->r = r2;
+#endif
             gsym(tt);
         }
     }
@@ -4562,6 +5540,544 @@ static void label_or_decl(int l)
     decl(l);
 }
 
+#ifdef TCC_TARGET_AVR
+/* ------------------------------------------------------------------------- */
+/* counted loops
+
+   'for (i = C0; i < C1; i++)', or its decrementing variant, whose body
+   does not use 'i' or only to index arrays as in 'a[i]' is compiled as
+   a down counting loop: a hidden counter loaded with the trip count is
+   decremented at the bottom of the loop by gdecjnz() and no comparison
+   remains. 'a[i]' is strength reduced to '*p' with a hidden pointer 'p'
+   post incremented with the counter. The loop is first recorded as
+   token strings which are then parsed in their original or rewritten
+   form. */
+
+#define LOOP_MAX_PTRS 4
+
+typedef struct LoopInfo {
+    int recorded;
+    ParseState saved_parse_state;
+    TokenString init;           /* 'init ;' */
+    TokenString rest;           /* 'cond ; step ) body' */
+    TokenString body;           /* body with 'a [ i ]' rewritten */
+    int part;                   /* 0: init, 1: cond, 2: step, 3: body */
+    int nb_toks[3];
+    int toks[3][4];             /* last tokens of init, first ones of cond/step */
+    int init_toks, init_types;  /* tokens of init, type names among them */
+    int vals[3][4];             /* values of the integer constants */
+    int init_ops;               /* '=', ',' and '(' in init */
+    int v, v_uses, v_indexed;   /* induction variable */
+    int prev_tok, pending[3], nb_pending;
+    int nb_ptrs, ptr_name[LOOP_MAX_PTRS], ptr_tok[LOOP_MAX_PTRS];
+    int ptr_uses[LOOP_MAX_PTRS];
+    int *idents, nb_idents;
+    int has_goto, has_break, has_return;
+    int v_modified;             /* 'v' may be assigned by the body */
+    int v_addr;                 /* '& v' in the body */
+    int nested;                 /* inside another loop */
+    int trip;                   /* trip count of a generic loop, or 0 */
+} LoopInfo;
+
+static int loop_ptr_count;
+
+static int is_cint(int t)
+{
+    return t == TOK_CINT || t == TOK_CUINT || t == TOK_CCHAR;
+}
+
+/* return true if 't' may start the declaration of an integer */
+static int is_int_type_tok(int t)
+{
+    Sym *s;
+
+    switch (t) {
+    case TOK_CHAR:
+    case TOK_SHORT:
+    case TOK_INT:
+    case TOK_UNSIGNED:
+    case TOK_SIGNED1:
+    case TOK_SIGNED2:
+    case TOK_SIGNED3:
+    case TOK_REGISTER:
+        return 1;
+    }
+    s = t >= TOK_UIDENT ? sym_find(t) : NULL;
+    return s && (s->type.t & VT_TYPEDEF);
+}
+
+/* return the index of the hidden pointer for array 'v', or -1 */
+static int loop_ptr(LoopInfo *li, int v)
+{
+    char buf[32];
+    int i;
+
+    for (i = 0; i < li->nb_ptrs; i++)
+        if (li->ptr_name[i] == v)
+            return i;
+    if (li->nb_ptrs == LOOP_MAX_PTRS)
+        return -1;
+    snprintf(buf, sizeof(buf), "__loop_ptr%d", loop_ptr_count++);
+    li->ptr_name[i] = v;
+    li->ptr_tok[i] = tok_alloc(buf, strlen(buf))->tok;
+    li->ptr_uses[i] = 0;
+    li->nb_ptrs++;
+    return i;
+}
+
+/* add the current body token to the rewritten body */
+static void loop_body_tok(LoopInfo *li)
+{
+    int t = tok, i;
+
+    if (li->v && li->prev_tok == li->v &&
+        (t == '=' || t == TOK_INC || t == TOK_DEC ||
+         (t >= TOK_A_MOD && t <= TOK_A_DIV) || t == TOK_A_XOR ||
+         t == TOK_A_OR || t == TOK_A_SHL || t == TOK_A_SAR))
+        li->v_modified = 1;
+
+    if (t == TOK_GOTO)
+        li->has_goto = 1;
+    else if (t == TOK_BREAK)
+        li->has_break = 1;
+    else if (t == TOK_RETURN)
+        li->has_return = 1;
+    else if (t == li->v) {
+        li->v_uses++;
+        if (li->prev_tok == TOK_INC || li->prev_tok == TOK_DEC)
+            li->v_modified = 1;
+        if (li->prev_tok == '&')
+            li->v_addr = 1;
+    } else if (t >= TOK_UIDENT) {
+        li->idents = tcc_realloc(li->idents, (li->nb_idents + 1) * sizeof(int));
+        li->idents[li->nb_idents++] = t;
+    }
+
+    /* rewrite 'a [ i ]' as '( * p )' */
+ redo:
+    switch (li->nb_pending) {
+    case 0:
+        if (li->v && t >= TOK_UIDENT && t != li->v &&
+            li->prev_tok != '.' && li->prev_tok != TOK_ARROW)
+            goto pend;
+        tok_str_add_tok(&li->body);
+        goto done;
+    case 1:
+        if (t == '[')
+            goto pend;
+        break;
+    case 2:
+        if (t == li->v)
+            goto pend;
+        break;
+    case 3:
+        if (t == ']') {
+            i = loop_ptr(li, li->pending[0]);
+            if (i < 0)
+                break;
+            tok_str_add(&li->body, '(');
+            tok_str_add(&li->body, '*');
+            tok_str_add(&li->body, li->ptr_tok[i]);
+            tok_str_add(&li->body, ')');
+            li->ptr_uses[i]++;
+            li->v_indexed++;
+            li->nb_pending = 0;
+            goto done;
+        }
+        break;
+    }
+    /* no match: flush the pending tokens (identifiers or '[') */
+    for (i = 0; i < li->nb_pending; i++)
+        tok_str_add(&li->body, li->pending[i]);
+    li->nb_pending = 0;
+    goto redo;
+ pend:
+    li->pending[li->nb_pending++] = t;
+ done:
+    li->prev_tok = t;
+}
+
+/* record the current token and read the next one */
+static void loop_tok(LoopInfo *li)
+{
+    int *n;
+
+    if (tok == TOK_EOF)
+        tcc_error("unexpected end of file");
+    if (li->part == 0) {
+        tok_str_add_tok(&li->init);
+        if (tok == '=' || tok == ',' || tok == '(')
+            li->init_ops++;
+        li->init_toks++;
+        if (is_int_type_tok(tok))
+            li->init_types++;
+        n = &li->nb_toks[0];
+        if (*n == 3) {
+            memmove(li->toks[0], li->toks[0] + 1, 2 * sizeof(int));
+            memmove(li->vals[0], li->vals[0] + 1, 2 * sizeof(int));
+            --*n;
+        }
+    } else {
+        tok_str_add_tok(&li->rest);
+        if (li->part == 3) {
+            loop_body_tok(li);
+            next();
+            return;
+        }
+        n = &li->nb_toks[li->part];
+    }
+    if (*n < 4) {
+        li->toks[li->part][*n] = tok;
+        li->vals[li->part][*n] = tokc.i;
+    }
+    ++*n;
+    next();
+}
+
+/* record a parenthesized expression */
+static void loop_parens(LoopInfo *li)
+{
+    int level = 0;
+
+    if (tok != '(')
+        return;
+    do {
+        if (tok == '(')
+            level++;
+        else if (tok == ')')
+            level--;
+        loop_tok(li);
+    } while (level > 0);
+}
+
+/* record a statement */
+static void loop_stmt(LoopInfo *li)
+{
+    int level, t;
+
+    switch (tok) {
+    case '{':
+        level = 0;
+        do {
+            if (tok == '{')
+                level++;
+            else if (tok == '}')
+                level--;
+            loop_tok(li);
+        } while (level > 0);
+        return;
+    case TOK_IF:
+        loop_tok(li);
+        loop_parens(li);
+        loop_stmt(li);
+        if (tok == TOK_ELSE) {
+            loop_tok(li);
+            loop_stmt(li);
+        }
+        return;
+    case TOK_WHILE:
+    case TOK_FOR:
+    case TOK_SWITCH:
+        loop_tok(li);
+        loop_parens(li);
+        loop_stmt(li);
+        return;
+    case TOK_DO:
+        loop_tok(li);
+        loop_stmt(li);
+        break;
+    case TOK_CASE:
+    case TOK_DEFAULT:
+        while (tok != ':')
+            loop_tok(li);
+        loop_tok(li);
+        loop_stmt(li);
+        return;
+    default:
+        if (tok >= TOK_UIDENT) {
+            loop_tok(li);
+            if (tok == ':') {
+                /* label */
+                loop_tok(li);
+                loop_stmt(li);
+                return;
+            }
+        }
+        break;
+    }
+    /* expression, declaration, jump or end of 'do' statement */
+    level = 0;
+    for (;;) {
+        t = tok;
+        if (t == '}' && level == 0)
+            return;
+        if (t == '(' || t == '[' || t == '{')
+            level++;
+        else if (t == ')' || t == ']' || t == '}')
+            level--;
+        loop_tok(li);
+        if (t == ';' && level == 0)
+            return;
+    }
+}
+
+/* record the 'for' statement following '(' and start parsing the
+   recorded initialization */
+static void loop_record(LoopInfo *li)
+{
+    int i, level;
+
+    memset(li, 0, sizeof *li);
+    if (nocode_wanted)
+        return;
+    li->recorded = 1;
+    li->nested = loop_bound != NULL;
+    tok_str_new(&li->init);
+    tok_str_new(&li->rest);
+    tok_str_new(&li->body);
+    for (li->part = 0; li->part < 3; li->part++) {
+        /* 'init ;', 'cond ;' and 'step )' */
+        level = 0;
+        while (level || tok != (li->part == 2 ? ')' : ';')) {
+            if (tok == '(')
+                level++;
+            else if (tok == ')')
+                level--;
+            loop_tok(li);
+        }
+        tok_str_add_tok(li->part ? &li->rest : &li->init);
+        next();
+    }
+    if (li->nb_toks[1] >= 1 && li->toks[1][0] >= TOK_UIDENT)
+        li->v = li->toks[1][0];
+    loop_stmt(li);
+    for (i = 0; i < li->nb_pending; i++)
+        tok_str_add(&li->body, li->pending[i]);
+    tok_str_add(&li->init, -1);
+    tok_str_add(&li->init, 0);
+    tok_str_add(&li->rest, -1);
+    tok_str_add(&li->rest, 0);
+    tok_str_add(&li->body, -1);
+    tok_str_add(&li->body, 0);
+    save_parse_state(&li->saved_parse_state);
+    macro_ptr = li->init.str;
+    next();
+}
+
+/* called after the initialization is parsed: if the loop is counted,
+   generate it and return 1. Otherwise continue with the recorded
+   condition and return 0 */
+static int loop_counted(LoopInfo *li, int *case_sym, int *def_sym, int case_reg)
+{
+    int v, c0, c1, n, up, op, bt, min, max, exit_val, addr, size, align;
+    int i, j, k, a, b, d;
+    TokenString str;
+    CType ctype;
+    Sym *sym, *s;
+
+    if (!li->recorded)
+        return 0;
+    v = li->v;
+    /* 'v = C0', or a declaration 'type v = C0', 'v op C1' and 'v++',
+       'v--', 'v += 1' or 'v -= 1' */
+    if (!v || li->nb_toks[0] != 3 || li->init_ops != 1 ||
+        li->init_toks != 3 + li->init_types ||
+        li->toks[0][0] != v || li->toks[0][1] != '=' ||
+        !is_cint(li->toks[0][2]) ||
+        li->nb_toks[1] != 3 || !is_cint(li->toks[1][2]))
+        goto generic;
+    c0 = li->vals[0][2];
+    c1 = li->vals[1][2];
+    op = li->toks[1][1];
+    if (li->nb_toks[2] == 2 && li->toks[2][0] == v &&
+        (li->toks[2][1] == TOK_INC || li->toks[2][1] == TOK_DEC)) {
+        up = li->toks[2][1] == TOK_INC;
+    } else if (li->nb_toks[2] == 2 && li->toks[2][1] == v &&
+        (li->toks[2][0] == TOK_INC || li->toks[2][0] == TOK_DEC)) {
+        up = li->toks[2][0] == TOK_INC;
+    } else if (li->nb_toks[2] == 3 && li->toks[2][0] == v &&
+               (li->toks[2][1] == TOK_A_ADD || li->toks[2][1] == TOK_A_SUB) &&
+               is_cint(li->toks[2][2]) && li->vals[2][2] == 1) {
+        up = li->toks[2][1] == TOK_A_ADD;
+    } else
+        goto generic;
+    if (up && (op == TOK_LT || op == TOK_NE))
+        n = c1 - c0;
+    else if (up && op == TOK_LE)
+        n = c1 - c0 + 1;
+    else if (!up && (op == TOK_GT || op == TOK_NE))
+        n = c0 - c1;
+    else if (!up && op == TOK_GE)
+        n = c0 - c1 + 1;
+    else
+        goto generic;
+    if (n <= 0 || n > 0xffff)
+        goto generic;
+    exit_val = up ? c0 + n : c0 - n;
+
+    /* 'v' must be a local integer holding all its values, which only
+       the loop can change: a pointer to it could assign it anywhere */
+    sym = sym_find(v);
+    if (!sym || (sym->r & VT_VALMASK) != VT_LOCAL ||
+        !(sym->r & VT_LVAL) || (sym->type.t & VT_VOLATILE) || li->v_addr)
+        goto generic;
+    for (j = 0; j < nb_addr_taken; j++)
+        if (addr_taken[j] == sym->c)
+            goto generic;
+    bt = sym->type.t & VT_BTYPE;
+    if (bt != VT_BYTE && bt != VT_SHORT && bt != VT_INT)
+        goto generic;
+    size = type_size(&sym->type, &align);
+    max = size == 1 ? 0xff : 0xffff;
+    min = 0;
+    if (!(sym->type.t & VT_UNSIGNED)) {
+        max >>= 1;
+        min = -max - 1;
+    }
+    if (c0 < min || c0 > max || c1 < min || c1 > max ||
+        exit_val < min || exit_val > max)
+        goto generic;
+
+    /* the body may only use 'v' as an array index when counting up.
+       Otherwise the loop stays generic, with a known trip count if the
+       body does not assign 'v' */
+    if (li->has_goto || li->v_uses != li->v_indexed ||
+        (li->v_indexed && !up))
+        goto trip;
+    for (i = 0; i < li->nb_ptrs; i++) {
+        k = 0;
+        for (j = 0; j < li->nb_idents; j++)
+            if (li->idents[j] == li->ptr_name[i])
+                k++;
+        if (k != li->ptr_uses[i])
+            goto trip;
+        /* '&a[C0]' is computed once: 'a' must be an array, or a local
+           pointer which the body cannot change through its address. In
+           an enclosing loop, '&a' could follow */
+        s = sym_find(li->ptr_name[i]);
+        if (!s)
+            goto trip;
+        if (!(s->type.t & VT_ARRAY)) {
+            if ((s->type.t & (VT_BTYPE | VT_VOLATILE)) != VT_PTR ||
+                (s->r & (VT_VALMASK | VT_LVAL)) != (VT_LOCAL | VT_LVAL) ||
+                li->nested)
+                goto trip;
+            for (j = 0; j < nb_addr_taken; j++)
+                if (addr_taken[j] == s->c)
+                    goto trip;
+        }
+    }
+
+    /* hidden counter */
+    ctype.t = n > 0xff ? VT_INT | VT_UNSIGNED : VT_BYTE | VT_UNSIGNED;
+    size = type_size(&ctype, &align);
+    loc = (loc - size) & -align;
+    addr = loc;
+    vset(&ctype, VT_LOCAL | VT_LVAL, addr);
+    vpushi(n);
+    vstore();
+    vpop();
+
+    /* hidden pointers: '__typeof__(&a[0]) p = &a[C0];' */
+    if (li->nb_ptrs) {
+        tok_str_new(&str);
+        for (i = 0; i < li->nb_ptrs; i++) {
+            tok_str_add(&str, TOK_TYPEOF3);
+            tok_str_add(&str, '(');
+            tok_str_add(&str, '&');
+            tok_str_add(&str, li->ptr_name[i]);
+            tok_str_add(&str, '[');
+            tok = TOK_CINT;
+            tokc.i = 0;
+            tok_str_add_tok(&str);
+            tok_str_add(&str, ']');
+            tok_str_add(&str, ')');
+            tok_str_add(&str, li->ptr_tok[i]);
+            tok_str_add(&str, '=');
+            tok_str_add(&str, '&');
+            tok_str_add(&str, li->ptr_name[i]);
+            tok_str_add(&str, '[');
+            tokc.i = c0;
+            tok_str_add_tok(&str);
+            tok_str_add(&str, ']');
+            tok_str_add(&str, ';');
+        }
+        tok_str_add(&str, -1);
+        tok_str_add(&str, 0);
+        macro_ptr = str.str;
+        next();
+        decl0(VT_LOCAL, 0);
+        tok_str_free(str.str);
+    }
+
+    macro_ptr = li->body.str;
+    next();
+    a = 0;
+    b = 0;
+    d = ind;
+    block(&a, &b, case_sym, def_sym, case_reg, 0);
+    gsym(b);
+    if (a || li->has_return)
+        gloop_bound(d, 0, n - 1);
+    else
+        gloop_bound(d, n - 1, n - 1);
+
+    /* 'p0++, p1++' */
+    if (li->nb_ptrs) {
+        tok_str_new(&str);
+        for (i = 0; i < li->nb_ptrs; i++) {
+            if (i)
+                tok_str_add(&str, ',');
+            tok_str_add(&str, li->ptr_tok[i]);
+            tok_str_add(&str, TOK_INC);
+        }
+        tok_str_add(&str, -1);
+        tok_str_add(&str, 0);
+        macro_ptr = str.str;
+        next();
+        gexpr();
+        vpop();
+        tok_str_free(str.str);
+    }
+
+    vset(&ctype, VT_LOCAL | VT_LVAL, addr);
+    gdecjnz(d);
+    gsym(a);
+
+    /* give 'v' its exit value, which depends on the counter if the
+       loop can be left by 'break' */
+    vset(&sym->type, sym->r, sym->c);
+    vpushi(exit_val);
+    vtop->type.t = sym->type.t & (VT_BTYPE | VT_UNSIGNED);
+    if (li->has_break) {
+        vset(&ctype, VT_LOCAL | VT_LVAL, addr);
+        gen_op(up ? '-' : '+');
+    }
+    vstore();
+    vpop();
+    return 1;
+ trip:
+    if (!li->v_modified)
+        li->trip = n;
+ generic:
+    macro_ptr = li->rest.str;
+    next();
+    return 0;
+}
+
+/* go back to the tokens following the loop */
+static void loop_end(LoopInfo *li)
+{
+    if (!li->recorded)
+        return;
+    tok_str_free(li->init.str);
+    tok_str_free(li->rest.str);
+    tok_str_free(li->body.str);
+    tcc_free(li->idents);
+    restore_parse_state(&li->saved_parse_state);
+}
+#endif
+
 static void block(int *bsym, int *csym, int *case_sym, int *def_sym, 
                   int case_reg, int is_expr)
 {
@@ -4583,23 +6099,52 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
     }
 
     if (tok == TOK_IF) {
+        int expect, cold_calls;
         /* if test */
         next();
         skip('(');
+        expect = tok;
+        expect_value = -1;
         gexpr();
         skip(')');
+        /* 1 if likely, 0 if unlikely, -1 if unknown */
+        expect = expect == TOK_builtin_expect ? expect_value : -1;
         a = gtst(1, 0);
+        b = ind;
+        cold_calls = nb_cold_calls;
         block(bsym, csym, case_sym, def_sym, case_reg, 0);
+        /* a branch calling a cold function is unlikely */
+        if (expect < 0 && nb_cold_calls > cold_calls)
+            expect = 0;
         c = tok;
         if (c == TOK_ELSE) {
             next();
             d = gjmp(0);
             gsym(a);
+#ifdef TCC_TARGET_AVR
+            if (expect == 0)
+                gcold(b, ind);
+#endif
+            b = ind;
+            cold_calls = nb_cold_calls;
             block(bsym, csym, case_sym, def_sym, case_reg, 0);
             gsym(d); /* patch else jmp */
-        } else
+#ifdef TCC_TARGET_AVR
+            if (expect == 1 || (expect < 0 && nb_cold_calls > cold_calls))
+                gcold(b, ind);
+#endif
+        } else {
             gsym(a);
+#ifdef TCC_TARGET_AVR
+            if (expect == 0)
+                gcold(b, ind);
+#endif
+        }
     } else if (tok == TOK_WHILE) {
+#ifdef TCC_TARGET_AVR
+        int bound = -1, *outer_bound = loop_bound;
+        loop_bound = &bound;
+#endif
         next();
         d = ind;
         skip('(');
@@ -4611,6 +6156,12 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         gjmp_addr(d);
         gsym(a);
         gsym_addr(b, d);
+#ifdef TCC_TARGET_AVR
+        /* the test is at the top: one jump back per iteration */
+        loop_bound = outer_bound;
+        if (bound >= 0)
+            gloop_bound(d, 0, bound);
+#endif
     } else if (tok == '{') {
         Sym *llabel;
         
@@ -4714,6 +6265,8 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
                 gv(RC_IRET);
             } else if ((func_vt.t & VT_BTYPE) == VT_LONG) {
                 gv(RC_LRET);
+            } else if (is_fixed(func_vt.t)) {
+                gv(RC_IRET);
             }
 #else
             } else {
@@ -4740,12 +6293,20 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         skip(';');
     } else if (tok == TOK_FOR) {
         int e;
+#ifdef TCC_TARGET_AVR
+        LoopInfo li;
+        int bound = -1, *outer_bound = loop_bound;
+#endif
         next();
         skip('(');
         s = local_stack;
         frame_bottom = sym_push2(&local_stack, SYM_FIELD, 0, 0);
         frame_bottom->next = scope_stack_bottom;
         scope_stack_bottom = frame_bottom;
+#ifdef TCC_TARGET_AVR
+        loop_record(&li);
+        loop_bound = &bound;
+#endif
         if (tok != ';') {
             /* c99 for-loop init decl? */
             if (!decl0(VT_LOCAL, 1)) {
@@ -4755,6 +6316,10 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
             }
         }
         skip(';');
+#ifdef TCC_TARGET_AVR
+        if (loop_counted(&li, case_sym, def_sym, case_reg))
+            goto for_end;
+#endif
         d = ind;
         c = ind;
         a = 0;
@@ -4777,15 +6342,35 @@ static void block(int *bsym, int *csym, int *case_sym, int *def_sym,
         gjmp_addr(c);
         gsym(a);
         gsym_addr(b, c);
+#ifdef TCC_TARGET_AVR
+        if (bound >= 0)
+            gloop_bound(d, 0, bound);
+        else if (li.trip)
+            gloop_bound(d, li.has_break || li.has_goto || li.has_return ?
+                        0 : li.trip, li.trip);
+    for_end:
+        loop_bound = outer_bound;
+        loop_end(&li);
+#endif
         scope_stack_bottom = scope_stack_bottom->next;
         sym_pop(&local_stack, s);
     } else 
     if (tok == TOK_DO) {
+#ifdef TCC_TARGET_AVR
+        int bound = -1, *outer_bound = loop_bound;
+        loop_bound = &bound;
+#endif
         next();
         a = 0;
         b = 0;
         d = ind;
         block(&a, &b, case_sym, def_sym, case_reg, 0);
+#ifdef TCC_TARGET_AVR
+        /* the test is at the bottom: no jump back for the last iteration */
+        loop_bound = outer_bound;
+        if (bound >= 0)
+            gloop_bound(d, 0, bound ? bound - 1 : 0);
+#endif
         skip(TOK_WHILE);
         skip('(');
         gsym(b);
@@ -5122,15 +6707,44 @@ static void init_putv(CType *type, Section *sec, unsigned long c,
         case VT_SHORT:
             *(short *)ptr |= (vtop->c.i & bit_mask) << bit_pos;
             break;
+#ifdef TCC_TARGET_AVR
+        case VT_DOUBLE:
+            /* same as float */
+            *(float *)ptr = vtop->c.d;
+            break;
+        case VT_LDOUBLE:
+            *(float *)ptr = vtop->c.ld;
+            break;
+        case VT_INT:
+        case VT_ENUM:
+        case VT_PTR:
+            /* 16 bits, the functions having word addresses */
+            if (vtop->r & VT_SYM)
+                greloc(sec, vtop->sym, c,
+                       (vtop->sym->type.t & VT_BTYPE) == VT_FUNC ?
+                       R_AVR_16_PM : R_DATA_PTR);
+            *(short *)ptr |= (vtop->c.i & bit_mask) << bit_pos;
+            break;
+#else
         case VT_DOUBLE:
             *(double *)ptr = vtop->c.d;
             break;
         case VT_LDOUBLE:
             *(long double *)ptr = vtop->c.ld;
             break;
+#endif
         case VT_LLONG:
             *(long long *)ptr |= (vtop->c.ll & bit_mask) << bit_pos;
             break;
+#ifdef TCC_TARGET_AVR
+        case VT_FRACT:
+        case VT_ACCUM:
+            if (type->t & VT_FIXSHORT && bt == VT_FRACT)
+                *(char *)ptr = vtop->c.i;
+            else
+                *(short *)ptr = vtop->c.i;
+            break;
+#endif
         default:
             if (vtop->r & VT_SYM) {
                 greloc(sec, vtop->sym, c, R_DATA_PTR);
@@ -5413,6 +7027,78 @@ static void decl_initializer(CType *type, Section *sec, unsigned long c,
     }
 }
 
+/* return the section '.name' of 'sec' for the function or variable
+   'v', with -ffunction-sections and -fdata-sections */
+static Section *sym_section(Section *sec, int v)
+{
+    char buf[256];
+    Section *s;
+    int i;
+
+    snprintf(buf, sizeof(buf), "%s.%s", sec->name, get_tok_str(v, NULL));
+    for(i = 1; i < tcc_state->nb_sections; i++) {
+        s = tcc_state->sections[i];
+        if (!strcmp(buf, s->name))
+            return s;
+    }
+    s = new_section(tcc_state, buf, sec->sh_type, sec->sh_flags);
+    /* the variables give their own alignment */
+    if (!(sec->sh_flags & SHF_EXECINSTR))
+        s->sh_addralign = 1;
+    return s;
+}
+
+/* the section of the code of the function 'sym' without a section
+   attribute: .text.unlikely for a cold function */
+static Section *func_section(Sym *sym)
+{
+    Section *sec = text_section;
+    int i;
+
+    if (FUNC_COLD(sym->type.ref->r)) {
+        sec = NULL;
+        for(i = 1; i < tcc_state->nb_sections; i++)
+            if (!strcmp(tcc_state->sections[i]->name, ".text.unlikely"))
+                sec = tcc_state->sections[i];
+        if (!sec)
+            sec = new_section(tcc_state, ".text.unlikely", SHT_PROGBITS,
+                              SHF_ALLOC | SHF_EXECINSTR);
+    }
+    if (tcc_state->function_sections)
+        sec = sym_section(sec, sym->v);
+    return sec;
+}
+
+/* move the string literal of vtop, just allocated at the end of the data
+   section, to the section of the merged strings. The strings with an
+   inner zero are not moved, as the linkers split the merged strings */
+static void merge_str_literal(void)
+{
+    ElfW(Sym) *esym;
+    unsigned char *str;
+    int len;
+
+    if (!(vtop->r & VT_SYM))
+        return;
+#ifdef CONFIG_TCC_BCHECK
+    /* the bound checked strings are padded */
+    if (tcc_state->do_bounds_check)
+        return;
+#endif
+    esym = &((ElfW(Sym) *)symtab_section->data)[vtop->sym->c];
+    str = data_section->data + esym->st_value;
+    len = esym->st_size;
+    if (esym->st_shndx != data_section->sh_num ||
+        esym->st_value + len != data_section->data_offset ||
+        memchr(str, 0, len) != str + len - 1)
+        return;
+    esym->st_value = put_merge_str(merge_str_section(tcc_state), str, len);
+    esym->st_shndx = merge_str_section(tcc_state)->sh_num;
+    /* the data are expected to be zero before their initialization */
+    memset(str, 0, len);
+    data_section->data_offset -= len;
+}
+
 /* parse an initializer for type 't' if 'has_init' is non zero, and
    allocate space in local or global data space ('r' is either
    VT_LOCAL or VT_CONST). If 'v' is non zero, then an associated
@@ -5576,6 +7262,8 @@ static void decl_initializer_alloc(CType *type, AttributeDef *ad, int r,
                 sec = data_section;
             else if (tcc_state->nocommon)
                 sec = bss_section;
+            if (sec && v && v < SYM_FIRST_ANOM && tcc_state->data_sections)
+                sec = sym_section(sec, v);
         }
         if (sec) {
             data_offset = sec->data_offset;
@@ -5723,11 +7411,27 @@ static void func_decl_list(Sym *func_sym)
     }
 }
 
+#ifdef TCC_TARGET_AVR
+/* the N of max_cycles(N) given for the function 'v', 0 if none */
+static int func_max_cycles(int v)
+{
+    int i, n = 0;
+
+    for (i = 0; i < nb_func_budgets; i += 2)
+        if (func_budgets[i] == v)
+            n = func_budgets[i + 1];
+    return n;
+}
+#endif
+
 /* parse a function defined by symbol 'sym' and generate its code in
    'cur_text_section' */
 static void gen_function(Sym *sym)
 {
     int saved_nocode_wanted = nocode_wanted;
+#ifdef TCC_TARGET_AVR
+    int line_num;
+#endif
     nocode_wanted = 0;
     ind = cur_text_section->data_offset;
     /* NOTE: we patch the symbol size later */
@@ -5739,12 +7443,34 @@ static void gen_function(Sym *sym)
         put_func_debug(sym);
     /* push a dummy symbol to enable local sym storage */
     sym_push2(&local_stack, SYM_FIELD, 0, 0);
+    inline_bottom = NULL;
+    inline_depth = 0;
+#ifdef TCC_TARGET_AVR
+    loop_bound = NULL;
+    nb_addr_taken = 0;
+#endif
     gfunc_prolog(&sym->type);
     rsym = 0;
     block(NULL, NULL, NULL, NULL, 0, 0);
     gsym(rsym);
     gfunc_epilog();
+#ifdef TCC_TARGET_AVR
+    if (!tcc_state->do_debug)
+        gen_layout();
+#endif
     cur_text_section->data_offset = ind;
+#ifdef TCC_TARGET_AVR
+    if (tcc_state->stack_usage)
+        gen_stack_usage(sym);
+    /* its diagnostics are reported at the line of the function, not of
+       the token after its body */
+    line_num = file->line_num;
+    file->line_num = func_line;
+    gen_cycles(sym, func_max_cycles(sym->v));
+    file->line_num = line_num;
+    if (func_max_cycles(sym->v))
+        outline_exclude(func_ind, ind);
+#endif
     label_pop(&global_label_stack, NULL);
     /* reset local stack */
     scope_stack_bottom = NULL;
@@ -5791,7 +7517,10 @@ ST_FUNC void gen_inline_functions(void)
 
                 macro_ptr = str;
                 next();
-                cur_text_section = text_section;
+#ifdef TCC_TARGET_AVR
+                func_line = file->line_num;
+#endif
+                cur_text_section = func_section(sym);
                 gen_function(sym);
                 macro_ptr = NULL; /* fail safe */
 
@@ -5807,6 +7536,12 @@ ST_FUNC void gen_inline_functions(void)
         tok_str_free(str);
     }
     dynarray_reset(&tcc_state->inline_fns, &tcc_state->nb_inline_fns);
+#ifdef TCC_TARGET_AVR
+    /* end of the compilation unit */
+    tcc_free(func_budgets);
+    func_budgets = NULL;
+    nb_func_budgets = 0;
+#endif
 }
 
 /* 'l' is VT_LOCAL or VT_CONST to define default storage type */
@@ -5849,6 +7584,10 @@ static int decl0(int l, int is_for_loop_init)
         while (1) { /* iterate thru each declaration */
             char *asm_label; // associated asm label
             type = btype;
+#ifdef TCC_TARGET_AVR
+            if (l == VT_CONST)
+                func_line = file->line_num;
+#endif
             type_decl(&type, &ad, &v, TYPE_DIRECT);
 #if 0
             {
@@ -5882,6 +7621,15 @@ static int decl0(int l, int is_for_loop_init)
 
             if (ad.weak)
                 type.t |= VT_WEAK;
+#ifdef TCC_TARGET_AVR
+            if (ad.max_cycles && (type.t & VT_BTYPE) == VT_FUNC) {
+                /* for the definition, which may follow */
+                func_budgets = tcc_realloc(func_budgets,
+                                           (nb_func_budgets + 2) * sizeof(int));
+                func_budgets[nb_func_budgets++] = v;
+                func_budgets[nb_func_budgets++] = ad.max_cycles;
+            }
+#endif
 #ifdef TCC_TARGET_PE
             if (ad.func_import)
                 type.t |= VT_IMPORT;
@@ -5919,6 +7667,14 @@ static int decl0(int l, int is_for_loop_init)
                     if (FUNC_EXPORT(r))
                         FUNC_EXPORT(type.ref->r) = 1;
 
+                    /* use cold and inlining from prototype */
+                    if (FUNC_COLD(r))
+                        FUNC_COLD(type.ref->r) = 1;
+                    if (FUNC_ALWAYS_INLINE(r))
+                        FUNC_ALWAYS_INLINE(type.ref->r) = 1;
+                    if (FUNC_NOINLINE(r))
+                        FUNC_NOINLINE(type.ref->r) = 1;
+
                     /* use static from prototype */
                     if (sym->type.t & VT_STATIC)
                         type.t = (type.t & ~VT_EXTERN) | VT_STATIC;
@@ -5936,19 +7692,29 @@ static int decl0(int l, int is_for_loop_init)
                     sym->type.ref = type.ref;
                 }
 
+                /* always_inline makes a static function inline */
+                if ((type.t & VT_STATIC) && FUNC_ALWAYS_INLINE(type.ref->r)) {
+                    type.t |= VT_INLINE;
+                    sym->type.t |= VT_INLINE;
+                }
+
                 /* static inline functions are just recorded as a kind
                    of macro. Their code will be emitted at the end of
                    the compilation unit only if they are used */
                 if ((type.t & (VT_INLINE | VT_STATIC)) == 
                     (VT_INLINE | VT_STATIC)) {
                     TokenString func_str;
-                    int block_level;
+                    int block_level, size, prev, n;
+                    unsigned written;
                     struct InlineFunc *fn;
                     const char *filename;
                            
                     tok_str_new(&func_str);
                     
                     block_level = 0;
+                    size = 0;
+                    written = 0;
+                    prev = 0;
                     for(;;) {
                         int t;
                         if (tok == TOK_EOF)
@@ -5956,6 +7722,14 @@ static int decl0(int l, int is_for_loop_init)
                         tok_str_add_tok(&func_str);
                         t = tok;
                         next();
+                        if (inline_forbidden(t, prev, v))
+                            size = -1;
+                        else if (size >= 0)
+                            size++;
+                        n = inline_param(type.ref, t);
+                        if (n >= 0 && inline_modifies(prev, tok))
+                            written |= 1u << n;
+                        prev = t;
                         if (t == '{') {
                             block_level++;
                         } else if (t == '}') {
@@ -5971,13 +7745,15 @@ static int decl0(int l, int is_for_loop_init)
                     strcpy(fn->filename, filename);
                     fn->sym = sym;
                     fn->token_str = func_str.str;
+                    fn->size = size;
+                    fn->written = written;
                     dynarray_add((void ***)&tcc_state->inline_fns, &tcc_state->nb_inline_fns, fn);
 
                 } else {
                     /* compute text section */
                     cur_text_section = ad.section;
                     if (!cur_text_section)
-                        cur_text_section = text_section;
+                        cur_text_section = func_section(sym);
                     sym->r = VT_SYM | VT_CONST;
                     gen_function(sym);
                 }
@@ -6025,6 +7801,13 @@ static int decl0(int l, int is_for_loop_init)
                             tsec.sh_num = esym->st_shndx;
                             put_extern_sym2(sym, &tsec, esym->st_value, esym->st_size, 0);
                         }
+#ifdef TCC_TARGET_AVR
+                    } else if (ad.global_reg && asm_label && l == VT_CONST) {
+                        if (has_init)
+                            tcc_error("global register variable '%s' cannot be initialized",
+                                      get_tok_str(v, NULL));
+                        avr_global_reg(&type, v, asm_label);
+#endif
                     } else {
                         type.t |= (btype.t & VT_STATIC); /* Retain "static". */
                         if (type.t & VT_STATIC)
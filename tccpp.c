@@ -2465,6 +2465,18 @@ maybe_newline:
         }
         break;
         
+#ifdef TCC_TARGET_AVR
+    case ';':
+        if (parse_flags & PARSE_FLAG_ASM_COMMENTS) {
+            /* avr-as line comment */
+            p = parse_line_comment(p);
+            tok = ' ';
+            goto keep_tok_flags;
+        }
+        tok = c;
+        p++;
+        break;
+#endif
         /* simple tokens */
     case '(':
     case ')':
@@ -2473,7 +2485,9 @@ maybe_newline:
     case '{':
     case '}':
     case ',':
+#ifndef TCC_TARGET_AVR
     case ';':
+#endif
     case ':':
     case '?':
     case '~':
@@ -729,4 +729,68 @@ ST_FUNC void *resolve_sym(TCCState *s1, const char *sym)
 
 #endif /* CONFIG_TCC_STATIC */
 #endif /* TCC_IS_NATIVE */
+
+#ifdef TCC_TARGET_AVR
+/* ------------------------------------------------------------- */
+/* -run on the simulator of avr-sim.c */
+
+/* lay out and relocate the sections as in an executable: the read only
+   ones in flash from 0, the writable ones in SRAM and the EEPROM apart.
+   The image stays in the sections, 'ptr' is not used */
+LIBTCCAPI int tcc_relocate(TCCState *s1, void *ptr)
+{
+    Section *s;
+    addr_t addr[2], a;
+    int i, j, k;
+
+    s1->nb_errors = 0;
+    tcc_add_runtime(s1);
+    relocate_common_syms();
+    tcc_add_linker_symbols(s1);
+    if (s1->call_graph_sort)
+        sort_call_graph(s1);
+    if (s1->avr_relax || s1->optimize_size)
+        avr_relax(s1);
+    if (s1->nb_errors)
+        return -1;
+
+    addr[0] = 0;
+    addr[1] = AVR_DATA_VMA + s1->avr_device->ram_start;
+    for(k = 0; k < 2; k++) {
+        for(i = 1; i < s1->nb_sections; i++) {
+            s = s1->sections[i];
+            if (!(s->sh_flags & SHF_ALLOC) || (s->sh_type == SHT_NOBITS) != k)
+                continue;
+            if (!strcmp(s->name, ".eeprom")) {
+                s->sh_addr = AVR_EEPROM_VMA;
+                continue;
+            }
+            j = (s->sh_flags & SHF_WRITE) != 0;
+            a = addr[j];
+            if (s->sh_addralign > 1)
+                a = (a + s->sh_addralign - 1) & ~(addr_t)(s->sh_addralign - 1);
+            s->sh_addr = a;
+            addr[j] = a + s->data_offset;
+        }
+    }
+
+    relocate_syms(s1, 1);
+    if (s1->nb_errors)
+        return -1;
+    for(i = 1; i < s1->nb_sections; i++) {
+        s = s1->sections[i];
+        if (s->reloc)
+            relocate_section(s1, s);
+    }
+    return s1->nb_errors ? -1 : 0;
+}
+
+/* run main() on the simulator, which prints the cycles it took */
+LIBTCCAPI int tcc_run(TCCState *s1, int argc, char **argv)
+{
+    if (tcc_relocate(s1, TCC_RELOCATE_AUTO) < 0)
+        return -1;
+    return avr_sim_run(s1, argc, argv);
+}
+#endif /* TCC_TARGET_AVR */
 /* ------------------------------------------------------------- */
@@ -58,6 +58,11 @@
      DEF(TOK_ASM1, "asm")
      DEF(TOK_ASM2, "__asm")
      DEF(TOK_ASM3, "__asm__")
+#ifdef TCC_TARGET_AVR
+     DEF(TOK_FRACT, "_Fract")
+     DEF(TOK_ACCUM, "_Accum")
+     DEF(TOK_SAT, "_Sat")
+#endif
 
 /*********************************************************************/
 /* the following are not keywords. They are included to ease parsing */
@@ -121,14 +126,37 @@
      DEF(TOK_DLLIMPORT, "dllimport")
      DEF(TOK_NORETURN1, "noreturn")
      DEF(TOK_NORETURN2, "__noreturn__")
+     DEF(TOK_COLD1, "cold")
+     DEF(TOK_COLD2, "__cold__")
+     DEF(TOK_ALWAYS_INLINE1, "always_inline")
+     DEF(TOK_ALWAYS_INLINE2, "__always_inline__")
+     DEF(TOK_NOINLINE1, "noinline")
+     DEF(TOK_NOINLINE2, "__noinline__")
      DEF(TOK_builtin_types_compatible_p, "__builtin_types_compatible_p")
      DEF(TOK_builtin_constant_p, "__builtin_constant_p")
+     DEF(TOK_builtin_expect, "__builtin_expect")
      DEF(TOK_builtin_frame_address, "__builtin_frame_address")
 #ifdef TCC_TARGET_X86_64
      DEF(TOK_builtin_va_arg_types, "__builtin_va_arg_types")
 #endif
      DEF(TOK_REGPARM1, "regparm")
      DEF(TOK_REGPARM2, "__regparm__")
+#ifdef TCC_TARGET_AVR
+     DEF(TOK_MAX_CYCLES1, "max_cycles")
+     DEF(TOK_MAX_CYCLES2, "__max_cycles__")
+     DEF(TOK_builtin_loop_bound, "__builtin_loop_bound")
+     DEF(TOK_builtin_avr_nop, "__builtin_avr_nop")
+     DEF(TOK_builtin_avr_sei, "__builtin_avr_sei")
+     DEF(TOK_builtin_avr_cli, "__builtin_avr_cli")
+     DEF(TOK_builtin_avr_sleep, "__builtin_avr_sleep")
+     DEF(TOK_builtin_avr_wdr, "__builtin_avr_wdr")
+     DEF(TOK_builtin_avr_swap, "__builtin_avr_swap")
+     DEF(TOK_builtin_avr_fmul, "__builtin_avr_fmul")
+     DEF(TOK_builtin_avr_fmuls, "__builtin_avr_fmuls")
+     DEF(TOK_builtin_avr_fmulsu, "__builtin_avr_fmulsu")
+     DEF(TOK_builtin_avr_insert_bits, "__builtin_avr_insert_bits")
+     DEF(TOK_builtin_avr_delay_cycles, "__builtin_avr_delay_cycles")
+#endif
 
 /* pragma */
      DEF(TOK_pack, "pack")
@@ -195,6 +223,20 @@
      DEF(TOK__divd, "_divd")
      DEF(TOK__remi, "_remi")
      DEF(TOK__remu, "_remu")
+     DEF(TOK___addsf3, "__addsf3")
+     DEF(TOK___subsf3, "__subsf3")
+     DEF(TOK___mulsf3, "__mulsf3")
+     DEF(TOK___mulqi3, "__mulqi3")
+     DEF(TOK___mulhi3, "__mulhi3")
+     DEF(TOK___prologue_saves__, "__prologue_saves__")
+     DEF(TOK___epilogue_restores__, "__epilogue_restores__")
+     DEF(TOK___divsf3, "__divsf3")
+     DEF(TOK___cmpsf2, "__cmpsf2")
+     DEF(TOK___gesf2, "__gesf2")
+     DEF(TOK___floathisf, "__floathisf")
+     DEF(TOK___floatunhisf, "__floatunhisf")
+     DEF(TOK___fixsfhi, "__fixsfhi")
+     DEF(TOK___fixunssfhi, "__fixunssfhi")
 #endif
 #ifdef TCC_TARGET_I386
      DEF(TOK___tcc_int_fpu_control, "__tcc_int_fpu_control")
@@ -283,3 +325,6 @@
 #if defined TCC_TARGET_I386 || defined TCC_TARGET_X86_64
 #include "i386-tok.h"
 #endif
+#ifdef TCC_TARGET_AVR
+#include "avr-tok.h"
+#endif
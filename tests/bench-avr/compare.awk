@@ -0,0 +1,42 @@
+# compare the figures of the benchmarks with the baseline: fail when one
+# of them grows by more than 'tol' percent
+
+BEGIN {
+    split("flash data stack cycles", name)
+}
+
+/^#/ { next }
+
+FNR == NR {
+    for (i = 2; i <= 5; i++)
+        base[$1, i] = $i
+    known[$1] = 1
+    next
+}
+
+{
+    line = sprintf("%-8s", $1)
+    for (i = 2; i <= 5; i++) {
+        if (!($1 in known)) {
+            line = line sprintf(" %s %d", name[i - 1], $i)
+            continue
+        }
+        b = base[$1, i]
+        d = b ? ($i - b) * 100 / b : 0
+        line = line sprintf(" %s %d (%+.1f%%)", name[i - 1], $i, d)
+        if ($i > b && d > tol) {
+            regressions++
+            line = line " REGRESSION"
+        }
+    }
+    if (!($1 in known))
+        line = line " (not in the baseline)"
+    print line
+}
+
+END {
+    if (regressions) {
+        printf("%d regressions over the %s%% tolerance\n", regressions, tol)
+        exit 1
+    }
+}
@@ -0,0 +1,79 @@
+/* CRC-8 (poly 0x07), CRC-16/CCITT and CRC-32 bit by bit. There is no
+   32 bits arithmetic yet, CRC-32 works on two 16 bits halves */
+
+int printf(const char *fmt, ...);
+
+unsigned char data[64];
+
+unsigned char crc8(const unsigned char *p, unsigned n)
+{
+    unsigned char crc = 0, i;
+
+    while (n--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++) {
+            if (crc & 0x80)
+                crc = (crc << 1) ^ 0x07;
+            else
+                crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+unsigned crc16(const unsigned char *p, unsigned n)
+{
+    unsigned crc = 0xFFFF;
+    unsigned char i;
+
+    while (n--) {
+        crc ^= *p++ << 8;
+        for (i = 0; i < 8; i++) {
+            if (crc & 0x8000)
+                crc = (crc << 1) ^ 0x1021;
+            else
+                crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+/* reflected CRC-32 (poly 0xEDB88320), the result in hi:lo */
+unsigned crc32_hi;
+
+unsigned crc32(const unsigned char *p, unsigned n)
+{
+    unsigned lo = 0xFFFF, hi = 0xFFFF;
+    unsigned char i;
+
+    while (n--) {
+        lo ^= *p++;
+        for (i = 0; i < 8; i++) {
+            if (lo & 1) {
+                lo = (lo >> 1) | (hi << 15);
+                hi >>= 1;
+                lo ^= 0x8320;
+                hi ^= 0xEDB8;
+            } else {
+                lo = (lo >> 1) | (hi << 15);
+                hi >>= 1;
+            }
+        }
+    }
+    crc32_hi = ~hi;
+    return ~lo;
+}
+
+int main(void)
+{
+    unsigned char i;
+    unsigned c8, c16, c32;
+
+    for (i = 0; i < 64; i++)
+        data[i] = i * 7 + 1;
+    c8 = crc8(data, 64);
+    c16 = crc16(data, 64);
+    c32 = crc32(data, 64);
+    printf("crc8 %02x crc16 %04x crc32 %04x%04x\n", c8, c16, crc32_hi, c32);
+    return 0;
+}
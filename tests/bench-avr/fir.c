@@ -0,0 +1,49 @@
+/* 8 taps FIR low-pass filter on s.15 fixed point samples */
+
+int printf(const char *fmt, ...);
+
+#define NTAPS 8
+#define NSAMPLES 64
+
+const _Fract h[NTAPS] = {
+    0.02, 0.06, 0.12, 0.18, 0.18, 0.12, 0.06, 0.02
+};
+
+_Fract x[NSAMPLES], y[NSAMPLES];
+
+/* the s.15 bits of 'f' */
+int bits(_Fract f)
+{
+    union { _Fract f; int i; } u;
+    u.f = f;
+    return u.i;
+}
+
+void fir(_Fract *out, const _Fract *in, unsigned char n)
+{
+    unsigned char i, k;
+    _Fract acc;
+
+    for (i = NTAPS - 1; i < n; i++) {
+        acc = 0;
+        for (k = 0; k < NTAPS; k++)
+            acc += h[k] * in[i - k];
+        out[i] = acc;
+    }
+}
+
+int main(void)
+{
+    unsigned char i;
+    int sum;
+
+    /* square wave */
+    for (i = 0; i < NSAMPLES; i++)
+        x[i] = i & 8 ? (_Fract)0.5 : (_Fract)-0.5;
+    fir(y, x, NSAMPLES);
+    sum = 0;
+    for (i = NTAPS - 1; i < NSAMPLES; i++)
+        sum += bits(y[i]) >> 4;
+    printf("y[15] %04x y[20] %04x sum %d\n", bits(y[15]), bits(y[20]), sum);
+    return 0;
+}
@@ -0,0 +1,70 @@
+/* state machine decoding a byte stream of frames: 0x7E, length, payload,
+   checksum (the sum of the payload bytes) */
+
+int printf(const char *fmt, ...);
+
+enum { SYNC, LEN, DATA, SUM };
+
+unsigned char stream[256];
+unsigned char state, len, pos, sum;
+unsigned good, bad, payload;
+
+void decode(unsigned char c)
+{
+    switch (state) {
+    case SYNC:
+        if (c == 0x7E)
+            state = LEN;
+        break;
+    case LEN:
+        if (c == 0 || c > 16) {
+            bad++;
+            state = SYNC;
+        } else {
+            len = c;
+            pos = 0;
+            sum = 0;
+            state = DATA;
+        }
+        break;
+    case DATA:
+        sum += c;
+        payload += c;
+        if (++pos == len)
+            state = SUM;
+        break;
+    case SUM:
+        if (c == sum)
+            good++;
+        else
+            bad++;
+        state = SYNC;
+        break;
+    }
+}
+
+int main(void)
+{
+    unsigned i, n;
+    unsigned char k, s;
+
+    /* frames of 1 to 12 bytes, the ones of 5 and 10 bytes corrupted */
+    n = 0;
+    k = 1;
+    while (n < 256 - 16) {
+        stream[n++] = 0x7E;
+        stream[n++] = k;
+        s = 0;
+        for (i = 0; i < k; i++) {
+            stream[n] = n * 13;
+            s += stream[n++];
+        }
+        stream[n++] = k == 5 || k == 10 ? s + 1 : s;
+        if (++k > 12)
+            k = 1;
+    }
+    for (i = 0; i < n; i++)
+        decode(stream[i]);
+    printf("%u good, %u bad, payload %u\n", good, bad, payload);
+    return 0;
+}
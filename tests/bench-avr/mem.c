@@ -0,0 +1,40 @@
+/* byte copy and fill loops, as in a small libc */
+
+int printf(const char *fmt, ...);
+
+unsigned char src[128], dst[128];
+
+void *bench_memcpy(void *d, const void *s, unsigned n)
+{
+    unsigned char *q = d;
+    const unsigned char *p = s;
+
+    while (n--)
+        *q++ = *p++;
+    return d;
+}
+
+void *bench_memset(void *d, unsigned char c, unsigned n)
+{
+    unsigned char *q = d;
+
+    while (n--)
+        *q++ = c;
+    return d;
+}
+
+int main(void)
+{
+    unsigned char i;
+    unsigned sum;
+
+    for (i = 0; i < 128; i++)
+        src[i] = i ^ 0x5A;
+    bench_memcpy(dst, src, 128);
+    bench_memset(dst + 32, 0xA5, 64);
+    sum = 0;
+    for (i = 0; i < 128; i++)
+        sum += dst[i];
+    printf("sum %u\n", sum);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/* minimal formatted output to the UART: %d, %u, %x, %c, %s and %%.
+   Variadic arguments are not on the stack with avr-tcc, they are given
+   in an array, and the decimal conversion subtracts powers of ten */
+
+#define UDR0 (*(volatile unsigned char *)0xC6)
+
+const unsigned pow10[5] = { 10000, 1000, 100, 10, 1 };
+
+void put(char c)
+{
+    UDR0 = c;
+}
+
+void put_udec(unsigned u)
+{
+    unsigned char i, d, started = 0;
+
+    for (i = 0; i < 5; i++) {
+        d = '0';
+        while (u >= pow10[i]) {
+            u -= pow10[i];
+            d++;
+        }
+        if (d != '0' || started || i == 4) {
+            put(d);
+            started = 1;
+        }
+    }
+}
+
+void put_hex(unsigned u)
+{
+    unsigned char i, d;
+
+    for (i = 0; i < 4; i++) {
+        d = u >> 12;
+        put(d < 10 ? '0' + d : 'a' - 10 + d);
+        u <<= 4;
+    }
+}
+
+void print_lite(const char *fmt, const int *args)
+{
+    const char *s;
+    char c;
+
+    while ((c = *fmt++)) {
+        if (c != '%') {
+            put(c);
+            continue;
+        }
+        switch (c = *fmt++) {
+        case 'd':
+            if (*args < 0) {
+                put('-');
+                put_udec(-*args++);
+                break;
+            }
+        case 'u':
+            put_udec(*args++);
+            break;
+        case 'x':
+            put_hex(*args++);
+            break;
+        case 'c':
+            put(*args++);
+            break;
+        case 's':
+            for (s = (const char *)*args++; *s; s++)
+                put(*s);
+            break;
+        default:
+            put(c);
+            break;
+        }
+    }
+}
+
+int args[5];
+
+int main(void)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        args[0] = i * 1237 - 4000;
+        args[1] = i * 9000;
+        args[2] = i * 0x1F3;
+        args[3] = 'a' + i;
+        args[4] = (int)"tcc";
+        print_lite("%d %u 0x%x %c %s 100%%\n", args);
+    }
+    return 0;
+}
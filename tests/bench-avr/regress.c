@@ -0,0 +1,208 @@
+/* code generation regressions: not a benchmark, only its output is
+   checked */
+
+int printf(const char *fmt, ...);
+
+/* counted loops */
+
+int b1[4], b2[4];
+int *buf = b1;
+
+int redirect(void)
+{
+    buf = b2;
+    return 7;
+}
+
+void loop_global_ptr(void)
+{
+    int i, c;
+
+    for (i = 0; i < 4; i++) {
+        c = redirect();
+        buf[i] = c;
+    }
+    printf("loop_global_ptr %d %d %d %d\n", b1[0], b1[1], b2[0], b2[3]);
+}
+
+struct counter { int i; } s;
+
+void loop_member_init(void)
+{
+    int i = 2, n = 0;
+
+    for (s.i = 0; i < 5; i++)
+        n++;
+    printf("loop_member_init %d %d\n", n, i);
+}
+
+int *gp;
+
+void bump(void)
+{
+    *gp = 20;
+}
+
+void loop_addr_taken(void)
+{
+    int i, s = 0, t = 0;
+    int *p = &i;
+
+    for (i = 0; i < 5; i++) {
+        s++;
+        if (s == 2)
+            *p = 3;
+    }
+    gp = &i;
+    for (i = 0; i < 10; i++) {
+        t++;
+        bump();
+    }
+    printf("loop_addr_taken %d %d\n", s, t);
+}
+
+/* conditional expressions */
+
+int leaf(int n)
+{
+    return n * 100 + 7;
+}
+
+int cond_rec(int n)
+{
+    return n ? cond_rec(n - 1) + leaf(n) : 0;
+}
+
+/* leaves 0x24 in r19 */
+int dirty(int a, int b)
+{
+    return a + b;
+}
+
+void cond_bytes(void)
+{
+    int r;
+
+    dirty(0x1234, 0x1234);
+    r = cond_rec(3);
+    printf("cond_bytes %d\n", r);
+}
+
+/* compound assignment through a pointer in registers */
+
+struct sized { char c; int cnt; };
+
+int add_through(int *p)
+{
+    *p += 1;
+    return *p;
+}
+
+int add_local(int x)
+{
+    int *p = &x;
+
+    *p += 1;
+    return x;
+}
+
+int inc_member(struct sized *s)
+{
+    s->cnt++;
+    return s->cnt;
+}
+
+void ptr_update(void)
+{
+    int a = 10;
+    struct sized s;
+
+    s.cnt = 300;
+    printf("ptr_update %d %d", add_through(&a), add_local(1283));
+    printf(" %d\n", inc_member(&s));
+}
+
+/* frame displacements beyond 63 bytes */
+
+int big_frame(int n)
+{
+    char buf[80];
+    int i, s = 0;
+
+    for (i = 0; i < 80; i++)
+        buf[i] = i + n;
+    for (i = 0; i < 80; i++)
+        s += buf[i];
+    return s + n;
+}
+
+/* indirect calls */
+
+int twice_plus(int x)
+{
+    return x * 2 + 1;
+}
+
+int minus3(int x)
+{
+    return x - 3;
+}
+
+int (*gfn)(int) = minus3;
+
+int apply(int (*fn)(int), int v)
+{
+    return fn(v) + fn(v + 1);
+}
+
+void indirect_calls(void)
+{
+    int (*lp)(int) = twice_plus;
+
+    printf("indirect_calls %d %d %d", lp(4), gfn(10), apply(twice_plus, 5));
+    printf(" %d %d\n", minus3(9), (*lp)(0));
+}
+
+/* call-saved registers: the arguments of many() go down to r8 */
+
+int many(int a, int b, int c, int d, int e, int f, int g, int h, int i)
+{
+    return a + b + c + d + e + f + g + h + i;
+}
+
+int pressure(int x)
+{
+    return many(x, x + 1, x + 2, x + 3, x + 4, x + 5, x + 6, x + 7, x + 8);
+}
+
+/* calls pressure(1) with r2 and r17 set, and returns their sum */
+int call_saved(void);
+asm(".globl call_saved\n"
+    "call_saved:\n"
+    "    push r2\n"
+    "    push r17\n"
+    "    ldi r17, 0x5a\n"
+    "    mov r2, r17\n"
+    "    ldi r17, 0xa5\n"
+    "    ldi r24, 1\n"
+    "    ldi r25, 0\n"
+    "    call pressure\n"
+    "    mov r24, r2\n"
+    "    add r24, r17\n"
+    "    clr r25\n"
+    "    pop r17\n"
+    "    pop r2\n"
+    "    ret\n");
+
+int main(void)
+{
+    loop_global_ptr();
+    loop_member_init();
+    loop_addr_taken();
+    cond_bytes();
+    ptr_update();
+    printf("big_frame %d\n", big_frame(3));
+    indirect_calls();
+    printf("call_saved %d %d\n", call_saved(), pressure(1));
+    return 0;
+}
@@ -0,0 +1,54 @@
+/* UART transmit ring buffer: the producer queues bytes and the data
+   register empty interrupt handler, called here as a function, sends
+   them */
+
+int printf(const char *fmt, ...);
+
+#define UDR0 (*(volatile unsigned char *)0xC6)
+#define RING_SIZE 32
+
+unsigned char ring[RING_SIZE];
+volatile unsigned char head, tail;
+
+int ring_put(unsigned char c)
+{
+    unsigned char h = (head + 1) & (RING_SIZE - 1);
+
+    if (h == tail)
+        return 0;
+    ring[head] = c;
+    head = h;
+    return 1;
+}
+
+/* body of the USART_UDRE interrupt handler */
+void uart_udre(void)
+{
+    unsigned char t = tail;
+
+    if (t != head) {
+        UDR0 = ring[t];
+        tail = (t + 1) & (RING_SIZE - 1);
+    }
+}
+
+void uart_puts(const char *s)
+{
+    while (*s) {
+        if (ring_put(*s))
+            s++;
+        else
+            uart_udre();
+    }
+}
+
+int main(void)
+{
+    unsigned char i;
+
+    for (i = 0; i < 4; i++)
+        uart_puts("The quick brown fox jumps over the lazy dog\n");
+    while (tail != head)
+        uart_udre();
+    return 0;
+}
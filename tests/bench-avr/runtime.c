@@ -0,0 +1,67 @@
+/* linked with lib/avr/libtcc1.a: soft-float, and the frame helpers of
+   -mcall-prologues */
+
+int printf(const char *fmt, ...);
+
+float scale(float x, float k)
+{
+    return x * k + 0.5f;
+}
+
+float ratio(int a, int b)
+{
+    return (float)a / b;
+}
+
+int frame(int n)
+{
+    char buf[8];
+    int i, s = 0;
+
+    for (i = 0; i < 8; i++)
+        buf[i] = n + i;
+    for (i = 0; i < 8; i++)
+        s += buf[i];
+    return s;
+}
+
+int many(int a, int b, int c, int d, int e, int f, int g, int h, int i)
+{
+    return a + b + c + d + e + f + g + h + i;
+}
+
+/* enough call-saved registers for the frame helpers */
+int pressure(int x)
+{
+    return many(x, x + 1, x + 2, x + 3, x + 4, x + 5, x + 6, x + 7, x + 8);
+}
+
+/* calls pressure(1) with r8 and r17 set, and returns their sum */
+int call_saved(void);
+asm(".globl call_saved\n"
+    "call_saved:\n"
+    "    push r8\n"
+    "    push r17\n"
+    "    ldi r17, 0x5a\n"
+    "    mov r8, r17\n"
+    "    ldi r17, 0xa5\n"
+    "    ldi r24, 1\n"
+    "    ldi r25, 0\n"
+    "    call pressure\n"
+    "    mov r24, r8\n"
+    "    add r24, r17\n"
+    "    clr r25\n"
+    "    pop r17\n"
+    "    pop r8\n"
+    "    ret\n");
+
+int main(void)
+{
+    float f = scale(3.0f, 2.5f);
+
+    printf("float %d %d %d %d\n", (int)f, (int)(f * 10), (int)(ratio(7, 2) * 4),
+           f > 7.5f);
+    printf("frame %d\n", frame(3));
+    printf("call_saved %d %d\n", call_saved(), pressure(1));
+    return 0;
+}
@@ -0,0 +1,38 @@
+/* insertion sort of 16 bits integers */
+
+int printf(const char *fmt, ...);
+
+int a[48];
+
+void isort(int *p, unsigned char n)
+{
+    unsigned char i, j;
+    int v;
+
+    for (i = 1; i < n; i++) {
+        v = p[i];
+        j = i;
+        while (j > 0 && p[j - 1] > v) {
+            p[j] = p[j - 1];
+            j--;
+        }
+        p[j] = v;
+    }
+}
+
+int main(void)
+{
+    unsigned char i;
+    unsigned x = 12345;
+
+    for (i = 0; i < 48; i++) {
+        x = x * 75 + 74;
+        a[i] = x;
+    }
+    isort(a, 48);
+    for (i = 1; i < 48; i++)
+        if (a[i - 1] > a[i])
+            break;
+    printf("%s %d %d %d\n", i == 48 ? "sorted" : "unsorted", a[0], a[24], a[47]);
+    return 0;
+}
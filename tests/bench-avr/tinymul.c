@@ -0,0 +1,19 @@
+/* multiplications through lib/avr/libtcc1.a on a core without 'mul' */
+
+int printf(const char *fmt, ...);
+
+int mul16(int a, int b)
+{
+    return a * b;
+}
+
+unsigned char mul8(unsigned char a, unsigned char b)
+{
+    return a * b;
+}
+
+int main(void)
+{
+    printf("mul %d %d %d\n", mul16(123, 45), mul16(-7, 300), mul8(13, 11));
+    return 0;
+}